@@ -0,0 +1,295 @@
+#include "SevenZAes.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AES_X86
+#endif
+
+using namespace std;
+
+static inline uint8_t xtime(uint8_t a){
+    return static_cast<uint8_t>((a << 1) ^ (0x1B & -(a >> 7)));
+}
+
+/**
+ * Multiplication in GF(2^8) without branches on the data
+ */
+static inline uint8_t gfMul(uint8_t a, uint8_t b){
+    uint8_t r = 0;
+    for (unsigned i = 0; i < 8; i++){
+	r ^= a & -(b & 1);
+	a = xtime(a);
+	b >>= 1;
+    }
+    return r;
+}
+
+/**
+ * x^254, the inverse of x (0 stays 0)
+ */
+static inline uint8_t gfInv(uint8_t x){
+    uint8_t r = x;
+    for (unsigned i = 0; i < 6; i++)
+	r = gfMul(gfMul(r, r), x);	// x^(2^(i+2) - 1)
+    return gfMul(r, r);
+}
+
+static inline uint8_t rotl8(uint8_t x, unsigned n){
+    return static_cast<uint8_t>((x << n) | (x >> (8 - n)));
+}
+
+static inline uint8_t subByte(uint8_t x){
+    uint8_t b = gfInv(x);
+    return b ^ rotl8(b, 1) ^ rotl8(b, 2) ^ rotl8(b, 3) ^ rotl8(b, 4) ^ 0x63;
+}
+
+static inline uint8_t invSubByte(uint8_t x){
+    return gfInv(rotl8(x, 1) ^ rotl8(x, 3) ^ rotl8(x, 6) ^ 0x05);
+}
+
+static bool genericSupported(){
+    return true;
+}
+
+/**
+ * Encryption schedule as in FIPS-197, the rounds run backwards
+ */
+static void expandGeneric(const uint8_t *keys, size_t count, uint8_t *schedules){
+    for (size_t k = 0; k < count; k++, keys += AES_KEY_SIZE, schedules += AES_SCHEDULE_SIZE){
+	uint8_t *w = schedules;
+	memcpy(w, keys, AES_KEY_SIZE);
+	uint8_t rcon = 1;
+	for (unsigned i = 8; i < 4 * (AES_ROUNDS + 1); i++){
+	    uint8_t t[4];
+	    memcpy(t, w + 4 * (i - 1), 4);
+	    if (i % 8 == 0){
+		uint8_t first = t[0];
+		t[0] = subByte(t[1]) ^ rcon;
+		t[1] = subByte(t[2]);
+		t[2] = subByte(t[3]);
+		t[3] = subByte(first);
+		rcon = xtime(rcon);
+	    } else if (i % 8 == 4){
+		for (unsigned j = 0; j < 4; j++)
+		    t[j] = subByte(t[j]);
+	    }
+	    for (unsigned j = 0; j < 4; j++)
+		w[4 * i + j] = w[4 * (i - 8) + j] ^ t[j];
+	}
+    }
+}
+
+static void invShiftSub(uint8_t *s){
+    uint8_t t[16];
+    for (unsigned c = 0; c < 4; c++)
+	for (unsigned r = 0; r < 4; r++)
+	    t[r + 4 * c] = invSubByte(s[r + 4 * ((c + 4 - r) & 3)]);
+    memcpy(s, t, 16);
+}
+
+static void invMixColumns(uint8_t *s){
+    for (unsigned c = 0; c < 4; c++, s += 4){
+	uint8_t a0 = s[0], a1 = s[1], a2 = s[2], a3 = s[3];
+	s[0] = gfMul(a0, 14) ^ gfMul(a1, 11) ^ gfMul(a2, 13) ^ gfMul(a3, 9);
+	s[1] = gfMul(a0, 9) ^ gfMul(a1, 14) ^ gfMul(a2, 11) ^ gfMul(a3, 13);
+	s[2] = gfMul(a0, 13) ^ gfMul(a1, 9) ^ gfMul(a2, 14) ^ gfMul(a3, 11);
+	s[3] = gfMul(a0, 11) ^ gfMul(a1, 13) ^ gfMul(a2, 9) ^ gfMul(a3, 14);
+    }
+}
+
+static void decryptGeneric(const uint8_t *schedules, size_t count, const uint8_t *iv,
+	const uint8_t *data, size_t blocks, uint8_t *out){
+    for (size_t k = 0; k < count; k++, schedules += AES_SCHEDULE_SIZE){
+	const uint8_t *prev = iv;
+	for (size_t b = 0; b < blocks; b++, out += AES_BLOCK_SIZE){
+	    const uint8_t *c = data + b * AES_BLOCK_SIZE;
+	    uint8_t s[16];
+	    for (unsigned i = 0; i < 16; i++)
+		s[i] = c[i] ^ schedules[AES_ROUNDS * 16 + i];
+	    for (unsigned r = AES_ROUNDS - 1; r > 0; r--){
+		invShiftSub(s);
+		for (unsigned i = 0; i < 16; i++)
+		    s[i] ^= schedules[r * 16 + i];
+		invMixColumns(s);
+	    }
+	    invShiftSub(s);
+	    for (unsigned i = 0; i < 16; i++)
+		out[i] = s[i] ^ schedules[i] ^ prev[i];
+	    prev = c;
+	}
+    }
+}
+
+static void shiftSub(uint8_t *s){
+    uint8_t t[16];
+    for (unsigned c = 0; c < 4; c++)
+	for (unsigned r = 0; r < 4; r++)
+	    t[r + 4 * c] = subByte(s[r + 4 * ((c + r) & 3)]);
+    memcpy(s, t, 16);
+}
+
+static void mixColumns(uint8_t *s){
+    for (unsigned c = 0; c < 4; c++, s += 4){
+	uint8_t a0 = s[0], a1 = s[1], a2 = s[2], a3 = s[3];
+	s[0] = gfMul(a0, 2) ^ gfMul(a1, 3) ^ a2 ^ a3;
+	s[1] = a0 ^ gfMul(a1, 2) ^ gfMul(a2, 3) ^ a3;
+	s[2] = a0 ^ a1 ^ gfMul(a2, 2) ^ gfMul(a3, 3);
+	s[3] = gfMul(a0, 3) ^ a1 ^ a2 ^ gfMul(a3, 2);
+    }
+}
+
+void sevenZAesEncrypt(const uint8_t *key, const uint8_t *iv, uint8_t *data, size_t blocks){
+    uint8_t schedule[AES_SCHEDULE_SIZE];
+    expandGeneric(key, 1, schedule);
+    const uint8_t *prev = iv;
+    for (size_t b = 0; b < blocks; b++, data += AES_BLOCK_SIZE){
+	uint8_t *s = data;
+	for (unsigned i = 0; i < 16; i++)
+	    s[i] ^= prev[i] ^ schedule[i];
+	for (unsigned r = 1; r < AES_ROUNDS; r++){
+	    shiftSub(s);
+	    mixColumns(s);
+	    for (unsigned i = 0; i < 16; i++)
+		s[i] ^= schedule[r * 16 + i];
+	}
+	shiftSub(s);
+	for (unsigned i = 0; i < 16; i++)
+	    s[i] ^= schedule[AES_ROUNDS * 16 + i];
+	prev = s;
+    }
+}
+
+#ifdef AES_X86
+
+static bool aesniSupported(){
+    return __builtin_cpu_supports("aes") && __builtin_cpu_supports("sse2");
+}
+
+__attribute__((target("aes")))
+static inline __m128i expandEven(__m128i key, __m128i assist){
+    assist = _mm_shuffle_epi32(assist, 0xFF);
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, assist);
+}
+
+__attribute__((target("aes")))
+static inline __m128i expandOdd(__m128i key, __m128i even){
+    __m128i assist = _mm_shuffle_epi32(_mm_aeskeygenassist_si128(even, 0), 0xAA);
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, assist);
+}
+
+#define EXPAND_PAIR(i, rcon) \
+    ek[i] = expandEven(ek[i - 2], _mm_aeskeygenassist_si128(ek[i - 1], rcon)); \
+    if (i < AES_ROUNDS) ek[i + 1] = expandOdd(ek[i - 1], ek[i]);
+
+/**
+ * Decryption schedule for aesdec: last round key first, the middle ones
+ * through InvMixColumns
+ */
+__attribute__((target("aes")))
+static void expandAesni(const uint8_t *keys, size_t count, uint8_t *schedules){
+    for (size_t k = 0; k < count; k++, keys += AES_KEY_SIZE, schedules += AES_SCHEDULE_SIZE){
+	__m128i ek[AES_ROUNDS + 1];
+	ek[0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys));
+	ek[1] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + 16));
+	EXPAND_PAIR(2, 0x01)
+	EXPAND_PAIR(4, 0x02)
+	EXPAND_PAIR(6, 0x04)
+	EXPAND_PAIR(8, 0x08)
+	EXPAND_PAIR(10, 0x10)
+	EXPAND_PAIR(12, 0x20)
+	EXPAND_PAIR(14, 0x40)
+	__m128i *dk = reinterpret_cast<__m128i*>(schedules);
+	_mm_storeu_si128(dk, ek[AES_ROUNDS]);
+	for (unsigned r = 1; r < AES_ROUNDS; r++)
+	    _mm_storeu_si128(dk + r, _mm_aesimc_si128(ek[AES_ROUNDS - r]));
+	_mm_storeu_si128(dk + AES_ROUNDS, ek[0]);
+    }
+}
+
+/**
+ * N keys decrypt the same block at once, their rounds are independent
+ */
+template <unsigned N>
+__attribute__((target("aes")))
+static inline void decryptKeys(const uint8_t *schedules, const uint8_t *iv,
+	const uint8_t *data, size_t blocks, uint8_t *out){
+    const __m128i *dk[N];
+    for (unsigned j = 0; j < N; j++)
+	dk[j] = reinterpret_cast<const __m128i*>(schedules + j * AES_SCHEDULE_SIZE);
+    __m128i prev = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iv));
+    for (size_t b = 0; b < blocks; b++){
+	__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + b * AES_BLOCK_SIZE));
+	__m128i x[N];
+	for (unsigned j = 0; j < N; j++)
+	    x[j] = _mm_xor_si128(c, _mm_loadu_si128(dk[j]));
+	for (unsigned r = 1; r < AES_ROUNDS; r++)
+	    for (unsigned j = 0; j < N; j++)
+		x[j] = _mm_aesdec_si128(x[j], _mm_loadu_si128(dk[j] + r));
+	for (unsigned j = 0; j < N; j++){
+	    x[j] = _mm_aesdeclast_si128(x[j], _mm_loadu_si128(dk[j] + AES_ROUNDS));
+	    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + (j * blocks + b) * AES_BLOCK_SIZE),
+		    _mm_xor_si128(x[j], prev));
+	}
+	prev = c;
+    }
+}
+
+#define AESNI_KEYS 8	// aesdec has latency 4 and throughput 1 or 2 per cycle
+
+__attribute__((target("aes")))
+static void decryptAesni(const uint8_t *schedules, size_t count, const uint8_t *iv,
+	const uint8_t *data, size_t blocks, uint8_t *out){
+    size_t k = 0;
+    for (; k + AESNI_KEYS <= count; k += AESNI_KEYS)
+	decryptKeys<AESNI_KEYS>(schedules + k * AES_SCHEDULE_SIZE, iv, data, blocks,
+		out + k * blocks * AES_BLOCK_SIZE);
+    for (; k < count; k++)
+	decryptKeys<1>(schedules + k * AES_SCHEDULE_SIZE, iv, data, blocks,
+		out + k * blocks * AES_BLOCK_SIZE);
+}
+
+#endif
+
+static const SevenZAesKernel Kernels[] = {
+#ifdef AES_X86
+    {"aes-ni", expandAesni, decryptAesni, aesniSupported},
+#endif
+    {"generic", expandGeneric, decryptGeneric, genericSupported}
+};
+
+const SevenZAesKernel* sevenZAesKernels(size_t *count){
+    *count = sizeof(Kernels) / sizeof(Kernels[0]);
+    return Kernels;
+}
+
+const SevenZAesKernel* sevenZBestAesKernel(){
+    size_t count;
+    const SevenZAesKernel *all = sevenZAesKernels(&count);
+    for (size_t i = 0; i < count; i++)
+	if (all[i].supported())
+	    return &all[i];
+    return &all[count - 1];
+}
+
+SevenZAesDecryptor::SevenZAesDecryptor(const SevenZAesKernel *kernel)
+: kernel(kernel != NULL ? kernel : sevenZBestAesKernel()) {}
+
+const SevenZAesKernel* SevenZAesDecryptor::getKernel() const {
+    return kernel;
+}
+
+void SevenZAesDecryptor::decrypt(const uint8_t *keys, size_t count, const uint8_t *iv,
+	const uint8_t *data, size_t blocks, uint8_t *out){
+    if (schedules.size() < count * AES_SCHEDULE_SIZE)
+	schedules.resize(count * AES_SCHEDULE_SIZE);
+    kernel->expand(keys, count, schedules.data());
+    kernel->decrypt(schedules.data(), count, iv, data, blocks, out);
+}
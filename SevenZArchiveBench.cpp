@@ -0,0 +1,297 @@
+#include "SevenZArchiveBench.h"
+#include "SevenZDecoder.h"
+#include "SevenZFormat.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+#define ONE_SHOT_LIMIT (1ull << 30)	// bigger streams are not decoded into one buffer
+
+static ISzAlloc benchAllocator = { SzAlloc, SzFree };
+
+/**
+ * Runs before the measured ones, they fault in the archive and the buffers
+ * @param runs
+ */
+static unsigned warmups(unsigned runs){
+    return runs / 10 + 1;
+}
+
+/**
+ * Sample of the nearest rank, 0.5 is the median and 0.99 the p99
+ * @param sorted, fraction
+ */
+static uint64_t percentile(const vector<uint64_t> &sorted, double fraction){
+    size_t rank = static_cast<size_t>(ceil(fraction * sorted.size()));
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+/**
+ * Sorted times of the runs after the warm-up
+ * @param runs, body
+ */
+static vector<uint64_t> timeRuns(unsigned runs, const function<void()> &body){
+    unsigned warm = warmups(runs);
+    vector<uint64_t> times;
+    for (unsigned i = 0; i < warm + runs; i++){
+	uint64_t start = SevenZPhaseClock::now();
+	body();
+	if (i >= warm)
+	    times.push_back(SevenZPhaseClock::now() - start);
+    }
+    sort(times.begin(), times.end());
+    return times;
+}
+
+struct PhaseTimes {
+    vector<uint64_t> phases[NumPhases];
+    vector<uint64_t> total;
+};
+
+/**
+ * Analysis of the archive as without --bench, the phases come from its stats.
+ * The information is formatted as usual and dropped.
+ * @param path, io, runs, times
+ * @return false when the archive can't be opened
+ */
+static bool timeAnalysis(const string &path, SevenZIOType io, unsigned runs, PhaseTimes &times){
+    SevenZFormat format;
+    format.setIO(io);
+    format.setStats(true);
+    ostringstream text;
+    format.setOutput(text);
+    unsigned warm = warmups(runs);
+    for (unsigned i = 0; i < warm + runs; i++){
+	text.str("");
+	if (!format.open(path.c_str()))
+	    return false;
+	try {
+	    format.process();
+	    format.finish();
+	} catch (const SevenZError &){
+	    format.close();
+	    throw;
+	}
+	if (i < warm)
+	    continue;
+	const SevenZStats &stats = format.getStats();
+	for (int p = 0; p < NumPhases; p++)
+	    times.phases[p].push_back(stats.phaseNs[p]);
+	times.total.push_back(stats.totalNs);
+    }
+    for (int p = 0; p < NumPhases; p++)
+	sort(times.phases[p].begin(), times.phases[p].end());
+    sort(times.total.begin(), times.total.end());
+    return true;
+}
+
+static void printPhase(ostream &out, const char *name, const vector<uint64_t> &mapped,
+	const vector<uint64_t> &read){
+    char line[128];
+    snprintf(line, sizeof(line), "%-8s %12.3f %10.3f %12.3f %10.3f", name,
+	    percentile(mapped, 0.5) / 1e6, percentile(mapped, 0.99) / 1e6,
+	    percentile(read, 0.5) / 1e6, percentile(read, 0.99) / 1e6);
+    out << line << endl;
+}
+
+/**
+ * LZMA or LZMA2 stream which is read right from a packed stream
+ */
+struct DecodeTarget {
+    string name;
+    string note;	// why it is not decoded, empty when it is
+    const SevenZCoder *coder = NULL;
+    bool lzma2 = false;
+    SevenZSpan packed = { NULL, 0 };
+    uint64_t size = 0;	// unpacked bytes
+};
+
+static bool isLzma(const SevenZCoder &coder){
+    return coder.coderIDSize == 3 && coder.coderID[0] == 0x03 && coder.coderID[1] == 0x01 &&
+	coder.coderID[2] == 0x01;
+}
+
+static bool isLzma2(const SevenZCoder &coder){
+    return coder.coderIDSize == 1 && coder.coderID[0] == 0x21;
+}
+
+/**
+ * Finds the LZMA coder of the folder reading its only packed stream, the
+ * filters after it are left out
+ * @param format, folder, packPos, packSize, target
+ */
+static void findStream(SevenZFormat &format, const SevenZFolder &folder, uint64_t packPos,
+	uint64_t packSize, DecodeTarget &target){
+    if (folder.getNumPackStreams() != 1){
+	target.note = "more packed streams";
+	return;
+    }
+    for (uint64_t c = 0; c < folder.numCoders; c++){
+	if (folder.coder[c].isAes()){
+	    target.note = "encrypted";
+	    return;
+	}
+	if (folder.coder[c].numInStreams != 1 || folder.coder[c].numOutStreams != 1){
+	    target.note = "coders with more streams";
+	    return;
+	}
+    }
+    uint64_t numBinds = folder.numOutStreamsTotal - 1;
+    for (uint64_t c = 0; c < folder.numCoders; c++){
+	const SevenZCoder &coder = folder.coder[c];
+	if (!isLzma(coder) && !isLzma2(coder))
+	    continue;
+	// with simple coders, in stream c belongs to coder c; the packed one is not bound
+	if (find(folder.bindIn, folder.bindIn + numBinds, c) != folder.bindIn + numBinds)
+	    continue;
+	if (coder.propertySize < (isLzma2(coder) ? 1u : 5u)){
+	    target.note = "damaged properties";
+	    return;
+	}
+	target.coder = &coder;
+	target.lzma2 = isLzma2(coder);
+	target.packed = format.readPacked(packPos, packSize);
+	target.size = folder.unPackSize[c];
+	return;
+    }
+    target.note = "not LZMA or LZMA2";
+}
+
+static void printDecode(ostream &out, const DecodeTarget &target, const string &decoder,
+	const vector<uint64_t> &times){
+    char line[160];
+    uint64_t median = percentile(times, 0.5);
+    snprintf(line, sizeof(line), "%-8s %-6s %-22s %10.3f %10.3f %10.1f", target.name.c_str(),
+	    target.lzma2 ? "LZMA2" : "LZMA", decoder.c_str(), median / 1e6,
+	    percentile(times, 0.99) / 1e6, median > 0 ? target.size * 1e3 / median : 0.0);
+    out << line << endl;
+}
+
+static void printNote(ostream &out, const DecodeTarget &target, const string &decoder,
+	const string &note){
+    char line[160];
+    snprintf(line, sizeof(line), "%-8s %-6s %-22s %s", target.name.c_str(),
+	    target.coder == NULL ? "-" : target.lzma2 ? "LZMA2" : "LZMA", decoder.c_str(), note.c_str());
+    out << line << endl;
+}
+
+/**
+ * Decodes the stream by every decoder which can read it, the output is dropped
+ * @param out, target, runs, threads
+ */
+static void benchDecode(ostream &out, const DecodeTarget &target, unsigned runs, unsigned threads){
+    if (target.coder == NULL){
+	printNote(out, target, "-", target.note);
+	return;
+    }
+    // segments of the dictionary, as the header parser and -t read them
+    vector<uint64_t> times = timeRuns(runs, [&](){
+	SevenZLzmaSource source(target.packed, target.coder->property, target.coder->propertySize,
+		target.size, &benchAllocator, target.lzma2);
+	uint64_t left = target.size;
+	while (left > 0){
+	    SevenZSpan span = source.view(left);
+	    if (span.size == 0)
+		throw SevenZError(156, "Unpacked data are shorter than the header says.");
+	    left -= span.size;
+	}
+    });
+    printDecode(out, target, "SevenZLzmaSource", times);
+
+    const char *oneShot = target.lzma2 ? "SevenZLzma2Decoder/1" : "LzmaDecode";
+    if (target.size > ONE_SHOT_LIMIT || target.size > SIZE_MAX){
+	printNote(out, target, oneShot, "too big for one buffer");
+	return;
+    }
+    vector<uint8_t> dest(target.size);
+    if (!target.lzma2){
+	times = timeRuns(runs, [&](){
+	    SizeT destLen = target.size, srcLen = target.packed.size;
+	    ELzmaStatus status;
+	    SRes res = LzmaDecode(dest.data(), &destLen, target.packed.data, &srcLen,
+		    target.coder->property, target.coder->propertySize, LZMA_FINISH_ANY, &status,
+		    &benchAllocator);
+	    if (res != SZ_OK || destLen != target.size)
+		throw SevenZError(156, "Something went wrong with decompression! LZMA data error.");
+	});
+	printDecode(out, target, oneShot, times);
+	return;
+    }
+    SevenZLzma2Decoder lzma2(target.packed, target.coder->property[0]);
+    if (lzma2.size() != target.size)
+	throw SevenZError(156, "Something went wrong with decompression! LZMA2 chunks do not match the unpacked size.");
+    times = timeRuns(runs, [&](){
+	lzma2.decode(dest.data(), 1);
+    });
+    printDecode(out, target, oneShot, times);
+    string parallel = "SevenZLzma2Decoder/" + to_string(threads);
+    if (threads <= 1)
+	return;
+    if (lzma2.runs() <= 1){
+	printNote(out, target, parallel, "one run, nothing to decode in parallel");
+	return;
+    }
+    times = timeRuns(runs, [&](){
+	lzma2.decode(dest.data(), threads);
+    });
+    printDecode(out, target, parallel, times);
+}
+
+bool sevenZArchiveBenchmark(ostream &out, const string &path, unsigned runs, unsigned threads){
+    PhaseTimes mapped, read;
+    if (!timeAnalysis(path, MappedIO, runs, mapped) || !timeAnalysis(path, PreadIO, runs, read))
+	return false;
+
+    out << path << ": " << runs << " runs after " << warmups(runs) << " warm-up runs" << endl;
+    out << endl << "Analysis (ms)" << endl;
+    char line[128];
+    snprintf(line, sizeof(line), "%-8s %12s %10s %12s %10s", "phase", "mmap median", "mmap p99",
+	    "pread median", "pread p99");
+    out << line << endl;
+    for (int p = 0; p < NumPhases; p++)
+	if (mapped.phases[p].back() > 0 || read.phases[p].back() > 0)
+	    printPhase(out, SevenZStats::phaseName(static_cast<SevenZPhase>(p)), mapped.phases[p],
+		    read.phases[p]);
+    printPhase(out, "total", mapped.total, read.total);
+
+    SevenZFormat format;
+    ostream discard(NULL);
+    format.setOutput(discard);
+    if (!format.open(path.c_str()))
+	return false;
+    try {
+	format.process();
+	const SevenZInitData &data = format.getData();
+	DecodeTarget header, folder;
+	header.name = "header";
+	if (data.hdrFolder != NULL)
+	    findStream(format, *data.hdrFolder, data.hdrPackPos, data.hdrPackSize, header);
+	else
+	    header.note = "not encoded";
+	folder.name = "folder 0";
+	if (data.hdrFolder != NULL && data.folders == data.hdrFolder)
+	    folder.note = "header is not decoded";
+	else if (data.numFolders == 0 || data.packInfo == NULL || data.packInfo->numPackStreams == 0)
+	    folder.note = "no folders";
+	else
+	    findStream(format, data.folders[0], data.packInfo->packPos, data.packInfo->packSize[0], folder);
+
+	out << endl << "Decoding, output dropped" << endl;
+	snprintf(line, sizeof(line), "%-8s %-6s %-22s %10s %10s %10s", "stream", "method", "decoder",
+		"median ms", "p99 ms", "MB/s");
+	out << line << endl;
+	benchDecode(out, header, runs, threads);
+	benchDecode(out, folder, runs, threads);
+    } catch (const SevenZError &){
+	format.close();
+	throw;
+    }
+    format.close();
+    return true;
+}
@@ -0,0 +1,117 @@
+#include "SevenZArena.h"
+
+#include <cstdlib>
+
+#define ARENA_ALIGN 16
+#define ALIGN_UP(x) (((x) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+// header of every block, data start right after it
+static const size_t blockHdr = ALIGN_UP(sizeof(void*) + 2 * sizeof(size_t));
+
+SevenZArena::SevenZArena(size_t blockSize): head(NULL), large(NULL), spare(NULL),
+    blockSize(blockSize), total(0), count(0){
+    lzma.funcs.Alloc = lzmaAllocFnc;
+    lzma.funcs.Free = lzmaFreeFnc;
+    lzma.arena = this;
+}
+
+SevenZArena::~SevenZArena(){
+    Block *lists[3] = { head, large, spare };
+    for (int i = 0; i < 3; i++)
+	while (lists[i] != NULL){
+	    Block *next = lists[i]->next;
+	    free(lists[i]);
+	    lists[i] = next;
+	}
+}
+
+SevenZArena::Block* SevenZArena::newBlock(size_t size){
+    if (size > SIZE_MAX - blockHdr)
+	throw std::bad_alloc();
+    Block *block = static_cast<Block*>(malloc(blockHdr + size));
+    if (block == NULL)
+	throw std::bad_alloc();
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    total += blockHdr + size;
+    return block;
+}
+
+void* SevenZArena::alloc(size_t size){
+    if (size > SIZE_MAX - ARENA_ALIGN)
+	throw std::bad_alloc();
+    size = ALIGN_UP(size);
+    count++;
+
+    if (size > blockSize / 4){
+	// big arrays (LZMA dictionary, huge headers) get their own block
+	Block *block = newBlock(size);
+	block->next = large;
+	large = block;
+	return reinterpret_cast<uint8_t*>(block) + blockHdr;
+    }
+    if (head == NULL || head->size - head->used < size){
+	Block *block = spare;
+	if (block != NULL)
+	    spare = block->next;
+	else
+	    block = newBlock(blockSize);
+	block->next = head;
+	head = block;
+    }
+    void *ptr = reinterpret_cast<uint8_t*>(head) + blockHdr + head->used;
+    head->used += size;
+    return ptr;
+}
+
+void SevenZArena::reset(){
+    while (large != NULL){
+	Block *next = large->next;
+	total -= blockHdr + large->size;
+	free(large);
+	large = next;
+    }
+    // keep standard blocks for the next archive, but not too many of them
+    size_t kept = 0;
+    for (Block *b = spare; b != NULL; b = b->next)
+	kept += blockHdr + b->size;
+    while (head != NULL){
+	Block *next = head->next;
+	if (kept + blockHdr + head->size <= RetainMax){
+	    head->used = 0;
+	    head->next = spare;
+	    spare = head;
+	    kept += blockHdr + head->size;
+	} else {
+	    total -= blockHdr + head->size;
+	    free(head);
+	}
+	head = next;
+    }
+}
+
+ISzAlloc* SevenZArena::lzmaAlloc(){
+    return &lzma.funcs;
+}
+
+size_t SevenZArena::allocated() const {
+    return total;
+}
+
+uint64_t SevenZArena::allocations() const {
+    return count;
+}
+
+void* SevenZArena::lzmaAllocFnc(void *p, size_t size){
+    try {
+	return reinterpret_cast<LzmaAlloc*>(p)->arena->alloc(size);
+    } catch (const std::bad_alloc&){
+	return NULL;	// LZMA reports SZ_ERROR_MEM
+    }
+}
+
+void SevenZArena::lzmaFreeFnc(void *p, void *address){
+    (void)p;
+    (void)address;	// released with the whole arena
+}
@@ -0,0 +1,249 @@
+#include "SevenZBatch.h"
+#include "SevenZFormat.h"
+#include "SevenZTester.h"
+#include "SevenZTrace.h"
+
+#include <thread>
+#include <cstring>
+#include <strings.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+static bool is7zName(const char *name){
+    size_t len = strlen(name);
+    return len > 3 && strcasecmp(name + len - 3, ".7z") == 0;
+}
+
+SevenZBatch::SevenZBatch(): next(0), failed(0), ioType(MappedIO),
+    hashOutput(false), truncate(0), verifyCrc(false),
+    testMode(false), stopOnError(false), stopped(false), testThreads(1), cracker(NULL),
+    statsEnabled(false), perfEnabled(false), wallNs(0), runThreads(0){
+}
+
+void SevenZBatch::setIO(SevenZIOType type){
+    ioType = type;
+}
+
+void SevenZBatch::setHashOutput(bool enable, uint64_t truncate){
+    hashOutput = enable;
+    this->truncate = truncate;
+}
+
+void SevenZBatch::setVerifyCrc(bool enable){
+    verifyCrc = enable;
+}
+
+void SevenZBatch::setTest(bool enable, bool stop){
+    testMode = enable;
+    stopOnError = stop;
+}
+
+void SevenZBatch::setCracker(SevenZCracker *cracker){
+    this->cracker = cracker;
+}
+
+void SevenZBatch::setStats(bool enable){
+    statsEnabled = enable;
+}
+
+void SevenZBatch::setPerf(bool enable){
+    perfEnabled = enable;
+}
+
+void SevenZBatch::addPath(const string& path){
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+	walk(path);
+    else
+	paths.push_back(path);	// errors are reported with the results
+}
+
+void SevenZBatch::walk(const string& dir){
+    DIR *d = opendir(dir.c_str());
+    if (d == NULL){
+	cerr << "WARNING: Couldn't read directory " << dir << endl;
+	return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL){
+	if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+	    continue;
+	string path = dir + "/" + entry->d_name;
+	unsigned char type = entry->d_type;
+	if (type == DT_UNKNOWN){
+	    struct stat st;
+	    if (lstat(path.c_str(), &st) != 0)
+		continue;
+	    type = S_ISDIR(st.st_mode) ? DT_DIR : (S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN);
+	}
+	if (type == DT_DIR)
+	    walk(path);	    // symlinks to directories are not followed
+	else if ((type == DT_REG || type == DT_LNK) && is7zName(entry->d_name))
+	    paths.push_back(path);
+    }
+    closedir(d);
+}
+
+void SevenZBatch::readList(istream& stream, char delim){
+    string line;
+    while (getline(stream, line, delim)){
+	if (delim == '\n' && !line.empty() && line[line.size() - 1] == '\r')
+	    line.erase(line.size() - 1);
+	if (!line.empty())
+	    addPath(line);
+    }
+}
+
+size_t SevenZBatch::size() const {
+    return paths.size();
+}
+
+void SevenZBatch::worker(ostream *out){
+    SevenZFormat archive;
+    ostringstream result;
+    ostream discard(NULL);
+    archive.setOutput(testMode ? discard : result);
+    archive.setIO(ioType);
+    archive.setHashOutput(hashOutput, truncate);
+    archive.setCrackData(cracker != NULL);
+    archive.setVerifyCrc(verifyCrc);
+    archive.setStats(statsEnabled);
+    archive.setPerf(perfEnabled);
+    // archives are tested at once, folders of one archive share the rest
+    SevenZTester tester;
+    tester.setThreads(testThreads);
+    tester.setStopOnError(stopOnError);
+    // hash lines and passwords go to a cracker or a script, keep them clean
+    bool quiet = hashOutput || cracker != NULL;
+
+    size_t i;
+    while ((i = next++) < paths.size()){
+	if (stopped)
+	    break;
+	result.str("");
+	result.clear();
+	string error, warning;
+	SevenZTraceSpan span("archive", paths[i].c_str());
+	if (!quiet)
+	    result << "Archive: " << paths[i] << endl;
+	if (!archive.open(paths[i].c_str())){
+	    error = "Couldn't open the archive";
+	} else {
+	    try {
+		archive.process();
+		if (cracker != NULL){
+		    cracker->addArchive(paths[i], archive.getData());
+		    archive.close();
+		} else if (testMode){
+		    size_t damaged;
+		    {
+			SevenZPhaseTimer timer(archive.phaseClock(), TestPhase);
+			damaged = tester.test(archive);
+		    }
+		    if (damaged > 0)
+			error = "Data error in " + to_string(damaged) + " folders";
+		    tester.print(result);
+		    archive.close();
+		} else {
+		    if (hashOutput && !archive.hasEncryptedData())
+			warning = "no encrypted data";
+		    archive.finish();
+		}
+	    } catch (const exception& e){
+		error = e.what();
+	    }
+	}
+	if (!error.empty()){
+	    failed++;
+	    if (stopOnError)
+		stopped = true;
+	    if (!quiet)
+		result << "ERROR: " << error << endl;
+	}
+	if (statsEnabled || perfEnabled){
+	    archive.close();	// a failed archive is still open
+	    stats[i] = archive.getStats();
+	    stats[i].failed = error.empty() ? 0 : 1;
+	}
+
+	// waiting for the lock shows in the trace as a long write
+	SevenZTraceSpan write("write");
+	lock_guard<mutex> lock(outLock);
+	if (!error.empty() && quiet)
+	    cerr << "ERROR: " << paths[i] << ": " << error << endl;
+	if (!warning.empty())
+	    cerr << "WARNING: " << paths[i] << ": " << warning << endl;
+	if (cracker == NULL){
+	    *out << result.str();
+	    out->flush();
+	}
+    }
+}
+
+size_t SevenZBatch::run(unsigned threads, ostream& out){
+    if (threads == 0)
+	threads = 1;
+    testThreads = 1;
+    if (threads > paths.size()){
+	if (!paths.empty())
+	    testThreads = threads / paths.size();
+	threads = paths.size();
+    }
+    next = 0;
+    failed = 0;
+    stopped = false;
+    stats.assign(statsEnabled || perfEnabled ? paths.size() : 0, SevenZStats());
+    runThreads = threads;
+    uint64_t start = SevenZPhaseClock::now();
+
+    vector<thread> pool;
+    for (unsigned t = 1; t < threads; t++)
+	pool.push_back(thread(&SevenZBatch::worker, this, &out));
+    worker(&out);	// calling thread works too
+    for (size_t t = 0; t < pool.size(); t++)
+	pool[t].join();
+    wallNs = SevenZPhaseClock::now() - start;
+    return failed;
+}
+
+void SevenZBatch::printStats(ostream& out) const {
+    SevenZStats total;
+    out << "{\"archives\": [";
+    bool first = true;
+    for (size_t i = 0; i < stats.size(); i++){
+	if (stats[i].archives == 0)
+	    continue;	// not started after --fail-fast
+	total.add(stats[i]);
+	out << (first ? "\n" : ",\n") << "  {\"path\": ";
+	sevenZJsonString(out, paths[i]);
+	out << ", \"stats\": ";
+	stats[i].printJson(out);
+	out << "}";
+	first = false;
+    }
+    out << "\n],\n\"total\": ";
+    total.printJson(out);
+    out << ",\n\"wall_ns\": " << wallNs << ", \"threads\": " << runThreads << "}" << endl;
+}
+
+void SevenZBatch::printPerf(ostream& out) const {
+    static const char *kinds[] = {"raw", "compressed", "encrypted", "failed"};
+    SevenZStats byKind[4], total;
+    for (size_t i = 0; i < stats.size(); i++){
+	if (stats[i].archives == 0)
+	    continue;
+	total.add(stats[i]);
+	string kind = stats[i].failed ? "failed" : stats[i].kind;
+	for (int k = 0; k < 4; k++)
+	    if (kind == kinds[k])
+		byKind[k].add(stats[i]);
+    }
+    SevenZStats::printPerfHeader(out);
+    for (int k = 0; k < 4; k++)
+	if (byKind[k].archives > 0)
+	    byKind[k].printPerf(out, string(kinds[k]) + " (" + to_string(byKind[k].archives) + ")");
+    total.printPerf(out, "all (" + to_string(total.archives) + ")");
+}
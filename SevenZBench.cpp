@@ -0,0 +1,554 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <chrono>
+#include <algorithm>
+
+#include <sys/stat.h>
+
+#include "SevenZFormat.h"
+#include "SevenZLzmaEnc.h"
+#include "SevenZWriter.h"
+
+/**
+ * Benchmarks of the parser and the decoders on a generated corpus. Every
+ * result is printed as a line and written to a JSON file, so results of
+ * two versions can be compared by a script.
+ */
+
+#define BENCH_PASSWORD "bench"
+#define FILETIME_2016 131000000000000000ull
+
+struct Options {
+    std::string corpus = "bench_corpus";
+    std::string json;		// empty = no JSON file
+    bool generate = false;	// write the corpus even if it exists
+    uint64_t files = 1000000;	// entries of files_1m.7z
+    uint64_t hugeMiB = 256;	// size of the stream of huge_stream.7z
+    double minTime = 0.5;	// seconds of one measurement
+    unsigned repeats = 5;	// measurements of every benchmark, the median is reported
+    std::string filter;		// only benchmarks with names containing it
+};
+
+struct Result {
+    std::string name;
+    uint64_t iterations;	// in one measurement
+    double nsPerOp;		// median of the measurements
+    double minNsPerOp;
+    uint64_t bytes;		// processed by one operation, 0 when it has no meaning
+};
+
+/**
+ * splitmix64, the corpus must not depend on the standard library
+ */
+class Random {
+public:
+    Random(uint64_t seed): state(seed) {}
+    uint64_t next(){
+	uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+    }
+    uint64_t below(uint64_t n){
+	return next() % n;
+    }
+private:
+    uint64_t state;
+};
+
+/**
+ * Text of words from a small vocabulary, it compresses like source code
+ * @param random, size, out
+ */
+static void makeText(Random &random, size_t size, std::vector<uint8_t> &out){
+    static const char *words[] = {"archive", "header", "folder", "stream", "coder", "size",
+	"the", "of", "int", "return", "for", "if", "while", "uint64_t", "const", "data",
+	"file", "name", "crc", "pack", "unpack", "{", "}", "(", ")", ";", "=", "+"};
+    out.clear();
+    while (out.size() < size){
+	const char *w = words[random.below(sizeof(words) / sizeof(words[0]))];
+	out.insert(out.end(), w, w + strlen(w));
+	out.push_back(random.below(8) == 0 ? '\n' : ' ');
+    }
+    out.resize(size);
+}
+
+static bool exists(const std::string &path){
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+/**
+ * Archive of the corpus
+ */
+struct Shape {
+    const char *name;
+    void (*write)(SevenZWriter &writer, const Options &options);
+};
+
+/**
+ * 64 files in 8 LZMA folders, the header is not compressed
+ */
+static void writeRawHeader(SevenZWriter &writer, const Options&){
+    Random random(1);
+    std::vector<uint8_t> data;
+    writer.setHeader(SevenZWriter::RawHeaderType);
+    for (unsigned f = 0; f < 8; f++){
+	writer.beginFolder(SevenZWriter::LzmaMethod);
+	for (unsigned i = 0; i < 8; i++){
+	    makeText(random, 1000 + random.below(20000), data);
+	    writer.addFile("src/dir" + std::to_string(f) + "/file" + std::to_string(i) + ".c", FILETIME_2016 + i);
+	    writer.append(data.data(), data.size());
+	}
+    }
+}
+
+/**
+ * 1000 files in one solid folder, LZMA header
+ */
+static void writeLzmaHeader(SevenZWriter &writer, const Options&){
+    Random random(2);
+    std::vector<uint8_t> data;
+    writer.setHeader(SevenZWriter::LzmaHeaderType);
+    writer.beginFolder(SevenZWriter::LzmaMethod);
+    for (unsigned i = 0; i < 1000; i++){
+	makeText(random, random.below(4000), data);
+	writer.addFile("docs/page" + std::to_string(i) + ".txt", FILETIME_2016 + i);
+	writer.append(data.data(), data.size());
+    }
+}
+
+/**
+ * 100 files, the LZMA header is encrypted with password "bench"
+ */
+static void writeAesHeader(SevenZWriter &writer, const Options&){
+    Random random(3);
+    std::vector<uint8_t> data;
+    writer.setHeader(SevenZWriter::AesHeaderType, BENCH_PASSWORD, 19);
+    writer.beginFolder(SevenZWriter::LzmaMethod);
+    for (unsigned i = 0; i < 100; i++){
+	makeText(random, random.below(4000), data);
+	writer.addFile("secret/note" + std::to_string(i) + ".txt", FILETIME_2016 + i);
+	writer.append(data.data(), data.size());
+    }
+}
+
+/**
+ * 10000 small files, each in its own folder as 7-Zip writes them without
+ * solid mode
+ */
+static void writeManyFolders(SevenZWriter &writer, const Options&){
+    Random random(4);
+    std::vector<uint8_t> data;
+    writer.setHeader(SevenZWriter::LzmaHeaderType);
+    for (unsigned i = 0; i < 10000; i++){
+	writer.beginFolder(i % 4 == 0 ? SevenZWriter::CopyMethod : SevenZWriter::LzmaMethod);
+	makeText(random, 100 + random.below(400), data);
+	writer.addFile("many/f" + std::to_string(i), FILETIME_2016 + i);
+	writer.append(data.data(), data.size());
+    }
+}
+
+/**
+ * options.files entries in solid folders of 100000 files, every 16th
+ * entry is an empty file
+ */
+static void writeFiles(SevenZWriter &writer, const Options &options){
+    Random random(5);
+    std::vector<uint8_t> data;
+    writer.setHeader(SevenZWriter::LzmaHeaderType);
+    for (uint64_t i = 0; i < options.files; i++){
+	if (i % 100000 == 0)
+	    writer.beginFolder(SevenZWriter::LzmaMethod);
+	char name[64];
+	snprintf(name, sizeof(name), "tree/d%03u/e%07llu.dat", static_cast<unsigned>(i % 1000),
+		static_cast<unsigned long long>(i));
+	writer.addFile(name, FILETIME_2016 + i * 10000000);
+	if (i % 16 != 0){
+	    makeText(random, 8 + random.below(56), data);
+	    writer.append(data.data(), data.size());
+	}
+    }
+}
+
+/**
+ * One file of options.hugeMiB MiB in a Copy folder
+ */
+static void writeHugeStream(SevenZWriter &writer, const Options &options){
+    Random random(6);
+    std::vector<uint8_t> data(1 << 20);
+    writer.setHeader(SevenZWriter::LzmaHeaderType);
+    writer.beginFolder(SevenZWriter::CopyMethod);
+    writer.addFile("huge.bin", FILETIME_2016);
+    for (uint64_t m = 0; m < options.hugeMiB; m++){
+	for (size_t i = 0; i < data.size(); i += 8){
+	    uint64_t v = random.next();
+	    memcpy(&data[i], &v, 8);
+	}
+	writer.append(data.data(), data.size());
+    }
+}
+
+static const Shape Shapes[] = {
+    {"raw_header", writeRawHeader},
+    {"lzma_header", writeLzmaHeader},
+    {"aes_header", writeAesHeader},
+    {"many_folders", writeManyFolders},
+    {"files_1m", writeFiles},
+    {"huge_stream", writeHugeStream}
+};
+
+static std::string shapePath(const Options &options, const Shape &shape){
+    return options.corpus + "/" + shape.name + ".7z";
+}
+
+/**
+ * Writes missing archives of the corpus, all of them with generate
+ * @param options
+ * @return false when an archive can't be written
+ */
+static bool generateCorpus(const Options &options){
+    mkdir(options.corpus.c_str(), 0755);
+    for (size_t i = 0; i < sizeof(Shapes) / sizeof(Shapes[0]); i++){
+	std::string path = shapePath(options, Shapes[i]);
+	if (!options.generate && exists(path))
+	    continue;
+	std::cerr << "Writing " << path << std::endl;
+	SevenZWriter writer;
+	if (!writer.open(path + ".tmp")){
+	    std::cerr << "ERROR: Can't create " << path << std::endl;
+	    return false;
+	}
+	try {
+	    Shapes[i].write(writer, options);
+	    writer.close();
+	} catch (SevenZError &e){
+	    std::cerr << "ERROR: " << e.what() << std::endl;
+	    return false;
+	}
+	// a run stopped in the middle leaves no half written archive
+	if (rename((path + ".tmp").c_str(), path.c_str()) != 0)
+	    return false;
+    }
+    return true;
+}
+
+/**
+ * Runs the operation until minTime passes, repeats times. The iterations
+ * of the first measurement are kept for the others.
+ * @param options, name, bytes, op
+ */
+template <typename Op>
+static Result measure(const Options &options, const std::string &name, uint64_t bytes, Op op){
+    typedef std::chrono::steady_clock Clock;
+    Result result;
+    result.name = name;
+    result.bytes = bytes;
+    op();	// warm-up: page cache, allocator, branch predictors
+
+    uint64_t iterations = 1;
+    for (;;){
+	Clock::time_point start = Clock::now();
+	for (uint64_t i = 0; i < iterations; i++)
+	    op();
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	if (seconds >= options.minTime || iterations >= (1ull << 40))
+	    break;
+	// aim a bit over minTime, never more than 10 times the iterations
+	double scale = seconds > 0 ? options.minTime * 1.2 / seconds : 10;
+	iterations = static_cast<uint64_t>(iterations * std::min(std::max(scale, 1.5), 10.0)) + 1;
+    }
+    result.iterations = iterations;
+
+    std::vector<double> samples;
+    for (unsigned r = 0; r < options.repeats; r++){
+	Clock::time_point start = Clock::now();
+	for (uint64_t i = 0; i < iterations; i++)
+	    op();
+	double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+	samples.push_back(ns / iterations);
+    }
+    std::sort(samples.begin(), samples.end());
+    result.nsPerOp = samples[samples.size() / 2];
+    result.minNsPerOp = samples[0];
+    return result;
+}
+
+/**
+ * Exposes the parts of the parser to the benchmarks
+ */
+class BenchFormat: public SevenZFormat {
+public:
+    SevenZFolder folder(SevenZCursor *cur){
+	return readFolder(cur);
+    }
+    void forget(){
+	reset();
+    }
+};
+
+static void putNumber(std::vector<uint8_t> &out, uint64_t value){
+    unsigned n = 0;
+    while (n < 8 && value >= (1ull << (7 * (n + 1))))
+	n++;
+    out.push_back(n == 8 ? 0xFF : static_cast<uint8_t>((0xFF00 >> n) | (value >> (8 * n))));
+    for (unsigned i = 0; i < n; i++)
+	out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+static volatile uint64_t sink;	// results of the loops, so they are not optimized out
+
+/**
+ * Numbers as sizes in real headers: mostly one or two bytes, some big
+ */
+static void benchNumbers(const Options &options, std::vector<Result> &results){
+    Random random(10);
+    std::vector<uint8_t> buffer;
+    const size_t count = 1 << 20;
+    for (size_t i = 0; i < count; i++){
+	unsigned kind = random.below(100);
+	uint64_t value = kind < 60 ? random.below(128) : (kind < 80 ? random.below(1 << 14) :
+		(kind < 95 ? random.below(1ull << 28) : random.next()));
+	putNumber(buffer, value);
+    }
+    SevenZSpan span = {buffer.data(), buffer.size()};
+    Result r = measure(options, "varint", buffer.size(), [&](){
+	SevenZCursor cur(span);
+	uint64_t sum = 0;
+	for (size_t i = 0; i < count; i++)
+	    sum += cur.number();
+	sink = sum;
+    });
+    // per number, not per buffer
+    r.nsPerOp /= count;
+    r.minNsPerOp /= count;
+    r.iterations *= count;
+    r.bytes = buffer.size() / count;
+    results.push_back(r);
+}
+
+/**
+ * Folders of common shapes: LZMA, LZMA2, BCJ + LZMA, 7zAES + LZMA
+ */
+static void benchFolders(const Options &options, std::vector<Result> &results){
+    const uint8_t lzma[] = {0x23, 0x03, 0x01, 0x01, 0x05, 0x5D, 0x00, 0x00, 0x10, 0x00};
+    const uint8_t lzma2[] = {0x21, 0x21, 0x01, 0x18};
+    const uint8_t bcj[] = {0x04, 0x03, 0x03, 0x01, 0x03};
+    const uint8_t aes[] = {0x24, 0x06, 0xF1, 0x07, 0x01, 0x0A, 0x53, 0x07,
+	0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88};
+    std::vector<uint8_t> buffer;
+    const size_t count = 1 << 16;
+    for (size_t i = 0; i < count; i++){
+	switch (i % 4){
+	case 0:
+	    buffer.push_back(1);
+	    buffer.insert(buffer.end(), lzma, lzma + sizeof(lzma));
+	    break;
+	case 1:
+	    buffer.push_back(1);
+	    buffer.insert(buffer.end(), lzma2, lzma2 + sizeof(lzma2));
+	    break;
+	case 2:
+	    buffer.push_back(2);
+	    buffer.insert(buffer.end(), bcj, bcj + sizeof(bcj));
+	    buffer.insert(buffer.end(), lzma, lzma + sizeof(lzma));
+	    buffer.push_back(0);	// bind pair
+	    buffer.push_back(1);
+	    break;
+	case 3:
+	    buffer.push_back(2);
+	    buffer.insert(buffer.end(), aes, aes + sizeof(aes));
+	    buffer.insert(buffer.end(), lzma, lzma + sizeof(lzma));
+	    buffer.push_back(1);
+	    buffer.push_back(0);
+	    break;
+	}
+    }
+    SevenZSpan span = {buffer.data(), buffer.size()};
+    BenchFormat format;
+    Result r = measure(options, "readFolder", buffer.size(), [&](){
+	SevenZCursor cur(span);
+	uint64_t sum = 0;
+	for (size_t i = 0; i < count; i++)
+	    sum += format.folder(&cur).mainOutStream;
+	format.forget();	// the arena would grow with every pass
+	sink = sum;
+    });
+    r.nsPerOp /= count;
+    r.minNsPerOp /= count;
+    r.iterations *= count;
+    r.bytes = buffer.size() / count;
+    results.push_back(r);
+}
+
+static ISzAlloc benchAlloc = {SzAlloc, SzFree};
+
+/**
+ * One-shot LzmaDecode of 16 MiB, text and incompressible data
+ */
+static void benchLzma(const Options &options, std::vector<Result> &results){
+    const size_t size = 16 << 20;
+    Random random(11);
+    for (int kind = 0; kind < 2; kind++){
+	std::vector<uint8_t> data;
+	if (kind == 0){
+	    makeText(random, size, data);
+	} else {
+	    data.resize(size);
+	    for (size_t i = 0; i < size; i++)
+		data[i] = static_cast<uint8_t>(random.next());
+	}
+	SevenZLzmaEncoder encoder(1 << 24);
+	uint8_t props[5];
+	encoder.properties(props);
+	std::vector<uint8_t> packed;
+	encoder.encode(data.data(), data.size(), packed);
+	std::vector<uint8_t> out(size);
+	bool ok = true;
+	Result r = measure(options, kind == 0 ? "LzmaDecode/text" : "LzmaDecode/random", size, [&](){
+	    SizeT outLen = size, inLen = packed.size();
+	    ELzmaStatus status;
+	    SRes res = LzmaDecode(out.data(), &outLen, packed.data(), &inLen, props, 5,
+		    LZMA_FINISH_END, &status, &benchAlloc);
+	    ok = ok && res == SZ_OK && outLen == size;
+	});
+	if (!ok || out != data){
+	    std::cerr << "ERROR: " << r.name << " decoded wrong data" << std::endl;
+	    exit(1);
+	}
+	results.push_back(r);
+    }
+}
+
+/**
+ * open(), process() and close() of every archive of the corpus
+ */
+static void benchProcess(const Options &options, std::vector<Result> &results){
+    std::ostream discard(NULL);
+    for (size_t i = 0; i < sizeof(Shapes) / sizeof(Shapes[0]); i++){
+	std::string path = shapePath(options, Shapes[i]);
+	for (int io = 0; io < 2; io++){
+	    std::string name = std::string("process/") + Shapes[i].name + (io == 0 ? "/mmap" : "/pread");
+	    if (name.find(options.filter) == std::string::npos)
+		continue;
+	    SevenZFormat format;
+	    format.setIO(io == 0 ? MappedIO : PreadIO);
+	    format.setOutput(discard);
+	    bool ok = true;
+	    std::string error;
+	    // most of the archive is never read, MB/s of its size would mean nothing
+	    Result r = measure(options, name, 0, [&](){
+		if (!format.open(path.c_str())){
+		    ok = false;
+		    error = "can't be opened";
+		    return;
+		}
+		try {
+		    format.process();
+		} catch (SevenZError &e){
+		    ok = false;
+		    error = e.what();
+		}
+		format.close();
+	    });
+	    if (!ok){
+		std::cerr << "ERROR: " << path << ": " << error << std::endl;
+		exit(1);
+	    }
+	    results.push_back(r);
+	}
+    }
+}
+
+static void printResult(const Result &r){
+    char line[256];
+    double mbps = r.bytes > 0 && r.nsPerOp > 0 ? r.bytes * 1e3 / r.nsPerOp : 0;
+    snprintf(line, sizeof(line), "%-32s %12.1f ns/op %12.1f min %10.1f MB/s %12llu iterations",
+	    r.name.c_str(), r.nsPerOp, r.minNsPerOp, mbps, static_cast<unsigned long long>(r.iterations));
+    std::cout << line << std::endl;
+}
+
+static bool writeJson(const std::string &path, const std::vector<Result> &results){
+    std::ofstream out(path.c_str());
+    out << "{\n  \"benchmark\": \"7z_analyser\",\n  \"version\": 1,\n  \"results\": [";
+    char line[512];
+    for (size_t i = 0; i < results.size(); i++){
+	const Result &r = results[i];
+	double mbps = r.bytes > 0 && r.nsPerOp > 0 ? r.bytes * 1e3 / r.nsPerOp : 0;
+	snprintf(line, sizeof(line), "%s\n    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.3f, "
+		"\"min_ns_per_op\": %.3f, \"bytes_per_op\": %llu, \"mb_per_s\": %.3f}",
+		i == 0 ? "" : ",", r.name.c_str(), static_cast<unsigned long long>(r.iterations),
+		r.nsPerOp, r.minNsPerOp, static_cast<unsigned long long>(r.bytes), mbps);
+	out << line;
+    }
+    out << "\n  ]\n}\n";
+    return static_cast<bool>(out);
+}
+
+static void PrintHelp(){
+    std::cout << "Usage: ./7z_bench [options]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --corpus=DIR     generated archives (default bench_corpus), missing ones are written" << std::endl;
+    std::cout << "  --generate       write the corpus again" << std::endl;
+    std::cout << "  --files=N        entries of files_1m.7z (default 1000000)" << std::endl;
+    std::cout << "  --huge=MiB       size of huge_stream.7z (default 256)" << std::endl;
+    std::cout << "  --json=FILE      write the results as JSON" << std::endl;
+    std::cout << "  --min-time=S     seconds of one measurement (default 0.5)" << std::endl;
+    std::cout << "  --repeats=N      measurements of every benchmark, the median is reported (default 5)" << std::endl;
+    std::cout << "  --filter=TEXT    run only benchmarks with TEXT in their names" << std::endl;
+}
+
+int main(int argc, char** argv){
+    Options options;
+    for (int i = 1; i < argc; i++){
+	std::string arg = argv[i];
+	if (arg.compare(0, 9, "--corpus=") == 0){
+	    options.corpus = arg.substr(9);
+	} else if (arg == "--generate"){
+	    options.generate = true;
+	} else if (arg.compare(0, 8, "--files=") == 0){
+	    options.files = strtoull(arg.c_str() + 8, NULL, 10);
+	} else if (arg.compare(0, 7, "--huge=") == 0){
+	    options.hugeMiB = strtoull(arg.c_str() + 7, NULL, 10);
+	} else if (arg.compare(0, 7, "--json=") == 0){
+	    options.json = arg.substr(7);
+	} else if (arg.compare(0, 11, "--min-time=") == 0){
+	    options.minTime = atof(arg.c_str() + 11);
+	} else if (arg.compare(0, 10, "--repeats=") == 0){
+	    options.repeats = std::max(1, atoi(arg.c_str() + 10));
+	} else if (arg.compare(0, 9, "--filter=") == 0){
+	    options.filter = arg.substr(9);
+	} else {
+	    PrintHelp();
+	    return arg == "-h" || arg == "--help" ? 0 : 1;
+	}
+    }
+
+    if (!generateCorpus(options))
+	return 1;
+    std::vector<Result> results;
+    size_t printed = 0;
+    void (*benches[])(const Options&, std::vector<Result>&) = {benchNumbers, benchFolders, benchLzma};
+    const char *names[] = {"varint", "readFolder", "LzmaDecode"};
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++){
+	if (std::string(names[i]).find(options.filter) == std::string::npos)
+	    continue;
+	benches[i](options, results);
+	for (; printed < results.size(); printed++)
+	    printResult(results[printed]);
+    }
+    benchProcess(options, results);
+    for (; printed < results.size(); printed++)
+	printResult(results[printed]);
+
+    if (!options.json.empty() && !writeJson(options.json, results)){
+	std::cerr << "ERROR: Can't write " << options.json << std::endl;
+	return 1;
+    }
+    return 0;
+}
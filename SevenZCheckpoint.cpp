@@ -0,0 +1,145 @@
+#include "SevenZCheckpoint.h"
+#include "SevenZError.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define CHECKPOINT_MAGIC "7zCheckpoint 1"
+
+static string toHex(const string &s){
+    static const char digits[] = "0123456789abcdef";
+    string hex;
+    hex.reserve(2 * s.size());
+    for (size_t i = 0; i < s.size(); i++){
+	hex += digits[static_cast<uint8_t>(s[i]) >> 4];
+	hex += digits[static_cast<uint8_t>(s[i]) & 15];
+    }
+    return hex;
+}
+
+static bool fromHex(const string &hex, string &s){
+    if (hex.size() % 2 != 0)
+	return false;
+    s.clear();
+    for (size_t i = 0; i < hex.size(); i += 2){
+	int value = 0;
+	for (size_t j = i; j < i + 2; j++){
+	    char c = hex[j];
+	    int digit = c >= '0' && c <= '9' ? c - '0' : (c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1);
+	    if (digit < 0)
+		return false;
+	    value = value * 16 + digit;
+	}
+	s += static_cast<char>(value);
+    }
+    return true;
+}
+
+/**
+ * Rest of the line after the keyword and one space
+ */
+static string rest(const string &line, size_t keyword){
+    return line.size() > keyword + 1 ? line.substr(keyword + 1) : string();
+}
+
+bool SevenZCheckpoint::load(const string &path){
+    ifstream file(path.c_str());
+    if (!file)
+	return false;
+    string line;
+    if (!getline(file, line) || line != CHECKPOINT_MAGIC)
+	throw SevenZError(159, "Not a checkpoint: " + path);
+
+    source.clear();
+    pending.clear();
+    hits.clear();
+    open.clear();
+    bool end = false;
+    while (!end && getline(file, line)){
+	istringstream fields(line);
+	string keyword;
+	fields >> keyword;
+	bool ok = true;
+	if (keyword == "source"){
+	    source = rest(line, keyword.size());
+	} else if (keyword == "chunk"){
+	    ok = static_cast<bool>(fields >> chunkSize);
+	} else if (keyword == "shard"){
+	    ok = static_cast<bool>(fields >> shard >> shards);
+	} else if (keyword == "next"){
+	    ok = static_cast<bool>(fields >> next);
+	} else if (keyword == "pending"){
+	    uint64_t chunk, pos;
+	    ok = static_cast<bool>(fields >> chunk >> pos);
+	    pending.push_back(make_pair(chunk, pos));
+	} else if (keyword == "hit"){
+	    string hex, password;
+	    ok = fields >> hex && fromHex(hex, password);
+	    hits.push_back(make_pair(rest(line, keyword.size() + 1 + hex.size()), password));
+	} else if (keyword == "open"){
+	    open.push_back(rest(line, keyword.size()));
+	} else if (keyword == "end"){
+	    end = true;
+	} else
+	    ok = false;
+	if (!ok)
+	    throw SevenZError(159, "Checkpoint is corrupted: " + path);
+    }
+    if (!end || chunkSize == 0 || shards == 0 || shard >= shards)
+	throw SevenZError(159, "Checkpoint is corrupted: " + path);
+    return true;
+}
+
+bool SevenZCheckpoint::save(const string &path) const {
+    ostringstream text;
+    text << CHECKPOINT_MAGIC << "\n";
+    text << "source " << source << "\n";
+    text << "chunk " << chunkSize << "\n";
+    text << "shard " << shard << " " << shards << "\n";
+    text << "next " << next << "\n";
+    for (size_t i = 0; i < pending.size(); i++)
+	text << "pending " << pending[i].first << " " << pending[i].second << "\n";
+    for (size_t i = 0; i < hits.size(); i++)
+	text << "hit " << toHex(hits[i].second) << " " << hits[i].first << "\n";
+    for (size_t i = 0; i < open.size(); i++)
+	text << "open " << open[i] << "\n";
+    text << "end\n";
+
+    string data = text.str();
+    string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+	return false;
+    size_t done = 0;
+    while (done < data.size()){
+	ssize_t n = write(fd, data.data() + done, data.size() - done);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    break;
+	done += n;
+    }
+    // the data must be on the disk before the rename replaces the old state
+    bool ok = done == data.size() && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0){
+	unlink(tmp.c_str());
+	return false;
+    }
+    // the rename is an entry of the directory, it is durable once the
+    // directory is synced
+    size_t slash = path.rfind('/');
+    string dir = slash == string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dirFd < 0)
+	return false;
+    ok = fsync(dirFd) == 0;
+    return close(dirFd) == 0 && ok;
+}
@@ -0,0 +1,467 @@
+#include "SevenZCracker.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <cstdlib>
+#include <sys/stat.h>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static double since(Clock::time_point &start){
+    Clock::time_point now = Clock::now();
+    double seconds = chrono::duration<double>(now - start).count();
+    start = now;
+    return seconds;
+}
+
+static bool sameKdf(const SevenZAesProps &a, const SevenZAesProps &b){
+    return a.numCyclesPower == b.numCyclesPower && a.saltSize == b.saltSize &&
+	memcmp(a.salt, b.salt, a.saltSize) == 0;
+}
+
+// Class SevenZHitQueue
+SevenZHitQueue::SevenZHitQueue(): head(NULL) {}
+
+SevenZHitQueue::~SevenZHitQueue(){
+    vector<Hit> rest;
+    drain(rest);
+}
+
+void SevenZHitQueue::push(size_t target, const string &password){
+    Node *node = new Node;
+    node->hit.target = target;
+    node->hit.password = password;
+    node->next = head.load(memory_order_relaxed);
+    while (!head.compare_exchange_weak(node->next, node, memory_order_release, memory_order_relaxed))
+	;
+}
+
+void SevenZHitQueue::drain(vector<Hit> &out){
+    Node *node = head.exchange(NULL, memory_order_acquire);
+    // the list is the newest first
+    Node *reversed = NULL;
+    while (node != NULL){
+	Node *next = node->next;
+	node->next = reversed;
+	reversed = node;
+	node = next;
+    }
+    while (reversed != NULL){
+	Node *next = reversed->next;
+	out.push_back(move(reversed->hit));
+	delete reversed;
+	reversed = next;
+    }
+}
+
+// Struct SevenZCrackStats
+void SevenZCrackStats::print(ostream &out) const {
+    char line[160];
+    snprintf(line, sizeof(line), "Tried %llu passwords in %.2f s, %.1f passwords/s, %llu keys derived",
+	    static_cast<unsigned long long>(candidates), seconds, seconds > 0 ? candidates / seconds : 0.0,
+	    static_cast<unsigned long long>(derived));
+    out << line << endl;
+    double total = split + cache + kdf + verify + confirm;
+    const char *names[] = { "candidates", "key cache", "key derivation", "verification", "confirmation" };
+    double times[] = { split, cache, kdf, verify, confirm };
+    for (unsigned i = 0; i < 5; i++){
+	snprintf(line, sizeof(line), "  %-15s %9.3f s %5.1f %%", names[i], times[i],
+		total > 0 ? 100 * times[i] / total : 0.0);
+	out << line << endl;
+    }
+}
+
+// Class SevenZCracker
+SevenZCracker::SevenZCracker(): cache(NULL), running(0), remaining(0), shard(0), shards(1),
+    stopping(false), interrupted(false), batches(0), nextChunk(0) {}
+
+void SevenZCracker::setKeyCache(SevenZKeyCache *cache){
+    this->cache = cache;
+}
+
+void SevenZCracker::setShard(unsigned index, unsigned count){
+    shard = index;
+    shards = count;
+}
+
+void SevenZCracker::setCheckpoint(const string &path){
+    checkpoint = path;
+}
+
+void SevenZCracker::stop(){
+    stopping = true;
+}
+
+bool SevenZCracker::stopped() const {
+    return interrupted;
+}
+
+void SevenZCracker::addArchive(const string &path, const SevenZInitData &data){
+    Target target;
+    target.path = path;
+    target.verifier.reset(new SevenZHeaderVerifier(data));
+    const SevenZAesProps &props = target.verifier->getProps();
+    SevenZKdf check(props);	// throws on unsupported cycles
+
+    lock_guard<mutex> guard(lock);
+    size_t g = 0;
+    while (g < groups.size() && !sameKdf(groups[g].props, props))
+	g++;
+    if (g == groups.size()){
+	Group group;
+	group.props = props;
+	groups.push_back(group);
+    }
+    groups[g].targets.push_back(targets.size());
+    targets.push_back(move(target));
+}
+
+size_t SevenZCracker::size() const {
+    lock_guard<mutex> guard(lock);
+    return targets.size();
+}
+
+size_t SevenZCracker::numGroups() const {
+    lock_guard<mutex> guard(lock);
+    return groups.size();
+}
+
+const SevenZCrackStats& SevenZCracker::getStats() const {
+    return stats;
+}
+
+void SevenZCracker::deriveKeys(Worker &worker, size_t group, size_t count){
+    const SevenZSpan *passwords = worker.passwords.data();
+    worker.keys.resize(count * AES_KEY_SIZE);
+    SevenZKdf &kdf = *worker.kdfs[group];
+    Clock::time_point start = Clock::now();
+    if (cache == NULL){
+	kdf.derive(passwords, count, worker.keys.data());
+	worker.stats.derived += count;
+	worker.stats.kdf += since(start);
+	return;
+    }
+    worker.cached.resize(count);
+    size_t found = cache->lookup(groups[group].props, passwords, count, worker.keys.data(), worker.cached.data());
+    worker.stats.cache += since(start);
+    if (found == count)
+	return;
+    worker.missing.clear();
+    for (size_t i = 0; i < count; i++)
+	if (!worker.cached[i])
+	    worker.missing.push_back(passwords[i]);
+    worker.derived.resize(worker.missing.size() * AES_KEY_SIZE);
+    kdf.derive(worker.missing.data(), worker.missing.size(), worker.derived.data());
+    worker.stats.derived += worker.missing.size();
+    for (size_t i = 0, j = 0; i < count; i++)
+	if (!worker.cached[i])
+	    memcpy(worker.keys.data() + i * AES_KEY_SIZE, worker.derived.data() + j++ * AES_KEY_SIZE, AES_KEY_SIZE);
+    worker.stats.kdf += since(start);
+    cache->store(groups[group].props, passwords, count, worker.keys.data(), worker.cached.data());
+    worker.stats.cache += since(start);
+}
+
+void SevenZCracker::tryBatch(Worker &worker, size_t count){
+    worker.passed.resize(count);
+    for (size_t g = 0; g < groups.size(); g++){
+	const vector<size_t> &members = groups[g].targets;
+	bool open = false;
+	for (size_t t = 0; t < members.size() && !open; t++)
+	    open = !targets[members[t]].found.load(memory_order_relaxed);
+	if (!open)
+	    continue;
+	deriveKeys(worker, g, count);
+
+	for (size_t t = 0; t < members.size(); t++){
+	    size_t index = members[t];
+	    if (targets[index].found.load(memory_order_relaxed))
+		continue;
+	    SevenZHeaderVerifier &verifier = *worker.verifiers[index];
+	    Clock::time_point start = Clock::now();
+	    size_t passed = verifier.check(worker.keys.data(), count, worker.passed.data());
+	    worker.stats.verify += since(start);
+	    if (passed == 0)
+		continue;
+	    for (size_t i = 0; i < count; i++)
+		if (worker.passed[i] && verifier.confirm(worker.keys.data() + i * AES_KEY_SIZE)){
+		    // the same password may be in more chunks, only the first one reports
+		    if (!targets[index].found.exchange(true)){
+			hits.push(index, string(reinterpret_cast<const char*>(worker.passwords[i].data),
+				worker.passwords[i].size));
+			remaining--;
+		    }
+		    break;
+		}
+	    worker.stats.confirm += since(start);
+	}
+    }
+}
+
+bool SevenZCracker::claim(Worker &worker, const Source &source){
+    lock_guard<mutex> guard(progressLock);
+    worker.busy = false;
+    if (!pending.empty()){
+	worker.chunk = pending.front().first;
+	worker.pos = pending.front().second;
+	pending.erase(pending.begin());
+    } else {
+	if (nextChunk >= (source.size + source.chunk - 1) / source.chunk)
+	    return false;
+	worker.chunk = nextChunk;
+	worker.pos = nextChunk * source.chunk;
+	nextChunk += shards;
+    }
+    worker.busy = true;
+    return true;
+}
+
+void SevenZCracker::advance(Worker &worker, uint64_t pos, bool done){
+    {
+	lock_guard<mutex> guard(progressLock);
+	worker.pos = pos;
+	worker.busy = !done;
+    }
+    batches++;
+}
+
+void SevenZCracker::work(Worker *worker, const Source *source){
+    worker->passwords.resize(CRACK_BATCH);
+    while (remaining > 0 && !stopping && claim(*worker, *source)){
+	if (source->mask != NULL)
+	    tryMask(*worker, *source);
+	else
+	    tryLines(*worker, *source);
+    }
+    running--;
+}
+
+void SevenZCracker::tryLines(Worker &worker, const Source &source){
+    const char *text = reinterpret_cast<const char*>(source.text.data);
+    uint64_t size = source.size;
+    Clock::time_point start = Clock::now();
+    // lines starting in the chunk, the first one may start in the previous chunk
+    uint64_t begin = worker.chunk * source.chunk, pos = worker.pos;
+    uint64_t end = begin + source.chunk < size ? begin + source.chunk : size;
+    if (pos == begin && pos > 0){
+	const char *nl = static_cast<const char*>(memchr(text + pos - 1, '\n', size - pos + 1));
+	pos = nl == NULL ? size : nl - text + 1;
+    }
+    size_t count = 0;
+    while (pos < end && remaining > 0 && !stopping){
+	const char *nl = static_cast<const char*>(memchr(text + pos, '\n', size - pos));
+	uint64_t next = nl == NULL ? size : nl - text;
+	size_t len = next - pos;
+	if (len > 0 && text[pos + len - 1] == '\r')
+	    len--;
+	worker.passwords[count].data = source.text.data + pos;
+	worker.passwords[count].size = len;
+	pos = next + 1;
+	if (++count == CRACK_BATCH || pos >= end){
+	    worker.stats.candidates += count;
+	    worker.stats.split += since(start);
+	    tryBatch(worker, count);
+	    advance(worker, pos, pos >= end);
+	    count = 0;
+	    start = Clock::now();
+	}
+    }
+    worker.stats.split += since(start);
+}
+
+void SevenZCracker::tryMask(Worker &worker, const Source &source){
+    size_t len = source.mask->length();
+    uint64_t begin = worker.chunk * source.chunk, pos = worker.pos;
+    uint64_t end = begin + source.chunk < source.size ? begin + source.chunk : source.size;
+    worker.generated.resize(CRACK_BATCH * len);
+    while (pos < end && remaining > 0 && !stopping){
+	Clock::time_point start = Clock::now();
+	// candidates of a mask have the same length and go to the lanes as they are
+	size_t count = end - pos < CRACK_BATCH ? end - pos : CRACK_BATCH;
+	source.mask->generate(pos, count, worker.generated.data());
+	for (size_t i = 0; i < count; i++){
+	    worker.passwords[i].data = worker.generated.data() + i * len;
+	    worker.passwords[i].size = len;
+	}
+	worker.stats.candidates += count;
+	worker.stats.split += since(start);
+	tryBatch(worker, count);
+	pos += count;
+	advance(worker, pos, pos >= end);
+    }
+}
+
+void SevenZCracker::resume(SevenZCheckpoint &state, const Source &source, ostream &out){
+    state.source = source.name;
+    state.chunkSize = source.chunk;
+    state.shard = shard;
+    state.shards = shards;
+    state.next = shard;
+    SevenZCheckpoint saved;
+    if (checkpoint.empty() || !saved.load(checkpoint))
+	return;
+    if (saved.source != state.source || saved.chunkSize != state.chunkSize ||
+	    saved.shard != shard || saved.shards != shards)
+	throw SevenZError(159, "Checkpoint " + checkpoint + " belongs to other candidates or shard.");
+
+    for (size_t t = 0; t < targets.size(); t++){
+	const string &path = targets[t].path;
+	size_t h = 0;
+	while (h < saved.hits.size() && saved.hits[h].first != path)
+	    h++;
+	if (h < saved.hits.size()){
+	    targets[t].found = true;
+	    out << path << ":" << saved.hits[h].second << "\n";
+	} else if (find(saved.open.begin(), saved.open.end(), path) == saved.open.end())
+	    // the chunks done so far were not tried on it
+	    throw SevenZError(159, "Archive " + path + " is not in the checkpoint " + checkpoint + ".");
+    }
+    state = saved;
+}
+
+void SevenZCracker::snapshot(SevenZCheckpoint &state, const vector<Worker> &workers){
+    lock_guard<mutex> guard(progressLock);
+    state.next = nextChunk;
+    state.pending = pending;
+    for (size_t w = 0; w < workers.size(); w++)
+	if (workers[w].busy)
+	    state.pending.push_back(make_pair(workers[w].chunk, workers[w].pos));
+}
+
+long SevenZCracker::run(const char *wordlist, unsigned threads, ostream &out){
+    lock_guard<mutex> guard(lock);
+    SevenZMappedFile file;
+    if (!file.open(wordlist))
+	return -1;
+    // a checkpoint belongs only to the same file in the same state
+    struct stat st;
+    char *real = realpath(wordlist, NULL);
+    Source source;
+    source.size = file.size();
+    source.name = "wordlist " + to_string(source.size);
+    if (stat(wordlist, &st) == 0)
+	source.name += " " + to_string(st.st_mtim.tv_sec) + "." + to_string(st.st_mtim.tv_nsec);
+    source.name += " " + string(real != NULL ? real : wordlist);
+    free(real);
+    source.chunk = CRACK_CHUNK;
+    source.text.data = NULL;
+    source.text.size = 0;
+    if (source.size > 0)
+	source.text = file.span(0, source.size);
+    source.mask = NULL;
+    return attack(source, threads, out);
+}
+
+long SevenZCracker::run(const SevenZMask &mask, unsigned threads, ostream &out){
+    lock_guard<mutex> guard(lock);
+    Source source;
+    source.size = mask.size();
+    source.name = "mask " + mask.describe();
+    source.chunk = CRACK_MASK_CHUNK;
+    source.text.data = NULL;
+    source.text.size = 0;
+    source.mask = &mask;
+    return attack(source, threads, out);
+}
+
+long SevenZCracker::attack(const Source &source, unsigned threads, ostream &out){
+    SevenZCheckpoint state;
+    interrupted = false;
+    resume(state, source, out);
+    nextChunk = state.next;
+    pending = state.pending;
+    batches = 0;
+
+    if (threads == 0)
+	threads = 1;
+    uint64_t chunks = (source.size + source.chunk - 1) / source.chunk;
+    if (threads > chunks)
+	threads = chunks > 0 ? chunks : 1;
+    vector<Worker> workers(threads);
+    for (unsigned w = 0; w < threads; w++){
+	for (size_t g = 0; g < groups.size(); g++)
+	    workers[w].kdfs.emplace_back(new SevenZKdf(groups[g].props));
+	for (size_t t = 0; t < targets.size(); t++)
+	    workers[w].verifiers.emplace_back(new SevenZHeaderVerifier(*targets[t].verifier));
+    }
+
+    // targets whose hit was printed and saved, the found flags of the workers
+    // are set before their hits are queued
+    vector<bool> reported(targets.size());
+    size_t found = 0;
+    for (size_t t = 0; t < targets.size(); t++){
+	reported[t] = targets[t].found;
+	found += targets[t].found;
+    }
+    remaining = targets.size() - found;
+    running = threads;
+    Clock::time_point start = Clock::now();
+    vector<thread> pool;
+    for (unsigned w = 0; w < threads; w++)
+	pool.push_back(thread(&SevenZCracker::work, this, &workers[w], &source));
+
+    // hits are printed while the workers go on, the checkpoint is saved
+    // after every finished batch
+    vector<SevenZHitQueue::Hit> batch;
+    uint64_t saved = 0;
+    bool warned = false;
+    bool done = false;
+    while (!done){
+	done = running == 0;
+	if (!done)
+	    this_thread::sleep_for(chrono::milliseconds(50));
+	bool save = !checkpoint.empty() && (done || batches != saved);
+	if (save){
+	    // positions first, so the hits of the batches behind them are drained below
+	    saved = batches;
+	    snapshot(state, workers);
+	}
+	batch.clear();
+	hits.drain(batch);
+	for (size_t i = 0; i < batch.size(); i++){
+	    const string &path = targets[batch[i].target].path;
+	    out << path << ":" << batch[i].password << "\n";
+	    state.hits.push_back(make_pair(path, batch[i].password));
+	    reported[batch[i].target] = true;
+	    found++;
+	}
+	if (!batch.empty())
+	    out.flush();
+	if (save){
+	    state.open.clear();
+	    for (size_t t = 0; t < targets.size(); t++)
+		if (!reported[t])
+		    state.open.push_back(targets[t].path);
+	    if (!state.save(checkpoint) && !warned){
+		cerr << "WARNING: Couldn't write the checkpoint " << checkpoint << endl;
+		warned = true;
+	    }
+	}
+    }
+    for (size_t w = 0; w < pool.size(); w++)
+	pool[w].join();
+    out.flush();
+    // a stop after the last chunk leaves nothing to continue
+    bool left = nextChunk < chunks || !pending.empty();
+    for (unsigned w = 0; w < threads; w++)
+	left = left || workers[w].busy;
+    interrupted = stopping && remaining > 0 && left;
+
+    stats = SevenZCrackStats();
+    stats.seconds = chrono::duration<double>(Clock::now() - start).count();
+    for (unsigned w = 0; w < threads; w++){
+	const SevenZCrackStats &s = workers[w].stats;
+	stats.candidates += s.candidates;
+	stats.derived += s.derived;
+	stats.split += s.split;
+	stats.cache += s.cache;
+	stats.kdf += s.kdf;
+	stats.verify += s.verify;
+	stats.confirm += s.confirm;
+    }
+    return found;
+}
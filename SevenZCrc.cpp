@@ -0,0 +1,231 @@
+#include "SevenZCrc.h"
+
+#include <cstring>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC_X86
+#endif
+
+using namespace std;
+
+#define CRC_POLY 0xEDB88320
+
+/**
+ * Slicing-by-8 tables, table[k][n] is the CRC of byte n followed by k zeros
+ */
+struct CrcTable {
+    uint32_t table[8][256];
+    CrcTable(){
+	for (uint32_t n = 0; n < 256; n++){
+	    uint32_t c = n;
+	    for (unsigned i = 0; i < 8; i++)
+		c = (c & 1) ? (c >> 1) ^ CRC_POLY : c >> 1;
+	    table[0][n] = c;
+	}
+	for (uint32_t n = 0; n < 256; n++)
+	    for (unsigned k = 1; k < 8; k++)
+		table[k][n] = (table[k - 1][n] >> 8) ^ table[0][table[k - 1][n] & 0xFF];
+    }
+};
+
+static const CrcTable crcTable;
+
+static inline uint32_t load32(const uint8_t *p){
+    uint32_t value;
+    memcpy(&value, p, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    return value;
+}
+
+static bool slicingSupported(){
+    return true;
+}
+
+static uint32_t updateSlicing(uint32_t state, const uint8_t *data, size_t size){
+    const uint32_t (*t)[256] = crcTable.table;
+    // bytes up to 4-byte alignment, then 8 bytes per step
+    for (; size > 0 && (reinterpret_cast<uintptr_t>(data) & 3) != 0; size--)
+	state = t[0][(state ^ *data++) & 0xFF] ^ (state >> 8);
+    for (; size >= 8; size -= 8, data += 8){
+	uint32_t one = load32(data) ^ state;
+	uint32_t two = load32(data + 4);
+	state = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^ t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^
+	    t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^ t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+    }
+    for (; size > 0; size--)
+	state = t[0][(state ^ *data++) & 0xFF] ^ (state >> 8);
+    return state;
+}
+
+#ifdef CRC_X86
+
+static bool clmulSupported(){
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+}
+
+/**
+ * Folds 128 bits of the register forward by the distance of the constants
+ * and adds the next data
+ */
+__attribute__((target("pclmul,sse4.1"), always_inline))
+static inline __m128i fold(__m128i x, __m128i k, __m128i next){
+    __m128i low = _mm_clmulepi64_si128(x, k, 0x00);
+    __m128i high = _mm_clmulepi64_si128(x, k, 0x11);
+    return _mm_xor_si128(_mm_xor_si128(low, high), next);
+}
+
+/**
+ * Carry-less multiplication folding: four 128-bit registers are folded over
+ * 64 bytes per step, then into one register, which is reduced to 32 bits by
+ * Barrett reduction. Constants are powers of x modulo the polynomial, bit
+ * reflected, as in Intel's "Fast CRC Computation Using PCLMULQDQ".
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t updateClmul(uint32_t state, const uint8_t *data, size_t size){
+    if (size < 64)
+	return updateSlicing(state, data, size);
+    const __m128i k1k2 = _mm_set_epi64x(0x1c6e41596, 0x154442bd4);	// x^(512+-32)
+    const __m128i k3k4 = _mm_set_epi64x(0x0ccaa009e, 0x1751997d0);	// x^(128+-32)
+    const __m128i k5 = _mm_set_epi64x(0, 0x163cd6124);		// x^64
+    const __m128i poly = _mm_set_epi64x(0x1f7011641, 0x1db710641);	// mu, P
+    const __m128i mask32 = _mm_set_epi32(0, 0, 0, -1);
+    const __m128i *p = reinterpret_cast<const __m128i*>(data);
+
+    __m128i x1 = _mm_xor_si128(_mm_loadu_si128(p), _mm_cvtsi32_si128(state));
+    __m128i x2 = _mm_loadu_si128(p + 1);
+    __m128i x3 = _mm_loadu_si128(p + 2);
+    __m128i x4 = _mm_loadu_si128(p + 3);
+    for (p += 4, size -= 64; size >= 64; p += 4, size -= 64){
+	x1 = fold(x1, k1k2, _mm_loadu_si128(p));
+	x2 = fold(x2, k1k2, _mm_loadu_si128(p + 1));
+	x3 = fold(x3, k1k2, _mm_loadu_si128(p + 2));
+	x4 = fold(x4, k1k2, _mm_loadu_si128(p + 3));
+    }
+    x1 = fold(x1, k3k4, x2);
+    x1 = fold(x1, k3k4, x3);
+    x1 = fold(x1, k3k4, x4);
+    for (; size >= 16; p++, size -= 16)
+	x1 = fold(x1, k3k4, _mm_loadu_si128(p));
+
+    // 128 to 64 bits, then 64 to 32 bits with 32 zero bits appended
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), _mm_clmulepi64_si128(x1, k3k4, 0x10));
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k5, 0x00), x2);
+    // Barrett reduction
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), poly, 0x10);
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask32), poly, 0x00);
+    state = _mm_extract_epi32(_mm_xor_si128(x1, x2), 1);
+    return updateSlicing(state, reinterpret_cast<const uint8_t*>(p), size);
+}
+
+#endif
+
+static const SevenZCrcKernel crcKernels[] = {
+#ifdef CRC_X86
+    { "pclmul", updateClmul, clmulSupported },
+#endif
+    { "slice8", updateSlicing, slicingSupported }
+};
+
+const SevenZCrcKernel* sevenZCrcKernels(size_t *count){
+    *count = sizeof(crcKernels) / sizeof(crcKernels[0]);
+    return crcKernels;
+}
+
+static const SevenZCrcKernel* pickCrcKernel(){
+    size_t count;
+    const SevenZCrcKernel *all = sevenZCrcKernels(&count);
+    for (size_t i = 0; i < count; i++)
+	if (all[i].supported())
+	    return &all[i];
+    return &all[count - 1];
+}
+
+const SevenZCrcKernel* sevenZBestCrcKernel(){
+    static const SevenZCrcKernel *best = pickCrcKernel();
+    return best;
+}
+
+uint32_t sevenZCrcUpdate(uint32_t crc, const uint8_t *data, size_t size){
+    static uint32_t (*update)(uint32_t, const uint8_t*, size_t) = sevenZBestCrcKernel()->update;
+    return ~update(~crc, data, size);
+}
+
+uint32_t sevenZCrc(const uint8_t *data, size_t size){
+    return sevenZCrcUpdate(0, data, size);
+}
+
+SevenZCrcSource::SevenZCrcSource(SevenZSource *source): source(source), crc(0){
+}
+
+uint64_t SevenZCrcSource::fill(uint8_t *buffer, uint64_t size){
+    uint64_t filled = source->fill(buffer, size);
+    crc = sevenZCrcUpdate(crc, buffer, filled);
+    return filled;
+}
+
+SevenZSpan SevenZCrcSource::view(uint64_t size){
+    SevenZSpan span = source->view(size);
+    crc = sevenZCrcUpdate(crc, span.data, span.size);
+    return span;
+}
+
+uint32_t SevenZCrcSource::finish(){
+    while (view(UINT64_MAX).size > 0)
+	;
+    return crc;
+}
+
+static volatile uint32_t crcSink;	// keeps the benchmarked results alive
+
+/**
+ * GB/s of the kernel hashing the buffer again and again for 0.2 s
+ * @param kernel, data, size
+ */
+static double benchmarkCrc(const SevenZCrcKernel &kernel, const uint8_t *data, size_t size){
+    uint64_t bytes = 0;
+    uint32_t state = 0;
+    auto start = chrono::steady_clock::now();
+    double seconds = 0;
+    while (seconds < 0.2){
+	for (unsigned i = 0; i < 16; i++)
+	    state = kernel.update(state, data, size);
+	bytes += 16 * size;
+	seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+    crcSink = state;
+    return bytes / seconds / 1e9;
+}
+
+void sevenZCrcBenchmark(ostream &out){
+    static const size_t sizes[] = { 4 << 10, 256 << 10, 64 << 20 };
+    vector<uint8_t> buffer(sizes[2]);
+    uint32_t x = 1;
+    for (size_t i = 0; i < buffer.size(); i++){
+	x = x * 1103515245 + 12345;
+	buffer[i] = static_cast<uint8_t>(x >> 24);
+    }
+
+    out << "CRC-32 throughput" << endl;
+    size_t count;
+    const SevenZCrcKernel *all = sevenZCrcKernels(&count);
+    for (size_t k = 0; k < count; k++){
+	const SevenZCrcKernel &kernel = all[k];
+	if (!kernel.supported()){
+	    out << kernel.name << ": not supported by the CPU" << endl;
+	    continue;
+	}
+	char line[128];
+	int len = snprintf(line, sizeof(line), "%-8s", kernel.name);
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+	    len += snprintf(line + len, sizeof(line) - len, "  %6zu KiB %6.2f GB/s", sizes[s] >> 10,
+		    benchmarkCrc(kernel, buffer.data(), sizes[s]));
+	out << line << endl;
+    }
+}
@@ -0,0 +1,188 @@
+#include "SevenZDecoder.h"
+#include "SevenZError.h"
+
+#include <atomic>
+#include <thread>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+// runs are decoded concurrently, so the allocator must be thread safe
+static void *runAlloc(void *p, size_t size) { (void)p; return malloc(size); }
+static void runFree(void *p, void *address) { (void)p; free(address); }
+static ISzAlloc runAllocator = { runAlloc, runFree };
+
+static void truncatedLzma2(uint64_t pos){
+    ostringstream msg;
+    msg << "Something went wrong with decompression! LZMA2 chunk at " << pos
+	<< " is out of the packed stream.";
+    throw SevenZError(156, msg.str());
+}
+
+SevenZLzma2Decoder::SevenZLzma2Decoder(SevenZSpan packed, uint8_t prop):
+    packed(packed), prop(prop), unpackSize(0){
+
+    Byte props[LZMA_PROPS_SIZE];
+    if (Lzma2Dec_GetOldProps(prop, props) != SZ_OK)
+	throw SevenZError(156, "Unsupported LZMA2 properties.");
+
+    uint64_t pos = 0;
+    while (pos < packed.size){
+	const uint8_t *chunk = packed.data + pos;
+	uint8_t control = chunk[0];
+	if (control == 0){
+	    pos++;	// end marker
+	    break;
+	}
+	uint64_t hdrSize, inSize, outSize;
+	if (control & 0x80){
+	    // LZMA chunk, 0xC0 and higher carry new properties
+	    hdrSize = control >= 0xC0 ? 6 : 5;
+	    if (packed.size - pos < hdrSize)
+		truncatedLzma2(pos);
+	    outSize = (((uint64_t)(control & 0x1F) << 16) | (chunk[1] << 8) | chunk[2]) + 1;
+	    inSize = ((chunk[3] << 8) | chunk[4]) + 1;
+	} else if (control <= 2){
+	    // uncompressed chunk
+	    hdrSize = 3;
+	    if (packed.size - pos < hdrSize)
+		truncatedLzma2(pos);
+	    outSize = inSize = ((chunk[1] << 8) | chunk[2]) + 1;
+	} else {
+	    ostringstream msg;
+	    msg << "Something went wrong with decompression! Invalid LZMA2 chunk at " << pos << ".";
+	    throw SevenZError(156, msg.str());
+	}
+	if (inSize > packed.size - pos - hdrSize)
+	    truncatedLzma2(pos);
+
+	// 0x01 and 0xE0+ reset the dictionary, nothing after it looks back
+	if (runList.empty() || control == 1 || control >= 0xE0){
+	    if (!runList.empty())
+		runList.back().inSize = pos - runList.back().inPos;
+	    Run run = { pos, 0, unpackSize, 0 };
+	    runList.push_back(run);
+	}
+	runList.back().outSize += outSize;
+	unpackSize += outSize;
+	pos += hdrSize + inSize;
+    }
+    if (!runList.empty())
+	runList.back().inSize = pos - runList.back().inPos;
+}
+
+size_t SevenZLzma2Decoder::runs() const {
+    return runList.size();
+}
+
+uint64_t SevenZLzma2Decoder::size() const {
+    return unpackSize;
+}
+
+uint64_t SevenZLzma2Decoder::runSize(size_t run) const {
+    return runList[run].outSize;
+}
+
+uint64_t SevenZLzma2Decoder::largestRun() const {
+    uint64_t largest = 0;
+    for (size_t i = 0; i < runList.size(); i++)
+	if (runList[i].outSize > largest)
+	    largest = runList[i].outSize;
+    return largest;
+}
+
+SRes SevenZLzma2Decoder::decodeRun(const Run& run, uint8_t *dest){
+    // the run starts with a reset, so its output is a whole dictionary
+    SizeT outLen = run.outSize;
+    SizeT inLen = run.inSize;
+    ELzmaStatus status;
+    SRes res = Lzma2Decode(dest, &outLen, packed.data + run.inPos, &inLen,
+	    prop, LZMA_FINISH_ANY, &status, &runAllocator);
+    if (res == SZ_OK && outLen != run.outSize)
+	res = SZ_ERROR_DATA;
+    return res;
+}
+
+void SevenZLzma2Decoder::decode(uint8_t *dest, unsigned threads){
+    decode(0, runList.size(), dest, threads);
+}
+
+void SevenZLzma2Decoder::decode(size_t first, size_t last, uint8_t *dest, unsigned threads){
+    if (first >= last)
+	return;
+    vector<SRes> results(last - first, SZ_OK);
+    // dest starts with the output of the first run
+    uint64_t base = runList[first].outPos;
+
+    if (threads > last - first)
+	threads = last - first;
+    if (threads <= 1){
+	for (size_t i = first; i < last; i++)
+	    results[i - first] = decodeRun(runList[i], dest + runList[i].outPos - base);
+    } else {
+	atomic<size_t> next(first);
+	vector<thread> pool;
+	for (unsigned t = 0; t < threads; t++)
+	    pool.push_back(thread([&](){
+		size_t i;
+		while ((i = next++) < last)
+		    results[i - first] = decodeRun(runList[i], dest + runList[i].outPos - base);
+	    }));
+	for (unsigned t = 0; t < threads; t++)
+	    pool[t].join();
+    }
+
+    for (size_t i = first; i < last; i++)
+	if (results[i - first] != SZ_OK){
+	    ostringstream msg;
+	    msg << "Something went wrong with decompression! LZMA2 data error in run "
+		<< i << " at " << runList[i].inPos << ".";
+	    throw SevenZError(156, msg.str());
+	}
+}
+
+SevenZLzma2Source::SevenZLzma2Source(SevenZLzma2Decoder &decoder, unsigned threads, uint64_t windowSize):
+    decoder(decoder), threads(threads), windowSize(windowSize), nextRun(0), pos(0), end(0){
+}
+
+uint64_t SevenZLzma2Source::fill(uint8_t *buffer, uint64_t size){
+    uint64_t written = 0;
+    while (written < size){
+	SevenZSpan span = view(size - written);
+	if (span.size == 0)
+	    break;
+	memcpy(buffer + written, span.data, span.size);
+	written += span.size;
+    }
+    return written;
+}
+
+SevenZSpan SevenZLzma2Source::view(uint64_t size){
+    SevenZSpan span = { NULL, 0 };
+    if (pos == end && !decode())
+	return span;
+    span.data = window.data() + pos;
+    span.size = end - pos < size ? end - pos : size;
+    pos += span.size;
+    return span;
+}
+
+bool SevenZLzma2Source::decode(){
+    if (nextRun == decoder.runs())
+	return false;
+    // as many runs as fit into the window, at least one
+    size_t last = nextRun;
+    uint64_t bytes = 0;
+    do {
+	bytes += decoder.runSize(last++);
+    } while (last < decoder.runs() && bytes + decoder.runSize(last) <= windowSize);
+    if (window.size() < bytes)
+	window.resize(bytes);
+    decoder.decode(nextRun, last, window.data(), threads);
+    nextRun = last;
+    pos = 0;
+    end = bytes;
+    return true;
+}
@@ -0,0 +1,67 @@
+#include "SevenZFileTable.h"
+
+#include <cstdio>
+#include <cinttypes>
+
+using namespace std;
+
+#define FILE_ATTRIBUTE_DIRECTORY 0x10
+
+bool SevenZFileTable::isDir(uint64_t i) const {
+    if (attrib.has(i) && (attrib.values[i] & FILE_ATTRIBUTE_DIRECTORY))
+	return true;
+    // empty stream without the empty file bit is a directory
+    return !hasStream(i) && (emptyFile == NULL || !sevenZBit(emptyFile, i));
+}
+
+void SevenZFileTable::appendName(uint64_t i, string &dst) const {
+    if (names == NULL)
+	return;
+    const uint8_t *p = names + nameOffset[i];
+    const uint8_t *end = names + nameOffset[i + 1] - 2;	// without the terminator
+    while (p < end){
+	uint32_t c = p[0] | (p[1] << 8);
+	p += 2;
+	if (c >= 0xD800 && c < 0xDC00 && p < end){
+	    uint32_t low = p[0] | (p[1] << 8);
+	    if (low >= 0xDC00 && low < 0xE000){
+		c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+		p += 2;
+	    }
+	}
+	if (c < 0x80)
+	    dst += static_cast<char>(c);
+	else if (c < 0x800){
+	    dst += static_cast<char>(0xC0 | (c >> 6));
+	    dst += static_cast<char>(0x80 | (c & 0x3F));
+	} else if (c < 0x10000){
+	    dst += static_cast<char>(0xE0 | (c >> 12));
+	    dst += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+	    dst += static_cast<char>(0x80 | (c & 0x3F));
+	} else {
+	    dst += static_cast<char>(0xF0 | (c >> 18));
+	    dst += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+	    dst += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+	    dst += static_cast<char>(0x80 | (c & 0x3F));
+	}
+    }
+}
+
+void SevenZFileTable::printInfo(ostream &out) const {
+    out << "Number of files: " << numFiles << endl;
+    // one line buffer for all files, iostream formatting is too slow for millions of them
+    string line;
+    char fields[40];
+    for (uint64_t i = 0; i < numFiles; i++){
+	if (crc.has(i))
+	    snprintf(fields, sizeof(fields), "%12" PRIu64 " %08" PRIx32 " ", size[i], crc.values[i]);
+	else
+	    snprintf(fields, sizeof(fields), "%12" PRIu64 "          ", size[i]);
+	line.assign(fields);
+	appendName(i, line);
+	if (isDir(i))
+	    line += '/';
+	line += '\n';
+	out.write(line.data(), line.size());
+    }
+}
@@ -0,0 +1,150 @@
+#include "SevenZFilter.h"
+
+#include <cstring>
+
+using namespace std;
+
+SevenZSpanSource::SevenZSpanSource(SevenZSpan span): span(span), pos(0){
+}
+
+uint64_t SevenZSpanSource::fill(uint8_t *buffer, uint64_t size){
+    SevenZSpan data = view(size);
+    memcpy(buffer, data.data, data.size);
+    return data.size;
+}
+
+SevenZSpan SevenZSpanSource::view(uint64_t size){
+    if (size > span.size - pos)
+	size = span.size - pos;
+    SevenZSpan data = { span.data + pos, size };
+    pos += size;
+    return data;
+}
+
+SevenZFilterSource::SevenZFilterSource(SevenZSource *source):
+    source(source), buffer(FILTER_BUFFER), pos(0), done(0), end(0), last(false){
+}
+
+uint64_t SevenZFilterSource::fill(uint8_t *out, uint64_t size){
+    uint64_t written = 0;
+    while (written < size){
+	SevenZSpan span = view(size - written);
+	if (span.size == 0)
+	    break;
+	memcpy(out + written, span.data, span.size);
+	written += span.size;
+    }
+    return written;
+}
+
+SevenZSpan SevenZFilterSource::view(uint64_t size){
+    SevenZSpan span = { buffer.data() + pos, 0 };
+    if (pos == done && !refill())
+	return span;
+    span.data = buffer.data() + pos;
+    span.size = done - pos < size ? done - pos : size;
+    pos += span.size;
+    return span;
+}
+
+bool SevenZFilterSource::refill(){
+    while (pos == done){
+	if (last)
+	    return false;
+	// bytes waiting for the data after them go to the start
+	memmove(buffer.data(), buffer.data() + done, end - done);
+	end -= done;
+	pos = done = 0;
+	uint64_t n = source->fill(buffer.data() + end, buffer.size() - end);
+	end += n;
+	last = n == 0;
+	done = convert(buffer.data(), end, last);
+    }
+    return true;
+}
+
+SevenZBcjSource::SevenZBcjSource(SevenZSource *source):
+    SevenZFilterSource(source), ip(0), state(0){
+}
+
+static inline bool test86MSByte(uint8_t b){
+    return b == 0 || b == 0xFF;
+}
+
+size_t SevenZBcjSource::convert(uint8_t *data, size_t size, bool last){
+    static const uint8_t maskToAllowed[8] = { 1, 1, 1, 0, 1, 0, 0, 0 };
+    static const uint8_t maskToBitNumber[8] = { 0, 1, 2, 2, 3, 3, 3, 3 };
+    // the last 4 bytes of the stream are never converted
+    if (size < 5)
+	return last ? size : 0;
+
+    size_t bufferPos = 0, prevPos = (size_t)0 - 1;
+    uint32_t prevMask = state & 7;
+    uint32_t start = ip + 5;
+    for (;;){
+	uint8_t *p = data + bufferPos;
+	uint8_t *limit = data + size - 4;
+	for (; p < limit; p++)
+	    if ((*p & 0xFE) == 0xE8)
+		break;
+	bufferPos = p - data;
+	if (p >= limit)
+	    break;
+	prevPos = bufferPos - prevPos;
+	if (prevPos > 3)
+	    prevMask = 0;
+	else {
+	    prevMask = (prevMask << (prevPos - 1)) & 7;
+	    if (prevMask != 0){
+		uint8_t b = p[4 - maskToBitNumber[prevMask]];
+		if (!maskToAllowed[prevMask] || test86MSByte(b)){
+		    prevPos = bufferPos;
+		    prevMask = ((prevMask << 1) & 7) | 1;
+		    bufferPos++;
+		    continue;
+		}
+	    }
+	}
+	prevPos = bufferPos;
+
+	if (test86MSByte(p[4])){
+	    uint32_t src = (uint32_t(p[4]) << 24) | (uint32_t(p[3]) << 16) | (uint32_t(p[2]) << 8) | p[1];
+	    uint32_t dest;
+	    for (;;){
+		dest = src - (start + uint32_t(bufferPos));
+		if (prevMask == 0)
+		    break;
+		unsigned index = maskToBitNumber[prevMask] * 8;
+		if (!test86MSByte(static_cast<uint8_t>(dest >> (24 - index))))
+		    break;
+		src = dest ^ ((1U << (32 - index)) - 1);
+	    }
+	    p[4] = static_cast<uint8_t>(~(((dest >> 24) & 1) - 1));
+	    p[3] = static_cast<uint8_t>(dest >> 16);
+	    p[2] = static_cast<uint8_t>(dest >> 8);
+	    p[1] = static_cast<uint8_t>(dest);
+	    bufferPos += 5;
+	} else {
+	    prevMask = ((prevMask << 1) & 7) | 1;
+	    bufferPos++;
+	}
+    }
+    prevPos = bufferPos - prevPos;
+    state = prevPos > 3 ? 0 : ((prevMask << (prevPos - 1)) & 7);
+    ip += bufferPos;
+    return last ? size : bufferPos;
+}
+
+SevenZDeltaSource::SevenZDeltaSource(SevenZSource *source, unsigned distance):
+    SevenZFilterSource(source), distance(distance), pos(0){
+    memset(history, 0, sizeof(history));
+}
+
+size_t SevenZDeltaSource::convert(uint8_t *data, size_t size, bool last){
+    (void)last;
+    for (size_t i = 0; i < size; i++, pos++){
+	data[i] += history[static_cast<uint8_t>(pos - distance)];
+	history[pos] = data[i];
+    }
+    return size;
+}
@@ -1,5 +1,11 @@
 
 #include "SevenZFormat.h"
+#include "SevenZCrc.h"
+#include "SevenZDecoder.h"
+#include "SevenZHash.h"
+#include "SevenZTrace.h"
+
+#include <cstring>
 
 /**
  *    Functions needed for LZMA decompression
@@ -8,8 +14,38 @@ void *SzAlloc(void *p, size_t size) { p = p; return malloc(size); }
 void SzFree(void *p, void *address) { p = p; free(address); }
 ISzAlloc alloc = { SzAlloc, SzFree };
 
+/**
+ * Charges the time spent in another source to a phase and counts its data
+ * (bytes can be NULL)
+ */
+class SevenZTimedSource: public SevenZSource {
+public:
+    SevenZTimedSource(SevenZSource *source, SevenZPhaseClock *clock, SevenZPhase phase, uint64_t *bytes):
+	source(source), clock(clock), phase(phase), bytes(bytes) {}
+    uint64_t fill(uint8_t *buffer, uint64_t size){
+	SevenZPhaseTimer timer(clock, phase);
+	uint64_t n = source->fill(buffer, size);
+	if (bytes != NULL)
+	    *bytes += n;
+	return n;
+    }
+    SevenZSpan view(uint64_t size){
+	SevenZPhaseTimer timer(clock, phase);
+	SevenZSpan span = source->view(size);
+	if (bytes != NULL)
+	    *bytes += span.size;
+	return span;
+    }
+
+private:
+    SevenZSource *source;
+    SevenZPhaseClock *clock;
+    SevenZPhase phase;
+    uint64_t *bytes;
+};
+
 // Class SevenZFormat
-SevenZFormat::SevenZFormat(){
+SevenZFormat::SevenZFormat(): discard(NULL), clock(stats){
     signature = "7z\xBC\xAF\x27\x1C";
     ext = "7z";
     name = "SevenZ";
@@ -19,355 +55,863 @@ SevenZFormat::SevenZFormat(){
      * so we suppose, it is.
      */
     is_encrypted = true;
+    codersInEncHdr = 0;
+    out = &cout;
+    archive = &mappedFile;
+    crackData = false;
+    threads = 1;
+    verifyCrc = false;
+    hashOutput = false;
+    truncate = 0;
+    statsEnabled = false;
+    perfEnabled = false;
+    perfOpened = false;
+    measuring = false;
+    openedAt = 0;
+    allocBase = 0;
 }
 
-SevenZFormat::SevenZFormat(const SevenZFormat& orig){
+SevenZFormat::SevenZFormat(const SevenZFormat& orig): discard(NULL), clock(stats){
+    out = orig.out;
+    archive = &mappedFile;
+    crackData = orig.crackData;
+    threads = orig.threads;
+    verifyCrc = orig.verifyCrc;
+    hashOutput = orig.hashOutput;
+    truncate = orig.truncate;
+    statsEnabled = orig.statsEnabled;
+    perfEnabled = orig.perfEnabled;
+    perfOpened = false;
+    measuring = false;
+    openedAt = 0;
+    allocBase = 0;
 }
 
 SevenZFormat::~SevenZFormat(){   
 }
 
-uint64_t SevenZFormat::SevenZUINT64(ifstream *stream){
-    int bytes = 1;
-    uint8_t firstByte;
-
-    stream->read(reinterpret_cast<char*>(&firstByte), 1);
-    while (firstByte & 0x80){
-	SHL(firstByte);
-	bytes++;
-    }
-
-    uint8_t num[bytes];
-    num[0] = firstByte >> (bytes - 1);    // MSB
-    if (bytes > 1)
-	stream->read(reinterpret_cast<char*>(&num[1]), bytes-1);
-
-    uint64_t sum = num[0];
-    while(--bytes){
-	sum = sum << 8;
-	sum += num[bytes];
-    }
-    return sum;
-}
-
-SevenZStartHdr SevenZFormat::readStartHdr(ifstream *stream){
+SevenZStartHdr SevenZFormat::readStartHdr(SevenZCursor *cur){
 
     SevenZStartHdr header;
-    stream->seekg(12,stream->cur);   // 6 signature, 2 version, 4 sigCRC
-    stream->read(reinterpret_cast<char*>(&header.NxtHdrOffset),sizeof(uint64_t));
-    stream->read(reinterpret_cast<char*>(&header.NxtHdrSize),sizeof(uint64_t));
-    stream->seekg(4,stream->cur);   // NextHeaderCRC
+    char sig[6];
+    cur->bytes(sig, 6);
+    if (signature.compare(0, 6, sig, 6) != 0)
+	throw SevenZError(158, "Not a 7z archive, signature does not match.");
+    cur->skip(2);   // version
+    uint32_t startCRC = cur->uint32();
+    // NextHeaderOffset, NextHeaderSize and NextHeaderCRC
+    uint8_t fields[20];
+    cur->bytes(fields, sizeof(fields));
+    if (sevenZCrc(fields, sizeof(fields)) != startCRC)
+	throw SevenZError(155, "Header is corrupted. Start header CRC does not match.");
+    SevenZSpan span = { fields, sizeof(fields) };
+    SevenZCursor start(span);
+    header.NxtHdrOffset = start.uint64();
+    header.NxtHdrSize = start.uint64();
+    header.NxtHdrCRC = start.uint32();
 
     return header;
 }
 
-SevenZFolder SevenZFormat::readFolder(ifstream *stream){
+SevenZFolder SevenZFormat::readFolder(SevenZCursor *cur){
     SevenZFolder folder;
-    folder.numCoders = SevenZUINT64(stream);
-    folder.coder = new SevenZCoder[folder.numCoders];
-    for (uint8_t i = 0; i < folder.numCoders; i++){
+    folder.numCoders = readCount(cur);
+    folder.coder = arena.alloc<SevenZCoder>(folder.numCoders);
+    for (uint64_t i = 0; i < folder.numCoders; i++){
 	SevenZCoder *coder = &(folder.coder[i]); 
-	stream->read(reinterpret_cast<char*>(&coder->flags), 1);
+	coder->flags = cur->byte();
 	coder->coderIDSize = (coder->flags & 0x0f);
-	coder->coderID = new uint8_t[coder->coderIDSize];
-	stream->read(reinterpret_cast<char*>(coder->coderID), coder->coderIDSize);
+	coder->coderID = arena.alloc<uint8_t>(coder->coderIDSize);
+	cur->bytes(coder->coderID, coder->coderIDSize);
 	// most important and common IDs:
 	// 03 01 01 - 7z LZMA
 	// 06 f1 07 01 - 7zAES (AES-256 + SHA-256)
 
 	if (coder->flags & 0x10){
-	    coder->numInStreams = SevenZUINT64(stream);
+	    coder->numInStreams = readCount(cur);
 	    folder.numInStreamsTotal += coder->numInStreams;
 
-	    coder->numOutStreams = SevenZUINT64(stream);
+	    coder->numOutStreams = readCount(cur);
 	    folder.numOutStreamsTotal += coder->numOutStreams;
 	}else {
-	    // TODO: check this in the 7z sources
+	    // simple coder, one stream in and one out
+	    coder->numInStreams = 1;
+	    coder->numOutStreams = 1;
 	    folder.numInStreamsTotal++;
 	    folder.numOutStreamsTotal++;
 	}
+	coder->propertySize = 0;
+	coder->property = NULL;
 	if (coder->flags & 0x20){
-	    coder->propertySize = SevenZUINT64(stream);
-	    coder->property = new uint8_t[coder->propertySize];
-	    stream->read(reinterpret_cast<char*>(coder->property), coder->propertySize);
-	    //    for (int x = coder->propertySize; x > 0; x--)
-	    //	stream->read(reinterpret_cast<char*>(&(coder->property[x-1])),1);
+	    coder->propertySize = readCount(cur);
+	    coder->property = arena.alloc<uint8_t>(coder->propertySize);
+	    cur->bytes(coder->property, coder->propertySize);
 	}
     }
+    if (folder.numOutStreamsTotal == 0)
+	throw SevenZError(155, "Header is corrupted. Folder has no coders.");
+    // every bind pair takes two bytes at least
+    if (folder.numOutStreamsTotal - 1 > cur->remaining() / 2)
+	throw SevenZError(155, "Header is corrupted. Folder has more streams than the header can bind.");
+    vector<bool> bound(folder.numOutStreamsTotal);
+    folder.bindIn = arena.alloc<uint64_t>(folder.numOutStreamsTotal - 1);
+    folder.bindOut = arena.alloc<uint64_t>(folder.numOutStreamsTotal - 1);
     for (uint64_t i = 0; i < (folder.numOutStreamsTotal - 1); i++){
-	folder.inIndex = SevenZUINT64(stream);
-	folder.outIndex = SevenZUINT64(stream);
+	folder.inIndex = folder.bindIn[i] = cur->number();
+	folder.outIndex = folder.bindOut[i] = cur->number();
+	if (folder.outIndex < folder.numOutStreamsTotal)
+	    bound[folder.outIndex] = true;
     }
+    // the only out stream which is not bound to another coder is the final one
+    folder.mainOutStream = 0;
+    while (folder.mainOutStream + 1 < folder.numOutStreamsTotal && bound[folder.mainOutStream])
+	folder.mainOutStream++;
 
     uint64_t numPackStreams = folder.numInStreamsTotal - (folder.numOutStreamsTotal - 1);
     if (numPackStreams > 1){
 	numPackStreams--;
-	folder.index = new uint64_t[numPackStreams];
-	for (uint8_t i = 0; i < numPackStreams; i++)	
-	    folder.index[i] = SevenZUINT64(stream);
+	folder.index = arena.alloc<uint64_t>(numPackStreams);
+	for (uint64_t i = 0; i < numPackStreams; i++)
+	    folder.index[i] = cur->number();
     }
     return folder;
 }
 
-uint32_t* SevenZFormat::CRCHdr(ifstream *stream, uint64_t numPackStreams,bool skip){ 
-    uint32_t* crc;
+uint64_t SevenZFormat::readCount(SevenZCursor *cur){
+    uint64_t count = cur->number();
+    if (count > cur->remaining())
+	throw SevenZError(155, "Header is corrupted. Count is bigger than the rest of the header.");
+    return count;
+}
+
+uint32_t* SevenZFormat::CRCHdr(SevenZCursor *cur, uint64_t numPackStreams, bool skip, uint8_t **defined){ 
+    uint32_t* crc = NULL;
     if (!skip)
-	crc = new uint32_t[numPackStreams];
-    //  for (uint64_t i = 0; i < numPackStreams; i++){
-    uint8_t aad;
-    stream->read(reinterpret_cast<char*>(&aad), 1);
-    if (aad == 0){
-	cerr << "File reading error. AllAreDefined == 0." << endl; // TODO: figure out how AAD works
-	exit(153);
-    }
-    for (uint8_t j = 0; j < numPackStreams; j++)
-	if(skip)
-	    stream->seekg(4, stream->cur);
-	else
-	    stream->read(reinterpret_cast<char*>(&(crc[j])), 4);  // CRCs[NumDefined]
-    //}
-    return (skip ? NULL : crc);
+	crc = arena.alloc<uint32_t>(numPackStreams);
+
+    // AllAreDefined, otherwise bit field of defined CRCs follows
+    uint8_t *bits = readDefined(cur, numPackStreams);
+    for (uint64_t j = 0; j < numPackStreams; j++){
+	bool isDefined = bits == NULL || sevenZBit(bits, j);
+	if (skip){
+	    if (isDefined)
+		cur->skip(4);
+	} else
+	    crc[j] = isDefined ? cur->uint32() : 0;  // CRCs[NumDefined]
+    }
+    if (defined != NULL)
+	*defined = bits;
+    return crc;
 }
 
-void SevenZFormat::PackInfoHdr(ifstream *stream){	
-    SevenZPackInfoHdr *packInfo = new SevenZPackInfoHdr;
-    packInfo->packPos = 32 + SevenZUINT64(stream); // offset starting at 0x20 after startHeader
-    packInfo->numPackStreams = SevenZUINT64(stream);
+uint8_t* SevenZFormat::readBits(SevenZCursor *cur, uint64_t count){
+    uint64_t size = count / 8 + (count % 8 != 0);
+    uint8_t *bits = arena.alloc<uint8_t>(size);
+    cur->bytes(bits, size);
+    return bits;
+}
+
+uint8_t* SevenZFormat::readDefined(SevenZCursor *cur, uint64_t count){
+    if (cur->byte() != 0)
+	return NULL;	// AllAreDefined
+    return readBits(cur, count);
+}
+
+void SevenZFormat::PackInfoHdr(SevenZCursor *cur){	
+    SevenZPackInfoHdr *packInfo = arena.alloc<SevenZPackInfoHdr>(1);
+    packInfo->packPos = 32 + cur->number(); // offset starting at 0x20 after startHeader
+    packInfo->numPackStreams = readCount(cur);
 
     uint8_t subsubHdrID = 1; // we just have to get into the cycle
     while (subsubHdrID != 0){   
-	stream->read(reinterpret_cast<char*>(&subsubHdrID), 1);
+	subsubHdrID = cur->byte();
 	if (subsubHdrID == SIZE){   
-	    packInfo->packSize = new uint64_t[packInfo->numPackStreams];
+	    packInfo->packSize = arena.alloc<uint64_t>(packInfo->numPackStreams);
 	    for (uint64_t i = 0; i < packInfo->numPackStreams; i++)
-		packInfo->packSize[i] = SevenZUINT64(stream);
+		packInfo->packSize[i] = cur->number();
 	}else if (subsubHdrID == CRC){
-	    // packInfo->crc = new uint32_t[packInfo->numPackStreams];
-	    for (uint64_t i = 0; i < packInfo->numPackStreams; i++)
-		packInfo->crc = CRCHdr(stream, packInfo->numPackStreams, READ);
+	    packInfo->crc = CRCHdr(cur, packInfo->numPackStreams, READ, &packInfo->crcDefined);
 	}
     }
+    if (packInfo->packSize == NULL && packInfo->numPackStreams > 0)
+	throw SevenZError(155, "Header is corrupted. Sizes of packed streams are missing.");
     data.packInfo = packInfo;
 }
 
-void SevenZFormat::CodersHdr(ifstream *stream){	
-    uint8_t subsubHdrID;
-    stream->read(reinterpret_cast<char*>(&subsubHdrID), 1);	// (FOLDER)
+void SevenZFormat::CodersHdr(SevenZCursor *cur){	
+    uint8_t subsubHdrID = cur->byte();	// (FOLDER)
 
-    data.numFolders = SevenZUINT64(stream);
-    data.folders = new SevenZFolder[data.numFolders];
-    uint8_t ext;
-    stream->read(reinterpret_cast<char*>(&ext), 1);
-    if (ext == 1){
-	cerr << "Unsupporte value. External == 1." << endl;	// TODO: add support for work with datastream indexes
-	exit(154);
+    data.numFolders = readCount(cur);
+    data.folders = arena.alloc<SevenZFolder>(data.numFolders);
+    if (cur->byte() == 1){	// External
+	throw SevenZError(154, "Unsupporte value. External == 1.");	// TODO: add support for work with datastream indexes
     }else{
 	for (uint64_t i = 0; i < data.numFolders; i++)
-	    data.folders[i] = readFolder(stream);
+	    data.folders[i] = readFolder(cur);
     }
 
-    stream->read(reinterpret_cast<char*>(&subsubHdrID), 1);	//(CODERUNPACKSIZE)
+    subsubHdrID = cur->byte();	//(CODERUNPACKSIZE)
     if (subsubHdrID == CODERUNPACKSIZE){
 	for (uint64_t i = 0; i < data.numFolders; i++){
-	    data.folders[i].unPackSize = new uint64_t[data.folders[i].numOutStreamsTotal];
+	    data.folders[i].unPackSize = arena.alloc<uint64_t>(data.folders[i].numOutStreamsTotal);
 	    for (uint64_t j = 0; j < data.folders[i].numOutStreamsTotal; j++)
 	    {
-		data.folders[i].unPackSize[j] = SevenZUINT64(stream);
+		data.folders[i].unPackSize[j] = cur->number();
 	    }
 	}
-	stream->read(reinterpret_cast<char*>(&subsubHdrID), 1);	// (CRC)
+	subsubHdrID = cur->byte();	// (CRC)
     }
+    if (data.numFolders > 0 && data.folders[0].unPackSize == NULL)
+	throw SevenZError(155, "Header is corrupted. Sizes of unpacked streams are missing.");
 
     if (subsubHdrID == CRC){	    
-	data.packInfo->crc = CRCHdr(stream, data.numFolders, READ);
+	uint8_t *defined;
+	uint32_t *crc = CRCHdr(cur, data.numFolders, READ, &defined);
+	for (uint64_t i = 0; i < data.numFolders; i++){
+	    data.folders[i].unPackCRC = crc[i];
+	    data.folders[i].unPackCRCDefined = defined == NULL || sevenZBit(defined, i);
+	}
+	subsubHdrID = cur->byte();	// (END)
     }
+}
 
-    stream->read(reinterpret_cast<char*>(&subsubHdrID), 1);	// (END)
-
+void SevenZFormat::initSubStreams(){
+    data.numUnpackStreams = arena.alloc<uint64_t>(data.numFolders);
+    for (uint64_t i = 0; i < data.numFolders; i++)
+	data.numUnpackStreams[i] = 1;
+    data.numSubStreams = data.numFolders;
+    data.subStreamSize = NULL;
 }
 
-void SevenZFormat::SubStreamInfoHdr(ifstream *stream){
+void SevenZFormat::SubStreamInfoHdr(SevenZCursor *cur){
     uint8_t subsubHdrID = 1;
-    uint64_t unpackStreamsInFolders = 0;
+    uint32_t *digests = NULL;
+    uint8_t *digestDefined = NULL;
+    initSubStreams();
+
     while (subsubHdrID != 0){
-	stream->read(reinterpret_cast<char*>(&subsubHdrID), 1); 
+	subsubHdrID = cur->byte(); 
 	if (subsubHdrID == NUMUNPACKSTR){
-	    cout << "numFolders: " << data.numFolders << endl;
-	    for (uint64_t i = 0; i < data.numFolders; i++)
-		unpackStreamsInFolders += SevenZUINT64(stream);
+	    trace() << "numFolders: " << data.numFolders << endl;
+	    data.numSubStreams = 0;
+	    for (uint64_t i = 0; i < data.numFolders; i++){
+		data.numUnpackStreams[i] = cur->number();
+		data.numSubStreams += data.numUnpackStreams[i];
+		// all but one stream of a folder have their size in the header
+		if (data.numUnpackStreams[i] > cur->remaining() + 1 ||
+			data.numSubStreams > data.numFolders + cur->remaining())
+		    throw SevenZError(155, "Header is corrupted. Number of substreams does not fit into the header.");
+	    }
 	}
 	if (subsubHdrID == SIZE){
-	    if(unpackStreamsInFolders == 0)
-		unpackStreamsInFolders = 1;
-	    data.subStreamSize = new uint64_t[data.numFolders];
-	    for (uint64_t i = 0; i < data.numFolders; i++)
-		data.subStreamSize[i] = SevenZUINT64(stream);
+	    // last size in every folder is not stored, it is the rest of the folder
+	    data.subStreamSize = arena.alloc<uint64_t>(data.numSubStreams);
+	    uint64_t k = 0;
+	    for (uint64_t i = 0; i < data.numFolders; i++){
+		uint64_t sum = 0;
+		if (data.numUnpackStreams[i] == 0)
+		    continue;
+		for (uint64_t j = 1; j < data.numUnpackStreams[i]; j++){
+		    data.subStreamSize[k] = cur->number();
+		    sum += data.subStreamSize[k++];
+		}
+		if (sum > data.folders[i].getUnPackSize())
+		    throw SevenZError(155, "Header is corrupted. Substreams are bigger than their folder.");
+		data.subStreamSize[k++] = data.folders[i].getUnPackSize() - sum;
+	    }
 	}
 	if (subsubHdrID == CRC){
-	    uint32_t end[3] = {0xff,0xff,0xff};
+	    // digests are stored only for streams whose CRC is not known from the folder
 	    uint64_t count = 0;
-	    stream->seekg(1, stream->cur);
-	    while ((end[0] != 0x00 && end[1] != 0x00 && end[2] !=0x05 ) && count < 5){
-		stream->seekg(4,stream->cur);
-		stream->read(reinterpret_cast<char*>(&end[0]),1);
-		stream->read(reinterpret_cast<char*>(&end[1]),1);
-		stream->read(reinterpret_cast<char*>(&end[2]),1);
-		stream->seekg(-3,stream->cur);
-		//		cout << hex << "end[0]: " << end[0];
-		//		cout << " end[1]: " << end[1];
-		//		cout << " end[2]: " << end[2] << endl;
-		count++;
-	    }
-	    stream->seekg(-4*count-1, stream->cur);
-	    data.packInfo->crc = CRCHdr(stream, count, READ);
+	    for (uint64_t i = 0; i < data.numFolders; i++)
+		if (data.numUnpackStreams[i] != 1 || !data.folders[i].unPackCRCDefined)
+		    count += data.numUnpackStreams[i];
+	    digests = CRCHdr(cur, count, READ, &digestDefined);
 	}
     }
+    resolveSubStreams(digests, digestDefined);
 }
 
-void SevenZFormat::readHeader(ifstream *stream){
-    uint8_t subHdrID = 1;   // we just wanna get into the cycle
-    while (subHdrID != 0){   // End 
-	stream->read(reinterpret_cast<char*>(&subHdrID), 1);
-	if (subHdrID == PACKINFO)
-	    PackInfoHdr(stream);
-	else if (subHdrID == UNPACKINFO){ 
-	    CodersHdr(stream);
-	    if (data.packInfo->crc == NULL)
-		SubStreamInfoHdr(stream);
-	    subHdrID = 0;	// fixed end we have all info we need
+void SevenZFormat::resolveSubStreams(const uint32_t *digests, const uint8_t *digestDefined){
+    if (data.subStreamSize == NULL){
+	// sizes are not stored when no folder has more streams
+	data.subStreamSize = arena.alloc<uint64_t>(data.numSubStreams);
+	uint64_t k = 0;
+	for (uint64_t i = 0; i < data.numFolders; i++){
+	    if (data.numUnpackStreams[i] > 1)
+		throw SevenZError(155, "Header is corrupted. Sizes of substreams are missing.");
+	    if (data.numUnpackStreams[i] == 1)
+		data.subStreamSize[k++] = data.folders[i].getUnPackSize();
+	}
+    }
+
+    uint64_t bytes = data.numSubStreams / 8 + (data.numSubStreams % 8 != 0);
+    data.streamCRC.values = arena.alloc<uint32_t>(data.numSubStreams);
+    data.streamCRC.defined = arena.alloc<uint8_t>(bytes);
+    memset(data.streamCRC.defined, 0, bytes);
+    uint64_t k = 0, d = 0;
+    for (uint64_t i = 0; i < data.numFolders; i++){
+	if (data.numUnpackStreams[i] == 1 && data.folders[i].unPackCRCDefined){
+	    data.streamCRC.values[k] = data.folders[i].unPackCRC;
+	    data.streamCRC.defined[k >> 3] |= 0x80 >> (k & 7);
+	    k++;
+	    continue;
+	}
+	for (uint64_t j = 0; j < data.numUnpackStreams[i]; j++, k++, d++)
+	    if (digests != NULL && (digestDefined == NULL || sevenZBit(digestDefined, d))){
+		data.streamCRC.values[k] = digests[d];
+		data.streamCRC.defined[k >> 3] |= 0x80 >> (k & 7);
+	    }
+    }
+}
+
+void SevenZFormat::FilesInfoHdr(SevenZCursor *cur){
+    SevenZFileTable *files = arena.alloc<SevenZFileTable>(1);
+    files->numFiles = cur->number();
+    uint64_t n = files->numFiles;
+    // files without a stream take a bit of EmptyStream each, so the streams
+    // and the rest of the header bound the columns allocated below
+    if (n == UINT64_MAX || (n > data.numSubStreams && (n - data.numSubStreams) / 8 > cur->remaining()))
+	throw SevenZError(155, "Header is corrupted. Number of files does not fit into the header.");
+    uint8_t *emptyFile = NULL, *anti = NULL;
+
+    uint8_t type;
+    while ((type = cur->byte()) != END){
+	uint64_t size = cur->number();
+	uint64_t start = cur->tell();
+	if (size > cur->remaining())
+	    throw SevenZError(155, "Header is corrupted. File property is bigger than the header.");
+	switch (type){
+	    case EMPTYSTREAM:
+		files->emptyStream = readBits(cur, n);
+		files->numEmptyStreams = 0;
+		for (uint64_t i = 0; i < n; i++)
+		    files->numEmptyStreams += sevenZBit(files->emptyStream, i);
+		break;
+	    case EMPTYFILE:
+		emptyFile = readBits(cur, files->numEmptyStreams);
+		break;
+	    case ANTI:
+		anti = readBits(cur, files->numEmptyStreams);
+		break;
+	    case NAME: {
+		if (cur->byte() != 0)
+		    throw SevenZError(154, "Unsupporte value. External == 1.");
+		// every name has at least its terminating zero
+		if (size < 1 || (size - 1) % 2 != 0 || n > (size - 1) / 2)
+		    throw SevenZError(155, "Header is corrupted. Wrong size of file names.");
+		uint8_t *names = arena.alloc<uint8_t>(size - 1);
+		cur->bytes(names, size - 1);
+		// names are zero terminated, every file has one
+		files->nameOffset = arena.alloc<uint64_t>(n + 1);
+		uint64_t k = 0;
+		files->nameOffset[0] = 0;
+		for (uint64_t pos = 0; pos < size - 1 && k < n; pos += 2)
+		    if (names[pos] == 0 && names[pos + 1] == 0)
+			files->nameOffset[++k] = pos + 2;
+		if (k != n)
+		    throw SevenZError(155, "Header is corrupted. File names do not match number of files.");
+		files->names = names;
+		break;
+	    }
+	    case CTIME:
+	    case ATIME:
+	    case MTIME: {
+		SevenZColumn<uint64_t> &column = type == CTIME ? files->ctime :
+			(type == ATIME ? files->atime : files->mtime);
+		column.defined = readDefined(cur, n);
+		if (cur->byte() != 0)
+		    throw SevenZError(154, "Unsupporte value. External == 1.");
+		column.values = arena.alloc<uint64_t>(n);
+		for (uint64_t i = 0; i < n; i++)
+		    if (column.defined == NULL || sevenZBit(column.defined, i))
+			column.values[i] = cur->uint64();
+		break;
+	    }
+	    case WINATTRIB:
+		files->attrib.defined = readDefined(cur, n);
+		if (cur->byte() != 0)
+		    throw SevenZError(154, "Unsupporte value. External == 1.");
+		files->attrib.values = arena.alloc<uint32_t>(n);
+		for (uint64_t i = 0; i < n; i++)
+		    if (files->attrib.defined == NULL || sevenZBit(files->attrib.defined, i))
+			files->attrib.values[i] = cur->uint32();
+		break;
+	    default:
+		cur->skip(size);    // kDummy, kStartPos and unknown properties
+	}
+	if (cur->tell() - start != size)
+	    throw SevenZError(155, "Header is corrupted. Wrong size of file property.");
+    }
+
+    if (n - files->numEmptyStreams != data.numSubStreams || files->numEmptyStreams > n)
+	throw SevenZError(155, "Header is corrupted. Number of files does not match the streams.");
 
+    // empty file and anti bits are stored per empty stream, spread them to files
+    uint64_t bytes = n / 8 + (n % 8 != 0);
+    if (emptyFile != NULL || anti != NULL){
+	if (emptyFile != NULL){
+	    files->emptyFile = arena.alloc<uint8_t>(bytes);
+	    memset(files->emptyFile, 0, bytes);
+	}
+	if (anti != NULL){
+	    files->anti = arena.alloc<uint8_t>(bytes);
+	    memset(files->anti, 0, bytes);
+	}
+	for (uint64_t i = 0, e = 0; i < n; i++){
+	    if (files->hasStream(i))
+		continue;
+	    if (emptyFile != NULL && sevenZBit(emptyFile, e))
+		files->emptyFile[i >> 3] |= 0x80 >> (i & 7);
+	    if (anti != NULL && sevenZBit(anti, e))
+		files->anti[i >> 3] |= 0x80 >> (i & 7);
+	    e++;
 	}
     }
+
+    // sizes and CRCs of the substreams belong to files with stream in order
+    files->size = arena.alloc<uint64_t>(n);
+    files->crc.values = arena.alloc<uint32_t>(n);
+    files->crc.defined = arena.alloc<uint8_t>(bytes);
+    memset(files->crc.defined, 0, bytes);
+    for (uint64_t i = 0, k = 0; i < n; i++){
+	files->size[i] = 0;
+	if (!files->hasStream(i))
+	    continue;
+	files->size[i] = data.subStreamSize[k];
+	if (data.streamCRC.has(k)){
+	    files->crc.values[i] = data.streamCRC.values[k];
+	    files->crc.defined[i >> 3] |= 0x80 >> (i & 7);
+	}
+	k++;
+    }
+    data.files = files;
 }
 
-void SevenZFormat::copyStreamToBuffer(ifstream *stream, uint64_t pos, uint64_t size, uint8_t **buffer){
+void SevenZFormat::readStreamsInfo(SevenZCursor *cur){
+    bool subStreams = false;
+    uint8_t subHdrID;
+    while ((subHdrID = cur->byte()) != END){
+	if (subHdrID == PACKINFO)
+	    PackInfoHdr(cur);
+	else if (subHdrID == UNPACKINFO)
+	    CodersHdr(cur);
+	else if (subHdrID == SUBSTRINFO){
+	    SubStreamInfoHdr(cur);
+	    subStreams = true;
+	} else
+	    throw SevenZError(155, "Header is corrupted. Unknown ID in StreamsInfo.");
+    }
+    if (!subStreams && data.folders != NULL){
+	initSubStreams();
+	resolveSubStreams(NULL, NULL);
+    }
+}
+
+void SevenZFormat::readHeader(SevenZCursor *cur){
+    SevenZTraceSpan span("readHeader");
+    uint8_t subHdrID = cur->byte();
+    if (subHdrID == ARCHPROP){
+	// archive properties are not used by 7-Zip, skip them
+	while (cur->byte() != END)
+	    cur->skip(cur->number());
+	subHdrID = cur->byte();
+    }
+    if (subHdrID == ADDSTRINFO)
+	throw SevenZError(154, "Unsupported value. Additional streams are not supported.");
+    if (subHdrID == MSTRINFO){
+	readStreamsInfo(cur);
+	subHdrID = cur->byte();
+    }
+    if (subHdrID == FILESINFO){
+	FilesInfoHdr(cur);
+	subHdrID = cur->byte();
+    }
+    if (subHdrID != END)
+	throw SevenZError(155, "Header is corrupted. Unknown ID in Header.");
+}
 
-    // save state of stream
-    streampos save_pos = stream->tellg();
+void SevenZFormat::readDecodedHeader(SevenZCursor *cur){
+    uint8_t hdrID = cur->byte();
+    if (hdrID == ENCHDR)
+	throw SevenZError(154, "Unsupported value. Decoded header is encoded again.");
+    if (hdrID != HDR)
+	throw SevenZError(155, "Header is corrupted. Decoded data are not a header.");
+    // streams of the encoded header must not leak into a header without
+    // MainStreamsInfo, the arena keeps them for hdrFolder
+    data.folders = NULL;
+    data.numFolders = 0;
+    data.packInfo = NULL;
+    data.numUnpackStreams = NULL;
+    data.subStreamSize = NULL;
+    data.numSubStreams = 0;
+    data.streamCRC = SevenZColumn<uint32_t>();
+    readHeader(cur);
+}
 
+void SevenZFormat::readDecodedHeader(SevenZSource *source, uint64_t size, bool crcDefined, uint32_t crc){
+    if (!verifyCrc || !crcDefined){
+	SevenZCursor hdr(source, size);
+	readDecodedHeader(&hdr);
+	return;
+    }
+    // the CRC is charged to its phase, the decoding under it to its own
+    SevenZCrcSource checked(source);
+    SevenZTimedSource timed(&checked, phaseClock(), CrcPhase, NULL);
+    SevenZCursor hdr(&timed, size);
+    readDecodedHeader(&hdr);
+    uint32_t decodedCrc;
+    {
+	SevenZPhaseTimer timer(phaseClock(), CrcPhase);
+	decodedCrc = checked.finish();
+    }
+    if (decodedCrc != crc)
+	throw SevenZError(155, "Header is corrupted. Decoded header CRC does not match.");
+}
 
-    stream->seekg(pos, stream->beg);
-    *buffer = new uint8_t[size];
-    stream->read(reinterpret_cast<char*>(*buffer), size);
+void SevenZFormat::verifyPackedStreams(){
+    const SevenZPackInfoHdr *packInfo = data.packInfo;
+    if (packInfo == NULL || packInfo->crc == NULL || packInfo->packSize == NULL)
+	return;
+    uint64_t pos = packInfo->packPos;
+    for (uint64_t i = 0; i < packInfo->numPackStreams; i++){
+	uint64_t size = packInfo->packSize[i];
+	if (packInfo->crcDefined == NULL || sevenZBit(packInfo->crcDefined, i)){
+	    SevenZSpan span = streamSpan(pos, size);
+	    SevenZPhaseTimer timer(phaseClock(), CrcPhase);
+	    if (sevenZCrc(span.data, span.size) != packInfo->crc[i]){
+		ostringstream msg;
+		msg << "Archive is corrupted. CRC of packed stream " << i << " does not match.";
+		throw SevenZError(155, msg.str());
+	    }
+	}
+	pos += size;
+    }
+}
 
-    // restore the state of stream
-    stream->seekg(save_pos);
+SevenZSpan SevenZFormat::streamSpan(uint64_t pos, uint64_t size){
+    SevenZPhaseTimer timer(phaseClock(), IoPhase);
+    return archive->span(pos, size);
 }
 
-int SevenZFormat::decompressHdr(ifstream *istream, uint64_t numCoders){
-    int lzma = 0;
-    SizeT destlen = 0;
-    SizeT srclen = data.packInfo->packSize[0];
-    uint8_t *compbuf;
-    uint8_t *rawbuf;
-    SRes decode;
-    ELzmaStatus status;
+int SevenZFormat::decompressHdr(uint64_t numCoders){
+    SevenZTraceSpan span("decompressHdr");
+    uint64_t destlen = 0;
+    if (data.packInfo == NULL || data.packInfo->packSize == NULL || data.packInfo->numPackStreams == 0 ||
+	    data.folders[0].unPackSize == NULL)
+	throw SevenZError(155, "Header is corrupted. Sizes of the encoded header are missing.");
+    // data.folders are replaced by the folders of the decoded header
+    const SevenZFolder &folder = data.folders[0];
+    const SevenZPackInfoHdr *packInfo = data.packInfo;
+    bool crcDefined = folder.unPackCRCDefined;
+    uint32_t crc = folder.unPackCRC;
 
     for (int i = 0; i < numCoders; i++){
-	if (data.folders[0].coder[i].coderID[0] == 0x03)
-	    if (data.folders[0].coder[i].coderID[1] == 0x01){
-		destlen = data.folders[0].unPackSize[0];
-		rawbuf = new uint8_t[destlen];
-		copyStreamToBuffer(istream, data.packInfo->packPos,\
-			data.packInfo->packSize[0], &compbuf);
-		decode = LzmaDecode((uint8_t*)rawbuf, &destlen,\
-			compbuf, &srclen,\
-			data.folders[0].coder[0].property,\
-			data.folders[0].coder[0].propertySize,\
-			LZMA_FINISH_END, &status, &alloc);
-		if ( destlen != data.folders[0].unPackSize[0] || srclen != data.packInfo->packSize[0]){
-		    cerr << "Something went wrong with decompression!" << endl;
-		    cerr << "destlen: " << destlen << " unPackSize: " << data.folders[0].unPackSize[0] << endl;
-		    cerr << " srclen: " << srclen << " packSize: " << data.packInfo->packSize[0] << endl; 
-		    exit(156);
-		}
-		cout << "decode: " << decode << endl;
-		// TODO: Might need some optimalization
-		ofstream rawhdr;
-		rawhdr.open ("raw.hdr", ios::out | ios::trunc | ios::binary);
-		for (uint64_t i = 0; i < destlen; i++)
-		    rawhdr << rawbuf[i];
-		rawhdr.close(); 
+	SevenZCoder &coder = folder.coder[i];
+	if (coder.coderID[0] == 0x03)
+	    if (coder.coderID[1] == 0x01){
+		destlen = folder.unPackSize[0];
+		// header is decoded through the dictionary while it is parsed,
+		// the whole decoded header is never in the memory
+		SevenZLzmaSource decoder(streamSpan(packInfo->packPos, packInfo->packSize[0]),\
+			coder.property,\
+			coder.propertySize,\
+			destlen, arena.lzmaAlloc());
+		SevenZTimedSource timed(&decoder, phaseClock(), DecodePhase, &stats.bytesDecoded);
+		readDecodedHeader(&timed, destlen, crcDefined, crc);
 	    }
+	if (coder.coderID[0] == 0x21 && coder.coderIDSize == 1){
+	    destlen = folder.unPackSize[0];
+	    if (coder.propertySize < 1)
+		throw SevenZError(156, "Unsupported LZMA2 properties.");
+	    SevenZSpan packed = streamSpan(packInfo->packPos, packInfo->packSize[0]);
+	    SevenZLzma2Decoder lzma2(packed, coder.property[0]);
+	    if (threads > 1 && lzma2.runs() > 1 && lzma2.largestRun() <= LZMA2_WINDOW){
+		// independent runs are decoded at once on more threads, a window
+		// of them at a time
+		if (lzma2.size() != destlen)
+		    throw SevenZError(156, "Something went wrong with decompression! LZMA2 chunks do not match the unpacked size.");
+		SevenZLzma2Source decoder(lzma2, threads);
+		SevenZTimedSource timed(&decoder, phaseClock(), DecodePhase, &stats.bytesDecoded);
+		readDecodedHeader(&timed, destlen, crcDefined, crc);
+	    } else {
+		SevenZLzmaSource decoder(packed, coder.property, coder.propertySize,
+			destlen, arena.lzmaAlloc(), true);
+		SevenZTimedSource timed(&decoder, phaseClock(), DecodePhase, &stats.bytesDecoded);
+		readDecodedHeader(&timed, destlen, crcDefined, crc);
+	    }
+	}
     }
+    // errors of the decoders are thrown, only a header decoded whole gets here
+    if (destlen > 0)
+	trace() << "decode: " << SZ_OK << endl;
     return destlen;
 }
 
-void SevenZFormat::data4Cracking(ifstream *istream){
-    copyStreamToBuffer(istream, data.packInfo->packPos,\
-	    data.packInfo->packSize[0], &data.encData);
+void SevenZFormat::data4Cracking(){
+    SevenZTraceSpan span("data4Cracking");
+    data.encFolder = data.numFolders;
+    if (data.folders == NULL || data.numFolders == 0)
+	return;
+    if (data.packInfo == NULL || data.packInfo->packSize == NULL)
+	throw SevenZError(155, "Header is corrupted. Folders have no sizes of packed streams.");
+    // the smallest encrypted folder is the cheapest one to verify a password on
+    uint64_t packIndex = 0, stream = 0;
+    uint64_t pos = data.packInfo->packPos;
+    for (uint64_t i = 0; i < data.numFolders; i++){
+	SevenZFolder &folder = data.folders[i];
+	uint64_t numPacked = folder.getNumPackStreams();
+	if (numPacked > data.packInfo->numPackStreams - packIndex)
+	    throw SevenZError(155, "Header is corrupted. Folders use more packed streams than there are.");
+	bool encrypted = false;
+	for (uint64_t j = 0; j < folder.numCoders; j++)
+	    encrypted |= folder.coder[j].isAes();
+	if (encrypted && numPacked == 1 && (data.encFolder == data.numFolders ||
+		data.packInfo->packSize[packIndex] < data.encSize)){
+	    data.encFolder = i;
+	    data.encStream = stream;
+	    data.encPos = pos;
+	    data.encSize = data.packInfo->packSize[packIndex];
+	}
+	for (uint64_t j = 0; j < numPacked; j++)
+	    pos += data.packInfo->packSize[packIndex++];
+	if (data.numUnpackStreams != NULL)
+	    stream += data.numUnpackStreams[i];
+    }
+    // packed data can be huge, read them only when somebody needs them
+    if (crackData && data.encFolder < data.numFolders)
+	data.encData = streamSpan(data.encPos, data.encSize).data;
 }
 
-void SevenZFormat::readInitInfo(ifstream *stream){
+void SevenZFormat::readInitInfo(){
+    SevenZTraceSpan span("readInitInfo");
 
-    uint8_t hdrID;
-    SevenZStartHdr sighdr = readStartHdr(stream);
-    stream->seekg(sighdr.NxtHdrOffset,stream->cur); // move to Main Header
-    stream->read(reinterpret_cast<char*>(&hdrID), 1);
+    // 1st read: start header
+    SevenZCursor startHdr(streamSpan(0, 32));
+    SevenZStartHdr sighdr = readStartHdr(&startHdr);
+
+    // 2nd read: next header together with the tail before it, the packed
+    // (0x17) header is usually stored right there and is then not read again
+    uint64_t hdrPos = 32 + sighdr.NxtHdrOffset;
+    if (hdrPos < sighdr.NxtHdrOffset)
+	throw SevenZError(157, "Next header offset is out of the archive.");
+    uint64_t before = hdrPos - 32 < TAIL_WINDOW ? hdrPos - 32 : TAIL_WINDOW;
+    if (sighdr.NxtHdrSize <= UINT64_MAX - before)
+	streamSpan(hdrPos - before, before + sighdr.NxtHdrSize);
+    SevenZSpan hdrSpan = streamSpan(hdrPos, sighdr.NxtHdrSize);
+    // damaged or cut archives are refused before anything is decoded
+    uint32_t hdrCrc;
+    {
+	SevenZPhaseTimer timer(phaseClock(), CrcPhase);
+	hdrCrc = sevenZCrc(hdrSpan.data, hdrSpan.size);
+    }
+    if (hdrCrc != sighdr.NxtHdrCRC)
+	throw SevenZError(155, "Header is corrupted. Next header CRC does not match.");
+    SevenZCursor hdrCur(hdrSpan);
+    SevenZCursor *cur = &hdrCur;
+
+    uint8_t hdrID = cur->byte();
     if (hdrID == HDR){
 	// raw Main Header 
 	// only when only one file is compress and Header is not encrypted
 	data.type = RawHeader;
-	stream->seekg(1,stream->cur);
-	readHeader(stream); 
+	stats.kind = "raw";
+	readHeader(cur); 
+	if (verifyCrc)
+	    verifyPackedStreams();
     }else if (hdrID == ENCHDR){
 	data.type = EncHeader;
-	readHeader(stream);
+	stats.kind = "encrypted";
+	readStreamsInfo(cur);
+	if (verifyCrc)
+	    verifyPackedStreams();
 	codersInEncHdr = data.numFolders;
+	// the decoded header replaces the folders, the arena keeps these ones
+	if (data.numFolders == 1 && data.packInfo != NULL && data.packInfo->numPackStreams > 0){
+	    data.hdrFolder = data.folders;
+	    data.hdrPackPos = data.packInfo->packPos;
+	    data.hdrPackSize = data.packInfo->packSize[0];
+	}
 	if (data.numFolders == 1 && data.folders[0].numCoders == 1){
-	    int fsize = decompressHdr(stream, data.folders[0].numCoders); 
-	    if (fsize != 0 ){
-
-		ifstream rawhdr; 
-		rawhdr.open("raw.hdr", ios_base::binary);
-		readHeader(&rawhdr);
-		rawhdr.close();
-		remove("raw.hdr");	    // clear the file
-	    }
+	    stats.kind = "compressed";
+	    decompressHdr(data.folders[0].numCoders); 
+	    if (verifyCrc)
+		verifyPackedStreams();	// streams of the decoded header
 	} 
 	// else : go cracking
     }
-    data4Cracking(stream);
+    data4Cracking();
 } 
 
-ifstream& SevenZFormat::getStream() {
-    return archive;
+bool SevenZFormat::open(const char *path) {
+    this->path = path;
+    stats = SevenZStats();
+    stats.archives = 1;
+    measuring = true;
+    openedAt = phaseClock() != NULL ? SevenZPhaseClock::now() : 0;
+    allocBase = arena.allocations();
+    if (perfEnabled && !perfOpened){
+	perfOpened = true;
+	if (perf.open())
+	    clock.setCounters(&perf);
+    }
+    SevenZPhaseTimer timer(phaseClock(), OpenPhase);
+    return archive->open(path);
+}
+
+void SevenZFormat::setIO(SevenZIOType type){
+    archive->close();
+    archive = (type == PreadIO) ? static_cast<SevenZFile*>(&preadFile) : &mappedFile;
+}
+
+void SevenZFormat::setCrackData(bool load){
+    crackData = load;
+}
+
+void SevenZFormat::setThreads(unsigned threads){
+    this->threads = threads > 0 ? threads : 1;
+}
+
+void SevenZFormat::setVerifyCrc(bool enable){
+    verifyCrc = enable;
+}
+
+void SevenZFormat::setStats(bool enable){
+    statsEnabled = enable;
+}
+
+const SevenZStats& SevenZFormat::getStats() const {
+    return stats;
+}
+
+void SevenZFormat::setPerf(bool enable){
+    perfEnabled = enable;
+}
+
+SevenZPhaseClock* SevenZFormat::phaseClock(){
+    return statsEnabled || perfEnabled ? &clock : NULL;
+}
+
+void SevenZFormat::setHashOutput(bool enable, uint64_t truncate){
+    hashOutput = enable;
+    this->truncate = truncate;
+}
+
+ostream& SevenZFormat::trace(){
+    return hashOutput ? discard : *out;
+}
+
+void SevenZFormat::setOutput(ostream &stream){
+    out = &stream;
+}
+
+bool SevenZFormat::hasEncryptedData() const {
+    return data.encFolder < data.numFolders;
+}
+
+const SevenZInitData& SevenZFormat::getData() const {
+    return data;
+}
+
+SevenZSpan SevenZFormat::readPacked(uint64_t pos, uint64_t size){
+    return streamSpan(pos, size);
+}
+
+void SevenZFormat::reset(){
+    data = SevenZInitData();
+    codersInEncHdr = 0;
+    arena.reset();	// everything parsed from the previous archive at once
 }
 
 void SevenZFormat::process(){
-    readInitInfo(&archive);
+    SevenZPhaseTimer timer(phaseClock(), ParsePhase);
+    reset();
+    try {
+	readInitInfo();
+    } catch (const bad_alloc &){
+	// counts are checked against the header, but a decoded header may
+	// claim a size the memory can't hold
+	throw SevenZError(155, "Header is corrupted. It needs more memory than there is.");
+    }
 }
 
 void SevenZFormat::finish(){
-    printInfo();
-    archive.close();
+    {
+	SevenZPhaseTimer timer(phaseClock(), OutputPhase);
+	SevenZTraceSpan span("output");
+	if (hashOutput)
+	    printHash();
+	else
+	    printInfo();
+    }
+    close();
+}
+
+void SevenZFormat::close(){
+    if (measuring){
+	stats.allocations = arena.allocations() - allocBase;
+	stats.memoryBytes = arena.allocated();
+    }
+    reset();
+    {
+	SevenZPhaseTimer timer(measuring ? phaseClock() : NULL, OpenPhase);
+	archive->close();
+    }
+    if (measuring){
+	measuring = false;
+	stats.bytesRead = archive->bytesRead;
+	stats.ioRequests = archive->reads;
+	stats.syscalls = archive->syscalls;
+	if (statsEnabled)
+	    stats.totalNs = SevenZPhaseClock::now() - openedAt;
+    }
 }
 
 void SevenZFormat::printInfo(){
     uint64_t i;
-    cout << "======= SevenZ information =======" << endl;
-    cout << "Number of folders: " << data.numFolders << endl;
-    cout << "Key length: " << data.keyLength << endl;
+    *out << "======= SevenZ information =======" << endl;
+    *out << "Number of folders: " << data.numFolders << endl;
+    *out << "Key length: " << data.keyLength << endl;
     for (i=0; i < data.numFolders; i++ )
-	data.folders[i].printInfo();
-    data.packInfo->printInfo();
+	data.folders[i].printInfo(*out);
+    if (data.packInfo != NULL)
+	data.packInfo->printInfo(*out);
+    if (data.files != NULL)
+	data.files->printInfo(*out);
     if (data.type == NONE)
-	cout << "Encryption method is currently not supported by Wrathion." << endl;
+	*out << "Encryption method is currently not supported by Wrathion." << endl;
     else{
 	if (data.type == RawHeader)
-	    cout << "Header is not encrypted nor compressed" << endl;
+	    *out << "Header is not encrypted nor compressed" << endl;
 	else if (data.type == EncHeader){
 	    if (codersInEncHdr == 1)
-		cout << "Header is either compressed or encrypted" << endl;
+		*out << "Header is either compressed or encrypted" << endl;
 	    else 
-		cout << "Header is compressed and encrypted" << endl;
+		*out << "Header is compressed and encrypted" << endl;
 	}
-	cout << "Encryption method: 7ZAES256 + SHA256" << endl;
+	*out << "Encryption method: 7ZAES256 + SHA256" << endl;
     } 
-    cout << "===============================" << endl;
+    *out << "===============================" << endl;
+}
+
+void SevenZFormat::printHash(){
+    if (!hasEncryptedData())
+	return;	// callers report it
+    // truncated payload keeps whole AES blocks for the early reject
+    uint64_t size = data.encSize;
+    if (truncate > 0 && size > truncate){
+	size = (truncate + 15) & ~(uint64_t)15;
+	if (size > data.encSize)
+	    size = data.encSize;
+    }
+    string line = path + ":" + sevenZHash(data, streamSpan(data.encPos, size));
+    line += '\n';
+    out->write(line.data(), line.size());
 }
 
-SevenZInitData::SevenZInitData(){}
+SevenZInitData::SevenZInitData(): type(NONE), folders(NULL), packInfo(NULL),
+    numFolders(0), keyLength(0), encData(NULL), encPos(0), encSize(0),
+    encFolder(0), encStream(0), hdrFolder(NULL), hdrPackPos(0), hdrPackSize(0){}
 
 string uint8ToHex(uint8_t a) {
     
@@ -595,6 +1139,7 @@ string SevenZCoder::coderToString(uint8_t *array, uint8_t size) {
 		}
 	}
     }
+    return "Unknown method";
 }
 
 string SevenZCoder::printCoder(uint8_t *array, uint8_t size) {
@@ -605,25 +1150,58 @@ string SevenZCoder::propertyToString(uint8_t *array, uint8_t size) {
     return (printArray(array,size) + " size: " + uint8ToStr(size));
 }
 
-void SevenZCoder::printInfo() {
-    cout << "Method applied on data: " + printCoder(coderID, coderIDSize) << endl;
-//    cout << "Flags: " << HEX(flags) << dec<< endl;
-//    cout << "In streams: " << numInStreams << endl;
-//    cout << "Out streams: " << numOutStreams << endl;
-    cout << "Property: " << propertyToString(property, propertySize) << endl; 
+void SevenZCoder::printInfo(ostream &out) {
+    out << "Method applied on data: " + printCoder(coderID, coderIDSize) << endl;
+//    out << "Flags: " << HEX(flags) << dec<< endl;
+//    out << "In streams: " << numInStreams << endl;
+//    out << "Out streams: " << numOutStreams << endl;
+    out << "Property: " << propertyToString(property, propertySize) << endl; 
 }
 
-void SevenZFolder::printInfo() {
+void SevenZFolder::printInfo(ostream &out) {
     for (short i = 0; i < numCoders; i++)
-	coder[i].printInfo();
-    cout << "Total InStreams: " << numInStreamsTotal << endl;
-    cout << "Total OutStreams: " << numOutStreamsTotal << endl;
+	coder[i].printInfo(out);
+    out << "Total InStreams: " << numInStreamsTotal << endl;
+    out << "Total OutStreams: " << numOutStreamsTotal << endl;
+
+}
+
+uint64_t SevenZFolder::getUnPackSize() const {
+    return unPackSize[mainOutStream];
+}
+
+uint64_t SevenZFolder::getNumPackStreams() const {
+    return numInStreamsTotal - (numOutStreamsTotal - 1);    // not bound in streams
+}
+
+bool SevenZCoder::isAes() const {
+    return coderIDSize == 4 && coderID[0] == 0x06 && coderID[1] == 0xF1 &&
+	coderID[2] == 0x07 && coderID[3] == 0x01;
+}
 
+bool SevenZAesProps::read(const uint8_t *property, uint64_t size){
+    saltSize = ivSize = 0;
+    memset(salt, 0, sizeof(salt));
+    memset(iv, 0, sizeof(iv));
+    if (size < 1)
+	return false;
+    numCyclesPower = property[0] & 0x3F;
+    if ((property[0] & 0xC0) == 0)
+	return size == 1;   // no salt and no IV
+    if (size < 2)
+	return false;
+    saltSize = ((property[0] >> 7) & 1) + (property[1] >> 4);
+    ivSize = ((property[0] >> 6) & 1) + (property[1] & 0x0F);
+    if (size != 2 + saltSize + ivSize)
+	return false;
+    memcpy(salt, property + 2, saltSize);
+    memcpy(iv, property + 2 + saltSize, ivSize);
+    return true;
 }
 
-void SevenZPackInfoHdr::printInfo() {
-    cout << "Packpos: " << packPos << endl;
-    cout << "NumPackStreams: " << numPackStreams << endl;
+void SevenZPackInfoHdr::printInfo(ostream &out) {
+    out << "Packpos: " << packPos << endl;
+    out << "NumPackStreams: " << numPackStreams << endl;
     for (uint64_t i=0; i < numPackStreams; i++)
-	cout << "PackSize: " << packSize[i] << endl;
+	out << "PackSize: " << packSize[i] << endl;
 }
@@ -0,0 +1,113 @@
+#include "SevenZHash.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+
+using namespace std;
+
+/**
+ * Hex pairs of all byte values, "000102...ff"
+ */
+struct HexTable {
+    char pairs[512];
+    HexTable(){
+	const char *digits = "0123456789abcdef";
+	for (int i = 0; i < 256; i++){
+	    pairs[2 * i] = digits[i >> 4];
+	    pairs[2 * i + 1] = digits[i & 0x0F];
+	}
+    }
+};
+
+void hexEncode(const uint8_t *data, uint64_t size, string &dst){
+    static const HexTable table;
+    size_t start = dst.size();
+    dst.resize(start + 2 * size);
+    char *p = &dst[start];
+    for (uint64_t i = 0; i < size; i++, p += 2)
+	memcpy(p, table.pairs + 2 * data[i], 2);
+}
+
+static unsigned hashType(const SevenZCoder &coder){
+    const uint8_t *id = coder.coderID;
+    switch (coder.coderIDSize){
+	case 1:
+	    if (id[0] == 0x00)
+		return HASH_COPY;
+	    if (id[0] == 0x21)
+		return HASH_LZMA2;
+	    break;
+	case 3:
+	    if (id[0] == 0x03 && id[1] == 0x01 && id[2] == 0x01)
+		return HASH_LZMA;
+	    if (id[0] == 0x03 && id[1] == 0x04 && id[2] == 0x01)
+		return HASH_PPMD;
+	    if (id[0] == 0x04 && id[1] == 0x02 && id[2] == 0x02)
+		return HASH_BZIP2;
+	    if (id[0] == 0x04 && id[1] == 0x01 && id[2] == 0x08)
+		return HASH_DEFLATE;
+	    break;
+    }
+    throw SevenZError(154, "Unsupported value. Compression method can't be exported to the hash.");
+}
+
+string sevenZHash(const SevenZInitData &data, SevenZSpan payload){
+    const SevenZFolder &folder = data.folders[data.encFolder];
+    if (folder.numCoders > 2)
+	throw SevenZError(154, "Unsupported value. Only AES with one compression method can be exported to the hash.");
+
+    // AES coder and the out stream it writes to
+    uint64_t aes = folder.numCoders, aesOut = 0, outIndex = 0;
+    for (uint64_t i = 0; i < folder.numCoders; i++){
+	if (folder.coder[i].isAes()){
+	    aes = i;
+	    aesOut = outIndex;
+	}
+	outIndex += folder.coder[i].numOutStreams;
+    }
+    if (aes == folder.numCoders)
+	throw SevenZError(154, "Unsupported value. Folder is not encrypted.");
+    SevenZAesProps props;
+    if (!props.read(folder.coder[aes].property, folder.coder[aes].propertySize))
+	throw SevenZError(155, "Header is corrupted. Wrong 7zAES properties.");
+
+    const SevenZCoder *method = NULL;
+    unsigned type = HASH_COPY;
+    if (folder.numCoders == 2){
+	method = &folder.coder[1 - aes];
+	type = hashType(*method);
+    }
+    // a prefix can't be decompressed, the line leaves the method out
+    bool truncated = payload.size < data.encSize;
+    if (truncated)
+	type = HASH_TRUNCATED;
+
+    // CRC of the unpacked folder, it is stored at the substream when it is alone
+    uint32_t crc = 0;
+    if (folder.unPackCRCDefined)
+	crc = folder.unPackCRC;
+    else if (data.numUnpackStreams != NULL && data.numUnpackStreams[data.encFolder] == 1 &&
+	    data.streamCRC.has(data.encStream))
+	crc = data.streamCRC.values[data.encStream];
+
+    string line;
+    line.reserve(128 + 2 * payload.size);
+    char field[96];
+    snprintf(field, sizeof(field), "$7z$%u$%u$%u$", type, props.numCyclesPower, props.saltSize);
+    line += field;
+    hexEncode(props.salt, props.saltSize, line);
+    snprintf(field, sizeof(field), "$%u$", props.ivSize);
+    line += field;
+    hexEncode(props.iv, props.ivSize, line);
+    snprintf(field, sizeof(field), "$%" PRIu32 "$%" PRIu64 "$%" PRIu64 "$",
+	    crc, data.encSize, folder.unPackSize[aesOut]);
+    line += field;
+    hexEncode(payload.data, payload.size, line);
+    if (method != NULL && !truncated){
+	snprintf(field, sizeof(field), "$%" PRIu64 "$", folder.getUnPackSize());
+	line += field;
+	hexEncode(method->property, method->propertySize, line);
+    }
+    return line;
+}
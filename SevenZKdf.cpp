@@ -0,0 +1,788 @@
+#include "SevenZKdf.h"
+
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KDF_X86
+#endif
+
+using namespace std;
+
+static const uint32_t ShaK[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t ShaH0[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static inline uint32_t rotr(uint32_t x, unsigned n){
+    return (x >> n) | (x << (32 - n));
+}
+
+static bool scalarSupported(){
+    return true;
+}
+
+static void compressScalar(uint32_t *state, const uint32_t *blocks, uint64_t nblocks){
+    uint32_t w[64];
+    for (uint64_t b = 0; b < nblocks; b++, blocks += 16){
+	memcpy(w, blocks, 16 * sizeof(uint32_t));
+	for (unsigned t = 16; t < 64; t++){
+	    uint32_t s0 = rotr(w[t - 15], 7) ^ rotr(w[t - 15], 18) ^ (w[t - 15] >> 3);
+	    uint32_t s1 = rotr(w[t - 2], 17) ^ rotr(w[t - 2], 19) ^ (w[t - 2] >> 10);
+	    w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+	}
+	uint32_t a = state[0], b_ = state[1], c = state[2], d = state[3];
+	uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+	for (unsigned t = 0; t < 64; t++){
+	    uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + ShaK[t] + w[t];
+	    uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b_) ^ (a & c) ^ (b_ & c));
+	    h = g; g = f; f = e; e = d + t1;
+	    d = c; c = b_; b_ = a; a = t1 + t2;
+	}
+	state[0] += a; state[1] += b_; state[2] += c; state[3] += d;
+	state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+}
+
+#ifdef KDF_X86
+
+static bool shaniSupported(){
+    return __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+}
+
+static bool avx2Supported(){
+    return __builtin_cpu_supports("avx2");
+}
+
+static bool avx512Supported(){
+    return __builtin_cpu_supports("avx512f");
+}
+
+/**
+ * SHA extensions, one message. Words are loaded as they are, the usual byte
+ * shuffle was already done when the blocks were built.
+ */
+__attribute__((target("sha,sse4.1")))
+static void compressShani(uint32_t *state, const uint32_t *blocks, uint64_t nblocks){
+    __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state));
+    __m128i state1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4));
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);			// CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1B);		// EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);	// ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);	// CDGH
+
+    for (uint64_t b = 0; b < nblocks; b++, blocks += 16){
+	__m128i abef = state0, cdgh = state1;
+	__m128i msg[4];
+	for (unsigned i = 0; i < 4; i++)
+	    msg[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(blocks + 4 * i));
+#pragma GCC unroll 16
+	for (unsigned g = 0; g < 16; g++){
+	    __m128i m = _mm_add_epi32(msg[g & 3], _mm_loadu_si128(reinterpret_cast<const __m128i*>(ShaK + 4 * g)));
+	    state1 = _mm_sha256rnds2_epu32(state1, state0, m);
+	    if (g >= 3 && g < 15){
+		__m128i next = _mm_add_epi32(msg[(g + 1) & 3], _mm_alignr_epi8(msg[g & 3], msg[(g - 1) & 3], 4));
+		msg[(g + 1) & 3] = _mm_sha256msg2_epu32(next, msg[g & 3]);
+	    }
+	    m = _mm_shuffle_epi32(m, 0x0E);
+	    state0 = _mm_sha256rnds2_epu32(state0, state1, m);
+	    if (g >= 1 && g < 13)
+		msg[(g - 1) & 3] = _mm_sha256msg1_epu32(msg[(g - 1) & 3], msg[g & 3]);
+	}
+	state0 = _mm_add_epi32(state0, abef);
+	state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);		// FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);		// DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);	// DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);		// HGFE
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state), state0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), state1);
+}
+
+#define ROTR8(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+
+/**
+ * AVX2, 8 messages in the lanes of the 256-bit registers
+ */
+__attribute__((target("avx2")))
+static void compressAvx2(uint32_t *state, const uint32_t *blocks, uint64_t nblocks){
+    __m256i s[8];
+    for (unsigned i = 0; i < 8; i++)
+	s[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state + 8 * i));
+
+    for (uint64_t b = 0; b < nblocks; b++, blocks += 16 * 8){
+	__m256i w[16];
+	__m256i a = s[0], b_ = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+#pragma GCC unroll 64
+	for (unsigned t = 0; t < 64; t++){
+	    if (t < 16)
+		w[t] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(blocks + 8 * t));
+	    else {
+		__m256i w15 = w[(t - 15) & 15], w2 = w[(t - 2) & 15];
+		__m256i s0 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(w15, 7), ROTR8(w15, 18)), _mm256_srli_epi32(w15, 3));
+		__m256i s1 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(w2, 17), ROTR8(w2, 19)), _mm256_srli_epi32(w2, 10));
+		w[t & 15] = _mm256_add_epi32(_mm256_add_epi32(w[t & 15], s0), _mm256_add_epi32(w[(t - 7) & 15], s1));
+	    }
+	    __m256i sig1 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(e, 6), ROTR8(e, 11)), ROTR8(e, 25));
+	    __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+	    __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, sig1), _mm256_add_epi32(ch, w[t & 15]));
+	    t1 = _mm256_add_epi32(t1, _mm256_set1_epi32(static_cast<int>(ShaK[t])));
+	    __m256i sig0 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(a, 2), ROTR8(a, 13)), ROTR8(a, 22));
+	    __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b_), _mm256_and_si256(c, _mm256_or_si256(a, b_)));
+	    h = g; g = f; f = e; e = _mm256_add_epi32(d, t1);
+	    d = c; c = b_; b_ = a; a = _mm256_add_epi32(t1, _mm256_add_epi32(sig0, maj));
+	}
+	s[0] = _mm256_add_epi32(s[0], a); s[1] = _mm256_add_epi32(s[1], b_);
+	s[2] = _mm256_add_epi32(s[2], c); s[3] = _mm256_add_epi32(s[3], d);
+	s[4] = _mm256_add_epi32(s[4], e); s[5] = _mm256_add_epi32(s[5], f);
+	s[6] = _mm256_add_epi32(s[6], g); s[7] = _mm256_add_epi32(s[7], h);
+    }
+
+    for (unsigned i = 0; i < 8; i++)
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(state + 8 * i), s[i]);
+}
+
+// the rotations and shifts of avx512fintrin.h start from an undefined vector,
+// which GCC reports as uninitialized wherever they are inlined
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+#define XOR3(x, y, z) _mm512_ternarylogic_epi32(x, y, z, 0x96)
+
+/**
+ * AVX-512, 16 messages, native rotations and three input logic
+ */
+__attribute__((target("avx512f")))
+static void compressAvx512(uint32_t *state, const uint32_t *blocks, uint64_t nblocks){
+    __m512i s[8];
+    for (unsigned i = 0; i < 8; i++)
+	s[i] = _mm512_loadu_si512(state + 16 * i);
+
+    for (uint64_t b = 0; b < nblocks; b++, blocks += 16 * 16){
+	__m512i w[16];
+	__m512i a = s[0], b_ = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+#pragma GCC unroll 64
+	for (unsigned t = 0; t < 64; t++){
+	    if (t < 16)
+		w[t] = _mm512_loadu_si512(blocks + 16 * t);
+	    else {
+		__m512i w15 = w[(t - 15) & 15], w2 = w[(t - 2) & 15];
+		__m512i s0 = XOR3(_mm512_ror_epi32(w15, 7), _mm512_ror_epi32(w15, 18), _mm512_srli_epi32(w15, 3));
+		__m512i s1 = XOR3(_mm512_ror_epi32(w2, 17), _mm512_ror_epi32(w2, 19), _mm512_srli_epi32(w2, 10));
+		w[t & 15] = _mm512_add_epi32(_mm512_add_epi32(w[t & 15], s0), _mm512_add_epi32(w[(t - 7) & 15], s1));
+	    }
+	    __m512i sig1 = XOR3(_mm512_ror_epi32(e, 6), _mm512_ror_epi32(e, 11), _mm512_ror_epi32(e, 25));
+	    __m512i ch = _mm512_ternarylogic_epi32(e, f, g, 0xCA);
+	    __m512i t1 = _mm512_add_epi32(_mm512_add_epi32(h, sig1), _mm512_add_epi32(ch, w[t & 15]));
+	    t1 = _mm512_add_epi32(t1, _mm512_set1_epi32(static_cast<int>(ShaK[t])));
+	    __m512i sig0 = XOR3(_mm512_ror_epi32(a, 2), _mm512_ror_epi32(a, 13), _mm512_ror_epi32(a, 22));
+	    __m512i maj = _mm512_ternarylogic_epi32(a, b_, c, 0xE8);
+	    h = g; g = f; f = e; e = _mm512_add_epi32(d, t1);
+	    d = c; c = b_; b_ = a; a = _mm512_add_epi32(t1, _mm512_add_epi32(sig0, maj));
+	}
+	s[0] = _mm512_add_epi32(s[0], a); s[1] = _mm512_add_epi32(s[1], b_);
+	s[2] = _mm512_add_epi32(s[2], c); s[3] = _mm512_add_epi32(s[3], d);
+	s[4] = _mm512_add_epi32(s[4], e); s[5] = _mm512_add_epi32(s[5], f);
+	s[6] = _mm512_add_epi32(s[6], g); s[7] = _mm512_add_epi32(s[7], h);
+    }
+
+    for (unsigned i = 0; i < 8; i++)
+	_mm512_storeu_si512(state + 16 * i, s[i]);
+}
+
+/*
+ * Runs of unsalted passwords of a fixed size. The layout of (password,
+ * counter) units in the blocks of a run is known at compile time, so the
+ * message words holding the two lowest counter bytes are the only ones
+ * changing between runs. Every other word, and every schedule word
+ * depending only on such words, is computed once per call together with
+ * its round constant; the fixed terms of the changing schedule words are
+ * summed in advance too.
+ */
+
+template<unsigned UNIT, unsigned N = 64, bool HALVE = (N > 1 && (UNIT * (N / 2)) % 64 == 0)>
+struct RunUnits {
+    static const unsigned value = N;
+};
+
+template<unsigned UNIT, unsigned N>
+struct RunUnits<UNIT, N, true> {
+    static const unsigned value = RunUnits<UNIT, N / 2>::value;
+};
+
+/**
+ * Byte B of a run of passwords of LEN bytes
+ */
+template<unsigned LEN, unsigned B>
+struct RunByte {
+    static const unsigned offset = B % (LEN + 8);
+    static const bool counter = offset >= LEN && offset < LEN + 2;	// changes between runs
+    static const unsigned unit = B / (LEN + 8);
+    static const unsigned shift = counter ? 8 * (offset - LEN) : 0;
+    static const unsigned position = 24 - 8 * (B % 4);
+
+    static inline uint32_t value(uint32_t base){
+	return counter ? (((base + unit) >> shift) & 0xFF) << position : 0;
+    }
+};
+
+template<unsigned LEN, unsigned W>
+struct RunWord {
+    static const bool varying = RunByte<LEN, 4 * W>::counter || RunByte<LEN, 4 * W + 1>::counter ||
+	RunByte<LEN, 4 * W + 2>::counter || RunByte<LEN, 4 * W + 3>::counter;
+
+    /**
+     * Counter bytes of the word in the run with the first counter base
+     * @param base
+     */
+    static inline uint32_t value(uint32_t base){
+	return RunByte<LEN, 4 * W>::value(base) | RunByte<LEN, 4 * W + 1>::value(base) |
+	    RunByte<LEN, 4 * W + 2>::value(base) | RunByte<LEN, 4 * W + 3>::value(base);
+    }
+};
+
+/**
+ * Message word T of block BLK is the same in all runs
+ */
+template<unsigned LEN, unsigned BLK, unsigned T, bool MSG = (T < 16)>
+struct FixedWord {
+    static const bool value = !RunWord<LEN, 16 * BLK + T>::varying;
+};
+
+template<unsigned LEN, unsigned BLK, unsigned T>
+struct FixedWord<LEN, BLK, T, false> {
+    static const bool value = FixedWord<LEN, BLK, T - 2>::value && FixedWord<LEN, BLK, T - 7>::value &&
+	FixedWord<LEN, BLK, T - 15>::value && FixedWord<LEN, BLK, T - 16>::value;
+};
+
+/**
+ * Bits of the changing counter bytes in a word of the run, FixedWord at run time
+ * @param size, word
+ */
+static uint32_t counterMask(size_t size, size_t word){
+    uint32_t mask = 0;
+    for (unsigned i = 0; i < 4; i++){
+	size_t offset = (4 * word + i) % (size + 8);
+	if (offset >= size && offset < size + 2)
+	    mask |= 0xFFu << (24 - 8 * i);
+    }
+    return mask;
+}
+
+/**
+ * For every block and round of the run: W + K of a fixed word, the counter
+ * free part of a changing message word, or the sum of the fixed terms of a
+ * changing schedule word
+ * @param size, words (16 lanes), blocks, pre (blocks * 64 * 16 words)
+ */
+static void precomputeRuns(size_t size, const uint32_t *words, size_t blocks, uint32_t *pre){
+    const unsigned lanes = 16;
+    bool fixed[64];
+    uint32_t w[64];
+    for (size_t blk = 0; blk < blocks; blk++){
+	for (unsigned t = 0; t < 64; t++)
+	    fixed[t] = t < 16 ? counterMask(size, 16 * blk + t) == 0 :
+		fixed[t - 2] && fixed[t - 7] && fixed[t - 15] && fixed[t - 16];
+	for (unsigned j = 0; j < lanes; j++){
+	    for (unsigned t = 0; t < 16; t++)
+		w[t] = words[(16 * blk + t) * lanes + j];
+	    for (unsigned t = 16; t < 64; t++)
+		w[t] = w[t - 16] + (rotr(w[t - 15], 7) ^ rotr(w[t - 15], 18) ^ (w[t - 15] >> 3)) +
+		    w[t - 7] + (rotr(w[t - 2], 17) ^ rotr(w[t - 2], 19) ^ (w[t - 2] >> 10));
+	    for (unsigned t = 0; t < 64; t++){
+		uint32_t v = 0;
+		if (fixed[t])
+		    v = w[t] + ShaK[t];
+		else if (t < 16)
+		    v = w[t] & ~counterMask(size, 16 * blk + t);
+		else {
+		    if (fixed[t - 2])
+			v += rotr(w[t - 2], 17) ^ rotr(w[t - 2], 19) ^ (w[t - 2] >> 10);
+		    if (fixed[t - 7])
+			v += w[t - 7];
+		    if (fixed[t - 15])
+			v += rotr(w[t - 15], 7) ^ rotr(w[t - 15], 18) ^ (w[t - 15] >> 3);
+		    if (fixed[t - 16])
+			v += w[t - 16];
+		}
+		pre[(64 * blk + t) * lanes + j] = v;
+	    }
+	}
+    }
+}
+
+/**
+ * Changing message word T, part is its precomputed fixed part
+ */
+template<unsigned LEN, unsigned BLK, unsigned T, bool MSG = (T < 16)>
+struct Avx512Word {
+    __attribute__((target("avx512f"), always_inline))
+    static inline __m512i get(const __m512i*, __m512i part, uint32_t base){
+	return _mm512_add_epi32(part, _mm512_set1_epi32(static_cast<int>(RunWord<LEN, 16 * BLK + T>::value(base))));
+    }
+};
+
+template<unsigned LEN, unsigned BLK, unsigned T>
+struct Avx512Word<LEN, BLK, T, false> {
+    __attribute__((target("avx512f"), always_inline))
+    static inline __m512i get(const __m512i *w, __m512i part, uint32_t){
+	if (!FixedWord<LEN, BLK, T - 2>::value){
+	    __m512i x = w[(T - 2) & 15];
+	    part = _mm512_add_epi32(part, XOR3(_mm512_ror_epi32(x, 17), _mm512_ror_epi32(x, 19), _mm512_srli_epi32(x, 10)));
+	}
+	if (!FixedWord<LEN, BLK, T - 7>::value)
+	    part = _mm512_add_epi32(part, w[(T - 7) & 15]);
+	if (!FixedWord<LEN, BLK, T - 15>::value){
+	    __m512i x = w[(T - 15) & 15];
+	    part = _mm512_add_epi32(part, XOR3(_mm512_ror_epi32(x, 7), _mm512_ror_epi32(x, 18), _mm512_srli_epi32(x, 3)));
+	}
+	if (!FixedWord<LEN, BLK, T - 16>::value)
+	    part = _mm512_add_epi32(part, w[(T - 16) & 15]);
+	return part;
+    }
+};
+
+/**
+ * Round T and the following ones, the working variables rotate by the
+ * order of the arguments
+ */
+template<unsigned LEN, unsigned BLK, unsigned T>
+struct Avx512Round {
+    __attribute__((target("avx512f"), always_inline))
+    static inline void run(__m512i &a, __m512i &b, __m512i &c, __m512i &d, __m512i &e, __m512i &f,
+	    __m512i &g, __m512i &h, __m512i *w, const uint32_t *pre, uint32_t base){
+	__m512i wk = _mm512_loadu_si512(pre + (64 * BLK + T) * 16);
+	if (!FixedWord<LEN, BLK, T>::value){
+	    __m512i x = Avx512Word<LEN, BLK, T>::get(w, wk, base);
+	    w[T & 15] = x;
+	    wk = _mm512_add_epi32(x, _mm512_set1_epi32(static_cast<int>(ShaK[T])));
+	}
+	__m512i sig1 = XOR3(_mm512_ror_epi32(e, 6), _mm512_ror_epi32(e, 11), _mm512_ror_epi32(e, 25));
+	__m512i ch = _mm512_ternarylogic_epi32(e, f, g, 0xCA);
+	__m512i t1 = _mm512_add_epi32(_mm512_add_epi32(h, sig1), _mm512_add_epi32(ch, wk));
+	__m512i sig0 = XOR3(_mm512_ror_epi32(a, 2), _mm512_ror_epi32(a, 13), _mm512_ror_epi32(a, 22));
+	__m512i maj = _mm512_ternarylogic_epi32(a, b, c, 0xE8);
+	d = _mm512_add_epi32(d, t1);
+	h = _mm512_add_epi32(t1, _mm512_add_epi32(sig0, maj));
+	Avx512Round<LEN, BLK, T + 1>::run(h, a, b, c, d, e, f, g, w, pre, base);
+    }
+};
+
+template<unsigned LEN, unsigned BLK>
+struct Avx512Round<LEN, BLK, 64> {
+    static inline void run(__m512i&, __m512i&, __m512i&, __m512i&, __m512i&, __m512i&,
+	    __m512i&, __m512i&, __m512i*, const uint32_t*, uint32_t){}
+};
+
+template<unsigned LEN, unsigned BLK, unsigned BLOCKS>
+struct Avx512Blocks {
+    __attribute__((target("avx512f")))
+    static inline void run(__m512i *s, const uint32_t *pre, uint32_t base){
+	__m512i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+	__m512i w[16];
+	Avx512Round<LEN, BLK, 0>::run(a, b, c, d, e, f, g, h, w, pre, base);
+	s[0] = _mm512_add_epi32(s[0], a); s[1] = _mm512_add_epi32(s[1], b);
+	s[2] = _mm512_add_epi32(s[2], c); s[3] = _mm512_add_epi32(s[3], d);
+	s[4] = _mm512_add_epi32(s[4], e); s[5] = _mm512_add_epi32(s[5], f);
+	s[6] = _mm512_add_epi32(s[6], g); s[7] = _mm512_add_epi32(s[7], h);
+	Avx512Blocks<LEN, BLK + 1, BLOCKS>::run(s, pre, base);
+    }
+};
+
+template<unsigned LEN, unsigned BLOCKS>
+struct Avx512Blocks<LEN, BLOCKS, BLOCKS> {
+    static inline void run(__m512i*, const uint32_t*, uint32_t){}
+};
+
+template<unsigned LEN>
+__attribute__((target("avx512f")))
+static void runsAvx512(uint32_t *state, const uint32_t *words, uint64_t first, uint64_t runs){
+    const unsigned units = RunUnits<LEN + 8>::value;
+    const unsigned blocks = units * (LEN + 8) / 64;
+    vector<uint32_t> pre(blocks * 64 * 16);
+    precomputeRuns(LEN, words, blocks, pre.data());
+
+    __m512i s[8];
+    for (unsigned i = 0; i < 8; i++)
+	s[i] = _mm512_loadu_si512(state + 16 * i);
+    for (uint64_t r = first; r < first + runs; r++)
+	Avx512Blocks<LEN, 0, blocks>::run(s, pre.data(), static_cast<uint32_t>(r * units));
+    for (unsigned i = 0; i < 8; i++)
+	_mm512_storeu_si512(state + 16 * i, s[i]);
+}
+
+/**
+ * Layouts of 2, 4, 8 and 12 characters, their runs have 1 to 3 blocks. Longer
+ * runs unrolled this way don't fit the instruction cache and were slower than
+ * the generic kernel.
+ * @param size
+ */
+static SevenZShaRuns fixedAvx512(size_t size){
+    switch (size){
+    case 4: return runsAvx512<4>;
+    case 8: return runsAvx512<8>;
+    case 16: return runsAvx512<16>;
+    case 24: return runsAvx512<24>;
+    }
+    return NULL;
+}
+
+#pragma GCC diagnostic pop
+
+#endif
+
+// 16 lanes of AVX-512 outrun the SHA extensions, which beat 8 lanes of AVX2
+static const SevenZShaKernel Kernels[] = {
+#ifdef KDF_X86
+    {"avx512", 16, compressAvx512, avx512Supported, fixedAvx512},
+    {"sha-ni", 1, compressShani, shaniSupported, NULL},
+    {"avx2", 8, compressAvx2, avx2Supported, NULL},
+#endif
+    {"scalar", 1, compressScalar, scalarSupported, NULL}
+};
+
+const SevenZShaKernel* sevenZShaKernels(size_t *count){
+    *count = sizeof(Kernels) / sizeof(Kernels[0]);
+    return Kernels;
+}
+
+const SevenZShaKernel* sevenZBestShaKernel(){
+    size_t count;
+    const SevenZShaKernel *all = sevenZShaKernels(&count);
+    for (size_t i = 0; i < count; i++)
+	if (all[i].supported())
+	    return &all[i];
+    return &all[count - 1];
+}
+
+/**
+ * Units of (salt, password, counter) in a run, the fewest filling whole blocks
+ * @param unit (bytes)
+ */
+static size_t runUnitsOf(size_t unit){
+    size_t units = 64;
+    while (units > 1 && (unit * (units / 2)) % 64 == 0)
+	units /= 2;
+    return units;
+}
+
+SevenZKdf::SevenZKdf(const SevenZAesProps &props, const SevenZShaKernel *kernel)
+: props(props), kernel(kernel != NULL ? kernel : sevenZBestShaKernel()) {
+    if (props.numCyclesPower > KDF_CYCLES_MAX && props.numCyclesPower != 0x3F)
+	throw SevenZError(154, "Unsupported value. Too many cycles of the 7zAES key derivation.");
+}
+
+const SevenZShaKernel* SevenZKdf::getKernel() const {
+    return kernel;
+}
+
+/**
+ * Writes UTF-16LE of the UTF-8 text, out has room for 2 bytes per input byte
+ * @param p, end, out
+ * @return end of the written text
+ */
+static uint8_t* writeUtf16(const uint8_t *p, const uint8_t *end, uint8_t *out){
+    while (p < end){
+#ifdef KDF_X86
+	// ASCII is widened 16 characters at once, SSE2 is in every x86-64
+	if (end - p >= 16){
+	    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+	    if (_mm_movemask_epi8(x) == 0){
+		__m128i zero = _mm_setzero_si128();
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi8(x, zero));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), _mm_unpackhi_epi8(x, zero));
+		p += 16;
+		out += 32;
+		continue;
+	    }
+	}
+#endif
+	uint32_t c = *p;
+	if (c < 0x80){
+	    out[0] = static_cast<uint8_t>(c);
+	    out[1] = 0;
+	    p++;
+	    out += 2;
+	    continue;
+	}
+	unsigned more = 0;
+	if (c >= 0xF0 && c < 0xF8){
+	    more = 3;
+	    c &= 0x07;
+	} else if (c >= 0xE0 && c < 0xF0){
+	    more = 2;
+	    c &= 0x0F;
+	} else if (c >= 0xC0 && c < 0xE0){
+	    more = 1;
+	    c &= 0x1F;
+	}
+	unsigned i = 1;
+	for (; i <= more && p + i < end && (p[i] & 0xC0) == 0x80; i++)
+	    c = (c << 6) | (p[i] & 0x3F);
+	if (i <= more || c > 0x10FFFF){
+	    c = *p;	// broken sequence, the byte alone
+	    i = 1;
+	}
+	p += i;
+	if (c >= 0x10000){
+	    c -= 0x10000;
+	    uint32_t high = 0xD800 + (c >> 10), low = 0xDC00 + (c & 0x3FF);
+	    out[0] = static_cast<uint8_t>(high);
+	    out[1] = static_cast<uint8_t>(high >> 8);
+	    out[2] = static_cast<uint8_t>(low);
+	    out[3] = static_cast<uint8_t>(low >> 8);
+	    out += 4;
+	} else {
+	    out[0] = static_cast<uint8_t>(c);
+	    out[1] = static_cast<uint8_t>(c >> 8);
+	    out += 2;
+	}
+    }
+    return out;
+}
+
+void SevenZKdf::toUtf16(SevenZSpan utf8, string &dst){
+    size_t start = dst.size();
+    dst.resize(start + 2 * utf8.size);
+    uint8_t *out = reinterpret_cast<uint8_t*>(&dst[0]) + start;
+    uint8_t *end = writeUtf16(utf8.data, utf8.data + utf8.size, out);
+    dst.resize(start + (end - out));
+}
+
+void SevenZKdf::derive(const SevenZSpan *passwords, size_t count, uint8_t *keys){
+    // the whole batch is converted into one buffer
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++)
+	total += passwords[i].size;
+    utf16.resize(2 * total);
+    offsets.resize(count + 1);
+    uint8_t *start = reinterpret_cast<uint8_t*>(&utf16[0]), *out = start;
+    for (size_t i = 0; i < count; i++){
+	offsets[i] = out - start;
+	out = writeUtf16(passwords[i].data, passwords[i].data + passwords[i].size, out);
+    }
+    offsets[count] = out - start;
+    const uint8_t *text = reinterpret_cast<const uint8_t*>(utf16.data());
+
+    if (props.numCyclesPower == 0x3F){
+	// no hashing, the key is salt and password padded with zeros
+	for (size_t i = 0; i < count; i++){
+	    uint8_t *key = keys + i * AES_KEY_SIZE;
+	    memset(key, 0, AES_KEY_SIZE);
+	    size_t pos = min<size_t>(props.saltSize, AES_KEY_SIZE);
+	    memcpy(key, props.salt, pos);
+	    memcpy(key + pos, text + offsets[i], min<size_t>(offsets[i + 1] - offsets[i], AES_KEY_SIZE - pos));
+	}
+	return;
+    }
+
+    // lanes hash in lockstep, so only passwords of the same length share a call
+    order.resize(count);
+    for (size_t i = 0; i < count; i++)
+	order[i] = i;
+    stable_sort(order.begin(), order.end(), [this](size_t x, size_t y){
+	return offsets[x + 1] - offsets[x] < offsets[y + 1] - offsets[y];
+    });
+    vector<const uint8_t*> lanePasswords(kernel->lanes);
+    vector<uint8_t*> laneKeys(kernel->lanes);
+    for (size_t i = 0; i < count;){
+	size_t size = offsets[order[i] + 1] - offsets[order[i]];
+	size_t n = 0;
+	for (; n < kernel->lanes && i < count && offsets[order[i] + 1] - offsets[order[i]] == size; n++, i++){
+	    lanePasswords[n] = text + offsets[order[i]];
+	    laneKeys[n] = keys + order[i] * AES_KEY_SIZE;
+	}
+	deriveLanes(lanePasswords.data(), size, n, laneKeys.data());
+    }
+}
+
+void SevenZKdf::storeLane(const uint8_t *bytes, size_t size, unsigned lane, uint32_t *words){
+    unsigned lanes = kernel->lanes;
+    for (size_t w = 0; w < size / 4; w++, bytes += 4)
+	words[w * lanes + lane] = (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) |
+		(uint32_t(bytes[2]) << 8) | bytes[3];
+}
+
+void SevenZKdf::buildRun(const uint8_t **passwords, size_t size, size_t count, uint64_t counter, size_t units){
+    unsigned lanes = kernel->lanes;
+    size_t prefix = props.saltSize + size, unit = prefix + 8;
+    stream.resize(units * unit);
+    blocks.resize(units * unit / 4 * lanes);
+    for (unsigned j = 0; j < lanes; j++){
+	// unused lanes repeat the first password
+	const uint8_t *password = passwords[j < count ? j : 0];
+	for (size_t k = 0; k < units; k++){
+	    uint8_t *p = stream.data() + k * unit;
+	    memcpy(p, props.salt, props.saltSize);
+	    memcpy(p + props.saltSize, password, size);
+	    uint64_t value = counter + k;
+	    for (unsigned i = 0; i < 8; i++, value >>= 8)
+		p[prefix + i] = static_cast<uint8_t>(value);
+	}
+	storeLane(stream.data(), units * unit, j, blocks.data());
+    }
+}
+
+void SevenZKdf::deriveLanes(const uint8_t **passwords, size_t size, size_t count, uint8_t **keys){
+    unsigned lanes = kernel->lanes;
+    size_t prefix = props.saltSize + size;
+    size_t unit = prefix + 8;			// salt, password, counter
+    uint64_t rounds = 1ULL << props.numCyclesPower;
+
+    // the smallest run of units filling whole blocks, its words are built
+    // once and only the counters change between the runs
+    size_t runUnits = runUnitsOf(unit);
+    size_t runBytes = runUnits * unit;
+    uint64_t runs = rounds / runUnits;		// both are powers of two
+    size_t tailUnits = rounds % runUnits;
+
+    state.resize(8 * lanes);
+    for (unsigned i = 0; i < 8; i++)
+	for (unsigned j = 0; j < lanes; j++)
+	    state[i * lanes + j] = ShaH0[i];
+
+    SevenZShaRuns fixed = props.saltSize == 0 && kernel->fixed != NULL ? kernel->fixed(size) : NULL;
+    if (runs > 0 && fixed != NULL){
+	// the kernel makes the two lowest counter bytes, the others are the
+	// same for 65536 units
+	uint64_t segment = 65536 / runUnits;
+	for (uint64_t first = 0; first < runs; first += segment){
+	    buildRun(passwords, size, count, first * runUnits, runUnits);
+	    fixed(state.data(), blocks.data(), first, min(segment, runs - first));
+	}
+    } else if (runs > 0){
+	buildRun(passwords, size, count, 0, runUnits);
+	kernel->compress(state.data(), blocks.data(), runBytes / 64);
+
+	for (uint64_t r = 1; r < runs; r++){
+	    // counters are patched in place, only the bytes that changed
+	    uint64_t base = r * runUnits;
+	    uint64_t changed = base ^ (base - runUnits);
+	    unsigned changedBytes = 0;
+	    while (changed != 0){
+		changedBytes++;
+		changed >>= 8;
+	    }
+	    for (size_t k = 0; k < runUnits; k++){
+		uint64_t counter = base + k;
+		for (unsigned i = 0; i < changedBytes; i++){
+		    size_t pos = k * unit + prefix + i;
+		    unsigned shift = (3 - (pos & 3)) * 8;
+		    uint32_t value = static_cast<uint32_t>((counter >> (8 * i)) & 0xFF) << shift;
+		    uint32_t *w = blocks.data() + (pos / 4) * lanes;
+		    for (unsigned j = 0; j < lanes; j++)
+			w[j] = (w[j] & ~(0xFFu << shift)) | value;
+		}
+	    }
+	    kernel->compress(state.data(), blocks.data(), runBytes / 64);
+	}
+    }
+
+    // rest of the units and the SHA padding
+    size_t tailBytes = tailUnits * unit;
+    size_t tailSize = (tailBytes + 1 + 8 + 63) / 64 * 64;
+    uint64_t bits = rounds * unit * 8;
+    stream.assign(tailSize, 0);
+    tail.resize(tailSize / 4 * lanes);
+    for (unsigned j = 0; j < lanes; j++){
+	const uint8_t *password = passwords[j < count ? j : 0];
+	for (size_t k = 0; k < tailUnits; k++){
+	    uint8_t *p = stream.data() + k * unit;
+	    memcpy(p, props.salt, props.saltSize);
+	    memcpy(p + props.saltSize, password, size);
+	    uint64_t counter = runs * runUnits + k;
+	    for (unsigned i = 0; i < 8; i++, counter >>= 8)
+		p[prefix + i] = static_cast<uint8_t>(counter);
+	}
+	stream[tailBytes] = 0x80;
+	for (unsigned i = 0; i < 8; i++)
+	    stream[tailSize - 1 - i] = static_cast<uint8_t>(bits >> (8 * i));
+	storeLane(stream.data(), tailSize, j, tail.data());
+    }
+    kernel->compress(state.data(), tail.data(), tailSize / 64);
+
+    for (size_t j = 0; j < count; j++)
+	for (unsigned i = 0; i < 8; i++){
+	    uint32_t v = state[i * lanes + j];
+	    keys[j][4 * i] = static_cast<uint8_t>(v >> 24);
+	    keys[j][4 * i + 1] = static_cast<uint8_t>(v >> 16);
+	    keys[j][4 * i + 2] = static_cast<uint8_t>(v >> 8);
+	    keys[j][4 * i + 3] = static_cast<uint8_t>(v);
+	}
+}
+
+/**
+ * Keys per second of the kernel deriving 8 character passwords for a second
+ * @param kernel, props
+ */
+static double benchmarkKernel(const SevenZShaKernel &kernel, const SevenZAesProps &props){
+    SevenZKdf kdf(props, &kernel);
+    vector<string> words(kernel.lanes);
+    vector<SevenZSpan> spans(kernel.lanes);
+    vector<uint8_t> keys(kernel.lanes * AES_KEY_SIZE);
+    uint64_t candidates = 0, batch = 0;
+    auto start = chrono::steady_clock::now();
+    double seconds = 0;
+    while (seconds < 1.0){
+	for (unsigned j = 0; j < kernel.lanes; j++){
+	    char word[16];
+	    snprintf(word, sizeof(word), "%08llu", static_cast<unsigned long long>(batch * kernel.lanes + j));
+	    words[j] = word;
+	    spans[j].data = reinterpret_cast<const uint8_t*>(words[j].data());
+	    spans[j].size = words[j].size();
+	}
+	kdf.derive(spans.data(), spans.size(), keys.data());
+	candidates += kernel.lanes;
+	batch++;
+	seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+    return candidates / seconds;
+}
+
+void sevenZKdfBenchmark(ostream &out, unsigned numCyclesPower){
+    SevenZAesProps props;
+    props.numCyclesPower = numCyclesPower;
+    props.saltSize = 0;
+    props.ivSize = 16;
+    memset(props.iv, 0, sizeof(props.iv));
+
+    out << "7zAES key derivation, NumCyclesPower " << numCyclesPower << ", 8 character passwords" << endl;
+    size_t count;
+    const SevenZShaKernel *all = sevenZShaKernels(&count);
+    for (size_t k = 0; k < count; k++){
+	const SevenZShaKernel &kernel = all[k];
+	if (!kernel.supported()){
+	    out << kernel.name << ": not supported by the CPU" << endl;
+	    continue;
+	}
+	char line[96];
+	bool fixed = kernel.fixed != NULL && kernel.fixed(16) != NULL;
+	snprintf(line, sizeof(line), "%-8s %2u lanes %12.1f candidates/s%s", kernel.name, kernel.lanes,
+		benchmarkKernel(kernel, props), fixed ? ", compiled layout" : "");
+	out << line << endl;
+	if (fixed){
+	    // the same kernel without the layouts, for comparison
+	    SevenZShaKernel generic = kernel;
+	    generic.fixed = NULL;
+	    snprintf(line, sizeof(line), "%-8s %2u lanes %12.1f candidates/s, generic", kernel.name, kernel.lanes,
+		    benchmarkKernel(generic, props));
+	    out << line << endl;
+	}
+    }
+}
@@ -0,0 +1,284 @@
+#include "SevenZKeyCache.h"
+#include "SevenZKdf.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+#define STORE_MAGIC "7zKeys\0\1"
+#define STORE_HEADER 64		    // magic, number of slots, used slots
+#define INITIAL_SLOTS (1 << 14)
+
+struct SevenZKeyCache::Slot {
+    uint64_t lo, hi;		    // fingerprint, both 0 for an empty slot
+    uint8_t key[AES_KEY_SIZE];
+};
+
+/**
+ * flock() of the store for one call. The mutex orders the threads, the
+ * file lock the processes sharing the store. fd is the member of the
+ * cache, a store which fails is closed and is not unlocked then.
+ */
+class StoreLock {
+public:
+    StoreLock(const int &fd, int operation): fd(fd){
+	if (fd >= 0)
+	    while (flock(fd, operation) != 0 && errno == EINTR)
+		;
+    }
+    ~StoreLock(){
+	if (fd >= 0)
+	    flock(fd, LOCK_UN);
+    }
+private:
+    const int &fd;
+};
+
+static inline uint64_t mix64(uint64_t x){
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static uint64_t hash64(const uint8_t *p, size_t n, uint64_t seed){
+    uint64_t h = mix64(seed ^ n);
+    for (; n >= 8; p += 8, n -= 8){
+	uint64_t k;
+	memcpy(&k, p, 8);
+	h = mix64(h ^ k);
+    }
+    uint64_t k = 0;
+    memcpy(&k, p, n);
+    return mix64(h ^ k ^ 0x9e3779b97f4a7c15ULL);
+}
+
+SevenZKeyCache::SevenZKeyCache(): fd(-1), base(NULL), mapped(0), slots(NULL),
+    numSlots(NULL), used(NULL) {
+    map(INITIAL_SLOTS);
+    memcpy(base, STORE_MAGIC, 8);
+    *numSlots = INITIAL_SLOTS;
+}
+
+SevenZKeyCache::~SevenZKeyCache(){
+    unmap();
+    if (fd >= 0)
+	close(fd);
+}
+
+bool SevenZKeyCache::map(uint64_t count){
+    size_t size = STORE_HEADER + count * sizeof(Slot);
+    if (fd < 0){
+	memory.assign(size, 0);
+	base = memory.data();
+    } else {
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	    return false;
+	if (static_cast<uint64_t>(st.st_size) < size && ftruncate(fd, size) != 0)
+	    return false;
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+	    return false;
+	base = static_cast<uint8_t*>(p);
+	mapped = size;
+    }
+    numSlots = reinterpret_cast<uint64_t*>(base + 8);
+    used = numSlots + 1;
+    slots = reinterpret_cast<Slot*>(base + STORE_HEADER);
+    return true;
+}
+
+void SevenZKeyCache::unmap(){
+    if (fd >= 0 && base != NULL)
+	munmap(base, mapped);
+    base = NULL;
+    mapped = 0;
+}
+
+bool SevenZKeyCache::open(const char *path){
+    lock_guard<mutex> guard(lock);
+    int file = ::open(path, O_RDWR | O_CREAT, 0644);
+    if (file < 0)
+	return false;
+    // an empty store is initialized by the first process only
+    while (flock(file, LOCK_EX) != 0 && errno == EINTR)
+	;
+    struct stat st;
+    if (fstat(file, &st) != 0){
+	close(file);
+	return false;
+    }
+    vector<Slot> cached;
+    for (uint64_t i = 0; i < *numSlots; i++)
+	if (slots[i].lo != 0 || slots[i].hi != 0)
+	    cached.push_back(slots[i]);
+
+    uint64_t count = 0;
+    if (st.st_size > 0){
+	// existing store, the header must describe the whole file
+	char header[STORE_HEADER];
+	if (st.st_size < STORE_HEADER || pread(file, header, STORE_HEADER, 0) != STORE_HEADER ||
+		memcmp(header, STORE_MAGIC, 8) != 0){
+	    close(file);
+	    return false;
+	}
+	memcpy(&count, header + 8, sizeof(count));
+	if (count == 0 || (count & (count - 1)) != 0 ||
+		static_cast<uint64_t>(st.st_size) != STORE_HEADER + count * sizeof(Slot)){
+	    close(file);
+	    return false;
+	}
+    }
+    unmap();
+    memory.clear();
+    memory.shrink_to_fit();
+    fd = file;
+    uint64_t want = count > 0 ? count : INITIAL_SLOTS;
+    while (want < 2 * cached.size())
+	want *= 2;
+    if (!map(count > 0 ? count : want)){
+	close(fd);
+	fd = -1;
+	map(want);
+	memcpy(base, STORE_MAGIC, 8);
+	*numSlots = want;
+	for (size_t i = 0; i < cached.size(); i++)
+	    *find(Fingerprint{cached[i].lo, cached[i].hi}) = cached[i];
+	*used = cached.size();
+	return false;
+    }
+    if (count == 0){
+	memcpy(base, STORE_MAGIC, 8);
+	*numSlots = want;
+	*used = 0;
+    }
+    // keys cached so far go to the store
+    for (size_t i = 0; i < cached.size(); i++){
+	if ((*used + 1) * 2 > *numSlots)
+	    grow();
+	Slot *slot = find(Fingerprint{cached[i].lo, cached[i].hi});
+	if (slot->lo == 0 && slot->hi == 0){
+	    *slot = cached[i];
+	    (*used)++;
+	}
+    }
+    if (fd >= 0)
+	flock(fd, LOCK_UN);
+    return true;
+}
+
+size_t SevenZKeyCache::size() const {
+    lock_guard<mutex> guard(lock);
+    return *used;
+}
+
+SevenZKeyCache::Fingerprint SevenZKeyCache::fingerprint(const SevenZAesProps &props, SevenZSpan password){
+    scratch.clear();
+    scratch += static_cast<char>(props.numCyclesPower);
+    scratch += static_cast<char>(props.saltSize);
+    scratch.append(reinterpret_cast<const char*>(props.salt), props.saltSize);
+    scratch.append(reinterpret_cast<const char*>(password.data), password.size);
+    const uint8_t *p = reinterpret_cast<const uint8_t*>(scratch.data());
+    Fingerprint fp = { hash64(p, scratch.size(), 0x5a7a4b6579734c6fULL), hash64(p, scratch.size(), 0x2545f4914f6cdd1dULL) };
+    if (fp.lo == 0 && fp.hi == 0)
+	fp.lo = 1;	// zeros mark empty slots
+    return fp;
+}
+
+SevenZKeyCache::Slot* SevenZKeyCache::find(Fingerprint fp){
+    uint64_t mask = *numSlots - 1;
+    for (uint64_t i = fp.lo & mask;; i = (i + 1) & mask){
+	Slot *slot = &slots[i];
+	if ((slot->lo == fp.lo && slot->hi == fp.hi) || (slot->lo == 0 && slot->hi == 0))
+	    return slot;
+    }
+}
+
+void SevenZKeyCache::follow(){
+    if (fd < 0 || STORE_HEADER + *numSlots * sizeof(Slot) == mapped)
+	return;
+    // another process has grown the table
+    uint64_t count = *numSlots;
+    unmap();
+    if (count == 0 || (count & (count - 1)) != 0 || !map(count)){
+	cerr << "WARNING: Key store can't be mapped again, keys are cached only in the memory now" << endl;
+	close(fd);
+	fd = -1;
+	map(INITIAL_SLOTS);
+	memcpy(base, STORE_MAGIC, 8);
+	*numSlots = INITIAL_SLOTS;
+	*used = 0;
+    }
+}
+
+void SevenZKeyCache::grow(){
+    vector<Slot> cached;
+    cached.reserve(*used);
+    for (uint64_t i = 0; i < *numSlots; i++)
+	if (slots[i].lo != 0 || slots[i].hi != 0)
+	    cached.push_back(slots[i]);
+    uint64_t count = *numSlots * 2;
+    unmap();
+    if (!map(count)){
+	cerr << "WARNING: Key store can't grow, keys are cached only in the memory now" << endl;
+	close(fd);
+	fd = -1;
+	map(count);
+    }
+    memcpy(base, STORE_MAGIC, 8);
+    *numSlots = count;
+    memset(slots, 0, count * sizeof(Slot));
+    for (size_t i = 0; i < cached.size(); i++)
+	*find(Fingerprint{cached[i].lo, cached[i].hi}) = cached[i];
+    *used = cached.size();
+}
+
+size_t SevenZKeyCache::lookup(const SevenZAesProps &props, const SevenZSpan *passwords, size_t count,
+	uint8_t *keys, uint8_t *found){
+    lock_guard<mutex> guard(lock);
+    StoreLock shared(fd, LOCK_SH);
+    follow();
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++){
+	Slot *slot = find(fingerprint(props, passwords[i]));
+	found[i] = slot->lo != 0 || slot->hi != 0;
+	if (found[i]){
+	    memcpy(keys + i * AES_KEY_SIZE, slot->key, AES_KEY_SIZE);
+	    n++;
+	}
+    }
+    return n;
+}
+
+void SevenZKeyCache::store(const SevenZAesProps &props, const SevenZSpan *passwords, size_t count,
+	const uint8_t *keys, const uint8_t *skip){
+    lock_guard<mutex> guard(lock);
+    StoreLock exclusive(fd, LOCK_EX);
+    follow();
+    for (size_t i = 0; i < count; i++){
+	if (skip != NULL && skip[i])
+	    continue;
+	Fingerprint fp = fingerprint(props, passwords[i]);
+	Slot *slot = find(fp);
+	if (slot->lo != 0 || slot->hi != 0)
+	    continue;
+	if ((*used + 1) * 2 > *numSlots){
+	    grow();
+	    slot = find(fp);
+	}
+	memcpy(slot->key, keys + i * AES_KEY_SIZE, AES_KEY_SIZE);
+	slot->hi = fp.hi;
+	slot->lo = fp.lo;
+	(*used)++;
+    }
+}
@@ -0,0 +1,254 @@
+#include "SevenZLzmaEnc.h"
+
+#include <algorithm>
+
+using namespace std;
+
+#define LC 3
+#define PB 2
+#define NUM_STATES 12
+#define PROB_INIT 1024
+#define TOP (1u << 24)
+#define MATCH_MIN 3
+#define MATCH_MAX 273
+#define HASH_BITS 16
+#define END_POS_MODEL 14	// slots below it have their own footer probabilities
+#define FULL_DISTANCES (1 << (END_POS_MODEL >> 1))
+#define ALIGN_BITS 4
+
+typedef uint16_t Prob;
+
+/**
+ * Range encoder, the inverse of the decoder in LzmaDec.cpp
+ */
+class RangeEncoder {
+public:
+    RangeEncoder(vector<uint8_t> &out): out(out), low(0), range(0xFFFFFFFF), cache(0), cacheSize(1) {}
+
+    void bit(Prob &prob, unsigned bit){
+	uint32_t bound = (range >> 11) * prob;
+	if (bit == 0){
+	    range = bound;
+	    prob += (2048 - prob) >> 5;
+	} else {
+	    low += bound;
+	    range -= bound;
+	    prob -= prob >> 5;
+	}
+	normalize();
+    }
+
+    void direct(uint32_t value, unsigned numBits){
+	while (numBits-- > 0){
+	    range >>= 1;
+	    low += range & (0 - ((value >> numBits) & 1));
+	    normalize();
+	}
+    }
+
+    /**
+     * Bits from the highest one, probs are indexed as a binary tree from 1
+     */
+    void tree(Prob *probs, unsigned numBits, uint32_t symbol){
+	uint32_t m = 1;
+	while (numBits-- > 0){
+	    unsigned b = (symbol >> numBits) & 1;
+	    bit(probs[m], b);
+	    m = (m << 1) | b;
+	}
+    }
+
+    void reverseTree(Prob *probs, unsigned numBits, uint32_t symbol){
+	uint32_t m = 1;
+	for (unsigned i = 0; i < numBits; i++){
+	    unsigned b = symbol & 1;
+	    bit(probs[m], b);
+	    m = (m << 1) | b;
+	    symbol >>= 1;
+	}
+    }
+
+    void flush(){
+	for (int i = 0; i < 5; i++)
+	    shiftLow();
+    }
+
+private:
+    void normalize(){
+	while (range < TOP){
+	    range <<= 8;
+	    shiftLow();
+	}
+    }
+
+    /**
+     * Top byte of low is written when no carry can change it anymore,
+     * a run of 0xFF bytes waits in cacheSize for the carry
+     */
+    void shiftLow(){
+	if (static_cast<uint32_t>(low) < 0xFF000000 || (low >> 32) != 0){
+	    uint8_t carry = static_cast<uint8_t>(low >> 32);
+	    uint8_t temp = cache;
+	    do {
+		out.push_back(static_cast<uint8_t>(temp + carry));
+		temp = 0xFF;
+	    } while (--cacheSize != 0);
+	    cache = static_cast<uint8_t>(static_cast<uint32_t>(low) >> 24);
+	}
+	cacheSize++;
+	low = (low & 0x00FFFFFF) << 8;
+    }
+
+    vector<uint8_t> &out;
+    uint64_t low;
+    uint32_t range;
+    uint8_t cache;
+    uint64_t cacheSize;
+};
+
+/**
+ * Probabilities of match lengths
+ */
+struct LenModel {
+    Prob choice;
+    Prob choice2;
+    Prob low[1 << PB][8];
+    Prob mid[1 << PB][8];
+    Prob high[256];
+
+    void encode(RangeEncoder &rc, uint32_t len, unsigned posState){
+	len -= 2;
+	if (len < 8){
+	    rc.bit(choice, 0);
+	    rc.tree(low[posState], 3, len);
+	} else if (len < 16){
+	    rc.bit(choice, 1);
+	    rc.bit(choice2, 0);
+	    rc.tree(mid[posState], 3, len - 8);
+	} else {
+	    rc.bit(choice, 1);
+	    rc.bit(choice2, 1);
+	    rc.tree(high, 8, len - 16);
+	}
+    }
+};
+
+/**
+ * All probabilities of the stream
+ */
+struct LzmaModel {
+    Prob isMatch[NUM_STATES][1 << PB];
+    Prob isRep[NUM_STATES];
+    Prob literal[1 << LC][0x300];
+    Prob posSlot[4][64];
+    Prob specPos[FULL_DISTANCES - END_POS_MODEL + 1];
+    Prob align[1 << ALIGN_BITS];
+    LenModel len;
+
+    LzmaModel(){
+	Prob *p = reinterpret_cast<Prob*>(this);
+	fill(p, p + sizeof(*this) / sizeof(Prob), static_cast<Prob>(PROB_INIT));
+    }
+};
+
+static unsigned posSlotOf(uint32_t dist){
+    if (dist < 4)
+	return dist;
+    unsigned n = 31;
+    while ((dist >> n) == 0)
+	n--;
+    return 2 * n + ((dist >> (n - 1)) & 1);
+}
+
+SevenZLzmaEncoder::SevenZLzmaEncoder(uint32_t dictSize): dictSize(dictSize) {
+}
+
+void SevenZLzmaEncoder::properties(uint8_t *props) const {
+    props[0] = (PB * 5 + 0) * 9 + LC;
+    for (int i = 0; i < 4; i++)
+	props[1 + i] = static_cast<uint8_t>(dictSize >> (8 * i));
+}
+
+void SevenZLzmaEncoder::encode(const uint8_t *data, size_t size, vector<uint8_t> &out){
+    LzmaModel *model = new LzmaModel();
+    vector<uint32_t> head(1 << HASH_BITS, UINT32_MAX);
+    RangeEncoder rc(out);
+    unsigned state = 0;
+    uint32_t rep0 = 0;
+    size_t pos = 0;
+
+    while (pos < size){
+	unsigned posState = pos & ((1 << PB) - 1);
+	uint32_t len = 0, dist = 0;
+	if (pos + MATCH_MIN <= size){
+	    uint32_t h = (data[pos] | data[pos + 1] << 8 | data[pos + 2] << 16) * 2654435761u >> (32 - HASH_BITS);
+	    uint32_t cand = head[h];
+	    head[h] = static_cast<uint32_t>(pos);
+	    if (cand != UINT32_MAX && pos - cand <= dictSize){
+		size_t limit = min<size_t>(MATCH_MAX, size - pos);
+		while (len < limit && data[cand + len] == data[pos + len])
+		    len++;
+		dist = static_cast<uint32_t>(pos - cand - 1);
+	    }
+	}
+
+	if (len < MATCH_MIN){
+	    uint8_t cur = data[pos];
+	    Prob *probs = model->literal[pos > 0 ? data[pos - 1] >> (8 - LC) : 0];
+	    rc.bit(model->isMatch[state][posState], 0);
+	    if (state < 7){
+		rc.tree(probs, 8, cur);
+	    } else {
+		// literal after a match is coded against the byte at rep0
+		uint32_t matchByte = data[pos - rep0 - 1];
+		uint32_t symbol = cur | 0x100;
+		uint32_t offs = 0x100;
+		do {
+		    matchByte <<= 1;
+		    rc.bit(probs[offs + (matchByte & offs) + (symbol >> 8)], (symbol >> 7) & 1);
+		    symbol <<= 1;
+		    offs &= ~(matchByte ^ symbol);
+		} while (symbol < 0x10000);
+	    }
+	    state = state < 4 ? 0 : (state < 10 ? state - 3 : state - 6);
+	    pos++;
+	    continue;
+	}
+
+	rc.bit(model->isMatch[state][posState], 1);
+	rc.bit(model->isRep[state], 0);
+	model->len.encode(rc, len, posState);
+	unsigned slot = posSlotOf(dist);
+	rc.tree(model->posSlot[min<uint32_t>(len - 2, 3)], 6, slot);
+	if (slot >= 4){
+	    unsigned footerBits = (slot >> 1) - 1;
+	    uint32_t base = (2 | (slot & 1)) << footerBits;
+	    uint32_t reduced = dist - base;
+	    if (slot < END_POS_MODEL){
+		rc.reverseTree(model->specPos + base - slot - 1, footerBits, reduced);
+	    } else {
+		rc.direct(reduced >> ALIGN_BITS, footerBits - ALIGN_BITS);
+		rc.reverseTree(model->align - 1, ALIGN_BITS, reduced & ((1 << ALIGN_BITS) - 1));
+	    }
+	}
+	rep0 = dist;
+	state = state < 7 ? 7 : 10;
+	// positions inside the match go to the hash too, so later data find them
+	for (size_t i = pos + 1; i < pos + len && i + MATCH_MIN <= size; i++)
+	    head[(data[i] | data[i + 1] << 8 | data[i + 2] << 16) * 2654435761u >> (32 - HASH_BITS)] = static_cast<uint32_t>(i);
+	pos += len;
+    }
+    rc.flush();
+    delete model;
+}
+
+void sevenZLzma2Stored(const uint8_t *data, size_t size, vector<uint8_t> &out, bool resets){
+    for (size_t pos = 0; pos < size; pos += 1 << 16){
+	size_t chunk = min<size_t>(size - pos, 1 << 16);
+	out.push_back(pos == 0 || resets ? 1 : 2);	// the first chunk resets the dictionary
+	out.push_back(static_cast<uint8_t>((chunk - 1) >> 8));
+	out.push_back(static_cast<uint8_t>(chunk - 1));
+	out.insert(out.end(), data + pos, data + pos + chunk);
+    }
+    out.push_back(0);
+}
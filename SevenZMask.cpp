@@ -0,0 +1,116 @@
+#include "SevenZMask.h"
+#include "SevenZError.h"
+
+#include <cstring>
+
+using namespace std;
+
+static const char Lower[] = "abcdefghijklmnopqrstuvwxyz";
+static const char Upper[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+static const char Digits[] = "0123456789";
+static const char Special[] = " !\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~";
+
+/**
+ * Charset of ?c, custom charsets only outside of a custom charset
+ * @param c, custom
+ */
+static string charset(char c, const vector<string> *custom){
+    switch (c){
+    case 'l': return Lower;
+    case 'u': return Upper;
+    case 'd': return Digits;
+    case 's': return Special;
+    case 'a': return string(Lower) + Upper + Digits + Special;
+    case '?': return "?";
+    }
+    if (custom != NULL && c >= '1' && c < '1' + MASK_CHARSETS){
+	size_t i = c - '1';
+	if (i < custom->size() && !(*custom)[i].empty())
+	    return (*custom)[i];
+	throw SevenZError(160, string("Invalid mask. Custom charset ?") + c + " is not defined.");
+    }
+    throw SevenZError(160, string("Invalid mask. Unknown charset ?") + c + ".");
+}
+
+string SevenZMask::expand(const string &text, const vector<string> *custom){
+    string set;
+    for (size_t i = 0; i < text.size(); i++){
+	string part(1, text[i]);
+	if (text[i] == '?'){
+	    if (++i == text.size())
+		throw SevenZError(160, "Invalid mask. It ends with ?.");
+	    part = charset(text[i], custom);
+	}
+	for (size_t j = 0; j < part.size(); j++)
+	    if (set.find(part[j]) == string::npos)
+		set += part[j];
+    }
+    return set;
+}
+
+SevenZMask::SevenZMask(const string &mask, const vector<string> &custom): mask(mask), custom(custom), total(1) {
+    if (custom.size() > MASK_CHARSETS)
+	throw SevenZError(160, "Invalid mask. Too many custom charsets.");
+    for (size_t i = 0; i < custom.size(); i++)
+	this->custom[i] = expand(custom[i], NULL);
+
+    for (size_t i = 0; i < mask.size(); i++){
+	if (mask[i] != '?'){
+	    positions.push_back(string(1, mask[i]));
+	    continue;
+	}
+	if (++i == mask.size())
+	    throw SevenZError(160, "Invalid mask. It ends with ?.");
+	positions.push_back(charset(mask[i], &this->custom));
+    }
+    if (positions.empty())
+	throw SevenZError(160, "Invalid mask. It is empty.");
+    for (size_t i = 0; i < positions.size(); i++){
+	uint64_t n = positions[i].size();
+	if (total > UINT64_MAX / n)
+	    throw SevenZError(160, "Invalid mask. It has more than 2^64 candidates.");
+	total *= n;
+    }
+}
+
+uint64_t SevenZMask::size() const {
+    return total;
+}
+
+size_t SevenZMask::length() const {
+    return positions.size();
+}
+
+string SevenZMask::describe() const {
+    string text = mask;
+    for (size_t i = 0; i < custom.size(); i++)
+	text += " " + custom[i];
+    return text;
+}
+
+void SevenZMask::generate(uint64_t first, size_t count, uint8_t *out) const {
+    size_t len = positions.size();
+    if (count == 0)
+	return;
+    // digits of the first candidate, the last position is the lowest one
+    vector<size_t> digits(len);
+    for (size_t i = len; i-- > 0;){
+	digits[i] = first % positions[i].size();
+	first /= positions[i].size();
+	out[i] = static_cast<uint8_t>(positions[i][digits[i]]);
+    }
+    // every next candidate is the previous one with the digits carried
+    for (size_t c = 1; c < count; c++){
+	uint8_t *next = out + len;
+	memcpy(next, out, len);
+	for (size_t i = len; i-- > 0;){
+	    if (++digits[i] < positions[i].size()){
+		next[i] = static_cast<uint8_t>(positions[i][digits[i]]);
+		break;
+	    }
+	    digits[i] = 0;
+	    next[i] = static_cast<uint8_t>(positions[i][0]);
+	}
+	out = next;
+    }
+}
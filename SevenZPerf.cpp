@@ -0,0 +1,111 @@
+#include "SevenZPerf.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char *EventNames[NumPerfEvents] = {
+    "cycles", "instructions", "branch_misses", "llc_misses", "page_faults"
+};
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} EventConfigs[NumPerfEvents] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS}
+};
+
+SevenZPerfCounters::SevenZPerfCounters(): leader(-1), count(0) {
+    for (int i = 0; i < NumPerfEvents; i++){
+	fds[i] = -1;
+	slot[i] = -1;
+    }
+}
+
+SevenZPerfCounters::~SevenZPerfCounters(){
+    for (int i = 0; i < NumPerfEvents; i++)
+	if (fds[i] >= 0)
+	    close(fds[i]);
+}
+
+bool SevenZPerfCounters::open(){
+    int firstErrno = 0;
+    for (int i = 0; i < NumPerfEvents; i++){
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = EventConfigs[i].type;
+	attr.config = EventConfigs[i].config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.disabled = leader < 0;	// the group starts with its leader
+	int groupFd = leader >= 0 ? fds[leader] : -1;
+	int fd = syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+	if (fd < 0){
+	    if (firstErrno == 0)
+		firstErrno = errno;
+	    continue;
+	}
+	fds[i] = fd;
+	slot[i] = count++;
+	if (leader < 0)
+	    leader = i;
+    }
+    if (firstErrno != 0){
+	message = string("perf_event_open: ") + strerror(firstErrno);
+	ifstream paranoid("/proc/sys/kernel/perf_event_paranoid");
+	int level;
+	if (paranoid >> level)
+	    message += ", perf_event_paranoid is " + to_string(level);
+    }
+    if (leader < 0)
+	return false;
+    ioctl(fds[leader], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+}
+
+bool SevenZPerfCounters::available(SevenZPerfEvent event) const {
+    return fds[event] >= 0;
+}
+
+unsigned SevenZPerfCounters::events() const {
+    unsigned mask = 0;
+    for (int i = 0; i < NumPerfEvents; i++)
+	if (fds[i] >= 0)
+	    mask |= 1u << i;
+    return mask;
+}
+
+void SevenZPerfCounters::read(uint64_t *values) const {
+    memset(values, 0, NumPerfEvents * sizeof(uint64_t));
+    if (leader < 0)
+	return;
+    // nr, time enabled, time running, values in the order of opening
+    uint64_t buffer[3 + NumPerfEvents];
+    if (::read(fds[leader], buffer, sizeof(buffer)) < static_cast<ssize_t>(3 * sizeof(uint64_t)))
+	return;
+    double scale = buffer[2] > 0 && buffer[2] < buffer[1] ? static_cast<double>(buffer[1]) / buffer[2] : 1;
+    for (int i = 0; i < NumPerfEvents; i++)
+	if (slot[i] >= 0 && static_cast<uint64_t>(slot[i]) < buffer[0])
+	    values[i] = static_cast<uint64_t>(buffer[3 + slot[i]] * scale);
+}
+
+const string& SevenZPerfCounters::error() const {
+    return message;
+}
+
+const char* SevenZPerfCounters::eventName(SevenZPerfEvent event){
+    return EventNames[event];
+}
@@ -0,0 +1,167 @@
+#include "SevenZStats.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+static const char *PhaseNames[NumPhases] = {
+    "open", "io", "crc", "parse", "decode", "test", "output"
+};
+
+void SevenZStats::add(const SevenZStats &other){
+    if (archives == 0)
+	kind = other.kind;
+    else if (strcmp(kind, other.kind) != 0)
+	kind = "mixed";
+    archives += other.archives;
+    failed += other.failed;
+    totalNs += other.totalNs;
+    for (int i = 0; i < NumPhases; i++)
+	phaseNs[i] += other.phaseNs[i];
+    bytesRead += other.bytesRead;
+    ioRequests += other.ioRequests;
+    syscalls += other.syscalls;
+    bytesDecoded += other.bytesDecoded;
+    allocations += other.allocations;
+    if (other.memoryBytes > memoryBytes)
+	memoryBytes = other.memoryBytes;
+    perfEvents |= other.perfEvents;
+    for (int i = 0; i < NumPhases; i++)
+	for (int j = 0; j < NumPerfEvents; j++)
+	    perf[i][j] += other.perf[i][j];
+}
+
+void SevenZStats::printJson(ostream &out) const {
+    out << "{\"archives\": " << archives << ", \"failed\": " << failed
+	<< ", \"total_ns\": " << totalNs << ", \"phases_ns\": {";
+    for (int i = 0; i < NumPhases; i++)
+	out << (i > 0 ? ", " : "") << "\"" << PhaseNames[i] << "\": " << phaseNs[i];
+    out << "}, \"bytes_read\": " << bytesRead << ", \"io_requests\": " << ioRequests
+	<< ", \"syscalls\": " << syscalls << ", \"bytes_decoded\": " << bytesDecoded
+	<< ", \"allocations\": " << allocations << ", \"memory_bytes\": " << memoryBytes
+	<< ", \"kind\": \"" << kind << "\"";
+    if (perfEvents != 0){
+	out << ", \"perf\": {";
+	for (int i = 0; i < NumPhases; i++){
+	    out << (i > 0 ? ", " : "") << "\"" << PhaseNames[i] << "\": {";
+	    for (int j = 0; j < NumPerfEvents; j++){
+		out << (j > 0 ? ", " : "") << "\"" << SevenZPerfCounters::eventName(static_cast<SevenZPerfEvent>(j)) << "\": ";
+		if (perfEvents & (1u << j))
+		    out << perf[i][j];
+		else
+		    out << "null";
+	    }
+	    out << "}";
+	}
+	out << "}";
+    }
+    out << "}";
+}
+
+/**
+ * Ratio as text, "-" when an event was not counted
+ */
+static string perMille(bool valid, double value, double base, double scale){
+    if (!valid || base == 0)
+	return "-";
+    char text[32];
+    snprintf(text, sizeof(text), "%.2f", value * scale / base);
+    return text;
+}
+
+void SevenZStats::printPerfHeader(ostream &out){
+    char line[256];
+    snprintf(line, sizeof(line), "%-16s %-8s %10s %14s %6s %10s %10s %10s",
+	    "class", "phase", "ms", "cycles", "IPC", "br-miss/k", "LLC-miss/k", "faults");
+    out << line << endl;
+}
+
+void SevenZStats::printPerf(ostream &out, const string &label) const {
+    char line[256];
+    bool cycles = perfEvents & (1u << PerfCycles);
+    bool instructions = perfEvents & (1u << PerfInstructions);
+    bool branches = perfEvents & (1u << PerfBranchMisses);
+    bool llc = perfEvents & (1u << PerfLlcMisses);
+    bool faults = perfEvents & (1u << PerfPageFaults);
+    for (int i = 0; i < NumPhases; i++){
+	if (phaseNs[i] == 0)
+	    continue;
+	const uint64_t *e = perf[i];
+	snprintf(line, sizeof(line), "%-16s %-8s %10.3f %14s %6s %10s %10s %10s",
+		label.c_str(), PhaseNames[i], phaseNs[i] / 1e6,
+		cycles ? to_string(e[PerfCycles]).c_str() : "-",
+		perMille(cycles && instructions, e[PerfInstructions], e[PerfCycles], 1).c_str(),
+		perMille(instructions && branches, e[PerfBranchMisses], e[PerfInstructions], 1000).c_str(),
+		perMille(instructions && llc, e[PerfLlcMisses], e[PerfInstructions], 1000).c_str(),
+		faults ? to_string(e[PerfPageFaults]).c_str() : "-");
+	out << line << endl;
+    }
+}
+
+const char* SevenZStats::phaseName(SevenZPhase phase){
+    return PhaseNames[phase];
+}
+
+SevenZPhaseClock::SevenZPhaseClock(SevenZStats &stats): stats(stats), current(-1), mark(0),
+    counters(NULL) {
+}
+
+void SevenZPhaseClock::setCounters(const SevenZPerfCounters *counters){
+    this->counters = counters;
+}
+
+void SevenZPhaseClock::count(){
+    uint64_t values[NumPerfEvents];
+    counters->read(values);
+    for (int i = 0; i < NumPerfEvents; i++){
+	// scaled values of multiplexed counters may step back a little
+	if (current >= 0 && values[i] > last[i])
+	    stats.perf[current][i] += values[i] - last[i];
+	last[i] = values[i];
+    }
+    stats.perfEvents = counters->events();
+}
+
+uint64_t SevenZPhaseClock::now(){
+    return chrono::duration_cast<chrono::nanoseconds>(
+	    chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int SevenZPhaseClock::enter(SevenZPhase phase){
+    if (counters != NULL)
+	count();
+    uint64_t t = now();
+    if (current >= 0)
+	stats.phaseNs[current] += t - mark;
+    mark = t;
+    int previous = current;
+    current = phase;
+    return previous;
+}
+
+void SevenZPhaseClock::leave(int previous){
+    if (counters != NULL)
+	count();
+    uint64_t t = now();
+    stats.phaseNs[current] += t - mark;
+    mark = t;
+    current = previous;
+}
+
+void sevenZJsonString(ostream &out, const string &text){
+    out << '"';
+    for (size_t i = 0; i < text.size(); i++){
+	unsigned char c = text[i];
+	if (c == '"' || c == '\\'){
+	    out << '\\' << c;
+	} else if (c < 0x20){
+	    char escaped[8];
+	    snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+	    out << escaped;
+	} else
+	    out << c;
+    }
+    out << '"';
+}
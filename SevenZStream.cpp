@@ -0,0 +1,371 @@
+#include "SevenZStream.h"
+#include "SevenZError.h"
+
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// Class SevenZFile
+void SevenZFile::checkRange(uint64_t pos, uint64_t size) const {
+    uint64_t length = this->size();
+    if (pos > length || size > length - pos){
+	ostringstream msg;
+	msg << "Archive is truncated. Requested " << size << " bytes at " << pos
+	    << ", file has " << length << ".";
+	throw SevenZError(157, msg.str());
+    }
+}
+
+// Class SevenZMappedFile
+SevenZMappedFile::SevenZMappedFile(): fd(-1), base(NULL), length(0){
+}
+
+SevenZMappedFile::~SevenZMappedFile(){
+    close();
+}
+
+bool SevenZMappedFile::open(const char *path){
+    close();
+    reads = bytesRead = 0;
+    syscalls = 2;	// open and fstat
+    fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+	return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)){
+	close();
+	return false;
+    }
+    length = st.st_size;
+    if (length == 0)
+	return true;	// nothing to map, every span() will fail
+
+    void *map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    syscalls++;
+    if (map == MAP_FAILED){
+	close();
+	return false;
+    }
+    base = static_cast<const uint8_t*>(map);
+    return true;
+}
+
+void SevenZMappedFile::close(){
+    if (base != NULL){
+	munmap(const_cast<uint8_t*>(base), length);
+	syscalls++;
+    }
+    if (fd >= 0){
+	::close(fd);
+	syscalls++;
+    }
+    fd = -1;
+    base = NULL;
+    length = 0;
+}
+
+bool SevenZMappedFile::is_open() const {
+    return fd >= 0;
+}
+
+uint64_t SevenZMappedFile::size() const {
+    return length;
+}
+
+SevenZSpan SevenZMappedFile::span(uint64_t pos, uint64_t size){
+    checkRange(pos, size);
+    reads++;	// pages are faulted in when the view is used
+    bytesRead += size;
+    SevenZSpan s = { base + pos, size };
+    return s;
+}
+
+// Class SevenZPreadFile
+SevenZPreadFile::SevenZPreadFile(): fd(-1), length(0){
+}
+
+SevenZPreadFile::~SevenZPreadFile(){
+    close();
+}
+
+bool SevenZPreadFile::open(const char *path){
+    close();
+    reads = bytesRead = 0;
+    syscalls = 2;	// open and fstat
+    fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+	return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)){
+	close();
+	return false;
+    }
+    length = st.st_size;
+    return true;
+}
+
+void SevenZPreadFile::close(){
+    for (size_t i = 0; i < buffers.size(); i++)
+	delete buffers[i];
+    buffers.clear();
+    if (fd >= 0){
+	::close(fd);
+	syscalls++;
+    }
+    fd = -1;
+    length = 0;
+}
+
+bool SevenZPreadFile::is_open() const {
+    return fd >= 0;
+}
+
+uint64_t SevenZPreadFile::size() const {
+    return length;
+}
+
+SevenZSpan SevenZPreadFile::span(uint64_t pos, uint64_t size){
+    checkRange(pos, size);
+    SevenZSpan s;
+    for (size_t i = 0; i < buffers.size(); i++){
+	const Buffer *b = buffers[i];
+	if (pos >= b->pos && pos + size <= b->pos + b->data.size()){
+	    s.data = b->data.data() + (pos - b->pos);
+	    s.size = size;
+	    return s;
+	}
+    }
+
+    Buffer *b = new Buffer;
+    b->pos = pos;
+    b->data.resize(size);
+    buffers.push_back(b);
+    uint64_t done = 0;
+    while (done < size){
+	ssize_t n = pread(fd, b->data.data() + done, size - done, pos + done);
+	syscalls++;
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0){
+	    ostringstream msg;
+	    msg << "Couldn't read " << size << " bytes at " << pos << " from the archive.";
+	    throw SevenZError(157, msg.str());
+	}
+	done += n;
+	reads++;
+    }
+    bytesRead += size;
+    s.data = b->data.data();
+    s.size = size;
+    return s;
+}
+
+// Class SevenZLzmaSource
+#define LZMA_IN_WINDOW (1 << 16)    // packed bytes given to the decoder at once
+#define LZMA_SEGMENT (1 << 17)	    // bytes decoded into the dictionary at once
+
+SevenZLzmaSource::SevenZLzmaSource(SevenZSpan packed, const uint8_t *props, unsigned propsSize,
+	uint64_t unpackSize, ISzAlloc *alloc, bool lzma2):
+    dec(dec2.decoder), lzma2(lzma2), alloc(alloc), packed(packed), inPos(0),
+    outLeft(unpackSize), dicRead(0){
+
+    CLzmaProps lzmaProps;
+    Byte lzma2Props[LZMA_PROPS_SIZE];
+    Lzma2Dec_Construct(&dec2);
+    if (lzma2){
+	if (propsSize < 1 || Lzma2Dec_GetOldProps(props[0], lzma2Props) != SZ_OK)
+	    throw SevenZError(156, "Unsupported LZMA2 properties.");
+	props = lzma2Props;
+	propsSize = LZMA_PROPS_SIZE;
+    }
+    if (LzmaProps_Decode(&lzmaProps, props, propsSize) != SZ_OK ||
+	    LzmaDec_AllocateProbs(&dec, props, propsSize, alloc) != SZ_OK)
+	throw SevenZError(156, "Unsupported LZMA properties.");
+
+    // whole dictionary is not needed when the stream is shorter
+    SizeT dicSize = lzmaProps.dicSize;
+    if (unpackSize < dicSize)
+	dicSize = unpackSize;
+    if (dicSize == 0)
+	dicSize = 1;
+    dec.dic = static_cast<Byte*>(alloc->Alloc(alloc, dicSize));
+    if (dec.dic == NULL){
+	LzmaDec_FreeProbs(&dec, alloc);
+	throw SevenZError(156, "Not enough memory for LZMA dictionary.");
+    }
+    dec.dicBufSize = dicSize;
+    if (lzma2)
+	Lzma2Dec_Init(&dec2);
+    else
+	LzmaDec_Init(&dec);
+}
+
+SevenZLzmaSource::~SevenZLzmaSource(){
+    alloc->Free(alloc, dec.dic);
+    LzmaDec_FreeProbs(&dec, alloc);
+}
+
+bool SevenZLzmaSource::finished() const {
+    return outLeft == 0 && dicRead == dec.dicPos;
+}
+
+uint64_t SevenZLzmaSource::fill(uint8_t *buffer, uint64_t size){
+    uint64_t written = 0;
+    while (written < size){
+	SevenZSpan span = view(size - written);
+	if (span.size == 0)
+	    break;
+	memcpy(buffer + written, span.data, span.size);
+	written += span.size;
+    }
+    return written;
+}
+
+SevenZSpan SevenZLzmaSource::view(uint64_t size){
+    SevenZSpan span = { dec.dic + dicRead, 0 };
+    if (dicRead == dec.dicPos && !decode())
+	return span;
+    // what was already decoded is returned right from the dictionary
+    span.data = dec.dic + dicRead;
+    span.size = dec.dicPos - dicRead;
+    if (span.size > size)
+	span.size = size;
+    dicRead += span.size;
+    return span;
+}
+
+bool SevenZLzmaSource::decode(){
+    while (dicRead == dec.dicPos){
+	if (outLeft == 0)
+	    return false;
+	// everything in dic was returned, so it can be overwritten
+	if (dec.dicPos == dec.dicBufSize)
+	    dec.dicPos = dicRead = 0;
+
+	// one segment at once, it is still in the cache when it is read
+	SizeT dicLimit = dec.dicBufSize;
+	if (dicLimit - dec.dicPos > LZMA_SEGMENT)
+	    dicLimit = dec.dicPos + LZMA_SEGMENT;
+	ELzmaFinishMode mode = LZMA_FINISH_ANY;
+	if (outLeft <= dicLimit - dec.dicPos){
+	    dicLimit = dec.dicPos + outLeft;
+	    mode = LZMA_FINISH_END;
+	}
+	SizeT inLen = packed.size - inPos;
+	if (inLen > LZMA_IN_WINDOW)
+	    inLen = LZMA_IN_WINDOW;
+	SizeT start = dec.dicPos;
+	ELzmaStatus status;
+	SRes res = lzma2 ?
+	    Lzma2Dec_DecodeToDic(&dec2, dicLimit, packed.data + inPos, &inLen, mode, &status) :
+	    LzmaDec_DecodeToDic(&dec, dicLimit, packed.data + inPos, &inLen, mode, &status);
+	inPos += inLen;
+	outLeft -= dec.dicPos - start;
+	if (res != SZ_OK)
+	    throw SevenZError(156, "Something went wrong with decompression! LZMA data error.");
+	if (dec.dicPos == start && inLen == 0){
+	    ostringstream msg;
+	    msg << "Something went wrong with decompression! Packed stream ended at "
+		<< inPos << " with " << outLeft << " bytes not decoded.";
+	    throw SevenZError(156, msg.str());
+	}
+    }
+    return true;
+}
+
+// Class SevenZStream
+SevenZCursor::SevenZCursor(): pos(0), source(NULL), base(0), total(0){
+    span.data = NULL;
+    span.size = 0;
+}
+
+SevenZCursor::SevenZCursor(SevenZSpan span): span(span), pos(0), source(NULL), base(0),
+    total(span.size){
+}
+
+SevenZCursor::SevenZCursor(SevenZSource *source, uint64_t size, uint64_t windowSize):
+    pos(0), source(source), window(windowSize), base(0), total(size){
+    span.data = window.data();
+    span.size = 0;
+}
+
+void SevenZCursor::endOfData(uint64_t size) const {
+    ostringstream msg;
+    msg << "Unexpected end of data at " << tell() << " (+" << size << ").";
+    throw SevenZError(157, msg.str());
+}
+
+bool SevenZCursor::refill(){
+    if (source == NULL)
+	return false;
+    uint64_t left = span.size - pos;
+    memmove(window.data(), window.data() + pos, left);
+    base += pos;
+    pos = 0;
+    uint64_t got = source->fill(window.data() + left, window.size() - left);
+    span.size = left + got;
+    return got > 0;
+}
+
+void SevenZCursor::ensure(uint64_t size){
+    while (size > span.size - pos)
+	if (!refill())
+	    endOfData(size);
+}
+
+uint64_t SevenZCursor::numberSlow(){
+    uint8_t first = byte();
+    unsigned extra = 0;
+    while (extra < 8 && (first & (0x80 >> extra)))
+	extra++;
+    ensure(extra);
+    uint64_t value = 0;
+    for (unsigned i = 0; i < extra; i++)
+	value |= uint64_t(span.data[pos + i]) << (8 * i);
+    pos += extra;
+    if (extra < 8)
+	value |= uint64_t(first & (0x7F >> extra)) << (8 * extra);
+    return value;
+}
+
+void SevenZCursor::bytesSlow(void *buffer, uint64_t size){
+    uint8_t *dst = static_cast<uint8_t*>(buffer);
+    while (size > span.size - pos){
+	uint64_t avail = span.size - pos;
+	memcpy(dst, span.data + pos, avail);
+	dst += avail;
+	size -= avail;
+	pos += avail;
+	if (!refill())
+	    endOfData(size);
+    }
+    memcpy(dst, span.data + pos, size);
+    pos += size;
+}
+
+void SevenZCursor::skip(uint64_t size){
+    while (size > span.size - pos){
+	size -= span.size - pos;
+	pos = span.size;
+	if (!refill())
+	    endOfData(size);
+    }
+    pos += size;
+}
+
+uint64_t SevenZCursor::tell() const {
+    return base + pos;
+}
+
+uint64_t SevenZCursor::remaining() const {
+    return total > tell() ? total - tell() : 0;
+}
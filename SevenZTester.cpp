@@ -0,0 +1,303 @@
+#include "SevenZTester.h"
+#include "SevenZCrc.h"
+#include "SevenZFilter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+using namespace std;
+
+// folders are decoded concurrently, so the allocator must be thread safe
+static void *testAlloc(void *p, size_t size) { (void)p; return malloc(size); }
+static void testFree(void *p, void *address) { (void)p; free(address); }
+static ISzAlloc testAllocator = { testAlloc, testFree };
+
+enum CoderKind { CopyCoder, LzmaCoder, Lzma2Coder, BcjCoder, DeltaCoder, AesCoder, UnknownCoder };
+
+static CoderKind kindOf(const SevenZCoder &coder){
+    const uint8_t *id = coder.coderID;
+    switch (coder.coderIDSize){
+	case 1:
+	    if (id[0] == 0x00)
+		return CopyCoder;
+	    if (id[0] == 0x03)
+		return DeltaCoder;
+	    if (id[0] == 0x04)
+		return BcjCoder;
+	    if (id[0] == 0x21)
+		return Lzma2Coder;
+	    break;
+	case 3:
+	    if (id[0] == 0x03 && id[1] == 0x01 && id[2] == 0x01)
+		return LzmaCoder;
+	    break;
+	case 4:
+	    if (id[0] == 0x03 && id[1] == 0x03 && id[2] == 0x01 && id[3] == 0x03)
+		return BcjCoder;
+	    if (coder.isAes())
+		return AesCoder;
+	    break;
+    }
+    return UnknownCoder;
+}
+
+static string coderName(const SevenZCoder &coder){
+    static const char *names[] = { "Copy", "LZMA", "LZMA2", "BCJ", "Delta", "7zAES" };
+    CoderKind kind = kindOf(coder);
+    if (kind != UnknownCoder)
+	return names[kind];
+    string name;
+    char hex[4];
+    for (uint8_t i = 0; i < coder.coderIDSize; i++){
+	snprintf(hex, sizeof(hex), "%02X", coder.coderID[i]);
+	name += hex;
+    }
+    return name;
+}
+
+// Class SevenZTester
+SevenZTester::SevenZTester(): threads(1), stopOnError(false), archive(NULL), data(NULL),
+    next(0), failed(0), seconds(0){
+}
+
+void SevenZTester::setThreads(unsigned threads){
+    this->threads = threads > 0 ? threads : 1;
+}
+
+void SevenZTester::setStopOnError(bool stop){
+    stopOnError = stop;
+}
+
+const vector<SevenZFolderResult>& SevenZTester::getResults() const {
+    return results;
+}
+
+size_t SevenZTester::test(SevenZFormat &archive){
+    this->archive = &archive;
+    data = &archive.getData();
+    results.assign(data->numFolders, SevenZFolderResult());
+    packStart.assign(data->numFolders, 0);
+    streamStart.assign(data->numFolders, 0);
+    packPos.clear();
+    if (data->packInfo != NULL && data->packInfo->packSize != NULL){
+	uint64_t pos = data->packInfo->packPos;
+	for (uint64_t i = 0; i < data->packInfo->numPackStreams; i++){
+	    packPos.push_back(pos);
+	    pos += data->packInfo->packSize[i];
+	}
+    }
+    uint64_t pack = 0, stream = 0;
+    for (uint64_t i = 0; i < data->numFolders; i++){
+	packStart[i] = pack;
+	streamStart[i] = stream;
+	pack += data->folders[i].getNumPackStreams();
+	stream += data->numUnpackStreams != NULL ? data->numUnpackStreams[i] : 1;
+    }
+    order.resize(data->numFolders);
+    for (uint64_t i = 0; i < data->numFolders; i++)
+	order[i] = i;
+    // big folders first, a big one started last would leave the others idle
+    const SevenZFolder *folders = data->folders;
+    stable_sort(order.begin(), order.end(), [folders](uint64_t a, uint64_t b){
+	return folders[a].getUnPackSize() > folders[b].getUnPackSize();
+    });
+
+    next = 0;
+    failed = 0;
+    auto start = chrono::steady_clock::now();
+    unsigned count = threads;
+    if (count > order.size())
+	count = order.size();
+    vector<thread> pool;
+    for (unsigned t = 1; t < count; t++)
+	pool.push_back(thread(&SevenZTester::worker, this));
+    worker();	// calling thread works too
+    for (size_t t = 0; t < pool.size(); t++)
+	pool[t].join();
+    seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return failed;
+}
+
+void SevenZTester::worker(){
+    size_t i;
+    while ((i = next++) < order.size()){
+	if (stopOnError && failed > 0)
+	    break;
+	testFolder(order[i]);
+    }
+}
+
+bool SevenZTester::buildChain(uint64_t i, vector<unique_ptr<SevenZSource>> &chain,
+	SevenZFolderResult &result){
+    const SevenZFolder &folder = data->folders[i];
+    uint64_t numCoders = folder.numCoders;
+    uint64_t numBinds = folder.numOutStreamsTotal - 1;
+    for (uint64_t c = 0; c < numCoders; c++)
+	if (folder.coder[c].numInStreams != 1 || folder.coder[c].numOutStreams != 1){
+	    result.message = "coders with more streams are not supported";
+	    return false;
+	}
+
+    // with simple coders, in and out stream c belong to coder c; the first
+    // coder reads the packed stream, its in stream is not bound
+    vector<uint64_t> coders;
+    uint64_t c = 0;
+    while (c < numCoders && find(folder.bindIn, folder.bindIn + numBinds, c) != folder.bindIn + numBinds)
+	c++;
+    for (;;){
+	if (c >= numCoders || coders.size() == numCoders)
+	    throw SevenZError(155, "Header is corrupted. Coders of a folder are not a chain.");
+	coders.push_back(c);
+	uint64_t *bind = find(folder.bindOut, folder.bindOut + numBinds, c);
+	if (bind == folder.bindOut + numBinds)
+	    break;
+	c = folder.bindIn[bind - folder.bindOut];
+    }
+    if (c != folder.mainOutStream || coders.size() != numCoders)
+	throw SevenZError(155, "Header is corrupted. Coders of a folder are not a chain.");
+    for (size_t j = 0; j < coders.size(); j++)
+	result.method += (j > 0 ? " > " : "") + coderName(folder.coder[coders[j]]);
+
+    if (packStart[i] >= packPos.size())
+	throw SevenZError(155, "Header is corrupted. Folder has no packed stream.");
+    SevenZSpan packed;
+    {
+	lock_guard<mutex> lock(ioLock);
+	packed = archive->readPacked(packPos[packStart[i]], data->packInfo->packSize[packStart[i]]);
+    }
+    for (size_t j = 0; j < coders.size(); j++){
+	const SevenZCoder &coder = folder.coder[coders[j]];
+	uint64_t size = folder.unPackSize[coders[j]];
+	CoderKind kind = kindOf(coder);
+	if (kind == AesCoder){
+	    result.message = "encrypted";
+	    return false;
+	}
+	if (kind == UnknownCoder){
+	    result.message = "unsupported method " + coderName(coder);
+	    return false;
+	}
+	if ((kind == LzmaCoder || kind == Lzma2Coder) && j > 0){
+	    result.message = "LZMA after another coder is not supported";
+	    return false;
+	}
+	if (j == 0 && kind != LzmaCoder && kind != Lzma2Coder){
+	    SevenZSpan stored = { packed.data, packed.size < size ? packed.size : size };
+	    chain.push_back(unique_ptr<SevenZSource>(new SevenZSpanSource(stored)));
+	}
+	SevenZSource *input = chain.empty() ? NULL : chain.back().get();
+	switch (kind){
+	    case LzmaCoder:
+	    case Lzma2Coder:
+		chain.push_back(unique_ptr<SevenZSource>(new SevenZLzmaSource(packed, coder.property,
+			coder.propertySize, size, &testAllocator, kind == Lzma2Coder)));
+		break;
+	    case BcjCoder:
+		chain.push_back(unique_ptr<SevenZSource>(new SevenZBcjSource(input)));
+		break;
+	    case DeltaCoder:
+		chain.push_back(unique_ptr<SevenZSource>(new SevenZDeltaSource(input,
+			coder.propertySize > 0 ? coder.property[0] + 1 : 1)));
+		break;
+	    default:	// Copy passes the data through
+		break;
+	}
+    }
+    return true;
+}
+
+void SevenZTester::testFolder(uint64_t i){
+    SevenZFolderResult &result = results[i];
+    const SevenZFolder &folder = data->folders[i];
+    auto start = chrono::steady_clock::now();
+    try {
+	vector<unique_ptr<SevenZSource>> chain;
+	if (!buildChain(i, chain, result)){
+	    result.status = SevenZFolderResult::Skipped;
+	    return;
+	}
+	SevenZSource *source = chain.back().get();
+	// a folder without substreams is checked as one stream by its own CRC,
+	// a single substream has the CRC of the folder already
+	uint64_t numStreams = data->numUnpackStreams != NULL ? data->numUnpackStreams[i] : 1;
+	bool whole = numStreams == 0 || data->subStreamSize == NULL;
+	bool checkFolder = folder.unPackCRCDefined && (whole || numStreams != 1);
+	uint32_t folderCrc = 0;
+	result.status = SevenZFolderResult::Ok;
+	for (uint64_t j = 0; j < (whole ? 1 : numStreams); j++){
+	    uint64_t k = streamStart[i] + j;
+	    uint64_t left = whole ? folder.getUnPackSize() : data->subStreamSize[k];
+	    uint32_t crc = 0;
+	    while (left > 0){
+		if (stopOnError && failed > 0){
+		    result.status = SevenZFolderResult::NotTested;
+		    return;
+		}
+		// the CRC reads the segment the decoder has just written
+		SevenZSpan span = source->view(left);
+		if (span.size == 0)
+		    throw SevenZError(156, "Unpacked data are shorter than the header says.");
+		crc = sevenZCrcUpdate(crc, span.data, span.size);
+		if (checkFolder)
+		    folderCrc = sevenZCrcUpdate(folderCrc, span.data, span.size);
+		result.size += span.size;
+		left -= span.size;
+	    }
+	    result.streams++;
+	    if (!whole && data->streamCRC.has(k) && crc != data->streamCRC.values[k]){
+		result.status = SevenZFolderResult::Failed;
+		result.message = "CRC error in stream " + to_string(j);
+		break;
+	    }
+	}
+	if (result.status == SevenZFolderResult::Ok && checkFolder && folderCrc != folder.unPackCRC){
+	    result.status = SevenZFolderResult::Failed;
+	    result.message = "CRC error";
+	}
+    } catch (const exception &e){
+	result.status = SevenZFolderResult::Failed;
+	result.message = e.what();
+    }
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (result.status == SevenZFolderResult::Failed)
+	failed++;
+}
+
+void SevenZTester::print(ostream &out) const {
+    char line[160];
+    uint64_t bytes = 0, skipped = 0, notTested = 0;
+    for (size_t i = 0; i < results.size(); i++){
+	const SevenZFolderResult &result = results[i];
+	bytes += result.size;
+	out << "Folder " << i << ": ";
+	if (!result.method.empty())
+	    out << result.method << ", ";
+	switch (result.status){
+	    case SevenZFolderResult::NotTested:
+		notTested++;
+		out << "not tested" << endl;
+		continue;
+	    case SevenZFolderResult::Skipped:
+		skipped++;
+		out << "skipped, " << result.message << endl;
+		continue;
+	    default:
+		break;
+	}
+	snprintf(line, sizeof(line), "%llu streams, %llu bytes, %.3f s, %.1f MB/s: ",
+		static_cast<unsigned long long>(result.streams), static_cast<unsigned long long>(result.size),
+		result.seconds, result.seconds > 0 ? result.size / result.seconds / 1e6 : 0.0);
+	out << line << (result.status == SevenZFolderResult::Ok ? "OK" : result.message) << endl;
+    }
+    snprintf(line, sizeof(line), "Tested %llu folders, %llu bytes in %.3f s, %.1f MB/s: %llu failed, %llu skipped",
+	    static_cast<unsigned long long>(results.size() - skipped - notTested),
+	    static_cast<unsigned long long>(bytes), seconds, seconds > 0 ? bytes / seconds / 1e6 : 0.0,
+	    static_cast<unsigned long long>(failed.load()), static_cast<unsigned long long>(skipped));
+    out << line;
+    if (notTested > 0)
+	out << ", " << notTested << " not tested";
+    out << endl;
+}
@@ -0,0 +1,111 @@
+#include "SevenZTrace.h"
+#include "SevenZStats.h"
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+struct TraceEvent {
+    const char *name;
+    string arg;
+    uint64_t start;	// ns
+    uint64_t duration;
+};
+
+/**
+ * Spans of one thread. Only the owner appends, the buffer is read when the
+ * threads are done.
+ */
+struct TraceBuffer {
+    unsigned tid;
+    vector<TraceEvent> events;
+};
+
+static atomic<bool> traceOn(false);
+static uint64_t traceStart;
+static mutex registryLock;		// taken once per thread, not per span
+static vector<TraceBuffer*> registry;	// buffers live until the exit
+static thread_local TraceBuffer *localBuffer = NULL;
+
+static TraceBuffer* threadBuffer(){
+    if (localBuffer == NULL){
+	TraceBuffer *buffer = new TraceBuffer;
+	lock_guard<mutex> lock(registryLock);
+	buffer->tid = registry.size() + 1;
+	registry.push_back(buffer);
+	localBuffer = buffer;
+    }
+    return localBuffer;
+}
+
+void sevenZTraceStart(){
+    traceStart = SevenZPhaseClock::now();
+    traceOn.store(true, memory_order_release);
+}
+
+bool sevenZTraceActive(){
+    return traceOn.load(memory_order_relaxed);
+}
+
+SevenZTraceSpan::SevenZTraceSpan(const char *name, const char *arg): name(NULL), arg(arg), start(0) {
+    if (sevenZTraceActive()){
+	this->name = name;
+	start = SevenZPhaseClock::now();
+    }
+}
+
+SevenZTraceSpan::~SevenZTraceSpan(){
+    if (name == NULL)
+	return;
+    TraceEvent event;
+    event.name = name;
+    if (arg != NULL)
+	event.arg = arg;
+    event.start = start;
+    event.duration = SevenZPhaseClock::now() - start;
+    threadBuffer()->events.push_back(event);
+}
+
+/**
+ * Microseconds with a fraction, the unit of the trace format
+ */
+static void printMicros(ostream &out, uint64_t ns){
+    char text[32];
+    snprintf(text, sizeof(text), "%llu.%03u", static_cast<unsigned long long>(ns / 1000),
+	    static_cast<unsigned>(ns % 1000));
+    out << text;
+}
+
+bool sevenZTraceWrite(const string &path){
+    ofstream out(path.c_str());
+    if (!out)
+	return false;
+    lock_guard<mutex> lock(registryLock);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    out << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"7z_analyser\"}}";
+    for (size_t b = 0; b < registry.size(); b++){
+	const TraceBuffer *buffer = registry[b];
+	out << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->tid
+	    << ", \"args\": {\"name\": \"thread " << buffer->tid << "\"}}";
+	for (size_t i = 0; i < buffer->events.size(); i++){
+	    const TraceEvent &e = buffer->events[i];
+	    out << ",\n{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->tid << ", \"ts\": ";
+	    // spans started before sevenZTraceStart() are not recorded
+	    printMicros(out, e.start - traceStart);
+	    out << ", \"dur\": ";
+	    printMicros(out, e.duration);
+	    if (!e.arg.empty()){
+		out << ", \"args\": {\"path\": ";
+		sevenZJsonString(out, e.arg);
+		out << "}";
+	    }
+	    out << "}";
+	}
+    }
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
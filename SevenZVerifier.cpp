@@ -0,0 +1,206 @@
+#include "SevenZVerifier.h"
+#include "Lzma2Dec.h"
+#include "SevenZCrc.h"
+
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+// probabilities are allocated once, verification itself never allocates
+static void *verifyAlloc(void *p, size_t size) { (void)p; return malloc(size); }
+static void verifyFree(void *p, void *address) { (void)p; free(address); }
+static ISzAlloc verifyAllocator = { verifyAlloc, verifyFree };
+
+#define LZMA2_MAX_PROPS 225	// (pb * 5 + lp) * 9 + lc for pb, lp <= 4, lc <= 8
+
+SevenZHeaderVerifier::SevenZHeaderVerifier(const SevenZInitData &data)
+: method(Copy), plainSize(0), packedSize(0), headerSize(0), crcDefined(false), crc(0), lzma2Prop(0) {
+    LzmaDec_Construct(&lzma);
+    if (data.type != EncHeader || data.encFolder >= data.numFolders)
+	throw SevenZError(154, "Unsupported value. Header is not encrypted.");
+    if (data.encData == NULL)
+	throw SevenZError(154, "Unsupported value. Encrypted header was not loaded.");
+    const SevenZFolder &folder = data.folders[data.encFolder];
+    if (folder.numCoders > 2)
+	throw SevenZError(154, "Unsupported value. Header is encrypted by more than one method.");
+
+    // AES coder and the out stream it writes to
+    uint64_t aes = folder.numCoders, aesOut = 0, outIndex = 0;
+    for (uint64_t i = 0; i < folder.numCoders; i++){
+	if (folder.coder[i].isAes()){
+	    aes = i;
+	    aesOut = outIndex;
+	}
+	outIndex += folder.coder[i].numOutStreams;
+    }
+    if (aes == folder.numCoders)
+	throw SevenZError(154, "Unsupported value. Header is not encrypted.");
+    if (!props.read(folder.coder[aes].property, folder.coder[aes].propertySize))
+	throw SevenZError(155, "Header is corrupted. Wrong 7zAES properties.");
+    if (data.encSize < AES_BLOCK_SIZE || data.encSize % AES_BLOCK_SIZE != 0)
+	throw SevenZError(155, "Header is corrupted. Encrypted header is not made of AES blocks.");
+    packedSize = folder.unPackSize[aesOut];
+    headerSize = folder.getUnPackSize();
+    crcDefined = folder.unPackCRCDefined;
+    crc = folder.unPackCRC;
+    if (packedSize > data.encSize)
+	throw SevenZError(155, "Header is corrupted. Decrypted header is bigger than the encrypted one.");
+    packed.assign(data.encData, data.encData + data.encSize);
+
+    memset(lzmaProps, 0, sizeof(lzmaProps));
+    if (folder.numCoders == 2){
+	const SevenZCoder &coder = folder.coder[1 - aes];
+	if (coder.coderIDSize == 3 && coder.coderID[0] == 0x03 && coder.coderID[1] == 0x01 &&
+		coder.coderID[2] == 0x01){
+	    if (coder.propertySize < LZMA_PROPS_SIZE)
+		throw SevenZError(156, "Unsupported LZMA properties.");
+	    method = Lzma;
+	    memcpy(lzmaProps, coder.property, LZMA_PROPS_SIZE);
+	} else if (coder.coderIDSize == 1 && coder.coderID[0] == 0x21){
+	    if (coder.propertySize < 1 || Lzma2Dec_GetOldProps(coder.property[0], lzmaProps) != SZ_OK)
+		throw SevenZError(156, "Unsupported LZMA2 properties.");
+	    method = Lzma2;
+	    lzma2Prop = coder.property[0];
+	} else if (!(coder.coderIDSize == 1 && coder.coderID[0] == 0x00))
+	    throw SevenZError(154, "Unsupported value. Header compression can't be verified.");
+    }
+    allocateDecoder();
+    plainSize = packed.size() < VERIFY_BLOCKS * AES_BLOCK_SIZE ? packed.size() : VERIFY_BLOCKS * AES_BLOCK_SIZE;
+}
+
+SevenZHeaderVerifier::SevenZHeaderVerifier(const SevenZHeaderVerifier &orig)
+: method(orig.method), props(orig.props), packed(orig.packed), plainSize(orig.plainSize),
+    packedSize(orig.packedSize), headerSize(orig.headerSize), crcDefined(orig.crcDefined), crc(orig.crc),
+    lzma2Prop(orig.lzma2Prop),
+    aes(orig.aes.getKernel()) {
+    memcpy(lzmaProps, orig.lzmaProps, sizeof(lzmaProps));
+    LzmaDec_Construct(&lzma);
+    allocateDecoder();
+}
+
+void SevenZHeaderVerifier::allocateDecoder(){
+    if (method == Copy)
+	return;
+    // LZMA2 chunks may change lc and lp, their sum is at most 4
+    uint8_t largest[LZMA_PROPS_SIZE] = { 4 };
+    const uint8_t *alloc = method == Lzma2 ? largest : lzmaProps;
+    if (LzmaDec_AllocateProbs(&lzma, alloc, LZMA_PROPS_SIZE, &verifyAllocator) != SZ_OK)
+	throw SevenZError(156, "Something went wrong with decompression! Out of memory.");
+    lzma.dic = dict;
+    lzma.dicBufSize = sizeof(dict);
+}
+
+SevenZHeaderVerifier::~SevenZHeaderVerifier(){
+    LzmaDec_FreeProbs(&lzma, &verifyAllocator);
+}
+
+const SevenZAesProps& SevenZHeaderVerifier::getProps() const {
+    return props;
+}
+
+size_t SevenZHeaderVerifier::check(const uint8_t *keys, size_t count, uint8_t *passed){
+    if (plain.size() < count * plainSize)
+	plain.resize(count * plainSize);
+    aes.decrypt(keys, count, props.iv, packed.data(), plainSize / AES_BLOCK_SIZE, plain.data());
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++){
+	passed[i] = checkPlain(plain.data() + i * plainSize) ? 1 : 0;
+	n += passed[i];
+    }
+    return n;
+}
+
+bool SevenZHeaderVerifier::checkHeader(const uint8_t *hdr, size_t size) const {
+    if (size > headerSize)
+	size = headerSize;
+    if (size > 0 && hdr[0] != HDR)
+	return false;
+    if (size > 1 && !(hdr[1] == ARCHPROP || hdr[1] == ADDSTRINFO || hdr[1] == MSTRINFO ||
+	    hdr[1] == FILESINFO || hdr[1] == END))
+	return false;
+    // main streams start with the packed streams
+    if (size > 2 && hdr[1] == MSTRINFO && !(hdr[2] == PACKINFO || hdr[2] == UNPACKINFO ||
+	    hdr[2] == SUBSTRINFO || hdr[2] == END))
+	return false;
+    return true;
+}
+
+bool SevenZHeaderVerifier::checkLzma(const uint8_t *src, size_t size, const uint8_t *props){
+    // the range coder always starts with a zero byte
+    if (size > 0 && src[0] != 0)
+	return false;
+    if (LzmaProps_Decode(&lzma.prop, props, LZMA_PROPS_SIZE) != SZ_OK)
+	return false;
+    LzmaDec_Init(&lzma);
+    SizeT srcLen = size;
+    ELzmaStatus status;
+    SizeT want = headerSize < VERIFY_DECODED ? headerSize : VERIFY_DECODED;
+    if (LzmaDec_DecodeToDic(&lzma, want, src, &srcLen, LZMA_FINISH_ANY, &status) != SZ_OK)
+	return false;
+    return checkHeader(dict, lzma.dicPos);
+}
+
+bool SevenZHeaderVerifier::checkPlain(const uint8_t *plain){
+    size_t size = plainSize < packedSize ? plainSize : packedSize;
+    switch (method){
+	case Copy:
+	    return checkHeader(plain, size);
+	case Lzma:
+	    return checkLzma(plain, size, lzmaProps);
+	case Lzma2: {
+	    if (size == 0)
+		return true;
+	    uint8_t control = plain[0];
+	    // the first chunk resets the dictionary, stored or LZMA with new properties
+	    if (control == 0x01)
+		return size < 3 || checkHeader(plain + 3, size - 3);
+	    if (control < 0xE0)
+		return false;
+	    if (size < 6)
+		return true;
+	    uint64_t unpack = ((uint64_t(control & 0x1F) << 16) | (plain[1] << 8) | plain[2]) + 1;
+	    uint64_t pack = ((plain[3] << 8) | plain[4]) + 1;
+	    if (unpack > headerSize || pack + 6 > packedSize || plain[5] >= LZMA2_MAX_PROPS)
+		return false;
+	    uint8_t chunkProps[LZMA_PROPS_SIZE];
+	    memcpy(chunkProps, lzmaProps, LZMA_PROPS_SIZE);
+	    chunkProps[0] = plain[5];
+	    if ((plain[5] % 9) + (plain[5] / 9) % 5 > 4)	// lc + lp of LZMA2
+		return false;
+	    size_t data = size - 6 < pack ? size - 6 : pack;
+	    return checkLzma(plain + 6, data, chunkProps);
+	}
+    }
+    return true;
+}
+
+bool SevenZHeaderVerifier::confirm(const uint8_t *key){
+    if (plain.size() < packed.size())
+	plain.resize(packed.size());
+    aes.decrypt(key, 1, props.iv, packed.data(), packed.size() / AES_BLOCK_SIZE, plain.data());
+    header.resize(headerSize);
+    SizeT destLen = headerSize, srcLen = packedSize;
+    ELzmaStatus status = LZMA_STATUS_NOT_SPECIFIED;
+    SRes res = SZ_OK;
+    switch (method){
+	case Copy:
+	    if (packedSize != headerSize)
+		return false;
+	    memcpy(header.data(), plain.data(), headerSize);
+	    break;
+	case Lzma:
+	    res = LzmaDecode(header.data(), &destLen, plain.data(), &srcLen, lzmaProps, LZMA_PROPS_SIZE,
+		    LZMA_FINISH_END, &status, &verifyAllocator);
+	    break;
+	case Lzma2:
+	    res = Lzma2Decode(header.data(), &destLen, plain.data(), &srcLen, lzma2Prop,
+		    LZMA_FINISH_END, &status, &verifyAllocator);
+	    break;
+    }
+    if (res != SZ_OK || destLen != headerSize)
+	return false;
+    if (crcDefined && sevenZCrc(header.data(), headerSize) != crc)
+	return false;
+    return checkHeader(header.data(), headerSize);
+}
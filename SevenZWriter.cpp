@@ -0,0 +1,392 @@
+#include "SevenZWriter.h"
+#include "SevenZAes.h"
+#include "SevenZCrc.h"
+#include "SevenZError.h"
+#include "SevenZFormat.h"
+#include "SevenZKdf.h"
+#include "SevenZLzmaEnc.h"
+
+using namespace std;
+
+#define START_HDR_SIZE 32
+#define HDR_DICT_SIZE (1 << 24)
+#define HDR_LZMA2_PROP 16	// 1 MiB dictionary
+#define FILE_ATTRIBUTE_DIRECTORY 0x10
+
+static void putNumber(vector<uint8_t> &out, uint64_t value){
+    // the first byte has as many leading ones as there are bytes after it
+    unsigned n = 0;
+    while (n < 8 && value >= (1ull << (7 * (n + 1))))
+	n++;
+    if (n == 8){
+	out.push_back(0xFF);
+    } else {
+	uint8_t mask = static_cast<uint8_t>(0xFF00 >> n);
+	out.push_back(mask | static_cast<uint8_t>(value >> (8 * n)));
+    }
+    for (unsigned i = 0; i < n; i++)
+	out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+static void putLE(vector<uint8_t> &out, uint64_t value, unsigned size){
+    for (unsigned i = 0; i < size; i++)
+	out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+/**
+ * Property with its size, as in FilesInfo
+ * @param out, id, data
+ */
+static void putProperty(vector<uint8_t> &out, uint8_t id, const vector<uint8_t> &data){
+    out.push_back(id);
+    putNumber(out, data.size());
+    out.insert(out.end(), data.begin(), data.end());
+}
+
+static void putLzmaCoder(vector<uint8_t> &out, const uint8_t *props){
+    out.push_back(0x23);	// 3 bytes of ID, has properties
+    out.push_back(0x03);
+    out.push_back(0x01);
+    out.push_back(0x01);
+    putNumber(out, 5);
+    out.insert(out.end(), props, props + 5);
+}
+
+SevenZWriter::SevenZWriter(): file(NULL), headerType(RawHeaderType), numCyclesPower(19),
+    folderCrcs(false), inFolder(false), packPos(0) {
+}
+
+SevenZWriter::~SevenZWriter(){
+    if (file != NULL)
+	fclose(file);
+}
+
+bool SevenZWriter::open(const string &path){
+    if (file != NULL)
+	fclose(file);
+    folders.clear();
+    files.clear();
+    pending.clear();
+    inFolder = false;
+    packPos = 0;
+    this->path = path;
+    file = fopen(path.c_str(), "wb");
+    if (file == NULL)
+	return false;
+    // the start header is written by close() when the header is known
+    uint8_t blank[START_HDR_SIZE] = {0};
+    return fwrite(blank, 1, sizeof(blank), file) == sizeof(blank);
+}
+
+void SevenZWriter::setHeader(HeaderType type, const string &password, unsigned numCyclesPower){
+    headerType = type;
+    this->password = password;
+    this->numCyclesPower = numCyclesPower;
+}
+
+void SevenZWriter::setFolderCrcs(bool enable){
+    folderCrcs = enable;
+}
+
+void SevenZWriter::writeData(const uint8_t *data, size_t size){
+    if (size > 0 && fwrite(data, 1, size, file) != size)
+	throw SevenZError(161, "Can't write " + path);
+    packPos += size;
+}
+
+void SevenZWriter::beginFolder(Method method){
+    endFolder();
+    Folder folder = Folder();
+    folder.method = method;
+    folder.crc = 0;
+    folders.push_back(folder);
+    inFolder = true;
+}
+
+void SevenZWriter::addFile(const string &name, uint64_t mtime, uint32_t attrib){
+    File f;
+    f.name = name;
+    f.size = 0;
+    f.crc = 0;
+    f.mtime = mtime;
+    f.attrib = attrib;
+    f.hasStream = false;
+    files.push_back(f);
+}
+
+void SevenZWriter::append(const uint8_t *data, size_t size){
+    if (!inFolder || files.empty())
+	throw SevenZError(161, "Data written outside of a folder");
+    if (size == 0)
+	return;
+    File &f = files.back();
+    Folder &folder = folders.back();
+    if (!f.hasStream){
+	f.hasStream = true;
+	folder.numFiles++;
+    }
+    f.crc = sevenZCrcUpdate(f.crc, data, size);
+    f.size += size;
+    folder.crc = sevenZCrcUpdate(folder.crc, data, size);
+    folder.unpackSize += size;
+    if (folder.method == CopyMethod){
+	writeData(data, size);
+	folder.packSize += size;
+    } else
+	pending.insert(pending.end(), data, data + size);
+}
+
+void SevenZWriter::endFolder(){
+    if (!inFolder)
+	return;
+    inFolder = false;
+    Folder &folder = folders.back();
+    if (folder.unpackSize == 0){
+	folders.pop_back();
+	return;
+    }
+    if (folder.method == LzmaMethod){
+	SevenZLzmaEncoder encoder(1 << 20);
+	encoder.properties(folder.props);
+	vector<uint8_t> packed;
+	encoder.encode(pending.data(), pending.size(), packed);
+	writeData(packed.data(), packed.size());
+	folder.packSize = packed.size();
+	vector<uint8_t>().swap(pending);
+    }
+}
+
+void SevenZWriter::buildHeader(vector<uint8_t> &out) const {
+    out.push_back(HDR);
+    if (!folders.empty()){
+	out.push_back(MSTRINFO);
+	out.push_back(PACKINFO);
+	putNumber(out, 0);
+	putNumber(out, folders.size());
+	out.push_back(SIZE);
+	for (size_t i = 0; i < folders.size(); i++)
+	    putNumber(out, folders[i].packSize);
+	out.push_back(END);
+
+	out.push_back(UNPACKINFO);
+	out.push_back(FOLDER);
+	putNumber(out, folders.size());
+	out.push_back(0);	// not external
+	for (size_t i = 0; i < folders.size(); i++){
+	    putNumber(out, 1);
+	    if (folders[i].method == CopyMethod){
+		out.push_back(0x01);
+		out.push_back(0x00);
+	    } else
+		putLzmaCoder(out, folders[i].props);
+	}
+	out.push_back(CODERUNPACKSIZE);
+	for (size_t i = 0; i < folders.size(); i++)
+	    putNumber(out, folders[i].unpackSize);
+	if (folderCrcs){
+	    out.push_back(CRC);
+	    out.push_back(1);
+	    for (size_t i = 0; i < folders.size(); i++)
+		putLE(out, folders[i].crc, 4);
+	}
+	out.push_back(END);
+
+	bool single = true;
+	for (size_t i = 0; i < folders.size(); i++)
+	    single = single && folders[i].numFiles == 1;
+	if (!folderCrcs || !single){
+	    out.push_back(SUBSTRINFO);
+	    if (!single){
+		out.push_back(NUMUNPACKSTR);
+		for (size_t i = 0; i < folders.size(); i++)
+		    putNumber(out, folders[i].numFiles);
+		// sizes of the streams but the last one of every folder
+		out.push_back(SIZE);
+		size_t f = 0;
+		for (size_t i = 0; i < folders.size(); i++){
+		    for (uint64_t left = folders[i].numFiles; left > 0; f++){
+			if (!files[f].hasStream)
+			    continue;
+			if (--left > 0)
+			    putNumber(out, files[f].size);
+		    }
+		}
+	    }
+	    // a stream alone in its folder has the CRC of the folder
+	    out.push_back(CRC);
+	    out.push_back(1);	// all are defined
+	    size_t f = 0;
+	    for (size_t i = 0; i < folders.size(); i++){
+		for (uint64_t left = folders[i].numFiles; left > 0; f++){
+		    if (!files[f].hasStream)
+			continue;
+		    left--;
+		    if (!folderCrcs || folders[i].numFiles != 1)
+			putLE(out, files[f].crc, 4);
+		}
+	    }
+	    out.push_back(END);
+	}
+	out.push_back(END);
+    }
+
+    if (!files.empty()){
+	out.push_back(FILESINFO);
+	putNumber(out, files.size());
+	vector<uint8_t> data;
+	bool empty = false;
+	for (size_t i = 0; i < files.size(); i++)
+	    empty = empty || !files[i].hasStream;
+	if (empty){
+	    data.assign((files.size() + 7) / 8, 0);
+	    for (size_t i = 0; i < files.size(); i++)
+		if (!files[i].hasStream)
+		    data[i / 8] |= 0x80 >> (i % 8);
+	    putProperty(out, EMPTYSTREAM, data);
+
+	    // one bit per empty stream, the ones without it are directories
+	    vector<uint8_t> emptyFile;
+	    bool anyFile = false;
+	    for (size_t i = 0, e = 0; i < files.size(); i++){
+		if (files[i].hasStream)
+		    continue;
+		if (e % 8 == 0)
+		    emptyFile.push_back(0);
+		if (!(files[i].attrib & FILE_ATTRIBUTE_DIRECTORY)){
+		    emptyFile[e / 8] |= 0x80 >> (e % 8);
+		    anyFile = true;
+		}
+		e++;
+	    }
+	    if (anyFile)
+		putProperty(out, EMPTYFILE, emptyFile);
+	}
+
+	data.assign(1, 0);	// not external
+	string name;
+	for (size_t i = 0; i < files.size(); i++){
+	    name.clear();
+	    SevenZSpan utf8 = {reinterpret_cast<const uint8_t*>(files[i].name.data()), files[i].name.size()};
+	    SevenZKdf::toUtf16(utf8, name);
+	    data.insert(data.end(), name.begin(), name.end());
+	    data.push_back(0);
+	    data.push_back(0);
+	}
+	putProperty(out, NAME, data);
+
+	data.assign(1, 1);	// all are defined
+	data.push_back(0);
+	for (size_t i = 0; i < files.size(); i++)
+	    putLE(data, files[i].mtime, 8);
+	putProperty(out, MTIME, data);
+
+	data.assign(1, 1);
+	data.push_back(0);
+	for (size_t i = 0; i < files.size(); i++)
+	    putLE(data, files[i].attrib, 4);
+	putProperty(out, WINATTRIB, data);
+	out.push_back(END);
+    }
+    out.push_back(END);
+}
+
+void SevenZWriter::close(){
+    if (file == NULL)
+	return;
+    endFolder();
+    vector<uint8_t> header;
+    buildHeader(header);
+
+    if (headerType != RawHeaderType){
+	SevenZLzmaEncoder encoder(HDR_DICT_SIZE);
+	uint8_t props[5];
+	encoder.properties(props);
+	vector<uint8_t> packed;
+	if (headerType == Lzma2HeaderType)
+	    sevenZLzma2Stored(header.data(), header.size(), packed, true);
+	else
+	    encoder.encode(header.data(), header.size(), packed);
+
+	vector<uint8_t> encoded;
+	encoded.push_back(ENCHDR);
+	encoded.push_back(PACKINFO);
+	putNumber(encoded, packPos);
+	putNumber(encoded, 1);
+	encoded.push_back(SIZE);
+	uint64_t lzmaSize = packed.size();	// AES output, the padding is left out
+	if (headerType == AesHeaderType)
+	    packed.resize((packed.size() + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE * AES_BLOCK_SIZE, 0);
+	putNumber(encoded, packed.size());
+	encoded.push_back(END);
+
+	encoded.push_back(UNPACKINFO);
+	encoded.push_back(FOLDER);
+	putNumber(encoded, 1);
+	encoded.push_back(0);
+	if (headerType == AesHeaderType){
+	    // AES decrypts the packed stream into the input of LZMA, the IV
+	    // comes from the position so the archive stays deterministic
+	    SevenZAesProps aes;
+	    aes.numCyclesPower = numCyclesPower;
+	    aes.ivSize = 16;
+	    for (unsigned i = 0; i < 16; i++)
+		aes.iv[i] = static_cast<uint8_t>(i < 8 ? packPos >> (8 * i) : 0);
+	    uint8_t key[AES_KEY_SIZE];
+	    SevenZSpan pw = {reinterpret_cast<const uint8_t*>(password.data()), password.size()};
+	    SevenZKdf(aes).derive(&pw, 1, key);
+	    sevenZAesEncrypt(key, aes.iv, packed.data(), packed.size() / AES_BLOCK_SIZE);
+
+	    putNumber(encoded, 2);
+	    encoded.push_back(0x24);	// 4 bytes of ID, has properties
+	    putLE(encoded, 0x0107F106, 4);
+	    putNumber(encoded, 2 + aes.ivSize);
+	    encoded.push_back(static_cast<uint8_t>(numCyclesPower | 0x40));
+	    encoded.push_back(static_cast<uint8_t>(aes.ivSize - 1));
+	    encoded.insert(encoded.end(), aes.iv, aes.iv + aes.ivSize);
+	    putLzmaCoder(encoded, props);
+	    putNumber(encoded, 1);	// bind pair: LZMA input from AES output
+	    putNumber(encoded, 0);
+	    encoded.push_back(CODERUNPACKSIZE);
+	    putNumber(encoded, lzmaSize);
+	} else if (headerType == Lzma2HeaderType){
+	    putNumber(encoded, 1);
+	    encoded.push_back(0x21);	// 1 byte of ID, has properties
+	    encoded.push_back(0x21);
+	    putNumber(encoded, 1);
+	    encoded.push_back(HDR_LZMA2_PROP);
+	    encoded.push_back(CODERUNPACKSIZE);
+	} else {
+	    putNumber(encoded, 1);
+	    putLzmaCoder(encoded, props);
+	    encoded.push_back(CODERUNPACKSIZE);
+	}
+	putNumber(encoded, header.size());
+	encoded.push_back(CRC);
+	encoded.push_back(1);
+	putLE(encoded, sevenZCrc(header.data(), header.size()), 4);
+	encoded.push_back(END);
+	encoded.push_back(END);
+
+	writeData(packed.data(), packed.size());
+	header.swap(encoded);
+    }
+
+    uint64_t offset = packPos;
+    writeData(header.data(), header.size());
+
+    vector<uint8_t> start;
+    putLE(start, offset, 8);
+    putLE(start, header.size(), 8);
+    putLE(start, sevenZCrc(header.data(), header.size()), 4);
+    uint32_t startCrc = sevenZCrc(start.data(), start.size());
+    static const uint8_t signature[] = {'7', 'z', 0xBC, 0xAF, 0x27, 0x1C, 0, 4};
+    vector<uint8_t> prefix(signature, signature + sizeof(signature));
+    putLE(prefix, startCrc, 4);
+    prefix.insert(prefix.end(), start.begin(), start.end());
+
+    bool ok = fseek(file, 0, SEEK_SET) == 0 && fwrite(prefix.data(), 1, prefix.size(), file) == prefix.size();
+    ok = fclose(file) == 0 && ok;
+    file = NULL;
+    if (!ok)
+	throw SevenZError(161, "Can't write " + path);
+}
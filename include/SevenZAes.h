@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2016 Vojtech Vecera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef SevenZAES_H
+#define	SevenZAES_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "SevenZKdf.h"
+
+#define AES_BLOCK_SIZE 16
+#define AES_ROUNDS 14		    // AES-256
+#define AES_SCHEDULE_SIZE ((AES_ROUNDS + 1) * AES_BLOCK_SIZE)
+
+/**
+ * AES-256-CBC decryption of the same ciphertext with many keys. Every
+ * kernel keeps its own layout of the AES_SCHEDULE_SIZE bytes of round keys.
+ */
+struct SevenZAesKernel {
+    const char *name;
+    /**
+     * @param keys count * AES_KEY_SIZE, count, schedules count * AES_SCHEDULE_SIZE
+     */
+    void (*expand)(const uint8_t *keys, size_t count, uint8_t *schedules);
+    /**
+     * @param schedules, count, iv, data, blocks, out count * blocks * AES_BLOCK_SIZE
+     */
+    void (*decrypt)(const uint8_t *schedules, size_t count, const uint8_t *iv,
+	    const uint8_t *data, size_t blocks, uint8_t *out);
+    bool (*supported)();
+};
+
+/**
+ * All kernels, the fastest first, the last one runs everywhere
+ * @param count
+ */
+const SevenZAesKernel* sevenZAesKernels(size_t *count);
+/**
+ * Fastest kernel supported by the CPU
+ */
+const SevenZAesKernel* sevenZBestAesKernel();
+
+/**
+ * Decrypts the first blocks of an encrypted stream with a batch of
+ * candidate keys. AES-NI keeps 8 keys in flight, so the rounds are bound
+ * by throughput instead of latency. The fallback computes the S-box in
+ * GF(2^8) instead of looking it up.
+ */
+class SevenZAesDecryptor {
+public:
+    /**
+     * @param kernel (NULL = the fastest one)
+     */
+    SevenZAesDecryptor(const SevenZAesKernel *kernel = NULL);
+    /**
+     * Buffers only grow to the largest batch, there is no allocation per
+     * candidate
+     * @param keys count * AES_KEY_SIZE, count, iv, data, blocks,
+     * out count * blocks * AES_BLOCK_SIZE, blocks of one key together
+     */
+    void decrypt(const uint8_t *keys, size_t count, const uint8_t *iv,
+	    const uint8_t *data, size_t blocks, uint8_t *out);
+    const SevenZAesKernel* getKernel() const;
+
+private:
+    const SevenZAesKernel *kernel;
+    std::vector<uint8_t> schedules;
+};
+
+/**
+ * AES-256-CBC encryption in place by the portable code, slow but enough to
+ * write encrypted test archives
+ * @param key AES_KEY_SIZE bytes, iv, data, blocks
+ */
+void sevenZAesEncrypt(const uint8_t *key, const uint8_t *iv, uint8_t *data, size_t blocks);
+
+#endif	/* SevenZAES_H */
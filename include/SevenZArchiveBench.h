@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2016 Vojtech Vecera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef SevenZARCHIVEBENCH_H
+#define	SevenZARCHIVEBENCH_H
+
+#include <iostream>
+#include <string>
+
+/**
+ * Benchmark of one real archive. open(), process(), finish() and close() run
+ * runs times with each I/O method after a warm-up and the median and p99 of
+ * every phase are printed side by side. Then the LZMA or LZMA2 stream of the
+ * encoded header and of the first folder is decoded by every decoder which
+ * can read it, the output is dropped.
+ * @param out, path, runs, threads (for LZMA2 streams with more runs)
+ * @return false when the archive can't be opened, throws SevenZError when
+ * it is broken
+ */
+bool sevenZArchiveBenchmark(std::ostream &out, const std::string &path, unsigned runs,
+	unsigned threads);
+
+#endif	/* SevenZARCHIVEBENCH_H */
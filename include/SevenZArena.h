@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2016 Vojtech Vecera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef SevenZARENA_H
+#define	SevenZARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+#include "7zTypes.h"
+
+/**
+ * Bump allocator owning everything read from one archive. Nothing is freed
+ * separately, reset() releases all at once and keeps the first blocks for
+ * the next archive.
+ */
+class SevenZArena {
+public:
+    SevenZArena(size_t blockSize = 64 << 10);
+    ~SevenZArena();
+    /**
+     * Returns size bytes aligned for any type, throws std::bad_alloc
+     * @param size
+     */
+    void* alloc(size_t size);
+    /**
+     * Array of count objects like new T[count], they are never destroyed
+     * @param count
+     */
+    template <class T> T* alloc(uint64_t count){
+	static_assert(std::is_trivially_destructible<T>::value,
+		"arena never calls destructors");
+	if (count > SIZE_MAX / sizeof(T))
+	    throw std::bad_alloc();
+	T *array = static_cast<T*>(alloc(count * sizeof(T)));
+	if (!std::is_trivial<T>::value)
+	    for (uint64_t i = 0; i < count; i++)
+		new (array + i) T();
+	return array;
+    }
+    /**
+     * Frees all allocations, blocks up to RetainMax bytes are kept
+     */
+    void reset();
+    /**
+     * ISzAlloc for the LZMA decoder, its Free does nothing
+     */
+    ISzAlloc* lzmaAlloc();
+    /**
+     * Bytes taken from the system
+     */
+    size_t allocated() const;
+    /**
+     * Number of alloc() calls since the arena was made
+     */
+    uint64_t allocations() const;
+
+    static const size_t RetainMax = 8 << 20;
+
+private:
+    SevenZArena(const SevenZArena&);
+    SevenZArena& operator=(const SevenZArena&);
+
+    struct Block {
+	Block *next;
+	size_t size;	// usable bytes after the header
+	size_t used;
+    };
+    struct LzmaAlloc {
+	ISzAlloc funcs;	    // must be first, LZMA gets pointer to it
+	SevenZArena *arena;
+    };
+    static void* lzmaAllocFnc(void *p, size_t size);
+    static void lzmaFreeFnc(void *p, void *address);
+
+    Block* newBlock(size_t size);
+
+    Block *head;	// bump allocations go here
+    Block *large;	// blocks with one big allocation
+    Block *spare;	// empty blocks kept by reset()
+    size_t blockSize;
+    size_t total;
+    uint64_t count;
+    LzmaAlloc lzma;
+};
+
+#endif	/* SevenZARENA_H */
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2016 Vojtech Vecera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef SevenZBATCH_H
+#define	SevenZBATCH_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "SevenZFormat.h"
+#include "SevenZCracker.h"
+
+/**
+ * Analyses many archives in one process on a pool of worker threads.
+ * Every worker owns one SevenZFormat which is reused for all its archives.
+ */
+class SevenZBatch {
+public:
+    SevenZBatch();
+    /**
+     * Adds an archive, directories are searched recursively for *.7z files
+     * @param path
+     */
+    void addPath(const std::string& path);
+    /**
+     * Adds all paths from the list, one per line or NUL separated
+     * @param stream, delim
+     */
+    void readList(std::istream& stream, char delim);
+    /**
+     * Analyses all added archives, results are written as soon as they are done
+     * @param threads, out
+     * @return number of archives which could not be analysed
+     */
+    size_t run(unsigned threads, std::ostream& out);
+    size_t size() const;
+    /**
+     * How workers read the archives
+     * @param type
+     */
+    void setIO(SevenZIOType type);
+    /**
+     * Workers print $7z$ hash lines, errors go to stderr then
+     * @param enable, truncate
+     */
+    void setHashOutput(bool enable, uint64_t truncate);
+    /**
+     * Workers check CRCs of the packed streams and of the decoded headers
+     * @param enable
+     */
+    void setVerifyCrc(bool enable);
+    /**
+     * Workers test the archives instead of printing their information, with
+     * stop no archive is started after the first failure
+     * @param enable, stop
+     */
+    void setTest(bool enable, bool stop);
+    /**
+     * Workers add archives to the cracker instead of printing them, errors
+     * go to stderr
+     * @param cracker (NULL = print the information)
+     */
+    void setCracker(SevenZCracker *cracker);
+    /**
+     * Workers measure phases, I/O and allocations of every archive
+     * @param enable
+     */
+    void setStats(bool enable);
+    /**
+     * JSON with the counters of every archive and their sums, after run()
+     * @param out
+     */
+    void printStats(std::ostream& out) const;
+    /**
+     * Workers count hardware events of the phases
+     * @param enable
+     */
+    void setPerf(bool enable);
+    /**
+     * Table of the phases of every class of archives and of all, after run()
+     * @param out
+     */
+    void printPerf(std::ostream& out) const;
+
+private:
+    void walk(const std::string& dir);
+    void worker(std::ostream *out);
+
+    std::vector<std::string> paths;
+    std::atomic<size_t> next;
+    std::atomic<size_t> failed;
+    std::mutex outLock;
+    SevenZIOType ioType;
+    bool hashOutput;
+    uint64_t truncate;
+    bool verifyCrc;
+    bool testMode;
+    bool stopOnError;
+    std::atomic<bool> stopped;	// an archive failed with stopOnError
+    unsigned testThreads;	// threads left over by the archives
+    SevenZCracker *cracker;
+    bool statsEnabled;
+    bool perfEnabled;
+    std::vector<SevenZStats> stats;	// per path, written only by its worker
+    uint64_t wallNs;		// of the last run()
+    unsigned runThreads;
+};
+
+#endif	/* SevenZBATCH_H */
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2016 Vojtech Vecera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef SevenZCHECKPOINT_H
+#define	SevenZCHECKPOINT_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Search state of a password attack. The candidates are split into chunks
+ * numbered from 0 and a shard takes the chunks with number % shards ==
+ * shard, so processes splitting the work need no coordination. Chunks
+ * below next which are not pending are done, a pending chunk continues at
+ * its position. The file is text and is replaced by a rename, a reader
+ * never sees a half written state.
+ */
+struct SevenZCheckpoint {
+    std::string source;		// candidates, e.g. "wordlist <size> <mtime> <path>"
+    uint64_t chunkSize = 0;
+    unsigned shard = 0;
+    unsigned shards = 1;
+    uint64_t next = 0;		// first chunk not taken yet
+    std::vector<std::pair<uint64_t, uint64_t>> pending;	// chunk, position in the candidates
+    std::vector<std::pair<std::string, std::string>> hits;	// path, password
+    std::vector<std::string> open;	// paths of archives without a password
+
+    /**
+     * @param path
+     * @return false when the file is missing, throws SevenZError when it
+     * is not a checkpoint
+     */
+    bool load(const std::string &path);
+    /**
+     * Writes path.tmp, syncs it, renames it to path and syncs the directory
+     * @param path
+     * @return false when the file can't be written
+     */
+    bool save(const std::string &path) const;
+};
+
+#endif	/* SevenZCHECKPOINT_H */
@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2016 Vojtech Vecera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef SevenZCRACKER_H
+#define	SevenZCRACKER_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "SevenZCheckpoint.h"
+#include "SevenZFormat.h"
+#include "SevenZKdf.h"
+#include "SevenZKeyCache.h"
+#include "SevenZMask.h"
+#include "SevenZVerifier.h"
+
+#define CRACK_BATCH 4096	    // passwords derived and verified at once
+#define CRACK_CHUNK (1 << 20)	    // bytes of the wordlist taken by a worker
+#define CRACK_MASK_CHUNK (1 << 16)  // mask candidates taken by a worker
+
+/**
+ * Hits of the workers. Workers push without locks, the reporting thread
+ * takes all pushed hits at once.
+ */
+class SevenZHitQueue {
+public:
+    struct Hit {
+	size_t target;
+	std::string password;
+    };
+
+    SevenZHitQueue();
+    ~SevenZHitQueue();
+    SevenZHitQueue(const SevenZHitQueue&) = delete;
+    SevenZHitQueue& operator=(const SevenZHitQueue&) = delete;
+    void push(size_t target, const std::string &password);
+    /**
+     * Moves all hits to the vector, the oldest first
+     * @param hits
+     */
+    void drain(std::vector<Hit> &hits);
+
+private:
+    struct Node {
+	Hit hit;
+	Node *next;
+    };
+    std::atomic<Node*> head;
+};
+
+/**
+ * Time spent in the stages of the attack, summed over the workers
+ */
+struct SevenZCrackStats {
+    uint64_t candidates = 0;	// passwords read from the wordlist
+    uint64_t derived = 0;	// keys derived, the rest came from the cache
+    double seconds = 0;		// wall time of the run
+    double split = 0;		// wordlist lines or mask candidates
+    double cache = 0;		// key cache lookups and stores
+    double kdf = 0;		// UTF-16 and SHA-256 key derivation
+    double verify = 0;		// AES and the partial decode
+    double confirm = 0;		// whole header decode of possible keys
+    /**
+     * Candidates per second and share of every stage
+     * @param out
+     */
+    void print(std::ostream &out) const;
+};
+
+/**
+ * Wordlist attack on archives with encrypted headers. Archives are grouped
+ * by their key derivation parameters (salt and NumCyclesPower), every
+ * password is derived once per group and its key is checked against all
+ * archives of the group. Derived keys can be kept in a SevenZKeyCache.
+ *
+ * The wordlist is mapped and workers take CRACK_CHUNK bytes of it at once,
+ * each chunk holds the lines starting in it. Mask candidates are taken by
+ * CRACK_MASK_CHUNK and generated right into the batch. Every worker has its own
+ * derivation and verification state, so they share only the chunk counter,
+ * the key cache and the hit queue.
+ *
+ * With a checkpoint, the chunks taken, the position of every worker in its
+ * chunk and the hits are saved after each finished batch, a restarted run
+ * loses at most the batches which were in flight.
+ */
+class SevenZCracker {
+public:
+    SevenZCracker();
+    /**
+     * Adds an analysed archive, batch workers call it at once. Throws
+     * SevenZError when the archive can't be attacked.
+     * @param path, data
+     */
+    void addArchive(const std::string &path, const SevenZInitData &data);
+    /**
+     * @param cache (NULL = keys are not cached)
+     */
+    void setKeyCache(SevenZKeyCache *cache);
+    /**
+     * Tries only the chunks with number % count == index
+     * @param index, count
+     */
+    void setShard(unsigned index, unsigned count);
+    /**
+     * Saves the state to the file and resumes from it when it exists
+     * @param path (empty = no checkpoint)
+     */
+    void setCheckpoint(const std::string &path);
+    /**
+     * Workers stop after their batch, can be called from a signal handler
+     */
+    void stop();
+    /**
+     * Tries every line of the wordlist on threads, found passwords are
+     * printed as path:password as soon as they are confirmed
+     * @param wordlist, threads, out
+     * @return number of archives with a found password, -1 when the
+     * wordlist can't be read. Throws SevenZError when the checkpoint
+     * belongs to other candidates, shard or archives.
+     */
+    long run(const char *wordlist, unsigned threads, std::ostream &out);
+    /**
+     * Tries every candidate of the mask, as run() with a wordlist
+     * @param mask, threads, out
+     */
+    long run(const SevenZMask &mask, unsigned threads, std::ostream &out);
+    size_t size() const;
+    size_t numGroups() const;
+    const SevenZCrackStats& getStats() const;
+    /**
+     * @return true when the last run was stopped before the end
+     */
+    bool stopped() const;
+
+private:
+    struct Target {
+	std::string path;
+	std::unique_ptr<SevenZHeaderVerifier> verifier;
+	std::atomic<bool> found;
+	Target(): found(false) {}
+	Target(Target &&orig): path(std::move(orig.path)), verifier(std::move(orig.verifier)),
+	    found(orig.found.load()) {}
+    };
+    struct Group {
+	SevenZAesProps props;
+	std::vector<size_t> targets;
+    };
+    /**
+     * State of one thread, verifiers are copies of the targets' ones
+     */
+    struct Worker {
+	std::vector<std::unique_ptr<SevenZKdf>> kdfs;	// per group
+	std::vector<std::unique_ptr<SevenZHeaderVerifier>> verifiers;	// per target
+	std::vector<SevenZSpan> passwords;
+	std::vector<uint8_t> keys;
+	std::vector<uint8_t> cached;
+	std::vector<uint8_t> passed;
+	std::vector<SevenZSpan> missing;
+	std::vector<uint8_t> derived;
+	std::vector<uint8_t> generated;	// mask candidates
+	SevenZCrackStats stats;
+	bool busy = false;	// chunk and pos are valid, guarded by progressLock
+	uint64_t chunk = 0;
+	uint64_t pos = 0;	// first line not tried yet
+    };
+
+    /**
+     * Candidates of a run, lines of a wordlist or a mask
+     */
+    struct Source {
+	std::string name;	// identifies the candidates in a checkpoint
+	uint64_t size;		// bytes of the wordlist or number of candidates
+	uint64_t chunk;		// part of the size taken by a worker
+	SevenZSpan text;	// wordlist
+	const SevenZMask *mask;
+    };
+
+    long attack(const Source &source, unsigned threads, std::ostream &out);
+    void work(Worker *worker, const Source *source);
+    /**
+     * Takes a pending or the next chunk of the shard
+     * @param worker, source
+     * @return false when there is nothing left
+     */
+    bool claim(Worker &worker, const Source &source);
+    /**
+     * Tries the rest of the worker's chunk
+     * @param worker, source
+     */
+    void tryLines(Worker &worker, const Source &source);
+    void tryMask(Worker &worker, const Source &source);
+    /**
+     * Position after a finished batch, for the checkpoint
+     * @param worker, pos, done (the chunk is finished)
+     */
+    void advance(Worker &worker, uint64_t pos, bool done);
+    /**
+     * Loads the checkpoint and marks found archives
+     * @param state, source, out (where the found passwords are printed)
+     */
+    void resume(SevenZCheckpoint &state, const Source &source, std::ostream &out);
+    /**
+     * Chunks taken and positions of the workers into the state
+     * @param state, workers
+     */
+    void snapshot(SevenZCheckpoint &state, const std::vector<Worker> &workers);
+    /**
+     * Derives and verifies one batch of passwords for all groups
+     * @param worker, count
+     */
+    void tryBatch(Worker &worker, size_t count);
+    /**
+     * Keys of the passwords for the group, from the cache or derived
+     * @param worker, group, count
+     */
+    void deriveKeys(Worker &worker, size_t group, size_t count);
+
+    mutable std::mutex lock;
+    std::vector<Target> targets;
+    std::vector<Group> groups;
+    SevenZKeyCache *cache;
+    std::atomic<unsigned> running;	// workers not finished yet
+    std::atomic<size_t> remaining;	// targets without a password
+    SevenZHitQueue hits;
+    SevenZCrackStats stats;
+    unsigned shard;
+    unsigned shards;
+    std::string checkpoint;
+    std::atomic<bool> stopping;
+    bool interrupted;		// the last run stopped with candidates left
+    std::atomic<uint64_t> batches;	// finished, a change means a new checkpoint
+    std::mutex progressLock;
+    uint64_t nextChunk;		// guarded by progressLock as the workers' positions
+    std::vector<std::pair<uint64_t, uint64_t>> pending;	// chunks to continue
+};
+
+#endif	/* SevenZCRACKER_H */
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2016 Vojtech Vecera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef SevenZCRC_H
+#define	SevenZCRC_H
+
+#include <cstdint>
+#include <cstddef>
+#include <iostream>
+
+#include "SevenZStream.h"
+
+/**
+ * CRC-32 (IEEE, reflected polynomial 0xEDB88320) as stored in 7z headers.
+ * Kernels update the inverted register, sevenZCrcUpdate() inverts it on
+ * entry and exit, so CRCs of consecutive parts chain as in zlib.
+ */
+struct SevenZCrcKernel {
+    const char *name;
+    /**
+     * @param state inverted CRC, data, size
+     * @return new inverted CRC
+     */
+    uint32_t (*update)(uint32_t state, const uint8_t *data, size_t size);
+    bool (*supported)();
+};
+
+/**
+ * All kernels, the fastest first, the last one (slicing-by-8) runs everywhere
+ * @param count
+ */
+const SevenZCrcKernel* sevenZCrcKernels(size_t *count);
+/**
+ * Fastest kernel supported by the CPU, chosen once
+ */
+const SevenZCrcKernel* sevenZBestCrcKernel();
+/**
+ * CRC of the data following data with the CRC crc (0 at the start)
+ * @param crc, data, size
+ */
+uint32_t sevenZCrcUpdate(uint32_t crc, const uint8_t *data, size_t size);
+/**
+ * @param data, size
+ */
+uint32_t sevenZCrc(const uint8_t *data, size_t size);
+
+/**
+ * Passes data of another source through and computes their CRC
+ */
+class SevenZCrcSource: public SevenZSource {
+public:
+    SevenZCrcSource(SevenZSource *source);
+    uint64_t fill(uint8_t *buffer, uint64_t size);
+    SevenZSpan view(uint64_t size);
+    /**
+     * Reads the rest of the source
+     * @return CRC of all its data
+     */
+    uint32_t finish();
+
+private:
+    SevenZSource *source;
+    uint32_t crc;
+};
+
+/**
+ * Measures GB/s of every supported kernel on buffers from L1 to memory size
+ * @param out
+ */
+void sevenZCrcBenchmark(std::ostream &out);
+
+#endif	/* SevenZCRC_H */
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2016 Vojtech Vecera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef SevenZDECODER_H
+#define	SevenZDECODER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "SevenZStream.h"
+
+#define LZMA2_WINDOW (1 << 26)	// unpacked bytes of the runs SevenZLzma2Source decodes at once
+
+/**
+ * Decodes whole LZMA2 stream into the memory. The stream is split into runs
+ * of chunks where every run starts with a dictionary reset, such runs do not
+ * depend on each other and are decoded on more threads. Multi-threaded 7-Zip
+ * encoder produces a reset at the start of every block.
+ */
+class SevenZLzma2Decoder {
+public:
+    /**
+     * Reads only the chunk headers of the stream, throws SevenZError when
+     * they are damaged
+     * @param packed, prop
+     */
+    SevenZLzma2Decoder(SevenZSpan packed, uint8_t prop);
+    /**
+     * Number of independent runs
+     */
+    size_t runs() const;
+    /**
+     * Unpacked size given by the chunk headers
+     */
+    uint64_t size() const;
+    /**
+     * Unpacked size of the run
+     * @param run
+     */
+    uint64_t runSize(size_t run) const;
+    /**
+     * Unpacked size of the biggest run
+     */
+    uint64_t largestRun() const;
+    /**
+     * Decodes the stream, dest has size() bytes
+     * @param dest, threads
+     */
+    void decode(uint8_t *dest, unsigned threads);
+    /**
+     * Decodes the runs from first to last - 1, dest has their unpacked bytes
+     * @param first, last, dest, threads
+     */
+    void decode(size_t first, size_t last, uint8_t *dest, unsigned threads);
+
+private:
+    struct Run {
+	uint64_t inPos;
+	uint64_t inSize;
+	uint64_t outPos;
+	uint64_t outSize;
+    };
+    SRes decodeRun(const Run& run, uint8_t *dest);
+
+    SevenZSpan packed;
+    uint8_t prop;
+    uint64_t unpackSize;
+    std::vector<Run> runList;
+};
+
+/**
+ * LZMA2 stream decoded by SevenZLzma2Decoder on more threads. The runs are
+ * decoded in groups which fit into the window, so the memory is bounded by
+ * the window and not by the unpacked size. A run bigger than the window is
+ * decoded alone, callers which need the bound check largestRun() first.
+ */
+class SevenZLzma2Source: public SevenZSource {
+public:
+    /**
+     * @param decoder (must outlive the source), threads, windowSize
+     */
+    SevenZLzma2Source(SevenZLzma2Decoder &decoder, unsigned threads, uint64_t windowSize = LZMA2_WINDOW);
+    uint64_t fill(uint8_t *buffer, uint64_t size);
+    SevenZSpan view(uint64_t size);
+private:
+    SevenZLzma2Source(const SevenZLzma2Source&);
+    SevenZLzma2Source& operator=(const SevenZLzma2Source&);
+    /**
+     * Decodes the next group of runs, everything decoded before was returned
+     * @return false at the end of data
+     */
+    bool decode();
+    SevenZLzma2Decoder &decoder;
+    unsigned threads;
+    uint64_t windowSize;
+    std::vector<uint8_t> window;
+    size_t nextRun;
+    uint64_t pos;	// next byte of the window to return
+    uint64_t end;	// decoded bytes in the window
+};
+
+#endif	/* SevenZDECODER_H */
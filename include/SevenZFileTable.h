@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2016 Vojtech Vecera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef SevenZFILETABLE_H
+#define	SevenZFILETABLE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <iostream>
+
+/**
+ * Bit vector as stored in the header, item 0 is the highest bit of byte 0
+ * @param bits, i
+ */
+inline bool sevenZBit(const uint8_t *bits, uint64_t i){
+    return (bits[i >> 3] & (0x80 >> (i & 7))) != 0;
+}
+
+/**
+ * Optional file property, values of undefined items are not valid
+ */
+template <class T> struct SevenZColumn {
+    T *values = NULL;		// NULL when the property is not in the archive
+    uint8_t *defined = NULL;	// NULL when all items are defined
+    bool has(uint64_t i) const {
+	return values != NULL && (defined == NULL || sevenZBit(defined, i));
+    }
+};
+
+/**
+ * Files of the archive (FilesInfo 0x05) stored by columns. All names are
+ * kept in one UTF-16LE blob as they are in the header, the other properties
+ * are parallel arrays indexed by the file. Everything lives in the arena of
+ * the archive, so there is no allocation per file.
+ */
+struct SevenZFileTable {
+    uint64_t numFiles = 0;
+    uint64_t numEmptyStreams = 0;
+    const uint8_t *names = NULL;    // every name ends with two zero bytes
+    uint64_t *nameOffset = NULL;    // numFiles + 1 byte offsets into names
+    uint64_t *size = NULL;	    // 0 for files without stream
+    SevenZColumn<uint32_t> crc;
+    SevenZColumn<uint32_t> attrib;
+    SevenZColumn<uint64_t> ctime;   // FILETIME, 100 ns since 1601
+    SevenZColumn<uint64_t> atime;
+    SevenZColumn<uint64_t> mtime;
+    uint8_t *emptyStream = NULL;    // bit vectors per file, NULL when no bit is set
+    uint8_t *emptyFile = NULL;
+    uint8_t *anti = NULL;
+
+    bool hasStream(uint64_t i) const {
+	return emptyStream == NULL || !sevenZBit(emptyStream, i);
+    }
+    bool isDir(uint64_t i) const;
+    /**
+     * Appends UTF-8 name of the file, the string keeps its capacity so
+     * a reused string does not allocate per file
+     * @param i, dst
+     */
+    void appendName(uint64_t i, std::string &dst) const;
+    /**
+     * Lists all files, one per line: size, CRC and name
+     * @param out
+     */
+    void printInfo(std::ostream &out) const;
+};
+
+#endif	/* SevenZFILETABLE_H */
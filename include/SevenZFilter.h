@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2016 Vojtech Vecera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef SevenZFILTER_H
+#define	SevenZFILTER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "SevenZStream.h"
+
+#define FILTER_BUFFER (1 << 16)	    // data converted by a filter at once
+
+/**
+ * Packed stream stored as it is (Copy coder)
+ */
+class SevenZSpanSource: public SevenZSource {
+public:
+    SevenZSpanSource(SevenZSpan span);
+    uint64_t fill(uint8_t *buffer, uint64_t size);
+    SevenZSpan view(uint64_t size);
+
+private:
+    SevenZSpan span;
+    uint64_t pos;
+};
+
+/**
+ * Coder converting data of another source in place, it reads through
+ * its own buffer of FILTER_BUFFER bytes
+ */
+class SevenZFilterSource: public SevenZSource {
+public:
+    SevenZFilterSource(SevenZSource *source);
+    uint64_t fill(uint8_t *buffer, uint64_t size);
+    SevenZSpan view(uint64_t size);
+
+protected:
+    /**
+     * Converts the data, bytes at the end which need the data after them
+     * are left for the next call
+     * @param data, size, last (no more data follow, convert all)
+     * @return number of converted bytes
+     */
+    virtual size_t convert(uint8_t *data, size_t size, bool last) = 0;
+
+private:
+    /**
+     * Reads and converts next data, all converted data were returned
+     * @return false at the end of data
+     */
+    bool refill();
+
+    SevenZSource *source;
+    std::vector<uint8_t> buffer;
+    size_t pos;		// next byte to return
+    size_t done;	// end of the converted bytes
+    size_t end;		// end of the read bytes
+    bool last;
+};
+
+/**
+ * x86 branch converter (BCJ), relative addresses of CALL and JMP were made
+ * absolute by the encoder
+ */
+class SevenZBcjSource: public SevenZFilterSource {
+public:
+    SevenZBcjSource(SevenZSource *source);
+
+protected:
+    size_t convert(uint8_t *data, size_t size, bool last);
+
+private:
+    uint32_t ip;	// position of the buffer in the stream
+    uint32_t state;	// E8/E9 bytes seen before the buffer
+};
+
+/**
+ * Delta filter, every byte was stored as the difference from the byte
+ * distance bytes before it
+ */
+class SevenZDeltaSource: public SevenZFilterSource {
+public:
+    /**
+     * @param source, distance (1 to 256)
+     */
+    SevenZDeltaSource(SevenZSource *source, unsigned distance);
+
+protected:
+    size_t convert(uint8_t *data, size_t size, bool last);
+
+private:
+    unsigned distance;
+    uint8_t history[256];
+    uint8_t pos;
+};
+
+#endif	/* SevenZFILTER_H */
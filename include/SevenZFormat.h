@@ -34,6 +34,11 @@
 
 #include "7zTypes.h"
 #include "LzmaDec.h"
+#include "SevenZStream.h"
+#include "SevenZError.h"
+#include "SevenZArena.h"
+#include "SevenZFileTable.h"
+#include "SevenZStats.h"
 
 
 // HEADERS
@@ -51,6 +56,14 @@
 #define FOLDER 0x0B
 #define CODERUNPACKSIZE 0x0C 
 #define NUMUNPACKSTR 0x0D 
+#define EMPTYSTREAM 0x0E
+#define EMPTYFILE 0x0F
+#define ANTI 0x10
+#define NAME 0x11
+#define CTIME 0x12
+#define ATIME 0x13
+#define MTIME 0x14
+#define WINATTRIB 0x15
 #define ENCHDR 0x17 
 
 // CODERS ID
@@ -61,6 +74,7 @@
 #define SHL(x) (x = x << 1) // shift left by one bit 
 #define READ 0
 #define SKIP 1
+#define TAIL_WINDOW (64 << 10)	// read together with the next header
 
 
 using namespace std;
@@ -78,6 +92,14 @@ enum SevenZEncType{
     NONE
 };
 
+/**
+ * How the archive is read
+ */
+enum SevenZIOType{
+    MappedIO,	// mmap, no copies
+    PreadIO	// only the needed windows are read, good for network storage
+};
+
 struct SevenZCoder{
     uint8_t *coderID;
     uint8_t flags;
@@ -86,10 +108,31 @@ struct SevenZCoder{
     uint64_t numOutStreams;
     uint64_t propertySize;
     uint8_t *property;
-    void printInfo();
+    void printInfo(ostream &out);
     string coderToString(uint8_t *coder, uint8_t size);
     string printCoder(uint8_t *coder, uint8_t size);
     string propertyToString(uint8_t *coder, uint8_t size);
+    /**
+     * True for 7zAES (06 F1 07 01)
+     */
+    bool isAes() const;
+};
+
+/**
+ * Properties of 7zAES coder, key is derived from the password, salt and
+ * 2^numCyclesPower rounds of SHA-256
+ */
+struct SevenZAesProps{
+    unsigned numCyclesPower = 0;
+    unsigned saltSize = 0;
+    unsigned ivSize = 0;
+    uint8_t salt[16];
+    uint8_t iv[16];	// zero padded to the AES block
+    /**
+     * @param property, size
+     * @return false when the properties are damaged
+     */
+    bool read(const uint8_t *property, uint64_t size);
 };
 
 struct SevenZFolder{
@@ -99,14 +142,28 @@ struct SevenZFolder{
     uint64_t numOutStreamsTotal = 0;
     uint64_t inIndex;
     uint64_t outIndex;
-    uint64_t *unPackSize;
-    uint64_t *index;
-    void printInfo();
+    uint64_t *bindIn = NULL;	// all bind pairs, numOutStreamsTotal - 1 of them
+    uint64_t *bindOut = NULL;
+    uint64_t mainOutStream;	// out stream which is not bound, output of the folder
+    uint64_t *unPackSize = NULL;
+    uint64_t *index = NULL;	// packed streams after the first one, NULL when there is one
+    uint32_t unPackCRC;
+    bool unPackCRCDefined = false;
+    void printInfo(ostream &out);
+    /**
+     * Size of the unpacked data of the whole folder
+     */
+    uint64_t getUnPackSize() const;
+    /**
+     * Number of packed streams which are input of the folder
+     */
+    uint64_t getNumPackStreams() const;
 };
 
 struct SevenZStartHdr{
     uint64_t NxtHdrOffset;
     uint64_t NxtHdrSize;
+    uint32_t NxtHdrCRC;
 };
 
 struct SevenZPackInfoHdr{
@@ -114,7 +171,8 @@ struct SevenZPackInfoHdr{
     uint64_t numPackStreams;
     uint64_t *packSize;
     uint32_t *crc = NULL;
-    void printInfo();
+    uint8_t *crcDefined = NULL;	// bit vector, NULL when all CRCs are defined
+    void printInfo(ostream &out);
 };
 
 struct SevenZInitData{
@@ -122,10 +180,21 @@ struct SevenZInitData{
 	SevenZEncType type;
 	SevenZFolder *folders;
 	SevenZPackInfoHdr *packInfo;
+	uint64_t *numUnpackStreams = NULL;	// per folder
 	uint64_t *subStreamSize = NULL;
+	uint64_t numSubStreams = 0;
+	SevenZColumn<uint32_t> streamCRC;	// per substream
+	SevenZFileTable *files = NULL;	// NULL when there is no FilesInfo
 	uint64_t numFolders;
 	uint16_t keyLength;
-	uint8_t *encData;
+	const uint8_t *encData;	    // NULL unless setCrackData(true)
+	uint64_t encPos;
+	uint64_t encSize;
+	uint64_t encFolder;	    // smallest encrypted folder, numFolders if none
+	uint64_t encStream;	    // its first substream
+	const SevenZFolder *hdrFolder;	// folder of the encoded header, NULL when it is raw
+	uint64_t hdrPackPos;	    // its packed stream
+	uint64_t hdrPackSize;
 
 };
 
@@ -148,90 +217,251 @@ public:
     SevenZFormat(const SevenZFormat& orig);
     ~SevenZFormat();
 //    void init(std::ifstream& stream);
-    std::ifstream& getStream(); 
+    /**
+     * Opens the archive for reading
+     * @param path
+     * @return false if the archive can't be opened
+     */
+    bool open(const char *path);
+    /**
+     * Selects how archives are read, closes the opened one
+     * @param type
+     */
+    void setIO(SevenZIOType type);
+    /**
+     * Packed stream for cracking is read only when enabled (off by default),
+     * otherwise only the start header and the next header are read
+     * @param load
+     */
+    void setCrackData(bool load);
+    /**
+     * finish() prints $7z$ hash of the encrypted data instead of the information
+     * @param enable, truncate (bigger packed streams keep only so many first bytes, 0 = all)
+     */
+    void setHashOutput(bool enable, uint64_t truncate = 0);
+    /**
+     * Threads used for decoding of one LZMA2 stream (1 by default)
+     * @param threads
+     */
+    void setThreads(unsigned threads);
+    /**
+     * Checks CRCs of the packed streams and of the decoded header (off by
+     * default), the start header and the next header are checked always
+     * @param enable
+     */
+    void setVerifyCrc(bool enable);
+    /**
+     * Measures the phases, I/O and allocations of every archive (off by
+     * default), the counters are kept without it too
+     * @param enable
+     */
+    void setStats(bool enable);
+    /**
+     * Reads performance counters of the thread at every change of the phase
+     * (off by default), it measures the phases like setStats(true). Counters
+     * are opened by the next open() in the thread which calls it.
+     * @param enable
+     */
+    void setPerf(bool enable);
+    /**
+     * Counters of the last archive from open() to close()
+     */
+    const SevenZStats& getStats() const;
+    /**
+     * Clock of the phases, NULL when the stats are off. Callers time the
+     * work they do with the archive by SevenZPhaseTimer on it.
+     */
+    SevenZPhaseClock* phaseClock();
+    /**
+     * Redirects all the printed information (cout by default)
+     * @param stream
+     */
+    void setOutput(std::ostream &stream);
+    /**
+     * Analyses opened archive, throws SevenZError when the archive is broken
+     */
     void process();
     void finish();
+    /**
+     * Forgets the parsed data and closes the archive without printing
+     */
+    void close();
+    /**
+     * Data parsed by process(), valid until finish()
+     */
+    const SevenZInitData& getData() const;
+    /**
+     * True when process() found an encrypted folder, finish() prints no hash
+     * without it
+     */
+    bool hasEncryptedData() const;
+    /**
+     * View of the opened archive as streamSpan(), valid until close(). It is
+     * not thread safe, PreadIO keeps the read windows in a shared list.
+     * @param pos, size
+     */
+    SevenZSpan readPacked(uint64_t pos, uint64_t size);
 
 protected:
     /**
      * Read one file in stream from PK\x03\x04 signature position
-     * @param stream
+     * @param cur
      * @return 
      */
-    SevenZInitData readOneFile(std::ifstream *stream);
+    SevenZInitData readOneFile(SevenZCursor *cur);
     /**
      * Reads signature of 7z file and Start header structure from the file stream
-     * @param stream
+     * @param cur
      * @return 
      */
-    SevenZStartHdr readStartHdr(std::ifstream *stream);
+    SevenZStartHdr readStartHdr(SevenZCursor *cur);
     /**
      * Reads Folder structure (0x0B) from the file stream
-     * @param stream
+     * @param cur
      * @return 
      */
-    SevenZFolder readFolder(std::ifstream *stream);
+    SevenZFolder readFolder(SevenZCursor *cur);
     /**
-     * Converts number from 7z proprietary encoding to standard UINT64
-     * @param stream
+     * Reads structure of CRC (0x0A) from the file stream
+     * @param cur, numPackStreams, skip, defined (bit vector, NULL when all are defined)
      * @return 
      */
-    uint64_t SevenZUINT64(std::ifstream *stream);
+    uint32_t* CRCHdr(SevenZCursor *cur, uint64_t numPackStreams, bool skip, uint8_t **defined = NULL);
     /**
-     * Reads structure of CRC (0x0A) from the file stream
-     * @param stream, numPackStreams
-     * @return 
+     * Reads a number of items which take at least a byte each, so they can't
+     * be more than the rest of the header. Throws SevenZError otherwise.
+     * @param cur
+     */
+    uint64_t readCount(SevenZCursor *cur);
+    /**
+     * Reads bit vector of count items
+     * @param cur, count
      */
-    uint32_t* CRCHdr(std::ifstream *stream, uint64_t numPackStreams, bool skip);
+    uint8_t* readBits(SevenZCursor *cur, uint64_t count);
+    /**
+     * Reads AllAreDefined byte and bit vector if not all are defined
+     * @param cur, count
+     * @return NULL when all items are defined
+     */
+    uint8_t* readDefined(SevenZCursor *cur, uint64_t count);
     /**
      * Reads PackInfo header structure for the file stream
-     * @param stream, numPackStreams, skip
+     * @param cur, numPackStreams, skip
      */
-    void PackInfoHdr(std::ifstream *stream);
+    void PackInfoHdr(SevenZCursor *cur);
     /**
      * Reads Coders header structure for the file stream
-     * @param stream
+     * @param cur
      */
-    void CodersHdr(std::ifstream *stream);
+    void CodersHdr(SevenZCursor *cur);
     /**
-     * Root function for getting all information from the stream
-     * @param stream
+     * Root function for getting all information from the archive
      */
-    void readInitInfo(std::ifstream *stream);
+    void readInitInfo();
     /**
-     * Can read Main or Encryption header structure (0x01 | 0x17)
-     * @param stream
+     * Reads Header (0x01) after its ID: properties, streams and files
+     * @param cur
      */
-    void readHeader(std::ifstream *stream);
+    void readHeader(SevenZCursor *cur);
+    /**
+     * Reads StreamsInfo, the main one in Header or Encoded Header (0x17)
+     * @param cur
+     */
+    void readStreamsInfo(SevenZCursor *cur);
+    /**
+     * Reads FilesInfo (0x05) into the file table
+     * @param cur
+     */
+    void FilesInfoHdr(SevenZCursor *cur);
+    /**
+     * Reads decoded header, it starts with Header ID like the raw one
+     * @param cur
+     */
+    void readDecodedHeader(SevenZCursor *cur);
+    /**
+     * Reads decoded header from the source, with setVerifyCrc(true) and a
+     * defined CRC the rest of the data is decoded and checked too
+     * @param source, size (of the decoded header), crcDefined, crc
+     */
+    void readDecodedHeader(SevenZSource *source, uint64_t size, bool crcDefined, uint32_t crc);
+    /**
+     * Compares packed streams of the last read PackInfo with their CRCs
+     */
+    void verifyPackedStreams();
     /**
      * Print SevenZ encryption information obtained from the file
      */
     void printInfo();
     /**
-     * LZMA decompressHdrion of data
-     * @param stream, numCoders
+     * Print "path:$7z$..." line for crackers, nothing when no data are
+     * encrypted (see hasEncryptedData())
      */
-    int decompressHdr(ifstream *istream, uint64_t numCoders);
+    void printHash();
     /**
-     * Reads SubStreamInfoHdr and searches for CRC entries
-     * @param stream
+     * LZMA or LZMA2 decompressHdrion of data, decoded header is read while it
+     * is decoded unless LZMA2 stream has more independent runs and threads
+     * @param numCoders
+     * @return size of the decoded header
+     */
+    int decompressHdr(uint64_t numCoders);
+    /**
+     * Reads SubStreamInfoHdr, sizes and CRC entries of the streams in folders
+     * @param cur
      * @return 
      */
-    void SubStreamInfoHdr(ifstream *stream);
+    void SubStreamInfoHdr(SevenZCursor *cur);
+    /**
+     * One substream per folder, used when SubStreamsInfo is missing
+     */
+    void initSubStreams();
+    /**
+     * Fills sizes of one-stream folders and CRCs of all substreams
+     * @param digests, digestDefined read from SubStreamsInfo or NULL
+     */
+    void resolveSubStreams(const uint32_t *digests, const uint8_t *digestDefined);
+    /**
+     * Points to the stream saved in the archive which will be used for cracking.
+     */
+    void data4Cracking();
+    /**
+     * Returns view of the data at the position in the archive, it is
+     * copied only when the archive is read by PreadIO
+     * @param pos, size
+     */
+    SevenZSpan streamSpan(uint64_t pos, uint64_t size);
     /**
-     * Reads stream saved in the archive which will be used for cracking.      * @param stream
+     * Messages printed while parsing, they are left out of the hash output
      */
-    void data4Cracking(ifstream *istream);
+    std::ostream& trace();
     /**
-     * It copies data from the position in the file into the memory buffer 
-     * @param stream, pos, size, buffer
+     * Forgets everything read from the previous archive, frees its memory
      */
-    void copyStreamToBuffer(ifstream *stream, uint64_t pos, uint64_t size, uint8_t **buffer);
+    void reset();
     
 private:
     SevenZInitData data;
+    SevenZArena arena;	// owns all arrays in data
     uint64_t codersInEncHdr;
-    std::ifstream archive;
+    SevenZMappedFile mappedFile;
+    SevenZPreadFile preadFile;
+    SevenZFile *archive;
+    bool crackData;
+    unsigned threads;
+    bool verifyCrc;
+    bool hashOutput;
+    uint64_t truncate;
+    std::string path;
+    std::ostream *out;
+    std::ostream discard;	// no buffer, trace() output is dropped into it
+    SevenZStats stats;
+    SevenZPhaseClock clock;	// charges phases to stats
+    bool statsEnabled;
+    bool perfEnabled;
+    bool perfOpened;		// tried to open the counters
+    SevenZPerfCounters perf;
+    bool measuring;		// between open() and close()
+    uint64_t openedAt;
+    uint64_t allocBase;		// arena allocations before open()
 
 };
 
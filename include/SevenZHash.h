@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2016 Vojtech Vecera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef SevenZHASH_H
+#define	SevenZHASH_H
+
+#include <string>
+
+#include "SevenZFormat.h"
+
+// data types of the $7z$ line, compression of the data inside the AES stream
+#define HASH_COPY 0
+#define HASH_LZMA 1
+#define HASH_LZMA2 2
+#define HASH_PPMD 3
+#define HASH_BZIP2 6
+#define HASH_DEFLATE 7
+#define HASH_TRUNCATED 0x80	// only prefix of the data is in the line, the method is left out
+
+/**
+ * Appends lower-case hex of the data, two characters per table lookup
+ * @param data, size, dst
+ */
+void hexEncode(const uint8_t *data, uint64_t size, std::string &dst);
+
+/**
+ * Builds $7z$ line of the encrypted folder data.encFolder:
+ * $7z$type$NumCyclesPower$saltSize$salt$ivSize$iv$CRC$packSize$aesSize$data
+ * followed by $unpackSize$coderProps when the data are compressed, as
+ * 7z2john writes it. aesSize is the size of the decrypted data, unpackSize
+ * the size of the folder which the CRC is of. Truncated lines have type
+ * HASH_TRUNCATED and no coder part.
+ * Throws SevenZError when the coders can't be described by the line.
+ * @param data, payload (packed stream, shorter one is a truncated prefix)
+ */
+std::string sevenZHash(const SevenZInitData &data, SevenZSpan payload);
+
+#endif	/* SevenZHASH_H */
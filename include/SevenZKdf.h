@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2016 Vojtech Vecera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef SevenZKDF_H
+#define	SevenZKDF_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "SevenZFormat.h"
+
+#define AES_KEY_SIZE 32
+#define KDF_CYCLES_MAX 24	    // 7-Zip refuses more, 0x3F means no hashing
+
+/**
+ * Hashes runs of the key derivation stream of unsalted passwords of one
+ * size. A run is the shortest sequence of (password, counter) units filling
+ * whole blocks. Between runs only the two lowest bytes of the counters
+ * change, the other bytes must stay the same for all runs of a call.
+ * @param state, words (one run as blocks, lanes interleaved), first (run
+ * number), runs
+ */
+typedef void (*SevenZShaRuns)(uint32_t *state, const uint32_t *words, uint64_t first, uint64_t runs);
+
+/**
+ * SHA-256 compression of more independent messages at once. Words and
+ * states are interleaved by lanes, word t of lane j is at [t * lanes + j],
+ * message words are already converted from big-endian.
+ */
+struct SevenZShaKernel {
+    const char *name;
+    unsigned lanes;
+    /**
+     * @param state 8 * lanes words, blocks nblocks * 16 * lanes words
+     */
+    void (*compress)(uint32_t *state, const uint32_t *blocks, uint64_t nblocks);
+    bool (*supported)();
+    /**
+     * Runs compiled for the password size (UTF-16 bytes), the message
+     * words which don't change between runs are computed once per call
+     * @param size
+     * @return NULL when the size has no compiled layout
+     */
+    SevenZShaRuns (*fixed)(size_t size);
+};
+
+/**
+ * All kernels, the fastest first, the last one (scalar) runs everywhere
+ * @param count
+ */
+const SevenZShaKernel* sevenZShaKernels(size_t *count);
+/**
+ * Fastest kernel supported by the CPU
+ */
+const SevenZShaKernel* sevenZBestShaKernel();
+
+/**
+ * 7zAES key derivation: SHA-256 of (salt, UTF-16LE password, 64-bit
+ * counter) repeated 2^NumCyclesPower times. Passwords of the same length
+ * are hashed together, one in every lane of the kernel.
+ */
+class SevenZKdf {
+public:
+    /**
+     * Throws SevenZError when NumCyclesPower is not supported
+     * @param props, kernel (NULL = the fastest one)
+     */
+    SevenZKdf(const SevenZAesProps &props, const SevenZShaKernel *kernel = NULL);
+    /**
+     * Derives keys of UTF-8 passwords
+     * @param passwords, count, keys (count * AES_KEY_SIZE bytes)
+     */
+    void derive(const SevenZSpan *passwords, size_t count, uint8_t *keys);
+    const SevenZShaKernel* getKernel() const;
+    /**
+     * Appends UTF-16LE form of UTF-8 text, invalid bytes are taken as Latin-1
+     * @param utf8, dst
+     */
+    static void toUtf16(SevenZSpan utf8, std::string &dst);
+
+private:
+    /**
+     * Hashes up to lanes passwords of the same UTF-16 size
+     * @param passwords, size, count, keys
+     */
+    void deriveLanes(const uint8_t **passwords, size_t size, size_t count, uint8_t **keys);
+    /**
+     * Writes stream bytes of one lane into the interleaved words
+     * @param bytes, size, lane, words
+     */
+    void storeLane(const uint8_t *bytes, size_t size, unsigned lane, uint32_t *words);
+    /**
+     * Words of units starting at the counter into blocks
+     * @param passwords, size, count, counter, units
+     */
+    void buildRun(const uint8_t **passwords, size_t size, size_t count, uint64_t counter, size_t units);
+
+    SevenZAesProps props;
+    const SevenZShaKernel *kernel;
+    // buffers reused by all calls
+    std::string utf16;
+    std::vector<size_t> offsets;
+    std::vector<size_t> order;
+    std::vector<uint32_t> blocks;
+    std::vector<uint32_t> tail;
+    std::vector<uint32_t> state;
+    std::vector<uint8_t> stream;
+};
+
+/**
+ * Measures derived keys per second of every supported kernel
+ * @param out, numCyclesPower
+ */
+void sevenZKdfBenchmark(std::ostream &out, unsigned numCyclesPower);
+
+#endif	/* SevenZKDF_H */
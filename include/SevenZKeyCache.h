@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2016 Vojtech Vecera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef SevenZKEYCACHE_H
+#define	SevenZKEYCACHE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "SevenZFormat.h"
+
+/**
+ * Derived 7zAES keys by (password, salt, NumCyclesPower). 7-Zip writes an
+ * empty salt and the same cycles power to nearly every archive, so a key
+ * derived once serves the whole corpus and the next runs too.
+ *
+ * The cache is an open addressing table of 128-bit fingerprints of the
+ * triple and the keys. The table lives in the memory, or in a mapped file
+ * when a store is opened, so nothing has to be loaded or saved. Methods
+ * lock, the cache can be shared by threads, and a store by processes:
+ * lookups hold a shared flock() of the file, stores and growing an
+ * exclusive one, and a table grown by another process is mapped again.
+ */
+class SevenZKeyCache {
+public:
+    SevenZKeyCache();
+    ~SevenZKeyCache();
+    SevenZKeyCache(const SevenZKeyCache&) = delete;
+    SevenZKeyCache& operator=(const SevenZKeyCache&) = delete;
+    /**
+     * Keeps the table in the file, it is created when missing. Keys cached
+     * in the memory so far are moved there.
+     * @param path
+     * @return false when the file can't be used
+     */
+    bool open(const char *path);
+    /**
+     * @param props, passwords (UTF-8), count, keys count * AES_KEY_SIZE,
+     * found (count flags, 1 = key was cached and written to keys)
+     * @return number of found keys
+     */
+    size_t lookup(const SevenZAesProps &props, const SevenZSpan *passwords, size_t count,
+	    uint8_t *keys, uint8_t *found);
+    /**
+     * Caches keys of the passwords which are not flagged in skip
+     * @param props, passwords, count, keys, skip (may be NULL)
+     */
+    void store(const SevenZAesProps &props, const SevenZSpan *passwords, size_t count,
+	    const uint8_t *keys, const uint8_t *skip);
+    size_t size() const;
+
+private:
+    struct Slot;
+    struct Fingerprint {
+	uint64_t lo, hi;
+    };
+
+    Fingerprint fingerprint(const SevenZAesProps &props, SevenZSpan password);
+    Slot* find(Fingerprint fp);
+    /**
+     * Maps the table again when another process has grown it, the store
+     * is locked
+     */
+    void follow();
+    /**
+     * Doubles the table, the file grows with it
+     */
+    void grow();
+    /**
+     * Places the table of so many slots into the file or the memory
+     * @param slots
+     * @return false when the file can't be resized or mapped
+     */
+    bool map(uint64_t slots);
+    void unmap();
+
+    mutable std::mutex lock;
+    int fd;			// -1 for the table in the memory
+    uint8_t *base;		// store header and the slots
+    size_t mapped;
+    Slot *slots;
+    uint64_t *numSlots;		// in the header, power of two
+    uint64_t *used;
+    std::vector<uint8_t> memory;
+    std::string scratch;	// bytes hashed into a fingerprint
+};
+
+#endif	/* SevenZKEYCACHE_H */
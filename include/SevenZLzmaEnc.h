@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2016 Vojtech Vecera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef SevenZLZMAENC_H
+#define	SevenZLZMAENC_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Small LZMA encoder for generated archives (lc=3, lp=0, pb=2). Matches are
+ * found greedily by a hash of 3 bytes and coded as normal matches, repeated
+ * distances are not used, and no end marker is written. The output is a
+ * valid LZMA stream for any decoder, only its ratio is worse than 7-Zip's.
+ */
+class SevenZLzmaEncoder {
+public:
+    /**
+     * @param dictSize (matches are not farther)
+     */
+    SevenZLzmaEncoder(uint32_t dictSize = 1 << 20);
+    /**
+     * Appends the packed stream of the data to out
+     * @param data, size, out
+     */
+    void encode(const uint8_t *data, size_t size, std::vector<uint8_t> &out);
+    /**
+     * 5 bytes of coder properties as in the 7z header
+     * @param props
+     */
+    void properties(uint8_t *props) const;
+
+private:
+    uint32_t dictSize;
+};
+
+/**
+ * LZMA2 stream of uncompressed chunks with an end marker. Chunks are copied
+ * by the decoder, so it suits big streams which are made fast. With resets
+ * every chunk resets the dictionary and is an independent run, as the
+ * blocks of the multi-threaded 7-Zip encoder are.
+ * @param data, size, out, resets
+ */
+void sevenZLzma2Stored(const uint8_t *data, size_t size, std::vector<uint8_t> &out, bool resets = false);
+
+#endif	/* SevenZLZMAENC_H */
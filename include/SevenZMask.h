@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2016 Vojtech Vecera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef SevenZMASK_H
+#define	SevenZMASK_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define MASK_CHARSETS 4		// custom charsets ?1 to ?4
+
+/**
+ * Candidates of a mask like ?u?l?l?l?d?d. A position is a literal byte or
+ * a charset: ?l a-z, ?u A-Z, ?d 0-9, ?s space and punctuation, ?a all of
+ * them, ?1 to ?4 custom charsets and ?? the question mark. Custom charsets
+ * may use the built-in ones, e.g. ?l?d. All candidates have the same
+ * length, candidate i is the i-th in the order where the last position
+ * changes fastest.
+ */
+class SevenZMask {
+public:
+    /**
+     * Throws SevenZError when the mask is not valid or has more than 2^64
+     * candidates
+     * @param mask, custom (up to MASK_CHARSETS charsets)
+     */
+    SevenZMask(const std::string &mask, const std::vector<std::string> &custom = std::vector<std::string>());
+    /**
+     * Number of candidates
+     */
+    uint64_t size() const;
+    /**
+     * Bytes of every candidate
+     */
+    size_t length() const;
+    /**
+     * Mask and custom charsets as one text, identifies the candidates
+     */
+    std::string describe() const;
+    /**
+     * Writes candidates first to first + count - 1 one after another
+     * @param first, count, out (count * length() bytes)
+     */
+    void generate(uint64_t first, size_t count, uint8_t *out) const;
+
+private:
+    /**
+     * Expands the built-in charsets in the text
+     * @param text, custom (NULL inside a custom charset)
+     */
+    static std::string expand(const std::string &text, const std::vector<std::string> *custom);
+
+    std::string mask;
+    std::vector<std::string> custom;
+    std::vector<std::string> positions;	    // charset of every position
+    uint64_t total;
+};
+
+#endif	/* SevenZMASK_H */
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2016 Vojtech Vecera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef SevenZPERF_H
+#define	SevenZPERF_H
+
+#include <cstdint>
+#include <string>
+
+enum SevenZPerfEvent {
+    PerfCycles,
+    PerfInstructions,
+    PerfBranchMisses,
+    PerfLlcMisses,	// last level cache misses
+    PerfPageFaults,	// software event, it shows reads of mapped archives
+    NumPerfEvents
+};
+
+/**
+ * Performance counters of the calling thread opened by perf_event_open()
+ * as one group, so all of them are read by one read(). Only the user space
+ * is counted, which perf_event_paranoid up to 2 allows. Events which can't
+ * be opened (no PMU in a virtual machine, paranoid 3) are left out, the
+ * others still count.
+ */
+class SevenZPerfCounters {
+public:
+    SevenZPerfCounters();
+    ~SevenZPerfCounters();
+    /**
+     * Opens and starts the counters for the calling thread
+     * @return false when no counter can be opened, error() tells why
+     */
+    bool open();
+    bool available(SevenZPerfEvent event) const;
+    /**
+     * Bit (1 << event) of every available event
+     */
+    unsigned events() const;
+    /**
+     * Current values, scaled up when the kernel multiplexed the counters
+     * @param values NumPerfEvents, unavailable events are 0
+     */
+    void read(uint64_t *values) const;
+    const std::string& error() const;
+    static const char* eventName(SevenZPerfEvent event);
+
+private:
+    SevenZPerfCounters(const SevenZPerfCounters&);
+    SevenZPerfCounters& operator=(const SevenZPerfCounters&);
+
+    int fds[NumPerfEvents];	// -1 when not available, fds[leader] leads the group
+    int leader;
+    int slot[NumPerfEvents];	// position in the group read, -1 when not available
+    unsigned count;
+    std::string message;
+};
+
+#endif	/* SevenZPERF_H */
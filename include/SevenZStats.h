@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2016 Vojtech Vecera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef SevenZSTATS_H
+#define	SevenZSTATS_H
+
+#include <cstdint>
+#include <string>
+#include <iostream>
+
+#include "SevenZPerf.h"
+
+/**
+ * Parts of the work on one archive which are timed separately
+ */
+enum SevenZPhase {
+    OpenPhase,		// open(), fstat(), mmap() and close() of the archive
+    IoPhase,		// reads of the headers and packed streams
+    CrcPhase,		// CRCs of the headers and packed streams
+    ParsePhase,		// header parsing, all the rest of process()
+    DecodePhase,	// LZMA and LZMA2 decoding of the header
+    TestPhase,		// decoding of the folders by -t
+    OutputPhase,	// printInfo() or printHash()
+    NumPhases
+};
+
+/**
+ * Counters of one archive or sums of a batch. Phase times are exclusive,
+ * a nested phase is not counted in the phase around it, so they add up to
+ * the time spent in all phases.
+ */
+struct SevenZStats {
+    uint64_t archives = 0;
+    uint64_t failed = 0;
+    uint64_t totalNs = 0;	// from open() to close()
+    uint64_t phaseNs[NumPhases] = {};
+    uint64_t bytesRead = 0;	// mapped or read by pread()
+    uint64_t ioRequests = 0;	// spans of the archive which were read
+    uint64_t syscalls = 0;	// open, fstat, mmap, pread, munmap and close
+    uint64_t bytesDecoded = 0;	// decoded header read by the parser
+    uint64_t allocations = 0;	// arena allocations, LZMA dictionaries included
+    uint64_t memoryBytes = 0;	// held by the arena at the end, the most in a batch
+    const char *kind = "unknown";	// header of the archive: raw, compressed, encrypted or mixed
+    unsigned perfEvents = 0;	// bits of the counted SevenZPerfEvent, 0 without counters
+    uint64_t perf[NumPhases][NumPerfEvents] = {};	// events of the thread in every phase
+
+    void add(const SevenZStats &other);
+    /**
+     * One JSON object with all counters, phases in nanoseconds
+     * @param out
+     */
+    void printJson(std::ostream &out) const;
+    /**
+     * Table of time, IPC and miss rates of every phase which ran
+     * @param out, label (first column, e.g. class of the archives)
+     */
+    void printPerf(std::ostream &out, const std::string &label) const;
+    /**
+     * Column names of printPerf()
+     * @param out
+     */
+    static void printPerfHeader(std::ostream &out);
+    static const char* phaseName(SevenZPhase phase);
+};
+
+/**
+ * Running phase of one SevenZFormat, the time since the last change of the
+ * phase is charged to the phase which was running
+ */
+class SevenZPhaseClock {
+public:
+    SevenZPhaseClock(SevenZStats &stats);
+    /**
+     * Counters read at every change of the phase, opened in the thread
+     * which uses the clock
+     * @param counters (NULL = time only)
+     */
+    void setCounters(const SevenZPerfCounters *counters);
+    /**
+     * @param phase
+     * @return phase which was running, for leave()
+     */
+    int enter(SevenZPhase phase);
+    /**
+     * @param previous returned by enter()
+     */
+    void leave(int previous);
+    /**
+     * Monotonic time in nanoseconds
+     */
+    static uint64_t now();
+
+private:
+    /**
+     * Adds the events since the last change of the phase to the current one
+     */
+    void count();
+
+    SevenZStats &stats;
+    int current;	// -1 = no phase
+    uint64_t mark;
+    const SevenZPerfCounters *counters;
+    uint64_t last[NumPerfEvents];	// counter values at the mark
+};
+
+/**
+ * Phase for the lifetime of the object, nothing is measured without a clock
+ */
+class SevenZPhaseTimer {
+public:
+    SevenZPhaseTimer(SevenZPhaseClock *clock, SevenZPhase phase): clock(clock) {
+	if (clock != NULL)
+	    previous = clock->enter(phase);
+    }
+    ~SevenZPhaseTimer(){
+	if (clock != NULL)
+	    clock->leave(previous);
+    }
+
+private:
+    SevenZPhaseTimer(const SevenZPhaseTimer&);
+    SevenZPhaseTimer& operator=(const SevenZPhaseTimer&);
+
+    SevenZPhaseClock *clock;
+    int previous;
+};
+
+/**
+ * Writes the text as a quoted JSON string
+ * @param out, text
+ */
+void sevenZJsonString(std::ostream &out, const std::string &text);
+
+#endif	/* SevenZSTATS_H */
@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2016 Vojtech Vecera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef SevenZSTREAM_H
+#define	SevenZSTREAM_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "LzmaDec.h"
+#include "Lzma2Dec.h"
+
+/**
+ * Read-only view of bytes owned by someone else (mapping, decoded buffer)
+ */
+struct SevenZSpan{
+    const uint8_t *data;
+    uint64_t size;
+};
+
+/**
+ * Archive opened for reading, its data are accessed only through span()
+ */
+class SevenZFile {
+public:
+    SevenZFile(): reads(0), bytesRead(0), syscalls(0){}
+    virtual ~SevenZFile(){}
+    /**
+     * Opens the file, previously opened file is closed
+     * @param path
+     * @return false if the file can't be opened
+     */
+    virtual bool open(const char *path) = 0;
+    virtual void close() = 0;
+    virtual bool is_open() const = 0;
+    virtual uint64_t size() const = 0;
+    /**
+     * Returns view of the file valid until close(), throws SevenZError
+     * when it is out of the file
+     * @param pos, size
+     * @return
+     */
+    virtual SevenZSpan span(uint64_t pos, uint64_t size) = 0;
+
+    uint64_t reads;	    // I/O requests issued since open()
+    uint64_t bytesRead;
+    uint64_t syscalls;	    // since open(), close() included
+
+protected:
+    void checkRange(uint64_t pos, uint64_t size) const;
+};
+
+/**
+ * Whole archive mapped read-only into the memory, span() does not copy
+ */
+class SevenZMappedFile: public SevenZFile {
+public:
+    SevenZMappedFile();
+    ~SevenZMappedFile();
+    bool open(const char *path);
+    void close();
+    bool is_open() const;
+    uint64_t size() const;
+    SevenZSpan span(uint64_t pos, uint64_t size);
+
+private:
+    SevenZMappedFile(const SevenZMappedFile&);
+    SevenZMappedFile& operator=(const SevenZMappedFile&);
+
+    int fd;
+    const uint8_t *base;
+    uint64_t length;
+};
+
+/**
+ * Archive read by positioned reads. Every span() is one pread() unless it
+ * lies in a range which was already read, so a caller can read a bigger
+ * window once and take smaller spans from it later.
+ */
+class SevenZPreadFile: public SevenZFile {
+public:
+    SevenZPreadFile();
+    ~SevenZPreadFile();
+    bool open(const char *path);
+    void close();
+    bool is_open() const;
+    uint64_t size() const;
+    SevenZSpan span(uint64_t pos, uint64_t size);
+
+private:
+    SevenZPreadFile(const SevenZPreadFile&);
+    SevenZPreadFile& operator=(const SevenZPreadFile&);
+
+    struct Buffer {
+	uint64_t pos;
+	std::vector<uint8_t> data;
+    };
+    int fd;
+    uint64_t length;
+    std::vector<Buffer*> buffers;
+};
+
+/**
+ * Producer of data which are not in the memory at once (e.g. decoded header)
+ */
+class SevenZSource {
+public:
+    virtual ~SevenZSource(){}
+    /**
+     * Writes next data to the buffer
+     * @param buffer, size
+     * @return number of written bytes, 0 at the end of data
+     */
+    virtual uint64_t fill(uint8_t *buffer, uint64_t size) = 0;
+    /**
+     * Next data in the memory of the source, without a copy. The view is
+     * valid until the next call, calls of fill() and view() can be mixed.
+     * @param size (the most)
+     * @return empty span at the end of data
+     */
+    virtual SevenZSpan view(uint64_t size) = 0;
+};
+
+/**
+ * LZMA or LZMA2 decoder of packed stream working in the Dictionary Interface,
+ * memory is bounded by the dictionary size, not by the unpacked size. The
+ * dictionary is decoded by segments of LZMA_SEGMENT bytes, view() returns
+ * them right from the dictionary while they are in the cache, so a CRC or a
+ * filter reading them adds no copy and almost no memory traffic.
+ */
+class SevenZLzmaSource: public SevenZSource {
+public:
+    /**
+     * LZMA2 has one property byte, LZMA has five
+     * @param packed, props, propsSize, unpackSize, alloc, lzma2
+     */
+    SevenZLzmaSource(SevenZSpan packed, const uint8_t *props, unsigned propsSize,
+	    uint64_t unpackSize, ISzAlloc *alloc, bool lzma2 = false);
+    ~SevenZLzmaSource();
+    uint64_t fill(uint8_t *buffer, uint64_t size);
+    SevenZSpan view(uint64_t size);
+    /**
+     * True when whole unpackSize was decoded
+     */
+    bool finished() const;
+
+private:
+    SevenZLzmaSource(const SevenZLzmaSource&);
+    SevenZLzmaSource& operator=(const SevenZLzmaSource&);
+    /**
+     * Decodes the next segment, everything decoded before was returned
+     * @return false at the end of data
+     */
+    bool decode();
+
+    CLzma2Dec dec2;	    // LZMA works only with its inner decoder
+    CLzmaDec &dec;
+    bool lzma2;
+    ISzAlloc *alloc;
+    SevenZSpan packed;
+    uint64_t inPos;
+    uint64_t outLeft;
+    SizeT dicRead;	// decoded data in dic which were not returned yet start here
+};
+
+/**
+ * Forward-only cursor for header parsing. It reads directly from the span,
+ * with source it reads through a window which is refilled when needed.
+ * Every read checks bounds only once, the common case is pointer arithmetic.
+ */
+class SevenZCursor {
+public:
+    SevenZCursor();
+    SevenZCursor(SevenZSpan span);
+    /**
+     * @param source, size (of all data of the source, UINT64_MAX when not known), windowSize
+     */
+    SevenZCursor(SevenZSource *source, uint64_t size = UINT64_MAX, uint64_t windowSize = 1 << 16);
+
+    uint8_t byte(){
+	if (pos == span.size)
+	    ensure(1);
+	return span.data[pos++];
+    }
+    /**
+     * Converts number from 7z proprietary encoding to standard UINT64.
+     * Count of leading ones in the first byte is the count of following
+     * little-endian bytes, the rest of the first byte is the highest part.
+     * @return
+     */
+    uint64_t number(){
+	if (span.size - pos < 9)
+	    return numberSlow();	// one 64-bit load would cross the end
+	const uint8_t *p = span.data + pos;
+	unsigned first = p[0];
+	unsigned extra = __builtin_clz(~(first << 24));	// leading ones, never clz(0)
+	uint64_t value;
+	memcpy(&value, p + 1, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	value = __builtin_bswap64(value);
+#endif
+	pos += 1 + extra;
+	if (extra == 8)
+	    return value;
+	value &= (1ULL << (8 * extra)) - 1;
+	return value | (uint64_t(first & (0x7F >> extra)) << (8 * extra));
+    }
+    uint32_t uint32(){
+	uint32_t value;
+	bytes(&value, 4);
+	return value;
+    }
+    uint64_t uint64(){
+	uint64_t value;
+	bytes(&value, 8);
+	return value;
+    }
+    /**
+     * Copies size bytes to the buffer and moves forward
+     * @param buffer, size
+     */
+    void bytes(void *buffer, uint64_t size){
+	if (size <= span.size - pos){
+	    memcpy(buffer, span.data + pos, size);
+	    pos += size;
+	} else
+	    bytesSlow(buffer, size);
+    }
+    void skip(uint64_t size);
+    uint64_t tell() const;
+    /**
+     * Bytes after the position, counts read from the data can't be bigger
+     */
+    uint64_t remaining() const;
+
+private:
+    /**
+     * Makes at least size bytes available after the position
+     * @param size, must fit into the window
+     */
+    void ensure(uint64_t size);
+    uint64_t numberSlow();
+    void bytesSlow(void *buffer, uint64_t size);
+    /**
+     * Moves rest of the window to its start and gets next data from source
+     * @return false when there are no more data
+     */
+    bool refill();
+    void endOfData(uint64_t size) const;
+
+    SevenZSpan span;
+    uint64_t pos;
+    SevenZSource *source;
+    std::vector<uint8_t> window;
+    uint64_t base;	// position of span in the whole data
+    uint64_t total;	// size of the whole data
+};
+
+#endif	/* SevenZSTREAM_H */
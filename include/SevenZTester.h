@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2016 Vojtech Vecera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef SevenZTESTER_H
+#define	SevenZTESTER_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "SevenZFormat.h"
+
+/**
+ * Outcome of the test of one folder
+ */
+struct SevenZFolderResult {
+    enum Status { NotTested, Ok, Failed, Skipped };
+    Status status = NotTested;
+    std::string method;		// coders from the packed stream to the output
+    std::string message;	// why it failed or was skipped
+    uint64_t size = 0;		// bytes decoded
+    uint64_t streams = 0;	// substreams checked
+    double seconds = 0;
+};
+
+/**
+ * Integrity test of an archive like "7z t". Every folder is decoded by its
+ * chain of coders and the CRC of every unpacked stream is checked, the
+ * decoded data are dropped. Folders do not depend on each other, so they
+ * are decoded on a pool of threads, the biggest first. Copy, LZMA, LZMA2,
+ * BCJ (x86) and Delta are supported, encrypted folders are skipped.
+ */
+class SevenZTester {
+public:
+    SevenZTester();
+    /**
+     * @param threads (1 by default)
+     */
+    void setThreads(unsigned threads);
+    /**
+     * Folders not started yet are left out after the first failure
+     * @param stop
+     */
+    void setStopOnError(bool stop);
+    /**
+     * Tests all folders of the processed archive
+     * @param archive
+     * @return number of failed folders
+     */
+    size_t test(SevenZFormat &archive);
+    const std::vector<SevenZFolderResult>& getResults() const;
+    /**
+     * One line per folder and the summary
+     * @param out
+     */
+    void print(std::ostream &out) const;
+
+private:
+    void worker();
+    /**
+     * Decodes the folder and checks its streams
+     * @param folder
+     */
+    void testFolder(uint64_t folder);
+    /**
+     * Sources of the coders, the last one gives the folder output
+     * @param folder, chain, result
+     * @return false when the folder can't be decoded (result says why)
+     */
+    bool buildChain(uint64_t folder, std::vector<std::unique_ptr<SevenZSource>> &chain,
+	    SevenZFolderResult &result);
+
+    unsigned threads;
+    bool stopOnError;
+    SevenZFormat *archive;
+    const SevenZInitData *data;
+    std::vector<uint64_t> packStart;	// first packed stream of every folder
+    std::vector<uint64_t> packPos;	// position of every packed stream
+    std::vector<uint64_t> streamStart;	// first substream of every folder
+    std::vector<uint64_t> order;	// folders, the biggest first
+    std::vector<SevenZFolderResult> results;
+    std::atomic<size_t> next;
+    std::atomic<size_t> failed;
+    std::mutex ioLock;		// readPacked() is not thread safe
+    double seconds;
+};
+
+#endif	/* SevenZTESTER_H */
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2016 Vojtech Vecera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef SevenZTRACE_H
+#define	SevenZTRACE_H
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Timeline of spans in the Chrome trace event format, for chrome://tracing
+ * or Perfetto. Every thread records its spans into its own buffer without
+ * locks, the buffers are merged only when the trace is written. Nothing is
+ * recorded until sevenZTraceStart().
+ */
+
+/**
+ * Starts recording in all threads
+ */
+void sevenZTraceStart();
+/**
+ * True after sevenZTraceStart()
+ */
+bool sevenZTraceActive();
+/**
+ * Writes spans of all threads as JSON, the recording threads must be done
+ * @param path
+ * @return false when the file can't be written
+ */
+bool sevenZTraceWrite(const std::string &path);
+
+/**
+ * Span for the lifetime of the object, it is recorded when it ends
+ */
+class SevenZTraceSpan {
+public:
+    /**
+     * @param name (must outlive the trace, usually a literal), arg (path
+     * of the archive shown with the span, NULL = none)
+     */
+    SevenZTraceSpan(const char *name, const char *arg = NULL);
+    ~SevenZTraceSpan();
+
+private:
+    SevenZTraceSpan(const SevenZTraceSpan&);
+    SevenZTraceSpan& operator=(const SevenZTraceSpan&);
+
+    const char *name;	// NULL when the trace is off
+    const char *arg;
+    uint64_t start;
+};
+
+#endif	/* SevenZTRACE_H */
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2016 Vojtech Vecera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef SevenZVERIFIER_H
+#define	SevenZVERIFIER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "SevenZFormat.h"
+#include "SevenZAes.h"
+
+#define VERIFY_BLOCKS 2		// AES blocks decrypted per candidate
+#define VERIFY_DECODED 3	// header bytes checked after the partial decode
+
+/**
+ * Early reject of candidate keys of an encrypted header (EncHeader). The
+ * plain text is LZMA, LZMA2 or stored data of a header, so the first
+ * decrypted bytes are very rigid: the range coder starts with 0, LZMA2
+ * starts with a chunk resetting the dictionary, and the decoded header
+ * starts with kHeader followed by the ID of a header part. Only the first
+ * VERIFY_BLOCKS blocks are decrypted and at most VERIFY_DECODED bytes are
+ * decoded, so a wrong key costs 32 bytes of AES instead of the whole header
+ * and its CRC. Candidates passing the check are possible, not certain,
+ * confirm() decodes the whole header with them. The verifier keeps its own
+ * copy of the packed header, the archive can be closed once it is made.
+ */
+class SevenZHeaderVerifier {
+public:
+    /**
+     * Throws SevenZError when the header is not encrypted, its coders are not
+     * supported or the packed header was not loaded (setCrackData(true))
+     * @param data
+     */
+    SevenZHeaderVerifier(const SevenZInitData &data);
+    ~SevenZHeaderVerifier();
+    /**
+     * Verifier of the same header for another thread, with its own decoder
+     * @param orig
+     */
+    SevenZHeaderVerifier(const SevenZHeaderVerifier &orig);
+    SevenZHeaderVerifier& operator=(const SevenZHeaderVerifier&) = delete;
+    /**
+     * Key derivation parameters of the header
+     */
+    const SevenZAesProps& getProps() const;
+    /**
+     * @param keys count * AES_KEY_SIZE, count, passed (count flags, 1 = possible key)
+     * @return number of passed keys
+     */
+    size_t check(const uint8_t *keys, size_t count, uint8_t *passed);
+    /**
+     * Decrypts and decodes the whole header and checks its CRC, for keys
+     * which passed check()
+     * @param key
+     */
+    bool confirm(const uint8_t *key);
+
+private:
+    enum Method { Copy, Lzma, Lzma2 };
+
+    /**
+     * Structure of the decrypted start of the stream
+     * @param plain VERIFY_BLOCKS blocks (or the whole shorter stream)
+     */
+    bool checkPlain(const uint8_t *plain);
+    /**
+     * Decodes up to VERIFY_DECODED bytes of range coded data
+     * @param src, size, props (5 bytes of LZMA properties)
+     * @return false when the data are not valid LZMA
+     */
+    bool checkLzma(const uint8_t *src, size_t size, const uint8_t *props);
+    /**
+     * First bytes of the decoded header, shorter prefix is checked as far as it goes
+     * @param hdr, size
+     */
+    bool checkHeader(const uint8_t *hdr, size_t size) const;
+    /**
+     * Probabilities of the partial decoder, throws when out of memory
+     */
+    void allocateDecoder();
+
+    Method method;
+    SevenZAesProps props;
+    std::vector<uint8_t> packed;	// encrypted header
+    size_t plainSize;		// bytes decrypted per candidate
+    uint64_t packedSize;	// of the compressed header inside AES
+    uint64_t headerSize;	// of the decoded header
+    bool crcDefined;
+    uint32_t crc;		// of the decoded header
+    uint8_t lzmaProps[LZMA_PROPS_SIZE];
+    uint8_t lzma2Prop;
+    CLzmaDec lzma;		// probabilities only, the dictionary is dict
+    uint8_t dict[VERIFY_DECODED];
+    SevenZAesDecryptor aes;
+    std::vector<uint8_t> plain;
+    std::vector<uint8_t> header;	// decoded by confirm()
+};
+
+#endif	/* SevenZVERIFIER_H */
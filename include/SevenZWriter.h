@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2016 Vojtech Vecera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef SevenZWRITER_H
+#define	SevenZWRITER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/**
+ * Writer of 7z archives for benchmarks and fixtures. Every folder has one
+ * coder and one packed stream, its files are solid in it. Copy folders are
+ * written through to the file, so their size is not bounded by the memory;
+ * LZMA folders are encoded by SevenZLzmaEncoder when they are finished.
+ * The header is written raw, LZMA-compressed, LZMA-compressed and
+ * encrypted by 7zAES, or as LZMA2 chunks which are independent runs. The
+ * same calls give the same bytes.
+ */
+class SevenZWriter {
+public:
+    enum Method {
+	CopyMethod,
+	LzmaMethod
+    };
+    enum HeaderType {
+	RawHeaderType,
+	LzmaHeaderType,
+	AesHeaderType,
+	Lzma2HeaderType		// stored chunks, each of them resets the dictionary
+    };
+
+    SevenZWriter();
+    ~SevenZWriter();
+    /**
+     * Creates the file and writes a blank start header
+     * @param path
+     * @return false when the file can't be created
+     */
+    bool open(const std::string &path);
+    /**
+     * @param type, password, numCyclesPower (for AesHeaderType)
+     */
+    void setHeader(HeaderType type, const std::string &password = "", unsigned numCyclesPower = 19);
+    /**
+     * CRCs of the folders go to UnpackInfo, as older writers do, and
+     * SubStreamsInfo is left out when every folder has one file
+     * @param enable
+     */
+    void setFolderCrcs(bool enable);
+    /**
+     * Starts a new folder, the previous one is finished
+     * @param method
+     */
+    void beginFolder(Method method);
+    /**
+     * Starts a new file in the current folder, its data are given by
+     * append(). Files without data are empty files outside of the folders,
+     * or directories when attrib has FILE_ATTRIBUTE_DIRECTORY (0x10).
+     * @param name (UTF-8), mtime (FILETIME), attrib
+     */
+    void addFile(const std::string &name, uint64_t mtime = 0, uint32_t attrib = 0x20);
+    /**
+     * Appends data to the last file, throws SevenZError without a folder
+     * @param data, size
+     */
+    void append(const uint8_t *data, size_t size);
+    /**
+     * Writes the header and the start header, throws SevenZError when the
+     * file can't be written
+     */
+    void close();
+
+private:
+    SevenZWriter(const SevenZWriter&);
+    SevenZWriter& operator=(const SevenZWriter&);
+
+    struct Folder {
+	Method method;
+	uint64_t packSize;
+	uint64_t unpackSize;
+	uint32_t crc;		// of the unpacked data
+	uint8_t props[5];
+	uint64_t numFiles;
+    };
+    struct File {
+	std::string name;
+	uint64_t size;
+	uint32_t crc;
+	uint64_t mtime;
+	uint32_t attrib;
+	bool hasStream;
+    };
+
+    void endFolder();
+    void writeData(const uint8_t *data, size_t size);
+    /**
+     * Header (0x01) with the streams and files info
+     * @param out
+     */
+    void buildHeader(std::vector<uint8_t> &out) const;
+
+    FILE *file;
+    std::string path;
+    HeaderType headerType;
+    std::string password;
+    unsigned numCyclesPower;
+    bool folderCrcs;
+    std::vector<Folder> folders;
+    std::vector<File> files;
+    std::vector<uint8_t> pending;	// unpacked data of the LZMA folder
+    bool inFolder;
+    uint64_t packPos;		// end of the packed streams after the start header
+};
+
+#endif	/* SevenZWRITER_H */
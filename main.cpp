@@ -4,44 +4,443 @@
 #include <fstream>
 #include <cstring>
 #include <cstdlib>
+#include <csignal>
+#include <cstdio>
+#include <thread>
+#include <memory>
+
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "SevenZFormat.h"
+#include "SevenZArchiveBench.h"
+#include "SevenZBatch.h"
+#include "SevenZCrc.h"
+#include "SevenZKdf.h"
+#include "SevenZCracker.h"
+#include "SevenZTester.h"
+#include "SevenZTrace.h"
+
+struct Parameters {
+    std::vector<std::string> paths;
+    bool batch = false;		// more than one archive or explicit batch options
+    bool fromStdin = false;	// list of archives on stdin
+    char delim = '\n';
+    unsigned threads = 0;	// 0 = number of cores
+    SevenZIOType io = MappedIO;
+    bool hash = false;		// print $7z$ lines instead of the information
+    uint64_t truncate = 0;	// 0 = whole encrypted data in the hash
+    int kdfBench = -1;		// NumCyclesPower of the KDF benchmark, -1 = no benchmark
+    bool crcBench = false;
+    unsigned bench = 0;		// runs of the archive benchmark, 0 = no benchmark
+    bool verifyCrc = false;	// check CRCs of the packed streams and decoded headers
+    bool test = false;		// decode all folders and check their CRCs
+    bool failFast = false;	// stop the test at the first failure
+    std::string wordlist;	// attack the archives with these passwords
+    std::string mask;		// or with the candidates of this mask
+    std::vector<std::string> charsets;	// custom charsets ?1 to ?4 of the mask
+    std::string keyStore;	// file keeping the derived keys between runs
+    unsigned shard = 0;		// this process tries chunks with number % shards == shard
+    unsigned shards = 1;
+    std::string checkpoint;	// search state for a restarted run
+    bool stats = false;		// print counters of the archives as JSON
+    std::string statsPath;	// JSON goes to this file instead of stderr
+    std::ostream *statsOut = &std::cerr;
+    std::string trace;		// write a timeline of the run to this file
+    bool perf = false;		// count hardware events of the phases
+};
 
 void PrintHelp() {
     std::cout << "Usage: ./7z_analyzer <.7z archive>" << std::endl;
+    std::cout << "       ./7z_analyzer [-j threads] [-0] <archive | directory | ->..." << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --io=mmap|pread  map archives (default) or read only the headers by pread" << std::endl;
+    std::cout << "  --hash           print $7z$ hash of the encrypted data for crackers" << std::endl;
+    std::cout << "  --truncate[=N]   keep only first N bytes (default 4096) of bigger data in the hash" << std::endl;
+    std::cout << "  --verify-crc     check CRCs of the packed streams and of the decoded header" << std::endl;
+    std::cout << "  -t, --test       decode all data and check their CRCs like 7z t" << std::endl;
+    std::cout << "  --fail-fast      stop the test at the first damaged folder or archive" << std::endl;
+    std::cout << "  --wordlist=FILE  try passwords of the file on archives with encrypted headers" << std::endl;
+    std::cout << "  --key-cache=FILE  keep the derived keys in FILE for the next runs" << std::endl;
+    std::cout << "  --mask=MASK      try candidates of the mask (?l?u?d?s?a, ?1-?4 custom charsets)" << std::endl;
+    std::cout << "  --charsetN=SET   custom charset ?N of the mask, N from 1 to 4" << std::endl;
+    std::cout << "  --shard=I/N      try only the I-th of N parts of the candidates (I from 0)" << std::endl;
+    std::cout << "  --checkpoint=FILE  save the search state to FILE, resume from it when it exists" << std::endl;
+    std::cout << "  --stats=json[:FILE]  print time of the phases, I/O and allocations per archive to stderr or FILE" << std::endl;
+    std::cout << "  --perf           count cycles, instructions, branch and cache misses of the phases" << std::endl;
+    std::cout << "  --trace=FILE     write a timeline of the archives for chrome://tracing or Perfetto" << std::endl;
+    std::cout << "  --kdf-bench[=N]  measure 7zAES key derivation kernels with 2^N rounds (default 19)" << std::endl;
+    std::cout << "  --crc-bench      measure CRC-32 kernels in GB/s" << std::endl;
+    std::cout << "  --bench[=N]      time N runs (default 20) of the analysis and decoding of the archives" << std::endl;
+    std::cout << "  -j N   analyse archives and try passwords on N threads (default: number of cores)" << std::endl;
+    std::cout << "  -      read list of archives from stdin, one per line" << std::endl;
+    std::cout << "  -0     list on stdin is NUL separated (find -print0)" << std::endl;
+    std::cout << "Directories are searched recursively for *.7z files." << std::endl;
 };
 
-int CheckParameters(int argc, char *argv[], std::ifstream& in){
+int CheckParameters(int argc, char *argv[], Parameters& params){
 
-    if (argc != 2) {
+    if (argc < 2) {
 	PrintHelp();
 	return 1;
-    } else {
-	if ((strcmp(argv[1], "--help") == 0) || (strcmp(argv[1], "-h") == 0)) {
+    }
+    for (int i = 1; i < argc; i++) {
+	if ((strcmp(argv[i], "--help") == 0) || (strcmp(argv[i], "-h") == 0)) {
 	    PrintHelp();
 	    exit(0);
-	}
-	else
-	    in.open(argv[1]);
+	} else if (strcmp(argv[i], "-j") == 0) {
+	    if (++i == argc || atoi(argv[i]) <= 0) {
+		std::cerr << "ERROR: -j needs a positive number of threads" << std::endl;
+		return 1;
+	    }
+	    params.threads = atoi(argv[i]);
+	    params.batch = true;
+	} else if (strncmp(argv[i], "--io=", 5) == 0) {
+	    if (strcmp(argv[i] + 5, "mmap") == 0)
+		params.io = MappedIO;
+	    else if (strcmp(argv[i] + 5, "pread") == 0)
+		params.io = PreadIO;
+	    else {
+		std::cerr << "ERROR: Unknown I/O type " << argv[i] + 5 << std::endl;
+		return 1;
+	    }
+	} else if (strcmp(argv[i], "--hash") == 0) {
+	    params.hash = true;
+	} else if (strcmp(argv[i], "--truncate") == 0) {
+	    params.truncate = 4096;
+	} else if (strncmp(argv[i], "--truncate=", 11) == 0) {
+	    if (atoll(argv[i] + 11) <= 0) {
+		std::cerr << "ERROR: --truncate needs a positive number of bytes" << std::endl;
+		return 1;
+	    }
+	    params.truncate = atoll(argv[i] + 11);
+	} else if (strcmp(argv[i], "--verify-crc") == 0) {
+	    params.verifyCrc = true;
+	} else if (strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--test") == 0) {
+	    params.test = true;
+	} else if (strcmp(argv[i], "--fail-fast") == 0) {
+	    params.failFast = true;
+	} else if (strncmp(argv[i], "--wordlist=", 11) == 0) {
+	    params.wordlist = argv[i] + 11;
+	    params.batch = true;
+	} else if (strncmp(argv[i], "--mask=", 7) == 0) {
+	    params.mask = argv[i] + 7;
+	    params.batch = true;
+	} else if (strncmp(argv[i], "--charset", 9) == 0 && argv[i][9] >= '1' &&
+		argv[i][9] < '1' + MASK_CHARSETS && argv[i][10] == '=') {
+	    size_t n = argv[i][9] - '0';
+	    if (params.charsets.size() < n)
+		params.charsets.resize(n);
+	    params.charsets[n - 1] = argv[i] + 11;
+	} else if (strncmp(argv[i], "--key-cache", 11) == 0 && (argv[i][11] == '\0' || argv[i][11] == '=')) {
+	    if (argv[i][11] == '\0' || argv[i][12] == '\0') {
+		std::cerr << "ERROR: --key-cache needs a FILE" << std::endl;
+		return 1;
+	    }
+	    params.keyStore = argv[i] + 12;
+	} else if (strncmp(argv[i], "--shard=", 8) == 0) {
+	    unsigned index, count;
+	    char end;
+	    if (sscanf(argv[i] + 8, "%u/%u%c", &index, &count, &end) != 2 || count == 0 || index >= count) {
+		std::cerr << "ERROR: --shard needs I/N with 0 <= I < N" << std::endl;
+		return 1;
+	    }
+	    params.shard = index;
+	    params.shards = count;
+	} else if (strncmp(argv[i], "--checkpoint=", 13) == 0) {
+	    params.checkpoint = argv[i] + 13;
+	} else if (strncmp(argv[i], "--stats=", 8) == 0) {
+	    const char *format = argv[i] + 8;
+	    if (strncmp(format, "json:", 5) == 0 && format[5] != '\0') {
+		params.statsPath = format + 5;
+	    } else if (strcmp(format, "json") != 0) {
+		std::cerr << "ERROR: Unknown stats format " << format << std::endl;
+		return 1;
+	    }
+	    params.stats = true;
+	} else if (strcmp(argv[i], "--perf") == 0) {
+	    params.perf = true;
+	} else if (strncmp(argv[i], "--trace=", 8) == 0) {
+	    params.trace = argv[i] + 8;
+	} else if (strcmp(argv[i], "--kdf-bench") == 0) {
+	    params.kdfBench = 19;
+	} else if (strncmp(argv[i], "--kdf-bench=", 12) == 0) {
+	    int cycles = atoi(argv[i] + 12);
+	    if (cycles < 0 || cycles > KDF_CYCLES_MAX) {
+		std::cerr << "ERROR: --kdf-bench needs NumCyclesPower from 0 to " << KDF_CYCLES_MAX << std::endl;
+		return 1;
+	    }
+	    params.kdfBench = cycles;
+	} else if (strcmp(argv[i], "--crc-bench") == 0) {
+	    params.crcBench = true;
+	} else if (strcmp(argv[i], "--bench") == 0) {
+	    params.bench = 20;
+	} else if (strncmp(argv[i], "--bench=", 8) == 0) {
+	    if (atoi(argv[i] + 8) <= 0) {
+		std::cerr << "ERROR: --bench needs a positive number of runs" << std::endl;
+		return 1;
+	    }
+	    params.bench = atoi(argv[i] + 8);
+	} else if (strcmp(argv[i], "-0") == 0) {
+	    params.delim = '\0';
+	    params.fromStdin = true;
+	} else if (strcmp(argv[i], "-") == 0) {
+	    params.fromStdin = true;
+	} else
+	    params.paths.push_back(argv[i]);
     }
-    if (!in.is_open()) {
-	std::cerr << "ERROR: Couldn't open the archive" << std::endl;
-	return 2;
-    } else
+
+    if (params.kdfBench >= 0 || params.crcBench)
 	return 0;
+    struct stat st;
+    if (params.fromStdin || params.paths.size() != 1 ||
+	    (stat(params.paths[0].c_str(), &st) == 0 && S_ISDIR(st.st_mode)))
+	params.batch = true;
+    return 0;
 }
 
-int main (int argc, char *argv[]) {
-    
+int AnalyseArchive(SevenZFormat& archive, const std::string& path, Parameters& params) {
+
+    if (!archive.open(path.c_str())) {
+	std::cerr << "ERROR: Couldn't open the archive" << std::endl;
+	return 1;
+    }
+    try {
+	archive.process();
+	if (params.test) {
+	    SevenZTester tester;
+	    tester.setThreads(params.threads > 0 ? params.threads : std::thread::hardware_concurrency());
+	    tester.setStopOnError(params.failFast);
+	    size_t failed;
+	    {
+		SevenZPhaseTimer timer(archive.phaseClock(), TestPhase);
+		failed = tester.test(archive);
+	    }
+	    tester.print(std::cout);
+	    archive.close();
+	    return failed > 0 ? 1 : 0;
+	}
+	if (params.hash && !archive.hasEncryptedData())
+	    std::cerr << "WARNING: " << path << ": no encrypted data" << std::endl;
+	archive.finish();
+    } catch (const SevenZError& e) {
+	std::cerr << e.what() << std::endl;
+	return e.code;
+    }
+    return 0;
+}
+
+int AnalyseOne(const std::string& path, Parameters& params) {
+
     SevenZFormat archive;
+    archive.setIO(params.io);
+    archive.setHashOutput(params.hash, params.truncate);
+    archive.setVerifyCrc(params.verifyCrc);
+    archive.setStats(params.stats);
+    archive.setPerf(params.perf);
+    // the test prints only its results, not the parsing messages
+    std::ostream discard(NULL);
+    if (params.test)
+	archive.setOutput(discard);
+    archive.setThreads(std::thread::hardware_concurrency());
 
-    if (CheckParameters(argc, argv, archive.getStream()) > 0){
+    int status;
+    {
+	SevenZTraceSpan span("archive", path.c_str());
+	status = AnalyseArchive(archive, path, params);
+    }
+    archive.close();
+    SevenZStats stats = archive.getStats();
+    stats.failed = status != 0 ? 1 : 0;
+    if (params.perf) {
+	SevenZStats::printPerfHeader(std::cerr);
+	stats.printPerf(std::cerr, status != 0 ? "failed" : stats.kind);
+    }
+    if (params.stats) {
+	// same layout as the batch report
+	std::ostream &json = *params.statsOut;
+	json << "{\"archives\": [\n  {\"path\": ";
+	sevenZJsonString(json, path);
+	json << ", \"stats\": ";
+	stats.printJson(json);
+	json << "}\n],\n\"total\": ";
+	stats.printJson(json);
+	json << ",\n\"wall_ns\": " << stats.totalNs << ", \"threads\": 1}" << std::endl;
+    }
+    return status;
+}
+
+static SevenZCracker *interrupted = NULL;
+
+/**
+ * First SIGINT or SIGTERM lets the workers finish their batches and save
+ * the checkpoint, the second one kills
+ */
+static void StopCracker(int sig) {
+    signal(sig, SIG_DFL);
+    if (interrupted != NULL)
+	interrupted->stop();
+}
+
+int AnalyseBatch(Parameters& params) {
+
+    std::ios::sync_with_stdio(false);
+
+    SevenZBatch batch;
+    batch.setIO(params.io);
+    batch.setHashOutput(params.hash, params.truncate);
+    batch.setVerifyCrc(params.verifyCrc);
+    batch.setTest(params.test, params.failFast);
+    batch.setStats(params.stats);
+    batch.setPerf(params.perf);
+    SevenZCracker cracker;
+    SevenZKeyCache cache;
+    std::unique_ptr<SevenZMask> mask;
+    bool attack = !params.wordlist.empty() || !params.mask.empty();
+    if (!params.wordlist.empty() && !params.mask.empty()) {
+	std::cerr << "ERROR: Use either --wordlist or --mask" << std::endl;
 	return 1;
     }
+    if (!params.mask.empty()) {
+	try {
+	    mask.reset(new SevenZMask(params.mask, params.charsets));
+	} catch (const SevenZError& e) {
+	    std::cerr << "ERROR: " << e.what() << std::endl;
+	    return 1;
+	}
+    }
+    if (attack) {
+	if (!params.wordlist.empty() && access(params.wordlist.c_str(), R_OK) != 0) {
+	    std::cerr << "ERROR: Couldn't open the wordlist " << params.wordlist << std::endl;
+	    return 1;
+	}
+	// without a store the cache would only grow, the groups already
+	// derive every candidate once per run
+	if (!params.keyStore.empty()) {
+	    if (cache.open(params.keyStore.c_str()))
+		cracker.setKeyCache(&cache);
+	    else
+		std::cerr << "WARNING: Couldn't use the key store " << params.keyStore
+		    << ", keys are not cached" << std::endl;
+	}
+	cracker.setShard(params.shard, params.shards);
+	cracker.setCheckpoint(params.checkpoint);
+	batch.setCracker(&cracker);
+    }
+    for (size_t i = 0; i < params.paths.size(); i++)
+	batch.addPath(params.paths[i]);
+    if (params.fromStdin)
+	batch.readList(std::cin, params.delim);
 
-    archive.process();
-    archive.finish();
+    unsigned threads = params.threads;
+    if (threads == 0)
+	threads = std::thread::hardware_concurrency();
 
-    return 0;
+    size_t failed = batch.run(threads, std::cout);
+    std::cerr << "Analysed " << batch.size() << " archives, " << failed << " failed." << std::endl;
+    if (params.perf)
+	batch.printPerf(std::cerr);
+    if (params.stats)
+	batch.printStats(*params.statsOut);
+    if (attack) {
+	interrupted = &cracker;
+	signal(SIGINT, StopCracker);
+	signal(SIGTERM, StopCracker);
+	long found;
+	try {
+	    if (mask)
+		found = cracker.run(*mask, threads, std::cout);
+	    else
+		found = cracker.run(params.wordlist.c_str(), threads, std::cout);
+	} catch (const SevenZError& e) {
+	    std::cerr << "ERROR: " << e.what() << std::endl;
+	    return e.code;
+	}
+	if (found < 0) {
+	    std::cerr << "ERROR: Couldn't read the wordlist " << params.wordlist << std::endl;
+	    return 1;
+	}
+	cracker.getStats().print(std::cerr);
+	if (cracker.stopped())
+	    std::cerr << (params.checkpoint.empty() ? "Stopped." :
+		"Stopped, the search continues from the checkpoint.") << std::endl;
+	std::cerr << "Found " << found << " of " << cracker.size() << " passwords, "
+	    << cracker.numGroups() << " key derivation groups." << std::endl;
+	return static_cast<size_t>(found) < cracker.size() ? 1 : 0;
+    }
+    return failed > 0 ? 1 : 0;
+}
+
+int main (int argc, char *argv[]) {
+
+    Parameters params;
+
+    if (CheckParameters(argc, argv, params) > 0){
+	return 1;
+    }
+
+    if (params.kdfBench >= 0) {
+	sevenZKdfBenchmark(std::cout, params.kdfBench);
+	return 0;
+    }
+    if (params.crcBench) {
+	sevenZCrcBenchmark(std::cout);
+	return 0;
+    }
+    if (params.bench > 0) {
+	if (params.paths.empty()) {
+	    std::cerr << "ERROR: --bench needs an archive" << std::endl;
+	    return 1;
+	}
+	unsigned threads = params.threads > 0 ? params.threads : std::thread::hardware_concurrency();
+	for (size_t i = 0; i < params.paths.size(); i++) {
+	    try {
+		if (!sevenZArchiveBenchmark(std::cout, params.paths[i], params.bench, threads)) {
+		    std::cerr << "ERROR: Couldn't open the archive " << params.paths[i] << std::endl;
+		    return 1;
+		}
+	    } catch (const SevenZError& e) {
+		std::cerr << e.what() << std::endl;
+		return e.code;
+	    }
+	    if (i + 1 < params.paths.size())
+		std::cout << std::endl;
+	}
+	return 0;
+    }
+    if (params.perf) {
+	// workers open their own counters, they fail in the same way
+	SevenZPerfCounters probe;
+	if (!probe.open())
+	    std::cerr << "WARNING: Hardware counters are not available (" << probe.error()
+		<< "), only time is measured" << std::endl;
+	else if (!probe.error().empty())
+	    std::cerr << "WARNING: Some counters are not available (" << probe.error() << ")" << std::endl;
+    }
+    // the report goes to its own file, where nothing else is mixed into it
+    std::ofstream statsFile;
+    if (!params.statsPath.empty()) {
+	statsFile.open(params.statsPath.c_str());
+	if (!statsFile) {
+	    std::cerr << "ERROR: Couldn't write the stats " << params.statsPath << std::endl;
+	    return 1;
+	}
+	params.statsOut = &statsFile;
+    }
+    if (!params.trace.empty())
+	sevenZTraceStart();
+    int status = params.batch ? AnalyseBatch(params) : AnalyseOne(params.paths[0], params);
+    if (!params.trace.empty() && !sevenZTraceWrite(params.trace)) {
+	std::cerr << "ERROR: Couldn't write the trace " << params.trace << std::endl;
+	return status != 0 ? status : 1;
+    }
+    if (!params.statsPath.empty()) {
+	statsFile.close();
+	if (statsFile.fail()) {
+	    std::cerr << "ERROR: Couldn't write the stats " << params.statsPath << std::endl;
+	    return status != 0 ? status : 1;
+	}
+    }
+    return status;
 
 }
@@ -0,0 +1,1083 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cctype>
+#include <sstream>
+#include <new>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <map>
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "SevenZBatch.h"
+#include "SevenZCheckpoint.h"
+#include "SevenZCracker.h"
+#include "SevenZCrc.h"
+#include "SevenZDecoder.h"
+#include "SevenZError.h"
+#include "SevenZFormat.h"
+#include "SevenZKdf.h"
+#include "SevenZKeyCache.h"
+#include "SevenZLzmaEnc.h"
+#include "SevenZMask.h"
+#include "SevenZStats.h"
+#include "SevenZTester.h"
+#include "SevenZTrace.h"
+#include "SevenZVerifier.h"
+#include "SevenZWriter.h"
+
+/**
+ * Tests of the parser, the decoders, the tester, the cracker and the batch
+ * reports on archives written by SevenZWriter into a temporary directory.
+ * Every test prints a line, the exit code is the number of failed tests.
+ */
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static std::string directory;	// of the archives, removed at the end
+static unsigned failedChecks = 0;
+
+static bool check(bool ok, const char *what, int line){
+    if (!ok){
+	std::cout << "  line " << line << ": " << what << std::endl;
+	failedChecks++;
+    }
+    return ok;
+}
+
+/**
+ * Data which are the same for the same seed, text when text is set
+ * @param seed, size, text, out
+ */
+static void makeData(uint64_t seed, size_t size, bool text, std::vector<uint8_t> &out){
+    out.resize(size);
+    for (size_t i = 0; i < size; i++){
+	seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+	out[i] = text ? "archive header folder stream\n"[(seed >> 33) % 29] : static_cast<uint8_t>(seed >> 56);
+    }
+}
+
+static std::string archivePath(const char *name){
+    return directory + "/" + name + ".7z";
+}
+
+/**
+ * Flips a byte of the file
+ * @param path, pos
+ */
+static bool corrupt(const std::string &path, long pos){
+    FILE *f = fopen(path.c_str(), "r+b");
+    if (f == NULL)
+	return false;
+    int c = fseek(f, pos, SEEK_SET) == 0 ? fgetc(f) : EOF;
+    bool ok = c != EOF && fseek(f, pos, SEEK_SET) == 0 && fputc(c ^ 0xFF, f) != EOF;
+    return fclose(f) == 0 && ok;
+}
+
+/**
+ * Parses the archive and tests all of its folders
+ * @param path, threads, results, error (gets the message instead of the output)
+ * @return false when the archive can't be parsed
+ */
+static bool testArchive(const std::string &path, unsigned threads, std::vector<SevenZFolderResult> &results,
+	std::string *error = NULL){
+    SevenZFormat archive;
+    std::ostringstream info;
+    archive.setOutput(info);
+    archive.setThreads(threads);
+    archive.setVerifyCrc(true);
+    if (!archive.open(path.c_str()))
+	return false;
+    try {
+	archive.process();
+	SevenZTester tester;
+	tester.setThreads(threads);
+	tester.test(archive);
+	results = tester.getResults();
+    } catch (const SevenZError &e){
+	if (error != NULL)
+	    *error = e.what();
+	else
+	    std::cout << "  " << path << ": " << e.what() << std::endl;
+	archive.close();
+	return false;
+    }
+    archive.close();
+    return true;
+}
+
+static bool allOk(const std::vector<SevenZFolderResult> &results){
+    for (size_t i = 0; i < results.size(); i++)
+	if (results[i].status != SevenZFolderResult::Ok)
+	    return false;
+    return true;
+}
+
+/**
+ * Folder CRCs in UnpackInfo without SubStreamsInfo, as older writers do;
+ * the tester has to check them when the folder has no substreams
+ */
+static void testFolderCrcs(){
+    std::string path = archivePath("folder_crcs");
+    std::vector<uint8_t> data;
+    SevenZWriter writer;
+    CHECK(writer.open(path));
+    writer.setFolderCrcs(true);
+    writer.beginFolder(SevenZWriter::CopyMethod);
+    writer.addFile("copy.bin");
+    makeData(1, 3000, false, data);
+    writer.append(data.data(), data.size());
+    writer.beginFolder(SevenZWriter::LzmaMethod);
+    writer.addFile("one.txt");
+    makeData(2, 5000, true, data);
+    writer.append(data.data(), data.size());
+    writer.close();
+
+    std::vector<SevenZFolderResult> results;
+    CHECK(testArchive(path, 1, results) && results.size() == 2 && allOk(results));
+    // the first byte of the Copy folder
+    CHECK(corrupt(path, 32));
+    CHECK(testArchive(path, 1, results) && results.size() == 2);
+    CHECK(results.size() == 2 && results[0].status == SevenZFolderResult::Failed &&
+	    results[1].status == SevenZFolderResult::Ok);
+
+    // a folder with more files still needs SubStreamsInfo
+    writer.open(path);
+    writer.setFolderCrcs(true);
+    writer.beginFolder(SevenZWriter::LzmaMethod);
+    for (unsigned i = 0; i < 3; i++){
+	writer.addFile("solid" + std::to_string(i) + ".txt");
+	makeData(3 + i, 1000 + i, true, data);
+	writer.append(data.data(), data.size());
+    }
+    writer.beginFolder(SevenZWriter::CopyMethod);
+    writer.addFile("alone.bin");
+    makeData(6, 100, false, data);
+    writer.append(data.data(), data.size());
+    writer.close();
+    CHECK(testArchive(path, 1, results) && results.size() == 2 && allOk(results));
+    CHECK(results.size() == 2 && results[0].streams == 3 && results[1].streams == 1);
+}
+
+/**
+ * Files packed by SevenZLzmaEncoder come back with the CRCs they were
+ * written with, through the raw and the LZMA-compressed header
+ */
+static void testLzmaRoundTrip(){
+    std::string path = archivePath("lzma_round_trip");
+    SevenZWriter::HeaderType types[] = {SevenZWriter::RawHeaderType, SevenZWriter::LzmaHeaderType};
+    for (SevenZWriter::HeaderType type : types){
+	std::vector<uint32_t> crcs;
+	std::vector<uint8_t> data;
+	uint64_t bytes = 0;
+	SevenZWriter writer;
+	CHECK(writer.open(path));
+	writer.setHeader(type);
+	for (unsigned f = 0; f < 3; f++){
+	    writer.beginFolder(SevenZWriter::LzmaMethod);
+	    for (unsigned i = 0; i < 4; i++){
+		// text, noise, one repeated byte and files without data
+		writer.addFile("dir" + std::to_string(f) + "/file" + std::to_string(i));
+		if (i == 3)
+		    continue;
+		if (i == 2)
+		    data.assign(70000 + f, 'x');
+		else
+		    makeData(10 * f + i, 1 + 20000 * i + f, i == 0, data);
+		writer.append(data.data(), data.size());
+		crcs.push_back(sevenZCrc(data.data(), data.size()));
+		bytes += data.size();
+	    }
+	}
+	writer.close();
+
+	SevenZFormat archive;
+	std::ostringstream info;
+	archive.setOutput(info);
+	CHECK(archive.open(path.c_str()));
+	archive.process();
+	const SevenZInitData &init = archive.getData();
+	CHECK(init.numFolders == 3 && init.numSubStreams == crcs.size());
+	for (uint64_t k = 0; k < init.numSubStreams && k < crcs.size(); k++)
+	    CHECK(init.streamCRC.has(k) && init.streamCRC.values[k] == crcs[k]);
+	archive.close();
+
+	std::vector<SevenZFolderResult> results;
+	CHECK(testArchive(path, 2, results) && results.size() == 3 && allOk(results));
+	for (size_t i = 0; i < results.size(); i++)
+	    bytes -= results[i].size;
+	CHECK(bytes == 0);
+    }
+}
+
+/**
+ * LZMA2 header of independent runs, parsed by the one-threaded decoder and
+ * by the runs decoded on more threads
+ */
+static void testLzma2Header(){
+    std::string path = archivePath("lzma2_header");
+    std::vector<uint8_t> data;
+    std::vector<uint32_t> crcs;
+    long packed = 0;	// bytes of the folder before the header
+    SevenZWriter writer;
+    CHECK(writer.open(path));
+    writer.setHeader(SevenZWriter::Lzma2HeaderType);
+    writer.beginFolder(SevenZWriter::CopyMethod);
+    // the names make the header span more chunks
+    for (unsigned i = 0; i < 4000; i++){
+	writer.addFile("lzma2/directory/file" + std::to_string(i) + ".txt");
+	if (i % 100 != 0)
+	    continue;
+	makeData(i, 100 + i, true, data);
+	writer.append(data.data(), data.size());
+	crcs.push_back(sevenZCrc(data.data(), data.size()));
+	packed += data.size();
+    }
+    writer.close();
+
+    for (unsigned threads = 1; threads <= 3; threads += 2){
+	SevenZFormat archive;
+	std::ostringstream info;
+	archive.setOutput(info);
+	archive.setThreads(threads);
+	archive.setVerifyCrc(true);
+	CHECK(archive.open(path.c_str()));
+	archive.process();
+	const SevenZInitData &init = archive.getData();
+	CHECK(init.hdrFolder != NULL);
+	if (threads == 1 && init.hdrFolder != NULL){
+	    SevenZLzma2Decoder lzma2(archive.readPacked(init.hdrPackPos, init.hdrPackSize), 16);
+	    CHECK(lzma2.runs() > 2);
+	}
+	CHECK(init.files != NULL && init.files->numFiles == 4000);
+	CHECK(init.numSubStreams == crcs.size());
+	for (uint64_t k = 0; k < init.numSubStreams && k < crcs.size(); k++)
+	    CHECK(init.streamCRC.has(k) && init.streamCRC.values[k] == crcs[k]);
+	archive.close();
+    }
+
+    // a damaged header does not match its CRC on either path
+    CHECK(corrupt(path, 32 + packed + 5000));
+    std::vector<SevenZFolderResult> results;
+    std::string error;
+    CHECK(!testArchive(path, 1, results, &error) && error.find("CRC") != std::string::npos);
+    error.clear();
+    CHECK(!testArchive(path, 3, results, &error) && error.find("CRC") != std::string::npos);
+}
+
+/**
+ * SevenZLzma2Source gives the whole stream also when its runs do not fit
+ * into one window
+ */
+static void testLzma2Window(){
+    std::vector<uint8_t> data, packed, decoded;
+    makeData(7, 300000, false, data);
+    for (int resets = 0; resets < 2; resets++){
+	packed.clear();
+	sevenZLzma2Stored(data.data(), data.size(), packed, resets == 1);
+	SevenZSpan span = { packed.data(), packed.size() };
+	SevenZLzma2Decoder lzma2(span, 16);
+	CHECK(lzma2.runs() == (resets == 1 ? 5u : 1u) && lzma2.size() == data.size());
+	SevenZLzma2Source source(lzma2, 2, 100000);
+	decoded.clear();
+	for (SevenZSpan view = source.view(7000); view.size > 0; view = source.view(7000))
+	    decoded.insert(decoded.end(), view.data, view.data + view.size);
+	CHECK(decoded == data);
+    }
+}
+
+/**
+ * Processes storing keys into one store at once, the table grows under
+ * them; afterwards every key must be there
+ */
+static void testKeyStoreProcesses(){
+    std::string path = archivePath("key_store_processes");
+    const unsigned processes = 4, perProcess = 6000;	// the table grows twice
+    SevenZAesProps props;
+    props.numCyclesPower = 19;
+    std::vector<pid_t> children;
+    for (unsigned p = 0; p < processes; p++){
+	pid_t pid = fork();
+	if (pid == 0){
+	    SevenZKeyCache cache;
+	    if (!cache.open(path.c_str()))
+		_exit(1);
+	    // small batches, so the processes take turns
+	    for (unsigned i = 0; i < perProcess; i += 100){
+		std::string passwords[100];
+		SevenZSpan spans[100];
+		uint8_t keys[100 * AES_KEY_SIZE];
+		for (unsigned j = 0; j < 100; j++){
+		    passwords[j] = std::to_string(p) + "-" + std::to_string(i + j);
+		    spans[j].data = reinterpret_cast<const uint8_t*>(passwords[j].data());
+		    spans[j].size = passwords[j].size();
+		    memset(keys + j * AES_KEY_SIZE, static_cast<int>(p * 100 + j), AES_KEY_SIZE);
+		}
+		cache.store(props, spans, 100, keys, NULL);
+	    }
+	    _exit(0);
+	}
+	CHECK(pid > 0);
+	if (pid > 0)
+	    children.push_back(pid);
+    }
+    for (size_t c = 0; c < children.size(); c++){
+	int status;
+	CHECK(waitpid(children[c], &status, 0) == children[c] && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    SevenZKeyCache cache;
+    CHECK(cache.open(path.c_str()));
+    CHECK(cache.size() == processes * perProcess);
+    unsigned missing = 0, wrong = 0;
+    for (unsigned p = 0; p < processes; p++)
+	for (unsigned i = 0; i < perProcess; i++){
+	    std::string password = std::to_string(p) + "-" + std::to_string(i);
+	    SevenZSpan span = { reinterpret_cast<const uint8_t*>(password.data()), password.size() };
+	    uint8_t key[AES_KEY_SIZE], found;
+	    cache.lookup(props, &span, 1, key, &found);
+	    missing += !found;
+	    wrong += found && key[0] != static_cast<uint8_t>(p * 100 + i % 100);
+	}
+    CHECK(missing == 0 && wrong == 0);
+}
+
+/**
+ * Every worker of the cracker checks keys by its own copy of the verifier,
+ * the copy accepts the password of the header and nothing else
+ */
+static void testVerifierCopy(){
+    std::string path = archivePath("verifier_copy");
+    std::vector<uint8_t> data;
+    SevenZWriter writer;
+    CHECK(writer.open(path));
+    writer.setHeader(SevenZWriter::AesHeaderType, "secret", 6);
+    writer.beginFolder(SevenZWriter::LzmaMethod);
+    writer.addFile("plain.txt");
+    makeData(8, 4000, true, data);
+    writer.append(data.data(), data.size());
+    writer.close();
+
+    SevenZFormat archive;
+    std::ostringstream info;
+    archive.setOutput(info);
+    archive.setCrackData(true);
+    CHECK(archive.open(path.c_str()));
+    archive.process();
+    SevenZHeaderVerifier orig(archive.getData());
+    archive.close();
+
+    std::string passwords[] = {"secret", "secreT"};
+    SevenZSpan spans[2];
+    for (unsigned i = 0; i < 2; i++){
+	spans[i].data = reinterpret_cast<const uint8_t*>(passwords[i].data());
+	spans[i].size = passwords[i].size();
+    }
+    uint8_t keys[2 * AES_KEY_SIZE];
+    SevenZKdf kdf(orig.getProps());
+    kdf.derive(spans, 2, keys);
+
+    // the copy is made over dirty memory, members it leaves out are not zero
+    alignas(SevenZHeaderVerifier) uint8_t memory[sizeof(SevenZHeaderVerifier)];
+    memset(memory, 0xA5, sizeof(memory));
+    SevenZHeaderVerifier *copy = new (memory) SevenZHeaderVerifier(orig);
+    uint8_t passed[2];
+    CHECK(copy->check(keys, 2, passed) >= 1 && passed[0]);
+    CHECK(copy->confirm(keys));
+    CHECK(!copy->confirm(keys + AES_KEY_SIZE));
+    CHECK(orig.confirm(keys));
+    copy->~SevenZHeaderVerifier();
+}
+
+/**
+ * Only files without data and a directory, so the decoded header has no
+ * MainStreamsInfo and the streams of the encoded header must not be taken
+ * for its own; the empty files are not directories
+ */
+static void testEmptyFiles(){
+    std::string path = archivePath("empty_files");
+    SevenZWriter::HeaderType types[] = {SevenZWriter::RawHeaderType, SevenZWriter::LzmaHeaderType,
+	SevenZWriter::Lzma2HeaderType};
+    for (SevenZWriter::HeaderType type : types){
+	SevenZWriter writer;
+	CHECK(writer.open(path));
+	writer.setHeader(type);
+	for (unsigned i = 0; i < 5; i++)
+	    writer.addFile("empty" + std::to_string(i) + ".txt");
+	writer.addFile("directory", 0, 0x10);
+	writer.close();
+
+	SevenZFormat archive;
+	std::ostringstream info;
+	archive.setOutput(info);
+	CHECK(archive.open(path.c_str()));
+	archive.process();
+	const SevenZInitData &init = archive.getData();
+	CHECK(init.numFolders == 0 && init.numSubStreams == 0);
+	CHECK(init.files != NULL && init.files->numFiles == 6 && init.files->numEmptyStreams == 6);
+	for (uint64_t i = 0; init.files != NULL && i < init.files->numFiles; i++)
+	    CHECK(init.files->isDir(i) == (i == 5));
+	archive.close();
+
+	std::vector<SevenZFolderResult> results;
+	CHECK(testArchive(path, 1, results) && results.empty());
+    }
+}
+
+/**
+ * $7z$ line of an encrypted header, fields in the order of 7z2john: the
+ * size of the AES output before the data, the unpacked size after them
+ */
+static void testHashLine(){
+    std::string path = archivePath("hash_line");
+    SevenZWriter writer;
+    CHECK(writer.open(path));
+    writer.setHeader(SevenZWriter::AesHeaderType, "secret", 6);
+    writer.beginFolder(SevenZWriter::CopyMethod);
+    writer.addFile("a.txt");
+    writer.append(reinterpret_cast<const uint8_t*>("hash"), 4);
+    writer.close();
+
+    const char *expected[] = {
+	"$7z$1$6$0$$16$04000000000000000000000000000000$1610162134$64$58$"
+	"4a5ed88d8b2edd33c4602cd4f9718d92df548f6438faa20bf5eaefed53469e27"
+	"899b50ef2976e3a02083b733bef2443e0a2a1d79255cd6b242af8a960c6519eb$66$5d00000001",
+	// 16 bytes of the data, the method is left out
+	"$7z$128$6$0$$16$04000000000000000000000000000000$1610162134$64$58$4a5ed88d8b2edd33c4602cd4f9718d92"
+    };
+    for (unsigned truncate = 0; truncate <= 16; truncate += 16){
+	SevenZFormat archive;
+	std::ostringstream info;
+	archive.setOutput(info);
+	archive.setHashOutput(true, truncate);
+	CHECK(archive.open(path.c_str()));
+	archive.process();
+	archive.finish();
+	CHECK(info.str() == path + ":" + expected[truncate / 16] + "\n");
+    }
+}
+
+/**
+ * Adds the archive with an encrypted header to the cracker
+ * @param cracker, path
+ */
+static bool addEncrypted(SevenZCracker &cracker, const std::string &path){
+    SevenZFormat archive;
+    std::ostringstream info;
+    archive.setOutput(info);
+    archive.setCrackData(true);
+    if (!archive.open(path.c_str()))
+	return false;
+    archive.process();
+    cracker.addArchive(path, archive.getData());
+    archive.close();
+    return true;
+}
+
+/**
+ * Shards take every other chunk of the candidates, and a run resumed from
+ * its checkpoint tries exactly the candidates the saved state has left
+ */
+static void testCheckpoint(){
+    std::string path = archivePath("checkpoint");
+    std::string state = directory + "/checkpoint.state";
+    SevenZWriter writer;
+    CHECK(writer.open(path));
+    writer.setHeader(SevenZWriter::AesHeaderType, "secret", 6);
+    writer.addFile("empty.txt");
+    writer.close();
+    // two chunks, none of the candidates is the password
+    SevenZMask mask("?d?d?d?d?d");
+    const uint64_t total = 100000;
+    CHECK(mask.size() == total && total > CRACK_MASK_CHUNK && total < 2 * CRACK_MASK_CHUNK);
+    std::ostringstream out;
+
+    for (unsigned shard = 0; shard < 2; shard++){
+	SevenZCracker cracker;
+	CHECK(addEncrypted(cracker, path));
+	cracker.setShard(shard, 2);
+	CHECK(cracker.run(mask, 1, out) == 0);
+	CHECK(cracker.getStats().candidates == (shard == 0 ? CRACK_MASK_CHUNK : total - CRACK_MASK_CHUNK));
+    }
+
+    // both chunks were taken, 5536 + 4464 candidates are left in them
+    SevenZCheckpoint saved;
+    saved.source = "mask " + mask.describe();
+    saved.chunkSize = CRACK_MASK_CHUNK;
+    saved.next = 2;
+    saved.pending.push_back(std::make_pair(0, 60000));
+    saved.pending.push_back(std::make_pair(1, 95536));
+    saved.open.push_back(path);
+    CHECK(saved.save(state));
+    {
+	SevenZCracker cracker;
+	CHECK(addEncrypted(cracker, path));
+	cracker.setCheckpoint(state);
+	CHECK(cracker.run(mask, 1, out) == 0 && !cracker.stopped());
+	CHECK(cracker.getStats().candidates == 10000);
+    }
+    SevenZCheckpoint finished;
+    CHECK(finished.load(state) && finished.next == 2 && finished.pending.empty());
+    CHECK(finished.hits.empty() && finished.open.size() == 1 && finished.open[0] == path);
+    CHECK(access((state + ".tmp").c_str(), F_OK) != 0);
+
+    // stopped once its first batch is saved, the next run does the rest
+    unlink(state.c_str());
+    uint64_t first;
+    {
+	SevenZCracker cracker;
+	CHECK(addEncrypted(cracker, path));
+	cracker.setCheckpoint(state);
+	std::thread stopper([&](){
+	    SevenZCheckpoint progress;
+	    for (int i = 0; i < 60000; i++){
+		if (access(state.c_str(), F_OK) == 0 && progress.load(state) && !progress.pending.empty())
+		    break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	    }
+	    cracker.stop();
+	});
+	CHECK(cracker.run(mask, 1, out) == 0);
+	stopper.join();
+	CHECK(cracker.stopped());
+	first = cracker.getStats().candidates;
+	CHECK(first > 0 && first < total);
+    }
+    {
+	SevenZCracker cracker;
+	CHECK(addEncrypted(cracker, path));
+	cracker.setCheckpoint(state);
+	CHECK(cracker.run(mask, 1, out) == 0 && !cracker.stopped());
+	CHECK(first + cracker.getStats().candidates == total);
+    }
+    CHECK(out.str().empty());
+    unlink(state.c_str());
+}
+
+/**
+ * Candidates first to first + count - 1 of the mask
+ * @param mask, first, count
+ */
+static std::vector<std::string> candidates(const SevenZMask &mask, uint64_t first, size_t count){
+    std::vector<uint8_t> out(count * mask.length());
+    mask.generate(first, count, out.data());
+    std::vector<std::string> list;
+    for (size_t i = 0; i < count; i++)
+	list.push_back(std::string(reinterpret_cast<const char*>(out.data()) + i * mask.length(), mask.length()));
+    return list;
+}
+
+/**
+ * Error code of the mask, 0 when it is valid
+ * @param mask, custom
+ */
+static int maskError(const std::string &mask, const std::vector<std::string> &custom = std::vector<std::string>()){
+    try {
+	SevenZMask m(mask, custom);
+    } catch (const SevenZError &e){
+	return e.code;
+    }
+    return 0;
+}
+
+/**
+ * Order of the candidates, carries, generation from the middle of the
+ * keyspace, custom charsets and masks with too many candidates
+ */
+static void testMask(){
+    // the last position changes fastest, literals stay
+    SevenZMask digits("a?d");
+    CHECK(digits.size() == 10 && digits.length() == 2);
+    std::vector<std::string> list = candidates(digits, 0, 10);
+    for (unsigned i = 0; i < 10; i++)
+	CHECK(list[i] == "a" + std::to_string(i));
+
+    // a carry moves over more positions at once
+    SevenZMask numbers("?d?d?d");
+    list = candidates(numbers, 98, 4);
+    CHECK(list[0] == "098" && list[1] == "099" && list[2] == "100" && list[3] == "101");
+    SevenZMask mixed("?d?l");
+    list = candidates(mixed, 24, 4);
+    CHECK(list[0] == "0y" && list[1] == "0z" && list[2] == "1a" && list[3] == "1b");
+    CHECK(candidates(mixed, mixed.size() - 1, 1)[0] == "9z");
+
+    // any slice is the same as that part of the whole keyspace
+    std::vector<std::string> custom = {"xyz", "?d"};
+    SevenZMask small("?1-?2?1", custom);
+    CHECK(small.size() == 90);
+    std::vector<std::string> all = candidates(small, 0, small.size());
+    CHECK(all.front() == "x-0x" && all.back() == "z-9z");
+    for (uint64_t first = 0; first < small.size(); first += 7){
+	size_t count = small.size() - first < 13 ? small.size() - first : 13;
+	CHECK(candidates(small, first, count) == std::vector<std::string>(all.begin() + first, all.begin() + first + count));
+    }
+
+    // custom charsets use the built-in ones, repeated bytes are dropped
+    custom = {"aab", "?d", "x?u", "?l?d"};
+    SevenZMask expanded("?1?2?3?4", custom);
+    CHECK(expanded.size() == 2u * 10 * 27 * 36);
+    CHECK(candidates(expanded, 0, 1)[0] == "a0xa");
+    CHECK(candidates(expanded, 35, 1)[0] == "a0x9");
+    CHECK(candidates(expanded, 36, 1)[0] == "a0Aa");
+    CHECK(candidates(expanded, expanded.size() - 1, 1)[0] == "b9Z9");
+    CHECK(SevenZMask("??", custom).size() == 1);
+    CHECK(maskError("?1?2?3") == 160);
+    CHECK(maskError("?1?5", custom) == 160);
+    CHECK(maskError("?d?") == 160 && maskError("") == 160);
+
+    // 2^63 candidates fit, 2^64 do not
+    std::vector<std::string> bits = {"01"};
+    std::string mask;
+    for (unsigned i = 0; i < 63; i++)
+	mask += "?1";
+    CHECK(SevenZMask(mask, bits).size() == 1ull << 63);
+    CHECK(candidates(SevenZMask(mask, bits), (1ull << 63) - 1, 1)[0] == std::string(63, '1'));
+    CHECK(maskError(mask + "?1", bits) == 160);
+    CHECK(maskError("?a?a?a?a?a?a?a?a?a") == 0 && maskError("?a?a?a?a?a?a?a?a?a?a") == 160);
+}
+
+/**
+ * Writes an archive of one LZMA folder
+ * @param path, seed, type
+ */
+static void writeSmall(const std::string &path, uint64_t seed, SevenZWriter::HeaderType type){
+    std::vector<uint8_t> data;
+    SevenZWriter writer;
+    CHECK(writer.open(path));
+    writer.setHeader(type);
+    writer.beginFolder(SevenZWriter::LzmaMethod);
+    writer.addFile("file" + std::to_string(seed) + ".txt");
+    makeData(seed, 3000, true, data);
+    writer.append(data.data(), data.size());
+    writer.close();
+}
+
+/**
+ * Number of times the text is in the output
+ */
+static size_t occurrences(const std::string &output, const std::string &text){
+    size_t n = 0;
+    for (size_t pos = output.find(text); pos != std::string::npos; pos = output.find(text, pos + 1))
+	n++;
+    return n;
+}
+
+/**
+ * Directories are searched for *.7z in any case, lists add paths, every
+ * archive is reported once by the threads and failures are counted;
+ * --fail-fast starts no archive after the first failure
+ */
+static void testBatch(){
+    std::string root = directory + "/batch", sub = root + "/sub";
+    std::string good = root + "/good.7z", upper = sub + "/upper.7Z", notes = sub + "/notes.txt";
+    std::string bad = root + "/bad.7z", missing = directory + "/missing.7z";
+    CHECK(mkdir(root.c_str(), 0755) == 0 && mkdir(sub.c_str(), 0755) == 0);
+    writeSmall(good, 1, SevenZWriter::RawHeaderType);
+    writeSmall(upper, 2, SevenZWriter::LzmaHeaderType);
+    FILE *f = fopen(notes.c_str(), "w");
+    CHECK(f != NULL && fputs("not an archive\n", f) >= 0 && fclose(f) == 0);
+    f = fopen(bad.c_str(), "w");
+    CHECK(f != NULL && fputs("7z but not really\n", f) >= 0 && fclose(f) == 0);
+
+    SevenZBatch batch;
+    batch.addPath(root);
+    CHECK(batch.size() == 3);
+    std::string names = missing;
+    names += '\0';
+    names += good;
+    names += '\0';
+    std::istringstream list(names);
+    batch.readList(list, '\0');
+    CHECK(batch.size() == 5);
+    std::ostringstream out;
+    CHECK(batch.run(3, out) == 2);
+    std::string output = out.str();
+    CHECK(occurrences(output, "Archive: " + good) == 2 && occurrences(output, "Archive: " + upper) == 1);
+    CHECK(occurrences(output, "Archive: " + bad) == 1 && occurrences(output, "Archive: " + missing) == 1);
+    CHECK(occurrences(output, "ERROR: ") == 2 && output.find("notes.txt") == std::string::npos);
+
+    // one thread takes the list in order and stops at the first failure
+    SevenZBatch fast;
+    fast.setTest(true, true);
+    fast.addPath(good);
+    fast.addPath(bad);
+    fast.addPath(upper);
+    out.str("");
+    CHECK(fast.run(1, out) == 1);
+    output = out.str();
+    CHECK(output.find(good) != std::string::npos && output.find(bad) != std::string::npos);
+    CHECK(output.find(upper) == std::string::npos);
+
+    unlink(good.c_str());
+    unlink(upper.c_str());
+    unlink(notes.c_str());
+    unlink(bad.c_str());
+    rmdir(sub.c_str());
+    rmdir(root.c_str());
+}
+
+/**
+ * Parsed JSON value, enough to check the reports
+ */
+struct Json {
+    enum Type { Null, Bool, Number, String, Array, Object } type = Null;
+    double number = 0;
+    std::string text;
+    std::vector<Json> items;
+    std::vector<std::pair<std::string, Json>> members;
+    /**
+     * Member of the object, NULL when it is missing
+     */
+    const Json* get(const std::string &key) const {
+	for (size_t i = 0; i < members.size(); i++)
+	    if (members[i].first == key)
+		return &members[i].second;
+	return NULL;
+    }
+};
+
+static void skipSpace(const char *&p, const char *end){
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+	p++;
+}
+
+static bool parseString(const char *&p, const char *end, std::string &out){
+    if (p == end || *p++ != '"')
+	return false;
+    out.clear();
+    while (p < end && *p != '"'){
+	if (static_cast<unsigned char>(*p) < 0x20)
+	    return false;
+	if (*p != '\\'){
+	    out += *p++;
+	    continue;
+	}
+	if (++p == end)
+	    return false;
+	char c = *p++;
+	const char *escapes = "\"\\/bfnrt", *plain = "\"\\/\b\f\n\r\t";
+	const char *e = strchr(escapes, c);
+	if (c != 'u' && (c == '\0' || e == NULL))
+	    return false;
+	if (c != 'u'){
+	    out += plain[e - escapes];
+	    continue;
+	}
+	unsigned code = 0;
+	for (int i = 0; i < 4; i++, p++){
+	    if (p == end || !isxdigit(static_cast<unsigned char>(*p)))
+		return false;
+	    code = code * 16 + (isdigit(static_cast<unsigned char>(*p)) ? *p - '0' : (tolower(*p) - 'a' + 10));
+	}
+	out += code < 0x80 ? static_cast<char>(code) : '?';
+    }
+    return p++ < end;
+}
+
+static bool parseJson(const char *&p, const char *end, Json &value){
+    skipSpace(p, end);
+    if (p == end)
+	return false;
+    if (*p == '{' || *p == '['){
+	bool object = *p++ == '{';
+	value.type = object ? Json::Object : Json::Array;
+	skipSpace(p, end);
+	if (p < end && *p == (object ? '}' : ']')){
+	    p++;
+	    return true;
+	}
+	while (true){
+	    Json item;
+	    std::string key;
+	    if (object){
+		skipSpace(p, end);
+		if (!parseString(p, end, key))
+		    return false;
+		skipSpace(p, end);
+		if (p == end || *p++ != ':')
+		    return false;
+	    }
+	    if (!parseJson(p, end, item))
+		return false;
+	    if (object)
+		value.members.push_back(std::make_pair(key, item));
+	    else
+		value.items.push_back(item);
+	    skipSpace(p, end);
+	    if (p == end)
+		return false;
+	    char c = *p++;
+	    if (c == (object ? '}' : ']'))
+		return true;
+	    if (c != ',')
+		return false;
+	}
+    }
+    if (*p == '"'){
+	value.type = Json::String;
+	return parseString(p, end, value.text);
+    }
+    const char *words[] = {"null", "true", "false"};
+    for (int i = 0; i < 3; i++){
+	size_t len = strlen(words[i]);
+	if (static_cast<size_t>(end - p) >= len && strncmp(p, words[i], len) == 0){
+	    value.type = i == 0 ? Json::Null : Json::Bool;
+	    value.number = i == 1;
+	    p += len;
+	    return true;
+	}
+    }
+    // -?int frac? exp?
+    const char *start = p;
+    if (p < end && *p == '-')
+	p++;
+    if (p == end || !isdigit(static_cast<unsigned char>(*p)) || (*p == '0' && p + 1 < end && isdigit(static_cast<unsigned char>(p[1]))))
+	return false;
+    while (p < end && isdigit(static_cast<unsigned char>(*p)))
+	p++;
+    if (p < end && *p == '.'){
+	if (++p == end || !isdigit(static_cast<unsigned char>(*p)))
+	    return false;
+	while (p < end && isdigit(static_cast<unsigned char>(*p)))
+	    p++;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')){
+	if (++p < end && (*p == '+' || *p == '-'))
+	    p++;
+	if (p == end || !isdigit(static_cast<unsigned char>(*p)))
+	    return false;
+	while (p < end && isdigit(static_cast<unsigned char>(*p)))
+	    p++;
+    }
+    value.type = Json::Number;
+    value.number = strtod(std::string(start, p).c_str(), NULL);
+    return true;
+}
+
+/**
+ * Parses the whole text as one JSON value
+ * @param text, value
+ * @return false when the text is not valid JSON
+ */
+static bool parseJson(const std::string &text, Json &value){
+    const char *p = text.data(), *end = text.data() + text.size();
+    if (!parseJson(p, end, value))
+	return false;
+    skipSpace(p, end);
+    return p == end;
+}
+
+/**
+ * Number member of the object, -1 when it is missing
+ */
+static double number(const Json *object, const char *key){
+    const Json *value = object != NULL ? object->get(key) : NULL;
+    return value != NULL && value->type == Json::Number ? value->number : -1;
+}
+
+/**
+ * --stats=json of a batch is valid JSON: every archive with its kind and
+ * phases, failures counted, sums in the total
+ */
+static void testStatsJson(){
+    Json probe;
+    CHECK(parseJson("{\"a\": [1, -2.5e3, \"x\\\"\\u0041\", true, null, {}]}", probe));
+    CHECK(!parseJson("{\"a\": 1,}", probe) && !parseJson("[01]", probe) && !parseJson("{} {}", probe));
+
+    std::string raw = directory + "/stats raw.7z", lzma = directory + "/stats \"quoted\" \\lzma.7z";
+    std::string bad = directory + "/stats_bad.7z";
+    writeSmall(raw, 1, SevenZWriter::RawHeaderType);
+    writeSmall(lzma, 2, SevenZWriter::LzmaHeaderType);
+    FILE *f = fopen(bad.c_str(), "w");
+    CHECK(f != NULL && fputs("7z but not really\n", f) >= 0 && fclose(f) == 0);
+
+    SevenZBatch batch;
+    batch.setStats(true);
+    batch.addPath(raw);
+    batch.addPath(lzma);
+    batch.addPath(bad);
+    std::ostringstream out, report;
+    CHECK(batch.run(2, out) == 1);
+    batch.printStats(report);
+    Json json;
+    CHECK(parseJson(report.str(), json) && json.type == Json::Object);
+    const Json *archives = json.get("archives"), *total = json.get("total");
+    CHECK(archives != NULL && archives->type == Json::Array && archives->items.size() == 3);
+    CHECK(number(total, "archives") == 3 && number(total, "failed") == 1 && number(&json, "threads") == 2);
+    CHECK(number(&json, "wall_ns") > 0);
+
+    const char *phases[] = {"open", "io", "crc", "parse", "decode", "test", "output"};
+    double phaseSums[7] = {};
+    for (size_t i = 0; archives != NULL && i < archives->items.size(); i++){
+	const Json &item = archives->items[i];
+	const Json *path = item.get("path"), *stats = item.get("stats");
+	CHECK(path != NULL && stats != NULL && (path->text == raw || path->text == lzma || path->text == bad));
+	if (path == NULL || stats == NULL)
+	    continue;
+	const Json *kind = stats->get("kind"), *phaseNs = stats->get("phases_ns");
+	CHECK(number(stats, "archives") == 1 && number(stats, "failed") == (path->text == bad ? 1 : 0));
+	CHECK(kind != NULL && kind->text == (path->text == raw ? "raw" : path->text == lzma ? "compressed" : "unknown"));
+	CHECK(phaseNs != NULL && phaseNs->members.size() == 7);
+	for (int p = 0; p < 7; p++){
+	    CHECK(number(phaseNs, phases[p]) >= 0);
+	    phaseSums[p] += number(phaseNs, phases[p]);
+	}
+	if (path->text == lzma)
+	    CHECK(number(stats, "bytes_decoded") > 0);
+    }
+    const Json *totalPhases = total != NULL ? total->get("phases_ns") : NULL;
+    for (int p = 0; p < 7; p++)
+	CHECK(number(totalPhases, phases[p]) == phaseSums[p]);
+
+    unlink(raw.c_str());
+    unlink(lzma.c_str());
+    unlink(bad.c_str());
+}
+
+/**
+ * Span of the trace in nanoseconds
+ */
+struct TraceSpan {
+    std::string name, path;
+    long long start, end;
+    bool operator<(const TraceSpan &other) const {
+	return start != other.start ? start < other.start : end > other.end;
+    }
+};
+
+/**
+ * The trace of a batch is valid JSON of complete ("X") events. The spans
+ * of a thread nest like begin and end pairs would, every archive has its
+ * span and the header is read inside it. Tracing can't be stopped, so
+ * this test runs last.
+ */
+static void testTrace(){
+    std::string first = directory + "/trace first.7z", second = directory + "/trace_second.7z";
+    std::string path = directory + "/trace.json";
+    writeSmall(first, 1, SevenZWriter::RawHeaderType);
+    writeSmall(second, 2, SevenZWriter::LzmaHeaderType);
+    sevenZTraceStart();
+    CHECK(sevenZTraceActive());
+    SevenZBatch batch;
+    batch.addPath(first);
+    batch.addPath(second);
+    std::ostringstream out;
+    CHECK(batch.run(2, out) == 0);
+    CHECK(sevenZTraceWrite(path));
+
+    std::ifstream file(path.c_str());
+    std::stringstream text;
+    text << file.rdbuf();
+    Json json;
+    CHECK(parseJson(text.str(), json) && json.type == Json::Object);
+    const Json *events = json.get("traceEvents");
+    CHECK(events != NULL && events->type == Json::Array);
+    std::map<double, std::vector<TraceSpan>> threads;
+    unsigned metadata = 0;
+    for (size_t i = 0; events != NULL && i < events->items.size(); i++){
+	const Json &e = events->items[i];
+	const Json *name = e.get("name"), *ph = e.get("ph"), *args = e.get("args");
+	CHECK(name != NULL && name->type == Json::String && ph != NULL && number(&e, "tid") >= 0);
+	if (ph == NULL || name == NULL)
+	    continue;
+	if (ph->text == "M"){
+	    metadata++;
+	    continue;
+	}
+	CHECK(ph->text == "X" && number(&e, "ts") >= 0 && number(&e, "dur") >= 0);
+	TraceSpan span;
+	span.name = name->text;
+	const Json *arg = args != NULL ? args->get("path") : NULL;
+	if (arg != NULL)
+	    span.path = arg->text;
+	span.start = llround(number(&e, "ts") * 1000);
+	span.end = span.start + llround(number(&e, "dur") * 1000);
+	threads[number(&e, "tid")].push_back(span);
+    }
+    CHECK(metadata >= 2 && !threads.empty());
+
+    unsigned archives = 0, headers = 0;
+    for (auto &thread : threads){
+	std::vector<TraceSpan> &spans = thread.second;
+	std::sort(spans.begin(), spans.end());
+	// a span ends before the next one starts or inside the one around it
+	std::vector<const TraceSpan*> open;
+	for (const TraceSpan &span : spans){
+	    while (!open.empty() && open.back()->end <= span.start)
+		open.pop_back();
+	    CHECK(open.empty() || span.end <= open.back()->end);
+	    if (span.name == "archive"){
+		archives++;
+		CHECK(open.empty() && (span.path == first || span.path == second));
+	    }
+	    if (span.name == "readHeader"){
+		headers++;
+		CHECK(!open.empty() && open.front()->name == "archive");
+	    }
+	    open.push_back(&span);
+	}
+    }
+    CHECK(archives == 2 && headers == 2);
+
+    unlink(first.c_str());
+    unlink(second.c_str());
+    unlink(path.c_str());
+}
+
+struct Test {
+    const char *name;
+    void (*run)();
+};
+
+static const Test Tests[] = {
+    {"folder_crcs", testFolderCrcs},
+    {"lzma_round_trip", testLzmaRoundTrip},
+    {"empty_files", testEmptyFiles},
+    {"lzma2_header", testLzma2Header},
+    {"lzma2_window", testLzma2Window},
+    {"key_store_processes", testKeyStoreProcesses},
+    {"verifier_copy", testVerifierCopy},
+    {"hash_line", testHashLine},
+    {"checkpoint", testCheckpoint},
+    {"mask", testMask},
+    {"batch", testBatch},
+    {"stats_json", testStatsJson},
+    {"trace", testTrace}
+};
+
+int main(int argc, char** argv){
+    char temp[] = "/tmp/7z_test.XXXXXX";
+    if (mkdtemp(temp) == NULL){
+	std::cerr << "ERROR: Can't create a temporary directory." << std::endl;
+	return 1;
+    }
+    directory = temp;
+    int failed = 0;
+    for (const Test &test : Tests){
+	if (argc > 1 && strstr(test.name, argv[1]) == NULL)
+	    continue;
+	unsigned before = failedChecks;
+	try {
+	    test.run();
+	} catch (const SevenZError &e){
+	    std::cout << "  " << e.what() << std::endl;
+	    failedChecks++;
+	}
+	bool ok = failedChecks == before;
+	std::cout << (ok ? "ok     " : "FAILED ") << test.name << std::endl;
+	failed += !ok;
+    }
+    for (const Test &test : Tests)
+	unlink(archivePath(test.name).c_str());
+    rmdir(temp);
+    return failed;
+}